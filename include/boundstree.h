@@ -0,0 +1,84 @@
+#ifndef BOUNDSTREE_H
+#define BOUNDSTREE_H
+
+#include <QRectF>
+#include <vector>
+
+// --- Bounds Tree ---
+
+// Bounding-volume hierarchy over a fixed set of items (the members of a
+// group). Built once by median splits; after that an item that moved is
+// refitted in place - its leaf and the nodes above it are regrown
+// bottom-up, stopping at the first node whose bounds did not change -
+// so the root bounds are always current without a rebuild. A query
+// skips every subtree whose bounds miss the area.
+// Items may be "void" (an empty subgroup): they are never visited and
+// take no space in the bounds.
+class BoundsTree {
+public:
+    void build(const std::vector<QRectF>& itemBounds); // Item i = itemBounds[i]
+    void clear();
+    bool refit(int item, const QRectF& bounds);        // True if the root bounds changed
+
+    int size() const { return (int)boxes.size(); }
+    bool isEmpty() const { return nodes.empty() || isVoid(nodes[0].bounds); }
+    const QRectF& getBounds() const;                   // Void if there is nothing in it
+    const QRectF& getItemBounds(int item) const { return boxes[item]; }
+
+    // Calls visit(item) for every item whose bounds touch 'area' (closed
+    // intervals, as in SpatialIndex). Stateless: safe from several threads.
+    template <typename Visitor>
+    void query(const QRectF& area, Visitor&& visit) const;
+
+    static const QRectF& voidBounds();
+    static bool isVoid(const QRectF& r) { return r.width() < 0; }
+
+private:
+    struct Node {
+        QRectF bounds;
+        int parent;
+        int first;   // Leaf: first position in 'order'; inner node: left child (right = first + 1)
+        int count;   // Items in a leaf, 0 for an inner node
+    };
+
+    static const int LEAF_SIZE = 4;
+    static const int MAX_DEPTH = 64;
+
+    static bool touches(const QRectF& a, const QRectF& b);
+    static QRectF unite(const QRectF& a, const QRectF& b);
+    void split(int node, int begin, int end);
+    QRectF leafBounds(const Node& leaf) const;
+
+    std::vector<Node> nodes;     // nodes[0] is the root
+    std::vector<int> order;      // Items grouped by leaf
+    std::vector<int> leafOf;     // Item -> its leaf
+    std::vector<QRectF> boxes;   // Item -> bounds
+};
+
+// --- Template implementation ---
+
+template <typename Visitor>
+void BoundsTree::query(const QRectF& area, Visitor&& visit) const {
+    if (isEmpty() || !touches(nodes[0].bounds, area)) return;
+
+    // Median splits keep the depth logarithmic, so a fixed stack will do
+    int stack[MAX_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node& n = nodes[stack[--top]];
+        if (n.count > 0) {
+            for (int i = n.first; i < n.first + n.count; ++i) {
+                const QRectF& b = boxes[order[i]];
+                if (!isVoid(b) && touches(b, area)) visit(order[i]);
+            }
+            continue;
+        }
+        for (int child = n.first; child <= n.first + 1; ++child) {
+            const QRectF& b = nodes[child].bounds;
+            if (!isVoid(b) && touches(b, area)) stack[top++] = child;
+        }
+    }
+}
+
+#endif // BOUNDSTREE_H
@@ -5,9 +5,24 @@
 #include <QMouseEvent>
 #include <QPainter>
 #include <QKeyEvent>
+#include <QWheelEvent>
 #include <vector>
-#include <QMap>
 #include <QTransform>
+#include <QPixmap>
+#include <QImage>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QPicture>
+#include "shape.h"
+#include "document.h"
+#include "selectionset.h"
+#include "shaperenderer.h"
+#include "densitymap.h"
+#include "renderthread.h"
+#include "geometry.h"
+#include "undostack.h"
+#include "router.h"
+#include "snapguides.h"
 
 // --- Enums ---
 
@@ -15,61 +30,56 @@
 enum class Tool {
     Select, // Select, move, resize, marquee select
     Draw,   // Draw new shapes
-    Hand    // (Future) Pan the canvas
+    Connect, // Drag from one block to another to connect them
+    Hand    // Pan the canvas (wheel zooms with any tool)
 };
 
-// Type of shape to draw
-enum class ShapeType {
-    Line,
-    Rectangle,
-    Circle
-};
-
-// All 8 sides where "drag handles" can be + none
-enum class HandlePosition {
-    None,
-    TopLeft, Top, TopRight, // Top
-    Left, Right, // Middle
-    BottomLeft, Bottom, BottomRight, // Bottom
-    Start, End // For lines
-};
-
-// --- Data Structure ---
-
-struct Shape {
-    ShapeType type;
-    QRect rect;      // For shapes (Rectangle, Circle)
-    QPoint start;    // For line
-    QPoint end;      // For line
-    bool selected = false;
-
-    // Temp copy of stats of origin shape for resize
-    QRect originalRect;
-    QPoint originalStart;
-    QPoint originalEnd;
-
-    // Function to get selection border (bounding box)
-    QRectF bounds() const {
-        if (type == ShapeType::Line) {
-            return QRectF(start, end).normalized();
-        }
-        return QRectF(rect);
-    }
+// Which shapes a marquee selects
+enum class MarqueeMode {
+    Contain,  // Shapes entirely inside the marquee
+    Intersect // Shapes the marquee touches
 };
 
 // --- Canvas Class ---
 
 class Canvas : public QWidget {
     Q_OBJECT
+    friend class CanvasBench; // bsgbench times the private hot paths directly
+
 public:
     explicit Canvas(QWidget *parent = nullptr);
 
+    int getSelectedCount() const;
+    qreal getZoom() const { return zoom; }
+    bool isHudEnabled() const { return hudEnabled; }
+
+    // --- Files ---
+    bool saveDocument(const QString& path, QString* error = nullptr) const;
+    bool loadDocument(const QString& path, QString* error = nullptr);
+    bool importSource(const QString& path, QString* error = nullptr); // Flowcharts from code
+
     // --- Public Setters (Slots) ---
 public slots:
     void setShapeType(ShapeType type);
     void setTool(Tool tool);
     void setGridEnabled(bool enabled);
     void setSnapEnabled(bool enabled);
+    void setGuidesEnabled(bool enabled); // Snap to other shapes' edges and centers
+    void setMarqueeMode(MarqueeMode mode);
+    void setShapeStyle(const ShapeStyle& style);
+    void setUndoByteLimit(size_t bytes);
+    void undo();
+    void redo();
+    void zoomToFit(); // Whole scheme in view (Ctrl+0)
+    void autoLayout(bool selectionOnly); // Layered layout of all or the selected blocks
+    void setAsyncRendering(bool enabled); // Rasterize shapes on a render thread
+    void setHudEnabled(bool enabled);     // Frame time / event rate overlay
+    void groupSelection();        // Ctrl+G: selected shapes and groups become one group
+    void ungroupSelection();      // Ctrl+Shift+G: dissolve the selected groups
+    void toggleGroupsCollapsed(); // Ctrl+E: open the selected groups, or close the ones around the selection
+
+signals:
+    void selectionChanged();
 
 protected:
     // --- Qt Event Handlers ---
@@ -78,51 +88,305 @@ protected:
     void mouseMoveEvent(QMouseEvent *event) override;
     void mouseReleaseEvent(QMouseEvent *event) override;
     void keyPressEvent(QKeyEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
 
 private:
     // --- Grid & Snap Settings ---
     int gridSize = 20;
     bool gridEnabled = true;
     bool snapEnabled = true;
+    bool guidesEnabled = true;
+
+    // --- Alignment Guides ---
+    // Built from the visible shapes (minus the dragged ones) when a drag
+    // starts and again only if the view changes during it, so every
+    // mouse move is a few binary searches
+    SnapIndex snapIndex;
+    bool snapExcludesSelection = false;
+    QPoint snapFocus;         // Where the drag started: nearest shapes are indexed
+    SnapResult guides;        // Drawn while dragging
+
+    // --- Live Marquee ---
+    // The selection follows the marquee while it is dragged. Each move
+    // re-tests only the shapes in the strips between the old and the new
+    // rect; marqueeAdded tells the shapes the marquee selected from the
+    // ones that were selected before it (Shift keeps those).
+    MarqueeMode marqueeMode = MarqueeMode::Contain;
+    SelectionSet marqueeAdded;
+
+    // --- Groups ---
+    // A unit (a collapsed group, see Document) is picked and selected as
+    // a whole and drawn from a QPicture recorded at its group revision
+    // (and zoom, for the renderer's detail limits).
+    // Dragging units moves only their offset (moveTotal): the pictures
+    // are replayed translated and the member shapes are moved once, on
+    // release. Connectors leaving a dragged unit are hidden meanwhile
+    // and previewed as elbows.
+    struct GroupPicture {
+        QPicture picture;
+        quint64 revision = 0;     // Group revision it was recorded at
+        qreal zoom = 0;
+    };
+    std::unordered_map<GroupId, GroupPicture> groupPictures;
+    std::vector<GroupId> visibleUnits;  // Scratch: units inside the paint rect
+    std::vector<GroupId> moveUnits;     // Units being dragged
+    std::vector<ShapeId> moveShapes;    // Loose shapes being dragged
+    std::vector<ShapeId> moveLinks;     // Connectors leaving the dragged units
+    SelectionSet moveHidden;            // The same, for the paint filter
+    std::vector<ShapeId> groupScratch;
+    std::vector<int> pictureSlots;      // Scratch: slots of a unit being drawn
+    std::vector<QPoint> linkPreview;    // Scratch: elbow of one of moveLinks
+
+    // --- Viewport (world -> widget) ---
+    // Shapes live in world coordinates; widget = world * zoom + panOffset.
+    // panOffset is kept in whole pixels so panning can scroll() the
+    // already painted pixels and repaint only the exposed strip.
+    qreal zoom = 1.0;
+    QPointF panOffset;
+    QTransform view;          // World -> widget
+    QTransform viewInverse;   // Widget -> world
+    bool panning = false;     // Hand tool / middle button drag
+    Qt::MouseButton panButton = Qt::NoButton;
+    QPoint panLastPos;        // Widget coordinates
+
+    // --- Grid Tile Cache ---
+    QPixmap gridTile;         // One grid cell, blitted with drawTiledPixmap
+    int gridTileSize = 0;     // gridSize the tile was built for
+    qreal gridTileZoom = 0;   // Zoom the tile was built for
+    qreal gridTileDpr = 0;    // Device pixel ratio the tile was built for
+    bool gridLinesMode = false; // Old per-line grid (for comparison)
+
+    // --- Frame Timing (BSG_FRAME_STATS=1) ---
+    bool frameStatsEnabled = false;
+    int statFrames = 0;
+    qint64 statGridNs = 0;
+    qint64 statFrameNs = 0;
+
+    // --- HUD (BSG_HUD=1) ---
+    // Counters are collected over HUD_PERIOD_MS, then turned into hudText
+    bool hudEnabled = false;
+    QTimer hudTimer;
+    QElapsedTimer hudElapsed;
+    int hudFrames = 0;
+    int hudEvents = 0;        // Mouse and wheel events
+    qint64 hudFrameNs = 0;
+    qint64 hudFrameMaxNs = 0;
+    QString hudText;
+
+    // --- Mouse-Move Coalescing ---
+    // Moves are processed at most once per display frame with the latest
+    // position; press, release and wheel flush a pending move first
+    bool coalesceMoves = true;  // BSG_COALESCE_MOVES=0 processes every event
+    QTimer moveTimer;           // Fires when a deferred move is due
+    QElapsedTimer moveClock;    // Since the last processed move
+    bool movePending = false;
+    QPoint pendingMovePos;      // Widget coordinates
+    Qt::KeyboardModifiers pendingMoveModifiers;
+
+    // --- Hover Cache ---
+    // Cursor from the last hover hit-test. It stays valid anywhere inside
+    // 'region' (world) while the document, selection, zoom and tool are
+    // the same, so small moves skip getHandleAt/shapeAt entirely.
+    struct HoverCache {
+        bool valid = false;
+        QRect region;
+        quint64 revision = 0;
+        quint64 selection = 0;
+        qreal zoom = 0;
+        Tool tool = Tool::Select;
+        Qt::CursorShape cursor = Qt::ArrowCursor;
+    };
+    HoverCache hover;
 
     // --- Current State ---
     Tool currentTool = Tool::Select;
     ShapeType currentShape = ShapeType::Line;
+    StyleIndex currentStyle = 0; // Style for new shapes (index into 'styles')
 
     // --- Action Flags (State Machine) ---
     bool drawing = false;   // True if drawing a new shape
     bool moving = false;    // True if moving selected shape(s)
     bool resizing = false;  // True if resizing a shape
     bool selecting = false; // True if drawing marquee selection rect
+    bool connecting = false; // True if dragging a new connector
 
-    // --- Action Geometry ---
+    // --- Action Geometry (world coordinates) ---
     QPoint startPoint;      // Start point for 'drawing'
     QPoint lastMousePos;    // Last mouse pos for 'moving' delta
     QRect selectionRect;    // Geometry for 'selecting'
+    QRect previewRect;      // Last drawn 'drawing' preview bounds
+    QPoint moveTotal;       // Accumulated 'moving' delta (one undo entry per drag)
+    QPoint moveStart;       // Mouse position when 'moving' started
+    QRectF moveBounds;      // Bounds of the moved shapes when 'moving' started
+    QPoint drawEnd;         // Snapped end point of the 'drawing' preview
+    ShapeId connectFrom = NoShape; // Block a 'connecting' drag started on
+    Port connectFromPort = Port::Right;
+    std::vector<QPoint> connectPreview; // Route drawn while 'connecting'
 
     // --- Core Data ---
-    std::vector<Shape> shapes; // Array of all shapes
+    Document doc;              // All shapes, spatial index and styles
+    SelectionSet selection;    // Selected shape ids
+    bool selectionChangedPending = false; // selectionChanged() not emitted yet
+    ShapeRenderer renderer;    // Batched shape drawing
+    DensityMap densityMap;     // Shape counts for the zoomed-out overview
+    QImage densityImage;       // Scratch: one pixel per density cell
+    UndoStack undoStack;       // Edit history (compact commands)
+
+    // --- Async Rendering (BSG_ASYNC_RENDER=1) ---
+    // Shapes and selection are drawn by a render thread from snapshots;
+    // paintEvent blits its latest frame and draws the drag preview and
+    // marquee on top. A new snapshot is sent only when the key changes.
+    struct FrameKey {
+        quint64 revision;         // Document revision
+        quint64 selection;        // Selection version
+        QTransform view;
+        QSize size;
+        qreal dpr;
+        bool unitDrag;            // Dragged units are left out of the frame
+        bool operator==(const FrameKey& o) const {
+            return revision == o.revision && selection == o.selection && view == o.view &&
+                   size == o.size && dpr == o.dpr && unitDrag == o.unitDrag;
+        }
+    };
+    RenderThread* renderThread = nullptr; // Null = synchronous painting
+    FrameSnapshot frameSnapshot;  // Reused snapshot buffers
+    FrameKey lastFrame{};
+    bool frameRequested = false;
+
+    // --- Connector Routing ---
+    // When blocks move, their connectors (and connectors whose routes
+    // pass next to them) follow right away with a stretched route, and
+    // the router thread replaces it with an obstacle-avoiding one. Every
+    // job carries a serial; only the newest job's route is applied.
+    ConnectorRouter* router = nullptr;      // Started by the first job
+    quint64 routeSerial = 0;
+    std::unordered_map<ShapeId, quint64> pendingRoutes; // Connector -> serial of its newest job
+    std::vector<ShapeId> staleConnectors;   // Collected by markStale
+    std::vector<RouteJob> routeJobs;        // Scratch
+    std::vector<RouteResult> routeResults;  // Scratch
+
+    // --- Cached Pens & Brushes (built once, so painting doesn't allocate) ---
+    QPen selectionPen;        // Dashed frame of selected shapes and the marquee
+    QPen previewPen;          // Dashed drawing preview
+    QPen guidePen;            // Alignment guides
+    QBrush handleBrush;
+    QBrush marqueeBrush;
+
+    // --- Paint Scratch Buffers (reused between frames) ---
+    std::vector<int> visibleShapes;      // Slots of shapes inside the paint rect
+    std::vector<QRectF> selectionFrames; // Dashed frames of selected shapes
+    std::vector<QRectF> selectionHandles;
+
+    // Resize handles of one shape in hit-test priority order. A fixed
+    // array, so paint and hover never allocate for it.
+    struct HandleSet {
+        int count = 0;
+        HandlePosition positions[8];
+        QRectF rects[8];
+    };
 
     // --- Resize Data ---
-    Shape* resizingShape = nullptr; // Main resize shape
+    // Geometry of all selected shapes when the resize started, packed for
+    // Geometry::resizeBatch; every step rescales it from scratch
+    ShapeId resizingShape = NoShape; // Main resize shape
     HandlePosition currentResizeHandle = HandlePosition::None;
-    std::vector<Shape> originalShapes; // Snapshot of all selected shapes
+    Shape resizePrimary;             // Original geometry of resizingShape
+    std::vector<ShapeId> resizeIds;  // Parallel to resizeOriginal
+    PackedGeometry resizeOriginal;
+    std::vector<QPoint> resizeP1s;   // Scratch: points of the current step
+    std::vector<QPoint> resizeP2s;
+    ResizeParams lastResize;  // Last applied resize step (for the undo entry)
+    bool resizeApplied = false;
+
+    // --- Private Helpers: Mouse Moves ---
+    void processMove(const QPoint& widgetPos, Qt::KeyboardModifiers modifiers);
+    void flushMove();
+    int frameIntervalMs() const;
+
+    // --- Private Helpers: Snapping ---
+    void beginMove(const QPoint& pos);
+    void prepareSnap(bool excludeSelection, const QPoint& focus); // Index for the drag that starts
+    void refreshSnap();                      // Rebuild if the view moved
+    QPoint snapDrawPoint(const QPoint& pos);
+    void setGuides(const SnapResult& result);
+    void clearGuides();
 
     // --- Private Helpers: Resize & Math ---
+    void beginResize(ShapeId handleShape, HandlePosition handlePos);
     void applyResize(const QPoint& mousePos, Qt::KeyboardModifiers modifiers);
-    QPointF getAnchorPoint(const QRectF& rect, HandlePosition handle, bool fromCenter);
-    QPointF scalePoint(const QPointF& p, const QPointF& anchor, qreal sx, qreal sy);
     QRect calculateRect(const QPoint& p1, const QPoint& p2) const;
 
+    // --- Private Helpers: Connectors ---
+    void markStale(ShapeId shape); // Connectors to reroute after 'shape' changed
+    void rerouteStale();
+    void applyRoutes();            // Routes finished by the router thread
+    ShapeId connectTarget(const QPoint& pos);
+    void updateConnectPreview(const QPoint& pos);
+
     // --- Private Helpers: Hit-testing ---
-    Shape* shapeAt(const QPoint &pos);
-    std::pair<Shape*, HandlePosition> getHandleAt(const QPoint& pos);
-    QMap<HandlePosition, QRectF> getResizeHandles(const Shape& s) const;
+    ShapeId shapeAt(const QPoint &pos);
+    std::pair<ShapeId, HandlePosition> getHandleAt(const QPoint& pos);
+    HandleSet getResizeHandles(const Shape& s) const;
+    Qt::CursorShape hoverCursor(const QPoint& pos);
+    int hoverRadius(const QPoint& pos) const;
+
+    // --- Private Helpers: Selection ---
+    bool isSelected(ShapeId id) const;
+    void setSelected(ShapeId id, bool selected);
+    void flushSelectionChanged();
+    void beginMarquee(const QPoint& pos, bool additive);
+    void updateMarquee(const QPoint& corner);
+    bool marqueeHits(ShapeId id, const QRect& rect) const;
+    bool marqueeHitsUnit(GroupId g, const QRect& rect) const;
+
+    // --- Private Helpers: Groups ---
+    void setItemSelected(ShapeId id, bool selected); // A unit's shape selects the whole unit
+    void selectUnit(GroupId g, bool selected);
+    bool isUnitSelected(GroupId g) const;
+    bool isUnitMoving(GroupId g) const;
+    void collectSelectedUnits(std::vector<GroupId>& out) const;
+    const QPicture& unitPicture(GroupId g);
+    void drawUnit(QPainter* p, GroupId g, const QRectF& worldArea, const QPoint& offset);
+    void drawMovingUnits(QPainter* p, const QRectF& worldArea);
+    bool linkPreviewRoute(ShapeId connector, const QPoint& offset);
+    void invalidateMovingUnits(const QPoint& offset);
+    void finishUnitMove();
+    void pruneGroupPictures();
+
+    // --- Private Helpers: Undo ---
+    void stepHistory(bool forward);
+    bool isBusy() const;
+
+    // --- Private Helpers: Viewport ---
+    QPoint toWorld(const QPoint& widgetPos) const;
+    qreal toWorldLength(qreal pixels) const { return pixels / zoom; }
+    void setView(const QPointF& pan, qreal newZoom);
+    void beginPan(const QMouseEvent* event);
+    void panBy(const QPoint& delta);
+
+    // --- Private Helpers: Partial repaint ---
+    QRect damageRect(const QRectF& bounds) const;
+    void invalidateShape(ShapeId id);
+    void invalidateShapes(const std::vector<ShapeId>& ids);
+    void clearSelection();
+    QRect previewBounds() const;
 
     // --- Private Helpers: UI & Grid ---
+    void paintScene(QPainter* p, const QRect& dirty);
     void updateCursorIcon(const QPoint &pos = QPoint());
-    void drawGrid(QPainter* p);
-    QPoint snapToGrid(const QPoint& pos);
+    bool isOverview() const;
+    void collectSelection(const QRectF& worldArea, bool overview);
+    void applyDetailLimits();
+    void requestFrame();
+    void drawDensity(QPainter* p, const QRectF& worldArea);
+    void drawGrid(QPainter* p, const QRect& area);
+    void rebuildGridTile(qreal dpr);
+    void drawGridLines(QPainter* p, const QRect& area);
+    void reportFrameStats(qint64 gridNs, qint64 frameNs);
+    void updateHud();
+    QRect hudRect() const;
+    void drawHud(QPainter* p);
+    QPoint snapToGrid(const QPoint& pos) const;
 };
 
 #endif // CANVAS_H
@@ -0,0 +1,82 @@
+#ifndef DENSITYMAP_H
+#define DENSITYMAP_H
+
+#include <QRect>
+#include <unordered_map>
+#include <vector>
+#include "document.h"
+
+// --- Density Map ---
+
+// Shape counts per grid cell, precomputed for drawing zoomed-out views.
+// A pyramid of sparse grids: level 0 cells are BASE_CELL document units,
+// each next level doubles the cell size. A shape is counted once, in the
+// cell holding the center of its bounds.
+// The map remembers the document revision it was built from; rebuild
+// when isBuiltFor() says it is stale. Edits that only move a few shapes
+// (drag steps) can be applied with moveShape() and markCurrent() instead.
+class DensityMap {
+public:
+    static const int BASE_CELL = 4;
+    static const int MAX_LEVELS = 16;
+
+    void build(const Document& doc);
+    void clear();
+    bool isBuiltFor(const Document& doc) const;
+
+    // Moves one shape's count from the cell of its old points to the cell
+    // of the new ones, on every level
+    void moveShape(const QPoint& oldP1, const QPoint& oldP2, const QPoint& p1, const QPoint& p2);
+    // The map was current before the edit and followed it with moveShape()
+    void markCurrent(const Document& doc);
+
+    // Finest level whose cells are at least 'cellSize' document units
+    int levelFor(qreal cellSize) const;
+    int getCellSize(int level) const { return BASE_CELL << level; }
+    int getLevelCount() const { return (int)levels.size(); }
+
+    // Cell range (inclusive) covering 'area' on 'level'
+    QRect cellRange(int level, const QRectF& area) const;
+
+    // Calls visit(cx, cy, count) for every non-empty cell of 'range'
+    template <typename Visitor>
+    void forEachCell(int level, const QRect& range, Visitor&& visit) const;
+
+private:
+    using Level = std::unordered_map<quint64, quint32>;
+
+    static quint64 cellKey(int cx, int cy);
+    static void baseCell(const QPoint& p1, const QPoint& p2, int& cx, int& cy);
+
+    std::vector<Level> levels;
+    quint64 revision = 0;
+    bool built = false;
+};
+
+// --- Template implementation ---
+
+template <typename Visitor>
+void DensityMap::forEachCell(int level, const QRect& range, Visitor&& visit) const {
+    if (level < 0 || level >= (int)levels.size()) return;
+    const Level& cells = levels[level];
+
+    // Range bigger than the number of occupied cells: walk the cells
+    qint64 rangeCells = qint64(range.width()) * range.height();
+    if (rangeCells > qint64(cells.size())) {
+        for (const auto& [key, count] : cells) {
+            int cx = int(qint32(quint32(key >> 32)));
+            int cy = int(qint32(quint32(key & 0xffffffffu)));
+            if (range.contains(cx, cy)) visit(cx, cy, count);
+        }
+        return;
+    }
+
+    for (int cy = range.top(); cy <= range.bottom(); ++cy) {
+        for (int cx = range.left(); cx <= range.right(); ++cx) {
+            auto it = cells.find(cellKey(cx, cy));
+            if (it != cells.end()) visit(cx, cy, it->second);
+        }
+    }
+}
+
+#endif // DENSITYMAP_H
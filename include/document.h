@@ -0,0 +1,274 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <QRect>
+#include <QRectF>
+#include <QPoint>
+#include <vector>
+#include <unordered_map>
+#include "boundstree.h"
+#include "shape.h"
+#include "spatialindex.h"
+#include "styletable.h"
+
+// A shape put back by Document::restoreShapes (undo of a delete)
+struct RestoredShape {
+    int slot;     // Stacking position after the restore
+    ShapeId id;   // Original id
+    Shape shape;
+    GroupId group = NoGroup; // Innermost group it belonged to (rejoined if still there)
+};
+
+// A group as passed to Document::addGroup and returned by removeGroup
+struct GroupRecord {
+    GroupId id = NoGroup;        // NoGroup = new id; a removed group's id = bring it back
+    GroupId parent = NoGroup;
+    bool collapsed = true;
+    std::vector<ShapeId> shapes; // Direct members
+    std::vector<GroupId> subgroups;
+};
+
+// --- Document Model ---
+
+// All shapes of a scheme.
+// Shapes are addressed by ShapeId, which never changes and is never
+// reused, so ids stay valid across inserts and deletes (unlike pointers
+// or vector positions). Hot per-shape data is stored as parallel arrays
+// ("structure of arrays") ordered by slot - the stacking order, bottom
+// to top - so full scans walk contiguous memory:
+//   type | p1 | p2 | style | id
+// p1/p2 are the line endpoints, or the top-left corner and top-left +
+// size of a rect/circle, so bounds are QRectF(p1, p2).normalized().
+// Connectors are the exception: p1/p2 are their port points and their
+// bounds are those of the route, kept in a side table with the links.
+// The document also owns the spatial index over those bounds and the
+// style table, and keeps both in sync on every edit.
+class Document {
+public:
+    Document();
+
+    // --- Editing ---
+    ShapeId addShape(const Shape& s); // Placed on top
+    void setShape(ShapeId id, const Shape& s);
+    void setPoints(ShapeId id, const QPoint& p1, const QPoint& p2);
+    void setPoints(const std::vector<ShapeId>& shapeIds, const std::vector<QPoint>& newP1s,
+                   const std::vector<QPoint>& newP2s); // Many shapes, one revision
+    void translateShape(ShapeId id, const QPoint& delta);
+    void translateShapes(const std::vector<ShapeId>& shapeIds, const QPoint& delta); // One revision
+    void removeShapes(const std::vector<ShapeId>& ids);
+    void restoreShapes(const std::vector<RestoredShape>& restored); // Sorted by slot
+    void clear();
+
+    // Replaces all shapes at once (file loading): the arrays are taken
+    // over as-is, in slot order, and the shapes get ids 0..n-1.
+    // Style indices refer to getStyles(), which the caller fills first.
+    void assign(std::vector<ShapeType> newTypes, std::vector<QPoint> newP1s,
+                std::vector<QPoint> newP2s, std::vector<StyleIndex> newStyles);
+
+    // --- Access by id ---
+    bool contains(ShapeId id) const;
+    int slotOf(ShapeId id) const;     // -1 if the shape doesn't exist
+    Shape getShape(ShapeId id) const;
+    ShapeType getType(ShapeId id) const { return types[slotOf(id)]; }
+    QRectF getBounds(ShapeId id) const { return boundsAt(slotOf(id)); }
+
+    // --- Access by slot (stacking order, bottom to top) ---
+    int size() const { return (int)ids.size(); }
+    ShapeId idAt(int slot) const { return ids[slot]; }
+    ShapeType typeAt(int slot) const { return types[slot]; }
+    const QPoint& p1At(int slot) const { return p1s[slot]; }
+    const QPoint& p2At(int slot) const { return p2s[slot]; }
+    StyleIndex styleAt(int slot) const { return styleIdx[slot]; }
+    QRect rectAt(int slot) const {
+        return QRect(p1s[slot], QSize(p2s[slot].x() - p1s[slot].x(), p2s[slot].y() - p1s[slot].y()));
+    }
+    QRectF boundsAt(int slot) const {
+        if (types[slot] == ShapeType::Connector) return connectorBounds(ids[slot]);
+        return QRectF(p1s[slot], p2s[slot]).normalized();
+    }
+    Shape shapeInSlot(int slot) const;
+
+    QRectF getExtent() const; // Bounds of all shapes (null if empty)
+
+    // --- Connectors ---
+    // A connector joins ports of two blocks (see ConnectorLink); p1/p2
+    // follow the port points. What is drawn is its route, an orthogonal
+    // polyline from p1 to p2: an elbow (see Geometry::elbowRoute) until
+    // a router sets a better one. Routes are derived data - not saved,
+    // not part of undo.
+    const ConnectorLink& getLink(ShapeId id) const;
+    void setLink(ShapeId id, const ConnectorLink& link); // File loading
+    const std::vector<QPoint>& getRoute(ShapeId id) const; // Empty if not a connector
+    bool setRoute(ShapeId id, std::vector<QPoint> route); // False if its ends don't match p1/p2
+    bool followPorts(ShapeId id); // Moves p1/p2 to the current ports; false if already there
+    const std::vector<ShapeId>& getConnectors(ShapeId block) const; // Attached to a block
+    int getConnectorCount() const { return (int)connectors.size(); }
+
+    // --- Labels ---
+    // Text of a shape; few shapes have one, so they live in a side table
+    const QString& getLabel(ShapeId id) const; // Empty if none
+    void setLabel(ShapeId id, const QString& text);
+    int getLabelCount() const { return (int)labels.size(); }
+
+    // --- Groups ---
+    // Nestable groups: a group lists its direct member shapes and
+    // subgroups. Each group keeps a BoundsTree over its members, refitted
+    // bottom-up on every member edit, so group bounds are always current.
+    // A collapsed group with no collapsed ancestor is a "unit": it is
+    // picked, selected, moved and drawn as one object. Its shapes leave
+    // the shape grid - the grid of units holds it instead - and queries
+    // descend into its tree only where the area touches it.
+    // Shapes keep world coordinates; only membership and the collapsed
+    // flag are stored.
+    GroupId addGroup(const GroupRecord& group); // Members must be direct children of group.parent
+    GroupRecord removeGroup(GroupId g);         // Ungroup: members go to the parent
+    // In order, with one top-slot pass for the whole batch (file loading,
+    // undo, ungrouping a selection). A record may name subgroups added
+    // earlier in the same batch by their record ids.
+    std::vector<GroupId> addGroups(const std::vector<GroupRecord>& records);
+    std::vector<GroupRecord> removeGroups(const std::vector<GroupId>& ids);
+    void setGroupCollapsed(GroupId g, bool collapsed);
+    bool containsGroup(GroupId g) const;
+    GroupId getGroup(ShapeId id) const;         // Innermost group (NoGroup if none)
+    GroupId getUnit(ShapeId id) const;          // Unit the shape is drawn with (NoGroup if loose)
+    GroupId getParentGroup(GroupId g) const;
+    bool isGroupCollapsed(GroupId g) const;
+    const std::vector<ShapeId>& getGroupShapes(GroupId g) const;
+    const std::vector<GroupId>& getSubgroups(GroupId g) const;
+    void collectGroupShapes(GroupId g, std::vector<ShapeId>& out) const; // Appends, all levels
+    ShapeId firstGroupShape(GroupId g) const;   // Any one of its shapes (NoShape if none)
+    QRectF getGroupBounds(GroupId g) const;     // Null if it has no shapes
+    int getGroupTopSlot(GroupId g) const;       // Highest slot of its shapes (-1 if none)
+    quint64 getGroupRevision(GroupId g) const;  // Changes with any of its shapes
+    int getGroupCapacity() const { return (int)groups.size(); } // Ids are below this
+    int getGroupCount() const { return groupCount; }
+
+    // --- Raw arrays (for writing whole blocks) ---
+    const std::vector<ShapeType>& getTypes() const { return types; }
+    const std::vector<QPoint>& getP1s() const { return p1s; }
+    const std::vector<QPoint>& getP2s() const { return p2s; }
+    const std::vector<StyleIndex>& getStyleIndices() const { return styleIdx; }
+
+    // --- Spatial queries ---
+    // Calls visit(id) for every shape whose bounds touch 'area'
+    template <typename Visitor>
+    void query(const QRectF& area, Visitor&& visit) const {
+        index.query(area, visit);
+        if (units.size() > 0) units.query(area, [&](int g) { queryGroup(g, area, visit); });
+    }
+
+    // Same, but units are reported whole: visitShape(id) for the loose
+    // shapes and visitUnit(g) for the units whose bounds touch 'area'
+    template <typename ShapeVisitor, typename UnitVisitor>
+    void queryItems(const QRectF& area, ShapeVisitor&& visitShape, UnitVisitor&& visitUnit) const {
+        index.query(area, visitShape);
+        if (units.size() > 0) units.query(area, visitUnit);
+    }
+
+    // Calls visit(g) for the units whose bounds touch 'area'
+    template <typename Visitor>
+    void queryUnits(const QRectF& area, Visitor&& visit) const { units.query(area, visit); }
+
+    // Off: the queries above test every shape and unit (bsgbench --baseline)
+    void setIndexEnabled(bool enabled) {
+        index.setGridEnabled(enabled);
+        units.setGridEnabled(enabled);
+    }
+
+    // Calls visit(id) for the shapes of group g (all levels) touching 'area'
+    template <typename Visitor>
+    void queryGroup(GroupId g, const QRectF& area, Visitor&& visit) const {
+        const GroupData& d = groups[g];
+        int shapeCount = (int)d.shapes.size();
+        d.tree.query(area, [&](int item) {
+            if (item < shapeCount) visit(d.shapes[item]);
+            else queryGroup(d.subgroups[item - shapeCount], area, visit);
+        });
+    }
+
+    // --- Change tracking ---
+    // Changes on every shape edit; unique across all documents, so caches
+    // built from a document (see DensityMap) can tell they are stale
+    quint64 getRevision() const { return revision; }
+
+    // --- Styles ---
+    StyleTable& getStyles() { return styles; }
+    const StyleTable& getStyles() const { return styles; }
+
+private:
+    void writeSlot(int slot, const Shape& s);
+    void touch(); // New revision
+    QRectF connectorBounds(ShapeId id) const;
+    void link(int slot, const ConnectorLink& link); // New connector entry, elbow route
+    void unlink(ShapeId id);
+    // Bounds of a shape changed. With 'deferred', the ancestors of its
+    // group are refitted later by finishReindex (batch edits)
+    void reindex(ShapeId id, int slot, std::vector<GroupId>* deferred = nullptr);
+    void finishReindex(std::vector<GroupId>& deferred);
+
+    // Groups
+    struct Membership {
+        GroupId group = NoGroup; // Innermost
+        int item = -1;           // In that group's tree
+        GroupId unit = NoGroup;
+    };
+    Membership* membership(ShapeId id);
+    const Membership* membership(ShapeId id) const;
+    void rebuildGroup(GroupId g);   // New member lists: rebuild its tree
+    void groupChanged(GroupId g);   // Its tree changed: refit the ancestors, new revisions
+    void relinkUnits(GroupId g);    // Collapsed flags changed in g's subtree
+    void assignUnit(GroupId g, GroupId unit);
+    GroupId unitAbove(GroupId g) const; // Outermost collapsed ancestor, g itself included
+    int groupDepth(GroupId g) const;
+    void rebuildGroups(std::vector<GroupId>& changed); // Deepest first; sorts 'changed'
+    GroupId insertGroup(const GroupRecord& rec);    // addGroup without the top-slot pass
+    GroupRecord eraseGroup(GroupId g);              // removeGroup without it
+    void updateTopSlots();                          // O(n): once per group edit or batch
+    void clearGroups();
+
+    // Hot geometry, indexed by slot
+    std::vector<ShapeType> types;
+    std::vector<QPoint> p1s;
+    std::vector<QPoint> p2s;
+    std::vector<StyleIndex> styleIdx;
+    std::vector<ShapeId> ids;    // slot -> id
+
+    std::vector<int> slotById;   // id -> slot (-1 = removed)
+    ShapeId nextId = 0;
+
+    quint64 revision = 0;
+
+    SpatialIndex index;          // Keyed by ShapeId
+    StyleTable styles;
+
+    // Connectors: only they have an entry here
+    struct ConnectorData {
+        ConnectorLink link;
+        std::vector<QPoint> route;
+        QRectF bounds;           // Of the route
+    };
+    std::unordered_map<ShapeId, ConnectorData> connectors;
+    std::unordered_map<ShapeId, std::vector<ShapeId>> attached; // Block -> its connectors
+
+    std::unordered_map<ShapeId, QString> labels; // Only non-empty ones
+
+    // Groups: ids are not reused (a removed group's id only comes back by undo)
+    struct GroupData {
+        bool alive = false;
+        bool collapsed = true;
+        bool unit = false;            // Collapsed, and no collapsed ancestor
+        GroupId parent = NoGroup;
+        int itemInParent = -1;        // In the parent's tree
+        std::vector<ShapeId> shapes;
+        std::vector<GroupId> subgroups;
+        BoundsTree tree;              // Items: shapes, then subgroups
+        int topSlot = -1;
+        quint64 revision = 0;
+    };
+    std::vector<GroupData> groups;    // Indexed by GroupId
+    std::vector<Membership> members;  // By ShapeId; empty while there are no groups
+    SpatialIndex units;               // Keyed by GroupId
+    int groupCount = 0;
+};
+
+#endif // DOCUMENT_H
@@ -0,0 +1,88 @@
+#ifndef DOCUMENTIO_H
+#define DOCUMENTIO_H
+
+#include <QFile>
+#include <QString>
+#include "document.h"
+
+// --- Document Files ---
+
+// Saving and loading of schemes. Two formats:
+//
+// Binary (.bsg) - versioned, little-endian, laid out as the Document
+// arrays themselves, so loading is a memory map plus block copies:
+//   header (40 bytes): "BSGD", version, header size, style count,
+//                      shape count, flags, connector count, label count,
+//                      group count, reserved
+//   styles:  styleCount x 24 bytes (stroke ARGB, fill ARGB, width as
+//            IEEE double, pen style, reserved)
+//   types:   shapeCount x quint8
+//   style:   shapeCount x quint16 (index into the style block)
+//   p1, p2:  shapeCount x 2 x qint32 each
+//   links:   connectorCount x 16 bytes (connector slot, from/to block
+//            slots or -1, from/to port, reserved) - version 2
+//   labels:  labelCount x (slot, byte length, UTF-8 text padded to 4
+//            bytes) - version 3
+//   groups:  groupCount x (flags: 1 = collapsed, shape count, subgroup
+//            count, shape slots, subgroup indices), all quint32; a group
+//            comes after its subgroups, which it names by index - version 4
+// Every block starts at an 8-byte aligned offset. Older versions still
+// load.
+//
+// JSON (.json) - human-readable, one shape per line so schemes diff
+// well. Connectors name their blocks by slot ("from", "to") and ports;
+// labels are a "label" string; "groups" lists the groups as the binary
+// block does ("collapsed", "shapes" slots, "groups" indices). Written
+// and read as a stream (no QJsonDocument), so memory stays flat however
+// big the scheme is.
+//
+// Loaders build a fresh Document; ids are renumbered 0..n-1 in slot
+// order. On error they return false and describe it in 'error'.
+namespace DocumentIO {
+
+bool saveBinary(const Document& doc, const QString& path, QString* error = nullptr);
+bool loadBinary(const QString& path, Document& doc, QString* error = nullptr);
+
+bool saveJson(const Document& doc, const QString& path, QString* error = nullptr);
+bool loadJson(const QString& path, Document& doc, QString* error = nullptr);
+
+// Pick the format by file suffix (.json, anything else is binary)
+bool save(const Document& doc, const QString& path, QString* error = nullptr);
+bool load(const QString& path, Document& doc, QString* error = nullptr);
+
+// --- Mapped Binary Scheme ---
+
+// A binary scheme read in place, for readers that must not copy a file
+// bigger than memory (PagedDocument::build). Block pointers point into
+// the memory map of the file and stay valid while it is open; only the
+// styles are decoded. Connector and label records are in slot order.
+struct BinaryScheme {
+    std::vector<ShapeStyle> styles;
+    quint32 shapeCount = 0;
+    quint32 connectorCount = 0;
+    quint32 labelCount = 0;
+    quint32 groupCount = 0;
+    const uchar* types = nullptr;      // shapeCount x quint8
+    const uchar* styleIdx = nullptr;   // shapeCount x quint16
+    const uchar* p1 = nullptr;         // shapeCount x 2 x qint32
+    const uchar* p2 = nullptr;
+    const uchar* connectors = nullptr; // connectorCount x 16 bytes
+    const uchar* labels = nullptr;     // labelCount x (slot, byte length, padded text)
+    const uchar* end = nullptr;        // End of the file
+
+    ShapeType typeAt(qint64 i) const { return ShapeType(types[i]); }
+    StyleIndex styleAt(qint64 i) const;
+    QPoint p1At(qint64 i) const;
+    QPoint p2At(qint64 i) const;
+};
+
+bool mapBinary(QFile& file, BinaryScheme& scheme, QString* error = nullptr);
+
+// Style records as stored in binary schemes and page files
+const int STYLE_RECORD_BYTES = 24;
+void writeStyleRecord(const ShapeStyle& style, uchar* rec);
+ShapeStyle readStyleRecord(const uchar* rec);
+
+}
+
+#endif // DOCUMENTIO_H
@@ -0,0 +1,194 @@
+#ifndef FLOWCHARTGEN_H
+#define FLOWCHARTGEN_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QRect>
+#include <QString>
+#include <vector>
+#include "document.h"
+#include "layout.h"
+
+// --- Source Tokenizer ---
+
+struct SourceToken {
+    enum Kind { End, Word, Number, String, Punct, Newline };
+    Kind kind = End;
+    QByteArray text;   // Cut at MAX_TOKEN_BYTES (on a UTF-8 character boundary)
+    QByteArray folded; // Line mode words: lower case (ASCII and Cyrillic), for keywords
+};
+
+// Single-pass tokenizer reading a device through one fixed buffer.
+// Skips whitespace and comments: // and /* */, in C mode preprocessor
+// lines, in line mode # comments. In line mode line ends (and ';') are
+// tokens. Over-long tokens are cut, so memory does not depend on the
+// input size.
+class SourceTokenizer {
+public:
+    static const int MAX_TOKEN_BYTES = 256;
+
+    SourceTokenizer(QIODevice& device, bool lineMode);
+
+    const SourceToken& next(); // End at the end of input or on a read error
+    const SourceToken& current() const { return token; }
+    bool is(const char* text) const; // Current token is this word or punctuator
+    bool isAtEnd() const { return token.kind == SourceToken::End; }
+
+    bool hasError() const { return failed; }
+    qint64 getBytesRead() const { return consumed + pos; }
+
+private:
+    int peekChar() {
+        if (pos >= len && !fill()) return -1;
+        return (unsigned char)buf[size_t(pos)];
+    }
+    int getChar() {
+        int c = peekChar();
+        if (c >= 0) ++pos;
+        return c;
+    }
+    bool fill();
+    void append(int c);
+    void skipLine();
+    void skipBlockComment();
+    void readWord(int c);
+    void readNumber(int c);
+    void readString(int quote);
+    void readPunct(int c);
+    void fold();
+
+    QIODevice& dev;
+    bool lineMode;
+    std::vector<char> buf;
+    qint64 len = 0;
+    qint64 pos = 0;
+    qint64 consumed = 0;
+    bool atLineStart = true;
+    bool cut = false;  // The current token hit MAX_TOKEN_BYTES
+    bool failed = false;
+    SourceToken token;
+};
+
+// --- Flowchart Generator ---
+
+enum class SourceDialect {
+    Auto,   // By file suffix: .txt, .pseudo, .alg, .kum - pseudocode, others C-like
+    CLike,  // C, C++, Java, C#, JavaScript
+    Pseudo  // Line based: if/then/else/end, while/do, for, repeat/until, function
+};
+
+struct FlowchartOptions {
+    QPoint origin;               // Top-left corner of the first chart
+    int chartGap = 120;          // Between the charts of two functions
+    int maxStatementLines = 4;   // Consecutive statements merged into one block
+    LayoutOptions layout;
+};
+
+struct FlowchartStats {
+    qint64 bytes = 0;
+    int charts = 0;      // One per function (and per run of top-level pseudocode)
+    int blocks = 0;
+    int connectors = 0;
+};
+
+// Builds flowcharts from source code, one chart per function: a start
+// and an end terminator (circles), process rectangles for statements,
+// decision diamonds for conditions, connectors labelled with branches.
+// C-like sources: if/else, while, for, do-while, switch/case (with
+// fallthrough), return, break, continue. Pseudocode: the same
+// constructs as keywords starting a line (English and Russian, KuMir
+// style included), closed by end / endif / кц / все; "if x then y" on
+// one line needs no end.
+// Blocks go into the document as the input is parsed; when a function
+// ends, its chart is laid out (Layout::layered) next to the previous one
+// and its parse state is dropped. Time is linear in the input, memory
+// is bounded by the largest function plus the output. Nesting deeper
+// than MAX_DEPTH is not recursed into: it ends up inside one block.
+class FlowchartGenerator {
+public:
+    static const int MAX_DEPTH = 128;
+
+    explicit FlowchartGenerator(Document& doc, const FlowchartOptions& options = FlowchartOptions());
+
+    // Appends the charts of 'source'. False on a read error (the charts
+    // built so far stay).
+    bool generate(QIODevice& source, SourceDialect dialect, QString* error = nullptr);
+    bool generateFile(const QString& path, SourceDialect dialect = SourceDialect::Auto,
+                      QString* error = nullptr);
+
+    const std::vector<ShapeId>& getCreated() const { return created; } // Slot order
+    const FlowchartStats& getStats() const { return stats; }
+    QRect getExtent() const { return extent; } // Of all charts, null if none
+
+    static SourceDialect dialectFor(const QString& path);
+
+private:
+    // A branch not yet joined to the next block
+    struct Exit {
+        ShapeId from;
+        QByteArray label; // Of the connector: "да", "нет", case values
+    };
+    using Exits = std::vector<Exit>;
+
+    // Enclosing loop or switch: where break and continue lead
+    struct Jumps {
+        bool loop;
+        Exits breaks;
+        Exits continues;
+    };
+
+    // C-like
+    void parseScope(SourceTokenizer& in, int depth);
+    void parseFunction(SourceTokenizer& in, const QByteArray& name);
+    void statement(SourceTokenizer& in, Exits& exits, int depth);
+    void parseFor(SourceTokenizer& in, Exits& exits, int depth);
+    void parseSwitch(SourceTokenizer& in, Exits& exits, int depth);
+    void readParens(SourceTokenizer& in);
+    void readStatement(SourceTokenizer& in);
+    void skipBraces(SourceTokenizer& in);
+
+    // Pseudocode
+    void parsePseudo(SourceTokenizer& in);
+    QByteArray pseudoBlock(SourceTokenizer& in, Exits& exits, int depth);
+    void pseudoStatement(SourceTokenizer& in, Exits& exits, int depth);
+    void pseudoIf(SourceTokenizer& in, Exits& exits, int depth);
+    bool readLine(SourceTokenizer& in, bool dropTail); // True: a statement follows the tail word
+    void skipLine(SourceTokenizer& in);
+
+    // Chart building
+    void beginChart(const QByteArray& name, Exits& exits);
+    void endChart(Exits& exits);
+    ShapeId addBlock(ShapeType type, const QByteArray& text);
+    void addProcess(Exits& exits, const QByteArray& text, bool mergeable);
+    ShapeId addDecision(Exits& exits, const QByteArray& text);
+    void join(Exits& exits, ShapeId to);
+    Jumps* findJumps(bool loop);
+
+    // Label text being collected from tokens
+    void labelClear();
+    void labelAdd(const SourceToken& t);
+    void labelAddText(const char* text);
+
+    Document& doc;
+    FlowchartOptions options;
+    std::vector<ShapeId> created;
+    FlowchartStats stats;
+    QRect extent;
+    int nextX = 0;
+
+    // Current chart
+    bool inChart = false;
+    std::vector<ShapeId> chartBlocks;
+    std::vector<Jumps> jumps;
+    Exits returns;
+    ShapeId lastProcess = NoShape; // Block the next statement may be merged into
+    int lastLines = 0;
+    int lastWidth = 0;             // Its longest line, characters
+
+    // Label scratch
+    QByteArray label;
+    int labelPrev = 0;     // Kind of the last token added (spacing, see labelAdd)
+    bool labelFull = false;
+};
+
+#endif // FLOWCHARTGEN_H
@@ -0,0 +1,105 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <QPointF>
+#include <QRectF>
+#include <QRect>
+#include <vector>
+#include "shape.h"
+
+// --- Resize Parameters ---
+
+// Everything needed to replay one resize step on a shape: which handle
+// was dragged, the modifiers and the scale factors computed from the
+// primary (dragged) shape. Every selected shape is scaled about its own
+// anchor, derived from its original geometry.
+struct ResizeParams {
+    HandlePosition handle = HandlePosition::None;
+    bool fromCenter = false;    // Ctrl: scale about the shape center
+    bool primaryIsLine = false; // Dragged shape was a line (Start/End handles)
+    qreal scaleX = 1.0;
+    qreal scaleY = 1.0;
+};
+
+// --- Packed Geometry ---
+
+// Geometry of many shapes as one array per coordinate (p1/p2 as stored
+// by Document), converted to double once. Batch kernels walk these
+// arrays without per-shape calls or Shape copies.
+struct PackedGeometry {
+    std::vector<double> x1, y1, x2, y2;
+    std::vector<quint8> isLine; // 1 = line, 0 = rect/circle
+
+    int size() const { return (int)x1.size(); }
+    QPoint p1At(int i) const { return QPoint(int(x1[i]), int(y1[i])); }
+    QPoint p2At(int i) const { return QPoint(int(x2[i]), int(y2[i])); }
+    void clear();
+    void reserve(size_t n);
+    void append(ShapeType type, const QPoint& p1, const QPoint& p2);
+};
+
+// --- Geometry Helpers ---
+
+namespace Geometry {
+
+// "Anchor" point that stays fixed while 'handle' is dragged
+QPointF getAnchorPoint(const QRectF& rect, HandlePosition handle, bool fromCenter);
+
+// Scales point 'p' about 'anchor'
+QPointF scalePoint(const QPointF& p, const QPointF& anchor, qreal sx, qreal sy);
+
+// Resize step for dragging 'handle' of the primary shape to 'mousePos'
+// (keepProportions = Shift, fromCenter = Ctrl)
+ResizeParams computeResize(const Shape& primary, HandlePosition handle, const QPointF& mousePos,
+                           bool keepProportions, bool fromCenter);
+
+// Applies a resize step to the original geometry of many shapes at once;
+// p1s/p2s receive the new points (Document layout), one per shape
+void resizeBatch(const PackedGeometry& orig, const ResizeParams& params,
+                 std::vector<QPoint>& p1s, std::vector<QPoint>& p2s);
+
+// Rect spanned by two points while drawing (square = Shift, fromCenter = Ctrl)
+QRect calculateRect(const QPoint& p1, const QPoint& p2, bool square, bool fromCenter);
+
+// Is 'pos' on the shape? Lines accept points within 'lineThreshold'
+bool hitTest(const Shape& s, const QPoint& pos, qreal lineThreshold);
+
+// Distance from 'p' to the segment a-b
+qreal segmentDistance(const QPointF& p, const QPointF& a, const QPointF& b);
+
+// --- Connectors ---
+// Routes are orthogonal polylines from the start port to the end port
+
+// Port point of a block: the midpoint of that side
+QPoint portPoint(const QRectF& block, Port port);
+
+// Unit step pointing out of a block through 'port'
+QPoint portDirection(Port port);
+
+// Port of 'block' closest to 'pos'
+Port nearestPort(const QRectF& block, const QPointF& pos);
+
+// Quick route that ignores obstacles: a stub out of each port, joined
+// with at most three segments
+void elbowRoute(const QPoint& a, Port aPort, const QPoint& b, Port bPort, int stub,
+                std::vector<QPoint>& route);
+
+// Moves the ends of a route to new port points, keeping its bends (a
+// connector following a dragged block). False, with the route unchanged,
+// if it would leave a port sideways or backwards.
+bool stretchRoute(std::vector<QPoint>& route, const QPoint& a, Port aPort,
+                  const QPoint& b, Port bPort);
+
+// Drops repeated points and the middle points of straight runs
+void simplifyRoute(std::vector<QPoint>& route);
+
+// Distance from 'p' to a polyline
+qreal polylineDistance(const QPointF& p, const QPoint* points, int count);
+
+// Does a polyline pass through the interior of 'rect'? Exact for
+// orthogonal segments, conservative (segment bounds) for others
+bool polylineCrosses(const QPoint* points, int count, const QRectF& rect);
+
+}
+
+#endif // GEOMETRY_H
@@ -0,0 +1,55 @@
+#ifndef IMAGESTREAM_H
+#define IMAGESTREAM_H
+
+#include <QImage>
+#include <QSaveFile>
+#include <QString>
+#include <memory>
+#include <vector>
+
+// --- Image Stream Writer ---
+
+// Writes an image to a file band by band, top to bottom, so the whole
+// image never has to be in memory (tiled export of huge schemes).
+//   PNG  - deflate-compressed, 8-bit RGB or RGBA
+//   TIFF - uncompressed strips, one strip per band, 8-bit RGB or RGBA
+//   Raw  - bare 8-bit RGB or RGBA rows, no header
+// Bands are QImage::Format_ARGB32_Premultiplied, as wide as the image;
+// the alpha channel is written only when the image was opened with one.
+class ImageStreamWriter {
+public:
+    enum class Format { Png, Tiff, Raw };
+
+    static std::unique_ptr<ImageStreamWriter> create(Format format);
+    // .png, .tif/.tiff, .raw/.rgba; false for anything else
+    static bool formatForPath(const QString& path, Format* format);
+
+    virtual ~ImageStreamWriter() = default;
+
+    bool open(const QString& path, const QSize& size, bool alpha, QString* error = nullptr);
+    // Appends the first 'rows' rows of 'band'
+    bool writeRows(const QImage& band, int rows, QString* error = nullptr);
+    bool finish(QString* error = nullptr); // Writes the trailer and commits the file
+
+protected:
+    virtual bool writeHeader() = 0;
+    virtual bool writeBand(const QImage& band, int rows) = 0;
+    virtual bool writeTrailer() = 0;
+
+    // Unpremultiplied RGB(A) bytes of one band row
+    const uchar* convertRow(const QImage& band, int y);
+    int getRowBytes() const { return size.width() * (alpha ? 4 : 3); }
+
+    QSaveFile file;
+    QSize size;
+    bool alpha = false;
+    int rowsWritten = 0;
+    QString failure;     // Set by writers for errors other than file I/O
+
+private:
+    bool fail(QString* error);
+
+    std::vector<uchar> rowBuffer;
+};
+
+#endif // IMAGESTREAM_H
@@ -13,6 +13,13 @@ class MainWindow : public QMainWindow {
 public:
     explicit MainWindow(QWidget *parent = nullptr);
 
+private slots:
+    void openScheme();
+    void saveScheme();
+    void importSource();
+    void toggleTracing();
+    void exportTrace();
+
 private:
     Canvas *canvas;
     QPushButton *btnSelect;
@@ -20,8 +27,20 @@ private:
     QPushButton *btnLine;
     QPushButton *btnRect;
     QPushButton *btnCircle;
+    QPushButton *btnDiamond;
+    QPushButton *btnConnect;
+    QPushButton *btnFit;
+    QPushButton *btnLayout;
+    QPushButton *btnGroup;
+    QPushButton *btnUngroup;
+    QPushButton *btnCollapse;
+    QPushButton *btnImport;
+    QPushButton *btnOpen;
+    QPushButton *btnSave;
     QCheckBox *chkGrid;
     QCheckBox *chkSnap;
+    QCheckBox *chkGuides;
+    QCheckBox *chkTouch;
 };
 
 #endif // MAINWINDOW_H
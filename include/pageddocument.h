@@ -0,0 +1,152 @@
+#ifndef PAGEDDOCUMENT_H
+#define PAGEDDOCUMENT_H
+
+#include <QFile>
+#include <QRectF>
+#include <QString>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "boundstree.h"
+#include "shape.h"
+#include "styletable.h"
+
+// --- Paged Shape ---
+
+// One shape of a paged document, self-contained: connectors name their
+// blocks by id and carry their ports, the label travels with the shape.
+// Ids are the slots of the source scheme, so sorting by id gives the
+// stacking order.
+struct PagedShape {
+    static const quint32 NoLink = 0xffffffffu;
+
+    quint32 id = 0;
+    ShapeType type = ShapeType::Line;
+    StyleIndex style = 0;
+    QPoint p1, p2;                 // As in Shape: rect corners or line / connector ends
+    quint32 from = NoLink;         // Connector blocks
+    quint32 to = NoLink;
+    Port fromPort = Port::Right;
+    Port toPort = Port::Left;
+    QString label;
+
+    QRectF bounds() const { return QRectF(QPointF(p1), QPointF(p2)).normalized(); }
+};
+
+// --- Paged Document ---
+
+// Read-only out-of-core scheme for exporting documents bigger than
+// memory (bsgrender --memory-limit). Shapes live in a page file on disk,
+// cut into spatially clustered pages (shapes ordered along a Hilbert
+// curve over a fine grid, PAGE_SHAPES per page). Only the page
+// directory - a bounds tree over page bounds - stays in memory; a page
+// is read when a query touches it and kept in an LRU cache under a byte
+// limit (setMemoryLimit, default BSG_PAGE_MEMORY_MB or 256 MB).
+//
+// The editor still works on Document; the page file is rebuilt from the
+// scheme, not edited. Not thread-safe: a query may load and evict pages.
+class PagedDocument {
+public:
+    static const int PAGE_SHAPES = 4096;
+
+    PagedDocument();
+    ~PagedDocument();
+    PagedDocument(const PagedDocument&) = delete;
+    PagedDocument& operator=(const PagedDocument&) = delete;
+
+    // Writes the page file for a binary scheme (.bsg). Streams the
+    // memory-mapped scheme in two passes, so it needs memory for the
+    // page grid only. Groups are not carried over.
+    static bool build(const QString& schemePath, const QString& pagePath, QString* error = nullptr);
+
+    bool open(const QString& pagePath, QString* error = nullptr);
+    void close(); // Release the cache and the file
+    bool isOpen() const { return file.isOpen(); }
+
+    // --- Memory ---
+    void setMemoryLimit(qint64 bytes);
+    qint64 getMemoryLimit() const { return memoryLimit; }
+    qint64 getMemoryUsage() const { return cacheBytes + directoryBytes(); }
+
+    // --- Access ---
+    // Calls visit(shape) for every shape whose bounds touch 'area', page
+    // by page (unordered). 'shape' is valid only during the call.
+    template <typename Visitor>
+    void query(const QRectF& area, Visitor&& visit);
+
+    const StyleTable& getStyles() const { return styles; }
+    QRectF getExtent() const;          // Null if there are no shapes
+    qint64 getShapeCount() const { return shapeCount; }
+    int getPageCount() const { return (int)pages.size(); }
+    int getResidentCount() const { return residentCount; }
+    qint64 getLoadCount() const { return loadCount; }  // Page reads since open
+    const QString& getLastError() const { return lastError; }
+    void clearLastError() { lastError.clear(); }
+
+private:
+    struct Page {
+        std::vector<PagedShape> shapes;
+        qint64 bytes = 0;        // Counted against the limit
+    };
+
+    struct PageInfo {
+        QRectF bounds;           // Void if the page has no shapes
+        qint64 recordOffset = 0;
+        qint64 labelOffset = 0;
+        quint32 count = 0;
+        quint32 labelBytes = 0;
+        std::unique_ptr<Page> page; // Null = on disk only
+        int newer = -1;          // LRU list of resident pages
+        int older = -1;
+    };
+
+    Page* acquire(int p);              // Loads if needed, moves to the LRU front
+    bool loadPage(int p);
+    void evict(int p);
+    void trimCache(int keep);
+    void unlinkLru(int p);
+    void pushLru(int p);
+    qint64 directoryBytes() const;
+    bool fail(const QString& what);
+
+    QFile file;
+    StyleTable styles;
+    std::vector<PageInfo> pages;
+    BoundsTree pageTree;               // Over page bounds; item = page
+    std::vector<int> pageScratch;
+    std::vector<uchar> ioBuffer;       // Records of the page being read
+    QByteArray labelBuffer;            // Its labels
+    qint64 shapeCount = 0;
+    qint64 memoryLimit;
+    qint64 cacheBytes = 0;
+    int residentCount = 0;
+    int lruNewest = -1;
+    int lruOldest = -1;
+    qint64 loadCount = 0;
+    QString lastError;
+};
+
+// --- Template implementation ---
+
+template <typename Visitor>
+void PagedDocument::query(const QRectF& area, Visitor&& visit) {
+    pageScratch.clear();
+    pageTree.query(area, [this](int p) { pageScratch.push_back(p); });
+    // In file order, so neighbouring pages are read in sequence
+    std::sort(pageScratch.begin(), pageScratch.end(), [this](int a, int b) {
+        return pages[a].recordOffset < pages[b].recordOffset;
+    });
+    for (int p : pageScratch) {
+        Page* page = acquire(p);
+        if (!page) continue;
+        for (const PagedShape& s : page->shapes) {
+            QRectF b = s.bounds();
+            if (b.left() <= area.right() && area.left() <= b.right() &&
+                b.top() <= area.bottom() && area.top() <= b.bottom()) {
+                visit(s);
+            }
+        }
+    }
+}
+
+#endif // PAGEDDOCUMENT_H
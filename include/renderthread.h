@@ -0,0 +1,77 @@
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QImage>
+#include <QTransform>
+#include <vector>
+#include "shaperenderer.h"
+
+// --- Frame Snapshot ---
+
+// Everything a frame needs, copied out of the widget state so the render
+// thread never touches the live document.
+struct FrameSnapshot {
+    ShapeList shapes;                    // Visible shapes, bottom to top
+    std::vector<QRectF> selectionFrames; // World coordinates
+    std::vector<QRectF> selectionHandles;
+    StyleTable styles;
+    QTransform view;                     // World -> widget
+    QSize size;                          // Widget size (logical pixels)
+    qreal dpr = 1.0;
+    qreal splatSize = 0;                 // Level of detail (see ShapeRenderer)
+    qreal boxSize = 0;
+    qreal textSize = 0;
+};
+
+// --- Render Thread ---
+
+// Rasterizes frame snapshots off the GUI thread.
+// Double-buffered: the thread paints into a back image and swaps it with
+// the front one when done; the widget only blits the front image. Only
+// the newest request is kept - requests that arrive while a frame is
+// being drawn replace each other, so a slow frame never queues up work.
+// Shapes go into a transparent image; the widget draws the background
+// below and interactive overlays above it.
+class RenderThread : public QThread {
+    Q_OBJECT
+public:
+    explicit RenderThread(QObject* parent = nullptr);
+    ~RenderThread() override;
+
+    // Queues a frame. Takes the snapshot's contents and hands back an
+    // older snapshot's buffers for reuse (no per-frame allocation).
+    void render(FrameSnapshot& snapshot);
+
+    // Draws the newest finished frame, remapped from the view it was
+    // rendered with to 'view'. False if no frame is ready yet.
+    bool drawFrame(QPainter* p, const QTransform& view);
+
+signals:
+    void frameReady(); // Emitted from the render thread
+
+protected:
+    void run() override;
+
+private:
+    void paintFrame(const FrameSnapshot& frame);
+
+    QMutex mutex;
+    QWaitCondition wake;
+    bool abort = false;
+    bool hasRequest = false;
+    FrameSnapshot request;     // Newest request (guarded by mutex)
+    QImage front;              // Finished frame (guarded by mutex)
+    QTransform frontView;
+
+    // Owned by the render thread
+    FrameSnapshot work;
+    QImage back;
+    ShapeRenderer renderer;
+    QPen selectionPen;      // Built once (see Canvas)
+    QBrush handleBrush;
+};
+
+#endif // RENDERTHREAD_H
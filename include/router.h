@@ -0,0 +1,108 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QRect>
+#include <unordered_map>
+#include <vector>
+#include "document.h"
+
+// --- Route Jobs ---
+
+// One connector to route, copied out of the document so the router
+// thread never touches it.
+struct RouteJob {
+    ShapeId id = NoShape;
+    quint64 serial = 0;           // Caller's request number, returned with the result
+    QPoint start, end;            // Port points
+    Port startPort = Port::Right;
+    Port endPort = Port::Left;
+    int gridSize = 20;            // Lattice step
+    QRect area;                   // The route stays inside
+    std::vector<QRect> obstacles; // Blocks touching 'area'
+};
+
+struct RouteResult {
+    ShapeId id = NoShape;
+    quint64 serial = 0;
+    std::vector<QPoint> route;
+};
+
+namespace Routing {
+
+// Job for connector 'id' of 'doc': search area around its ports and
+// the blocks inside it (spatial index query)
+RouteJob makeJob(const Document& doc, ShapeId id, int gridSize);
+
+// Routes every connector of 'doc' on the calling thread (export, tools)
+void routeAll(Document& doc, int gridSize);
+
+}
+
+// --- Orthogonal Router ---
+
+// A* over an orthogonal lattice: the grid lines of the search area, the
+// edges of every obstacle (inflated by half a cell of clearance) and the
+// port stubs. A step costs its length and a bend costs two cells, so
+// routes are short and have few bends; obstacle interiors are closed.
+// The lattice is capped at MAX_NODES - a big area is searched on a
+// coarser grid. Scratch buffers are kept between routes.
+class OrthogonalRouter {
+public:
+    // Writes the route (start, bends, end) into 'route'. False if there
+    // is no path inside the area; 'route' is then an elbow.
+    bool route(const RouteJob& job, std::vector<QPoint>& route);
+
+private:
+    bool buildLattice(const RouteJob& job, int step, const QPoint& s, const QPoint& e);
+    void closeObstacle(const QRect& r);
+    int nodeAt(int x, int y) const;
+
+    int clearance = 10;
+    std::vector<int> xs, ys;        // Lattice lines, sorted
+    std::vector<quint8> flags;      // Per node: see router.cpp
+    std::vector<int> cost;          // Per node and direction
+    std::vector<int> parent;        // Per node and direction
+    std::vector<std::pair<int, int>> heap; // (estimate, state)
+};
+
+// --- Router Thread ---
+
+// Routes connectors off the GUI thread. Jobs queue up; a job still
+// waiting for a connector is replaced by a newer one for it, so dragging
+// a block never builds a backlog. Finished routes are collected until
+// the owner takes them (routesReady tells it to).
+class ConnectorRouter : public QThread {
+    Q_OBJECT
+public:
+    explicit ConnectorRouter(QObject* parent = nullptr);
+    ~ConnectorRouter() override;
+
+    // Queues jobs; their contents are taken
+    void submit(std::vector<RouteJob>& jobs);
+
+    // Appends the finished routes to 'out'
+    void takeResults(std::vector<RouteResult>& out);
+
+signals:
+    void routesReady(); // Emitted from the router thread
+
+protected:
+    void run() override;
+
+private:
+    QMutex mutex;
+    QWaitCondition wake;
+    bool abort = false;
+    std::vector<RouteJob> queue;                  // Guarded by mutex
+    std::unordered_map<ShapeId, size_t> queued;   // Connector -> position in 'queue'
+    std::vector<RouteResult> results;             // Guarded by mutex
+
+    // Owned by the router thread
+    std::vector<RouteJob> work;
+    OrthogonalRouter router;
+};
+
+#endif // ROUTER_H
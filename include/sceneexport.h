@@ -0,0 +1,61 @@
+#ifndef SCENEEXPORT_H
+#define SCENEEXPORT_H
+
+#include <QColor>
+#include <QImage>
+#include <QPainter>
+#include <QString>
+#include "document.h"
+
+class PagedDocument;
+
+// --- Export Options ---
+
+struct ExportOptions {
+    qreal scale = 1.0;               // Output pixels per document unit
+    int margin = 20;                 // Empty border around the shapes (document units)
+    int maxSize = 16384;             // Max image side in pixels; larger scenes are scaled down
+    QColor background = Qt::white;   // Transparent = no background
+    int tileSize = 512;              // Tiled export: tile side in pixels
+};
+
+// --- Scene Export ---
+
+// Widget-free rendering of a whole document: offscreen QImage (PNG) or
+// QSvgGenerator (SVG). Needs no window system, and separate documents
+// can be exported from several threads at once.
+namespace SceneExport {
+
+// Draws every shape of 'doc' in stacking order with p's current transform
+void drawDocument(QPainter* p, const Document& doc);
+
+// Document area that gets exported: shape extent plus margin
+QRectF exportArea(const Document& doc, const ExportOptions& opt);
+QRectF exportArea(const QRectF& extent, const ExportOptions& opt);
+
+QImage renderImage(const Document& doc, const ExportOptions& opt = ExportOptions());
+bool savePng(const Document& doc, const QString& path, const ExportOptions& opt = ExportOptions(),
+             QString* error = nullptr);
+bool saveSvg(const Document& doc, const QString& path, const ExportOptions& opt = ExportOptions(),
+             QString* error = nullptr);
+
+// Tiled export for images too big for one QImage: the image is cut into
+// bands of tiles, tiles are drawn in parallel on the global thread pool
+// (each from its own spatial query) and every finished band is streamed
+// to the file while the next one renders. Peak memory is two bands, each
+// at most (pool threads x tileSize^2) pixels, whatever the image size.
+// maxSize does not apply. Format by suffix: .png, .tif/.tiff, .raw.
+bool saveTiled(const Document& doc, const QString& path, const ExportOptions& opt = ExportOptions(),
+               QString* error = nullptr);
+// The same for a paged document, within its memory limit: tiles are
+// drawn one after another (queries load and evict pages), bands still
+// stream to the file. The page cache, the two bands and the shapes
+// copied for a tile all share getMemoryLimit(); a tile with too many
+// shapes is split until its share is enough (a single pixel draws only
+// its topmost shapes).
+bool saveTiled(PagedDocument& doc, const QString& path, const ExportOptions& opt = ExportOptions(),
+               QString* error = nullptr);
+
+}
+
+#endif // SCENEEXPORT_H
@@ -0,0 +1,38 @@
+#ifndef SELECTIONSET_H
+#define SELECTIONSET_H
+
+#include <vector>
+#include "shape.h"
+
+// --- Selection Set ---
+
+// Set of selected shape ids.
+// Membership test, insert and remove are O(1); iteration and clear()
+// are O(k) in the number of selected shapes, not the document size.
+// Iteration order is unspecified.
+class SelectionSet {
+public:
+    bool contains(ShapeId id) const {
+        return id >= 0 && id < (int)position.size() && position[id] >= 0;
+    }
+    bool insert(ShapeId id);   // Returns true if the set changed
+    bool remove(ShapeId id);   // Returns true if the set changed
+    bool toggle(ShapeId id);   // Returns true if the id is now selected
+    void clear();
+
+    int size() const { return (int)members.size(); }
+    bool isEmpty() const { return members.empty(); }
+    const std::vector<ShapeId>& getItems() const { return members; }
+    std::vector<ShapeId>::const_iterator begin() const { return members.begin(); }
+    std::vector<ShapeId>::const_iterator end() const { return members.end(); }
+
+    // Changes whenever the set does (for caches of selection drawing)
+    quint64 getVersion() const { return version; }
+
+private:
+    std::vector<ShapeId> members;  // Dense list of selected ids
+    std::vector<int> position;     // id -> index in 'members' (-1 = not selected)
+    quint64 version = 0;
+};
+
+#endif // SELECTIONSET_H
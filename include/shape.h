@@ -0,0 +1,104 @@
+#ifndef SHAPE_H
+#define SHAPE_H
+
+#include <QRect>
+#include <QRectF>
+#include <QPoint>
+#include <QString>
+#include "styletable.h"
+
+// --- Enums ---
+
+// Type of shape to draw
+enum class ShapeType : quint8 {
+    Line,
+    Rectangle,
+    Circle,
+    Connector, // Orthogonal link between ports of two blocks
+    Diamond    // Decision block (rhombus inscribed in its rect)
+};
+
+// Side of a block a connector is attached to (at its midpoint)
+enum class Port : quint8 {
+    Top, Right, Bottom, Left
+};
+
+// All 8 sides where "drag handles" can be + none
+enum class HandlePosition {
+    None,
+    TopLeft, Top, TopRight, // Top
+    Left, Right, // Middle
+    BottomLeft, Bottom, BottomRight, // Bottom
+    Start, End // For lines
+};
+
+// Stable shape handle (see Document)
+typedef int ShapeId;
+const ShapeId NoShape = -1;
+
+// Stable group handle (see Document::addGroup)
+typedef int GroupId;
+const GroupId NoGroup = -1;
+
+// Shapes that are two endpoints (start/end) rather than a rect
+inline bool hasEndpoints(ShapeType t) {
+    return t == ShapeType::Line || t == ShapeType::Connector;
+}
+
+// Shapes a connector can attach to
+inline bool isBlock(ShapeType t) {
+    return t == ShapeType::Rectangle || t == ShapeType::Circle || t == ShapeType::Diamond;
+}
+
+// What a connector joins: a port on each of two blocks
+struct ConnectorLink {
+    ShapeId from = NoShape;
+    ShapeId to = NoShape;
+    Port fromPort = Port::Right;
+    Port toPort = Port::Left;
+};
+
+// --- Data Structure ---
+
+// Value copy of one shape. The document itself stores shapes as
+// parallel arrays; this struct is used to pass a shape around.
+struct Shape {
+    ShapeType type;
+    QRect rect;      // For blocks (Rectangle, Circle, Diamond)
+    QPoint start;    // For line and connector
+    QPoint end;      // For line and connector
+    StyleIndex style = 0; // Index into the document StyleTable
+    ConnectorLink link{}; // For connector
+    QString label{};      // Text inside a block / next to a connector
+
+    // Function to get selection border (bounding box)
+    QRectF bounds() const {
+        if (hasEndpoints(type)) {
+            return QRectF(start, end).normalized();
+        }
+        return QRectF(rect);
+    }
+
+    // Geometry as two points: line/connector endpoints, or the rect top-left
+    // corner and top-left + size (how Document stores it)
+    void toPoints(QPoint& p1, QPoint& p2) const {
+        if (hasEndpoints(type)) {
+            p1 = start;
+            p2 = end;
+        } else {
+            QRect r = rect.normalized();
+            p1 = r.topLeft();
+            p2 = r.topLeft() + QPoint(r.width(), r.height());
+        }
+    }
+    void setPoints(const QPoint& p1, const QPoint& p2) {
+        if (hasEndpoints(type)) {
+            start = p1;
+            end = p2;
+        } else {
+            rect = QRect(p1, QSize(p2.x() - p1.x(), p2.y() - p1.y()));
+        }
+    }
+};
+
+#endif // SHAPE_H
@@ -0,0 +1,107 @@
+#ifndef SHAPERENDERER_H
+#define SHAPERENDERER_H
+
+#include <QPainter>
+#include <QLine>
+#include <QFont>
+#include <vector>
+#include "document.h"
+
+// --- Shape List ---
+
+// Shapes copied out of a document, bottom to top - an immutable
+// snapshot a render thread can draw while the document keeps changing.
+// Connector routes are stored back to back in routePoints; shape i owns
+// [routeEnds[i - 1], routeEnds[i]) (empty for other shapes). Labels are
+// sparse: (shape index, text) in index order.
+struct ShapeList {
+    std::vector<ShapeType> types;
+    std::vector<QPoint> p1s;
+    std::vector<QPoint> p2s;
+    std::vector<StyleIndex> styles;
+    std::vector<QPoint> routePoints;
+    std::vector<int> routeEnds;
+    std::vector<std::pair<int, QString>> labels;
+
+    int size() const { return (int)types.size(); }
+    void clear();
+    void append(const Document& doc, int slot);
+    // A shape from elsewhere (a paged document); 'route' for connectors
+    void append(ShapeType type, const QPoint& p1, const QPoint& p2, StyleIndex style,
+                const QPoint* route = nullptr, int routeSize = 0, const QString& label = QString());
+};
+
+// --- Shape Renderer ---
+
+// Draws shapes grouped by style and type: one setPen/setBrush per group,
+// lines, connector routes (as segments) and rects through the
+// drawLines/drawRects array overloads, labels last over their group.
+// Small ellipses of solid outline-only styles are flattened into
+// segments and join the group's single drawLines call; filled, dashed
+// and large ones (over ELLIPSE_BATCH_PIXELS on screen) keep drawEllipse
+// - a shared QPainterPath would rebuild its converter on the heap.
+// A group draws by primitive kind with labels last, so next to a filled
+// style the groups are flushed whenever the style or the primitive kind
+// changes and after every labelled shape - the stacking order stays
+// correct; outline-only styles are merged freely.
+// Scratch buffers are kept between frames, so steady-state rendering
+// does not allocate.
+// Level of detail: shapes smaller than the splat size collapse into a
+// single point, ellipses and diamonds smaller than the box size into
+// their bounding rect, labels are left out while the font is smaller
+// than the text size (sizes in document units, 0 = full detail).
+class ShapeRenderer {
+public:
+    // 'order' holds document slots, bottom to top
+    void drawShapes(QPainter* p, const Document& doc, const int* order, int count);
+    void drawShapes(QPainter* p, const Document& doc, const std::vector<int>& order) {
+        drawShapes(p, doc, order.data(), (int)order.size());
+    }
+    void drawShapes(QPainter* p, const StyleTable& styles, const ShapeList& shapes);
+    void setDetailLimits(qreal splatSize, qreal boxSize, qreal textSize = 0);
+
+    static const int LABEL_FONT_SIZE = 12; // In document units
+    static const int ELLIPSE_BATCH_PIXELS = 64; // Largest batched ellipse (screen diameter)
+
+private:
+    struct Text {
+        QRect rect;
+        int flags;
+        const QString* text; // Owned by the document or the shape list
+    };
+
+    // What a shape is drawn as after the level-of-detail step
+    enum class Primitive { Line, Rect, Ellipse, Diamond, Splat };
+
+    struct Bucket {
+        std::vector<QLine> lines;
+        std::vector<QRect> rects;
+        std::vector<QRect> ellipses;
+        std::vector<QLineF> curves;      // Flattened small ellipses
+        std::vector<QRect> diamonds;
+        std::vector<QPointF> splats;     // Sub-pixel shapes (centers)
+        std::vector<Text> texts;
+        bool pending = false;
+    };
+
+    void begin(QPainter* p, const StyleTable& styles);
+    void addEllipse(Bucket& b, const QPen& pen, bool filled, const QRect& rect);
+    void add(QPainter* p, const StyleTable& styles, ShapeType type,
+             const QPoint& p1, const QPoint& p2, StyleIndex st,
+             const QPoint* route = nullptr, int routeSize = 0, const QString* label = nullptr);
+    void flush(QPainter* p, const StyleTable& styles);
+
+    std::vector<Bucket> buckets;       // Indexed by StyleIndex
+    std::vector<StyleIndex> pending;   // Buckets that hold something
+    bool haveLast = false;             // Style of the previous shape (see add)
+    StyleIndex last = 0;
+    Primitive lastPrimitive = Primitive::Line;
+    bool lastLabeled = false;
+    qreal splatSize = 0;
+    qreal boxSize = 0;
+    qreal textSize = 0;
+    qreal pixelScale = 1;              // Screen pixels per document unit
+    QFont font;
+};
+
+#endif // SHAPERENDERER_H
@@ -0,0 +1,81 @@
+#ifndef SNAPGUIDES_H
+#define SNAPGUIDES_H
+
+#include <QLine>
+#include <QPoint>
+#include <QRectF>
+#include <vector>
+#include "document.h"
+#include "selectionset.h"
+
+// --- Snap Result ---
+
+// Where a moving rect or point snapped: the offset to add to it and the
+// alignment guides to draw (world coordinates)
+struct SnapResult {
+    QPoint offset;
+    bool snappedX = false;  // To a vertical line (left, center or right of a shape)
+    bool snappedY = false;  // To a horizontal line (top, middle or bottom)
+    QLine guideX;           // Vertical guide, valid if snappedX
+    QLine guideY;           // Horizontal guide, valid if snappedY
+};
+
+// --- Snap Index ---
+
+// Alignment lines of the shapes in an area (usually the visible part of
+// the scheme): per axis, the left / center / right x (top / middle /
+// bottom y) of every shape, sorted, with shapes sharing a coordinate
+// merged into one line spanning all of them. A snap lookup is a binary
+// search per moving edge, so it does not depend on the shape count.
+// Connectors are left out (they follow their blocks). Built once per
+// drag; buffers are kept between builds.
+// A zoomed-out view of a big scheme can hold tens of thousands of
+// shapes; only the MAX_SHAPES closest to the drag focus are indexed
+// then, which keeps the build to a few milliseconds.
+class SnapIndex {
+public:
+    static const int MAX_SHAPES = 4096;
+
+    // Indexes the shapes of 'doc' touching 'area', except 'excluded'
+    // (the shapes being dragged); at most 'maxShapes', nearest to 'focus'
+    void build(const Document& doc, const QRectF& area, const SelectionSet* excluded = nullptr,
+               const QPointF& focus = QPointF(), int maxShapes = MAX_SHAPES);
+    void clear();
+
+    bool isEmpty() const { return xLines.empty() && yLines.empty(); }
+    const QRectF& getArea() const { return area; }
+    int getLineCount() const { return int(xLines.size() + yLines.size()); }
+
+    // Snaps the edges and center of 'rect' to the nearest lines within
+    // 'tolerance', each axis independently
+    SnapResult snapRect(const QRectF& rect, int tolerance) const;
+    // Snaps a point (a resize handle or a corner being drawn) on the
+    // axes it moves along
+    SnapResult snapPoint(const QPoint& p, int tolerance, bool alongX = true, bool alongY = true) const;
+
+private:
+    // One alignment coordinate; from..to is the extent of its shapes
+    // along the other axis
+    struct Line {
+        int coord;
+        int from;
+        int to;
+    };
+
+    static void sortAndMerge(std::vector<Line>& lines);
+    static const Line* nearest(const std::vector<Line>& lines, const int* values, int count,
+                               int tolerance, int& offset);
+
+    // A shape found in the area, before the cap
+    struct Candidate {
+        qreal distance; // Squared, from the bounds center to the focus
+        QRectF bounds;
+    };
+
+    QRectF area;
+    std::vector<Candidate> candidates;
+    std::vector<Line> xLines; // Sorted by coord, unique
+    std::vector<Line> yLines;
+};
+
+#endif // SNAPGUIDES_H
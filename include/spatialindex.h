@@ -0,0 +1,108 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <QRectF>
+#include <QRect>
+#include <unordered_map>
+#include <vector>
+
+// --- Spatial Index ---
+
+// Uniform grid over shape bounding boxes.
+// Every item is registered in all cells its bounds cover, so a point or
+// rect query only touches the cells under the query area instead of the
+// whole shape list. Items that would cover too many cells are kept in a
+// separate "oversized" list that every query scans.
+// With the grid disabled every query tests all items instead - the
+// "before" of bsgbench --baseline.
+class SpatialIndex {
+public:
+    explicit SpatialIndex(int cellSize = 128);
+
+    void clear();
+    void insert(int id, const QRectF& bounds);
+    void update(int id, const QRectF& bounds);
+    void remove(int id);
+    bool contains(int id) const;
+
+    // Calls visit(id) once for every item whose bounds touch 'area'.
+    // Order of visits is unspecified. Stateless, so several threads may
+    // query the same (unmodified) index concurrently.
+    template <typename Visitor>
+    void query(const QRectF& area, Visitor&& visit) const;
+
+    int getCellSize() const { return cellSize; }
+    int size() const { return count; }
+    void setGridEnabled(bool enabled) { gridEnabled = enabled; } // The grid is still kept up to date
+
+private:
+    struct Entry {
+        QRectF bounds;
+        QRect cells;            // Covered cell range (inclusive)
+        bool used = false;
+        bool oversized = false;
+    };
+
+    static quint64 cellKey(int cx, int cy);
+    QRect cellRange(const QRectF& r) const;
+    static bool touches(const QRectF& a, const QRectF& b);
+
+    void link(int id);
+    void unlink(int id);
+
+    int cellSize;
+    int count = 0;
+    bool gridEnabled = true;
+    std::vector<Entry> entries;                        // Indexed by item id
+    std::unordered_map<quint64, std::vector<int>> cells;
+    std::vector<int> oversized;
+};
+
+// --- Template implementation ---
+
+template <typename Visitor>
+void SpatialIndex::query(const QRectF& area, Visitor&& visit) const {
+    if (!gridEnabled) {
+        for (int id = 0; id < (int)entries.size(); ++id) {
+            if (entries[id].used && touches(entries[id].bounds, area)) visit(id);
+        }
+        return;
+    }
+
+    for (int id : oversized) {
+        if (touches(entries[id].bounds, area)) visit(id);
+    }
+
+    QRect range = cellRange(area);
+    auto visitCell = [&](int cx, int cy, const std::vector<int>& ids) {
+        for (int id : ids) {
+            const Entry& e = entries[id];
+            // Item is reported only from the first cell shared by its
+            // range and the query range - no "visited" set needed.
+            if (cx != qMax(e.cells.left(), range.left())) continue;
+            if (cy != qMax(e.cells.top(), range.top())) continue;
+            if (touches(e.bounds, area)) visit(id);
+        }
+    };
+
+    // Huge query (e.g. marquee over the whole scheme): walking the occupied
+    // cells is cheaper than walking every cell of the range.
+    qint64 rangeCells = qint64(range.width()) * range.height();
+    if (rangeCells > qint64(cells.size())) {
+        for (const auto& [key, ids] : cells) {
+            int cx = int(qint32(quint32(key >> 32)));
+            int cy = int(qint32(quint32(key & 0xffffffffu)));
+            if (range.contains(cx, cy)) visitCell(cx, cy, ids);
+        }
+        return;
+    }
+
+    for (int cy = range.top(); cy <= range.bottom(); ++cy) {
+        for (int cx = range.left(); cx <= range.right(); ++cx) {
+            auto it = cells.find(cellKey(cx, cy));
+            if (it != cells.end()) visitCell(cx, cy, it->second);
+        }
+    }
+}
+
+#endif // SPATIALINDEX_H
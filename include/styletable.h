@@ -0,0 +1,62 @@
+#ifndef STYLETABLE_H
+#define STYLETABLE_H
+
+#include <QPen>
+#include <QBrush>
+#include <QColor>
+#include <vector>
+
+// --- Data Structure ---
+
+// Visual style of a shape. Shapes don't own one - they keep a small
+// index into the shared StyleTable.
+struct ShapeStyle {
+    QColor stroke = Qt::black;
+    qreal strokeWidth = 2;
+    Qt::PenStyle strokeStyle = Qt::SolidLine;
+    QColor fill = Qt::transparent; // Transparent = no fill
+
+    bool operator==(const ShapeStyle& o) const {
+        return stroke == o.stroke && strokeWidth == o.strokeWidth &&
+               strokeStyle == o.strokeStyle && fill == o.fill;
+    }
+};
+
+typedef quint16 StyleIndex;
+
+// --- Style Table ---
+
+// Interned styles with prebuilt QPen/QBrush objects, so drawing only
+// copies shared pens and never builds one.
+// Index 0 is always the default style (black 2px outline, no fill).
+class StyleTable {
+public:
+    StyleTable();
+
+    // Returns the index of an equal style, adding it if needed
+    StyleIndex intern(const ShapeStyle& style);
+    void clear(); // Back to the default style only
+
+    const ShapeStyle& getStyle(StyleIndex i) const { return entries[valid(i)].style; }
+    const QPen& getPen(StyleIndex i) const { return entries[valid(i)].pen; }
+    const QBrush& getBrush(StyleIndex i) const { return entries[valid(i)].brush; }
+    const QPen& getPointPen(StyleIndex i) const { return entries[valid(i)].pointPen; } // 1px, stroke color
+    bool isFilled(StyleIndex i) const { return entries[valid(i)].brush.style() != Qt::NoBrush; }
+    int size() const { return (int)entries.size(); }
+    qreal getMaxStrokeWidth() const { return maxStrokeWidth; } // For repaint margins
+
+private:
+    struct Entry {
+        ShapeStyle style;
+        QPen pen;
+        QBrush brush;
+        QPen pointPen; // Cosmetic, for shapes collapsed into points
+    };
+
+    StyleIndex valid(StyleIndex i) const { return i < entries.size() ? i : 0; }
+
+    std::vector<Entry> entries;
+    qreal maxStrokeWidth = 0;
+};
+
+#endif // STYLETABLE_H
@@ -0,0 +1,58 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QString>
+#include <atomic>
+
+// --- Tracing ---
+
+// Lightweight instrumentation for "the editor feels sluggish" reports.
+// Scopes are recorded as complete events into a fixed-size lock-free
+// ring buffer (the newest events win) from any thread, and exported on
+// demand as Chrome trace-event JSON (chrome://tracing, Perfetto).
+// While tracing is off a scope costs one relaxed atomic load; building
+// with BSG_NO_TRACING removes the scopes entirely.
+namespace Trace {
+
+extern std::atomic<bool> active; // Use isEnabled()
+
+inline bool isEnabled() { return active.load(std::memory_order_relaxed); }
+void setEnabled(bool enabled);   // Also BSG_TRACE=1 at startup (see Canvas)
+void clear();
+
+qint64 now(); // Monotonic nanoseconds
+// 'name' and 'category' must be string literals (stored as pointers)
+void record(const char* name, const char* category, qint64 startNs, qint64 endNs);
+
+bool exportChromeTrace(const QString& path, QString* error = nullptr);
+
+}
+
+// Records the enclosing block as one event
+class TraceScope {
+public:
+    explicit TraceScope(const char* name, const char* category = "canvas")
+        : name(Trace::isEnabled() ? name : nullptr), category(category) {
+        if (this->name) start = Trace::now();
+    }
+    ~TraceScope() {
+        if (name) Trace::record(name, category, start, Trace::now());
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    const char* category;
+    qint64 start = 0;
+};
+
+#define BSG_TRACE_CONCAT2(a, b) a##b
+#define BSG_TRACE_CONCAT(a, b) BSG_TRACE_CONCAT2(a, b)
+#ifdef BSG_NO_TRACING
+#define BSG_TRACE_SCOPE(...) do {} while (false)
+#else
+#define BSG_TRACE_SCOPE(...) TraceScope BSG_TRACE_CONCAT(traceScope_, __LINE__)(__VA_ARGS__)
+#endif
+
+#endif // TRACER_H
@@ -0,0 +1,161 @@
+#ifndef UNDOSTACK_H
+#define UNDOSTACK_H
+
+#include <QPoint>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "document.h"
+#include "geometry.h"
+
+// --- Undo Commands ---
+
+// One undoable edit. Commands are pushed after the edit was already
+// applied to the document, and store only what is needed to replay it
+// in both directions - never a copy of the whole document.
+class UndoCommand {
+public:
+    virtual ~UndoCommand() = default;
+    virtual void undo(Document& doc) const = 0;
+    virtual void redo(Document& doc) const = 0;
+    virtual size_t getByteSize() const = 0;        // For the memory budget
+    const std::vector<ShapeId>& getShapes() const { return ids; } // Affected shapes
+
+protected:
+    std::vector<ShapeId> ids;
+};
+
+// A new shape was drawn
+class CreateShapeCommand : public UndoCommand {
+public:
+    CreateShapeCommand(ShapeId id, int slot, const Shape& shape);
+    void undo(Document& doc) const override;
+    void redo(Document& doc) const override;
+    size_t getByteSize() const override;
+
+private:
+    RestoredShape created;
+};
+
+// Many shapes were created at once (an import); the inverse of a delete
+class CreateShapesCommand : public UndoCommand {
+public:
+    explicit CreateShapesCommand(std::vector<RestoredShape> created); // Sorted by slot
+    void undo(Document& doc) const override;
+    void redo(Document& doc) const override;
+    size_t getByteSize() const override;
+
+private:
+    std::vector<RestoredShape> created;
+};
+
+// Shapes were deleted; keeps them with their ids and stacking slots
+class DeleteShapesCommand : public UndoCommand {
+public:
+    explicit DeleteShapesCommand(std::vector<RestoredShape> removed); // Sorted by slot
+    void undo(Document& doc) const override;
+    void redo(Document& doc) const override;
+    size_t getByteSize() const override;
+
+private:
+    std::vector<RestoredShape> removed;
+};
+
+// Shapes were moved by one delta (a whole drag is one command)
+class TranslateCommand : public UndoCommand {
+public:
+    TranslateCommand(std::vector<ShapeId> moved, const QPoint& delta);
+    void undo(Document& doc) const override;
+    void redo(Document& doc) const override;
+    size_t getByteSize() const override;
+
+private:
+    QPoint delta;
+};
+
+// Shapes were resized by one anchor/scale step (a whole drag is one
+// command). Rounding to integer geometry makes the inverse scale
+// inexact, so the original two-point geometry is kept packed for undo;
+// redo replays the anchor and scale factors on it.
+class ResizeCommand : public UndoCommand {
+public:
+    ResizeCommand(std::vector<ShapeId> resized, std::vector<QPoint> p1s,
+                  std::vector<QPoint> p2s, const ResizeParams& params);
+    void undo(Document& doc) const override;
+    void redo(Document& doc) const override;
+    size_t getByteSize() const override;
+
+private:
+    std::vector<QPoint> origP1;
+    std::vector<QPoint> origP2;
+    ResizeParams params;
+};
+
+// Blocks were placed by the auto-layout: each block has its own delta,
+// and the connectors between them got new ports
+class LayoutCommand : public UndoCommand {
+public:
+    LayoutCommand(std::vector<ShapeId> blocks, std::vector<QPoint> deltas,
+                  std::vector<ShapeId> connectors, std::vector<ConnectorLink> oldLinks,
+                  std::vector<ConnectorLink> newLinks);
+    void undo(Document& doc) const override;
+    void redo(Document& doc) const override;
+    size_t getByteSize() const override;
+
+private:
+    void apply(Document& doc, int sign, const std::vector<ConnectorLink>& links) const;
+
+    size_t blockCount;                // ids = blocks, then connectors
+    std::vector<QPoint> deltas;
+    std::vector<ConnectorLink> oldLinks;
+    std::vector<ConnectorLink> newLinks;
+};
+
+// Groups were created (Ctrl+G) or dissolved (Ctrl+Shift+G); shapes
+// don't move. Records are in the order the edit applied them
+class GroupCommand : public UndoCommand {
+public:
+    GroupCommand(const Document& doc, std::vector<GroupRecord> groups, bool created);
+    void undo(Document& doc) const override;
+    void redo(Document& doc) const override;
+    size_t getByteSize() const override;
+
+private:
+    void apply(Document& doc, bool add, bool reverse) const;
+
+    std::vector<GroupRecord> records;
+    bool created;
+};
+
+// --- Undo Stack ---
+
+// Linear undo/redo history with a memory budget: when the commands
+// exceed the byte limit, the oldest ones are dropped.
+class UndoStack {
+public:
+    explicit UndoStack(size_t byteLimit = 64 * 1024 * 1024);
+
+    void push(std::unique_ptr<UndoCommand> cmd); // Drops the redo tail
+    bool undo(Document& doc);
+    bool redo(Document& doc);
+    void clear();
+
+    bool canUndo() const { return done > 0; }
+    bool canRedo() const { return done < commands.size(); }
+    const UndoCommand* getUndoCommand() const { return canUndo() ? commands[done - 1].get() : nullptr; }
+    const UndoCommand* getRedoCommand() const { return canRedo() ? commands[done].get() : nullptr; }
+
+    void setByteLimit(size_t limit);
+    size_t getByteLimit() const { return byteLimit; }
+    size_t getByteSize() const { return bytes; }
+
+private:
+    void trim();
+
+    std::deque<std::unique_ptr<UndoCommand>> commands;
+    size_t done = 0;   // commands[0, done) are applied
+    size_t bytes = 0;
+    size_t byteLimit;
+};
+
+#endif // UNDOSTACK_H
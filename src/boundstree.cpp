@@ -0,0 +1,161 @@
+#include "boundstree.h"
+#include <algorithm>
+#include <numeric>
+
+//==================================================================
+// 1. Построение
+//==================================================================
+
+/**
+ * @brief Строит дерево заново по границам элементов.
+ *
+ * Рекурсивное деление пополам по медиане центров вдоль длинной оси
+ * разброса: O(n log n), глубина - log2(n / LEAF_SIZE).
+ */
+void BoundsTree::build(const std::vector<QRectF>& itemBounds) {
+    clear();
+    int n = (int)itemBounds.size();
+    if (n == 0) return;
+    boxes = itemBounds;
+    order.resize(n);
+    std::iota(order.begin(), order.end(), 0);
+    leafOf.resize(n);
+    nodes.reserve(2 * (n / LEAF_SIZE + 1));
+    nodes.push_back(Node{QRectF(), -1, 0, 0});
+    split(0, 0, n);
+}
+
+/**
+ * @brief Очищает дерево, сохраняя память буферов.
+ */
+void BoundsTree::clear() {
+    nodes.clear();
+    order.clear();
+    leafOf.clear();
+    boxes.clear();
+}
+
+/**
+ * @brief Заполняет узел node элементами order[begin, end).
+ */
+void BoundsTree::split(int node, int begin, int end) {
+    QRectF bounds = voidBounds();
+    QRectF centers = voidBounds();
+    for (int i = begin; i < end; ++i) {
+        const QRectF& b = boxes[order[i]];
+        bounds = unite(bounds, b);
+        if (!isVoid(b)) centers = unite(centers, QRectF(b.center(), b.center()));
+    }
+    nodes[node].bounds = bounds;
+
+    if (end - begin <= LEAF_SIZE) {
+        nodes[node].first = begin;
+        nodes[node].count = end - begin;
+        for (int i = begin; i < end; ++i) leafOf[order[i]] = node;
+        return;
+    }
+
+    // Пустые элементы центра не имеют - уходят в конец любой половины
+    bool alongX = isVoid(centers) || centers.width() >= centers.height();
+    int mid = (begin + end) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                     [&](int a, int b) {
+        const QRectF& ra = boxes[a];
+        const QRectF& rb = boxes[b];
+        if (isVoid(ra) || isVoid(rb)) return !isVoid(ra) && isVoid(rb);
+        return alongX ? ra.center().x() < rb.center().x() : ra.center().y() < rb.center().y();
+    });
+
+    // Дети соседние: правый всегда first + 1
+    int left = (int)nodes.size();
+    nodes.push_back(Node{QRectF(), node, 0, 0});
+    nodes.push_back(Node{QRectF(), node, 0, 0});
+    nodes[node].first = left;
+    nodes[node].count = 0;
+    split(left, begin, mid);
+    split(left + 1, mid, end);
+}
+
+//==================================================================
+// 2. Обновление
+//==================================================================
+
+/**
+ * @brief Новые границы элемента: пересчет от его листа вверх.
+ *
+ * Подъем останавливается на первом узле, границы которого не
+ * изменились, - выше ничего меняться не может. Сдвиг внутри
+ * прежних границ стоит O(LEAF_SIZE).
+ */
+bool BoundsTree::refit(int item, const QRectF& bounds) {
+    if (item < 0 || item >= size()) return false;
+    boxes[item] = bounds;
+
+    int node = leafOf[item];
+    QRectF b = leafBounds(nodes[node]);
+    while (node >= 0) {
+        Node& n = nodes[node];
+        if (n.bounds == b) return false;
+        n.bounds = b;
+        if (n.parent < 0) return true;
+        const Node& parent = nodes[n.parent];
+        b = unite(nodes[parent.first].bounds, nodes[parent.first + 1].bounds);
+        node = n.parent;
+    }
+    return true;
+}
+
+//==================================================================
+// 3. Доступ
+//==================================================================
+
+/**
+ * @brief Границы всех элементов (пустые, если элементов нет).
+ */
+const QRectF& BoundsTree::getBounds() const {
+    return nodes.empty() ? voidBounds() : nodes[0].bounds;
+}
+
+/**
+ * @brief "Пустые" границы: не покрывают ничего, даже точку.
+ */
+const QRectF& BoundsTree::voidBounds() {
+    static const QRectF none(0, 0, -1, -1);
+    return none;
+}
+
+//==================================================================
+// 4. Private-функции
+//==================================================================
+
+/**
+ * @brief Проверка пересечения с учетом границ (как в SpatialIndex).
+ */
+bool BoundsTree::touches(const QRectF& a, const QRectF& b) {
+    return a.left() <= b.right() && b.left() <= a.right() &&
+           a.top() <= b.bottom() && b.top() <= a.bottom();
+}
+
+/**
+ * @brief Объединение границ.
+ *
+ * Свое, а не QRectF::united: тот пропускает вырожденные прямоугольники
+ * (горизонтальную линию), а здесь пропускаются только пустые.
+ */
+QRectF BoundsTree::unite(const QRectF& a, const QRectF& b) {
+    if (isVoid(a)) return b;
+    if (isVoid(b)) return a;
+    return QRectF(QPointF(qMin(a.left(), b.left()), qMin(a.top(), b.top())),
+                  QPointF(qMax(a.right(), b.right()), qMax(a.bottom(), b.bottom())));
+}
+
+/**
+ * @brief Границы элементов листа.
+ */
+QRectF BoundsTree::leafBounds(const Node& leaf) const {
+    QRectF b = voidBounds();
+    for (int i = leaf.first; i < leaf.first + leaf.count; ++i) {
+        b = unite(b, boxes[order[i]]);
+    }
+    return b;
+}
@@ -0,0 +1,869 @@
+// bsgbench - замеры горячих путей холста на синтетических схемах.
+//
+//   bsgbench [--headless] [-o <file.json>] [--sizes 1000,10000,...] [--min-time <ms>] [--baseline]
+//
+// Для каждого размера строится схема из линий, прямоугольников и кругов
+// (поровну, с фиксированным seed) и замеряются: поиск фигуры под
+// курсором, поиск ручки, выделение рамкой (сразу и по шагам, как при
+// перетаскивании), ресайз и перемещение большого
+// выделения, полная отрисовка кадра (1:1 и "Вписать"), перестроение
+// 50 связей при перетаскивании блока, построение индекса направляющих
+// по видимой части и привязка к ним, проход вида по страничной копии
+// схемы с малым лимитом памяти; отдельно - раскладка блок-схемы того
+// же размера.
+// Результат - JSON, чтобы сравнивать версии между релизами.
+// Заодно считаются выделения памяти (malloc/realloc и operator new) в
+// установившемся режиме; для hit-test, наведения на фигуру, кадра и
+// направляющих (zero_alloc) их быть не должно - иначе код возврата 1.
+// Направляющие (индекс и привязка, 1:1, 0.5 и "Вписать") обязаны
+// укладываться в 1 мс на операцию - тоже иначе код возврата 1.
+// --headless запускает без дисплея (платформа Qt "offscreen").
+// --baseline добавляет те же запросы без индекса - для сравнения "до и
+// после" на той же схеме: shapeAt_baseline перебирает слоты сверху
+// вниз, как до индекса, а getHandleAt_baseline и marquee_baseline идут
+// тем же путем холста, что и основные замеры, но запросы к документу
+// проверяют все фигуры (Document::setIndexEnabled).
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMouseEvent>
+#include <QSysInfo>
+#include <QTemporaryDir>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <vector>
+#include "canvas.h"
+#include "documentio.h"
+#include "pageddocument.h"
+#include "geometry.h"
+#include "layout.h"
+#include "router.h"
+
+// --- Allocation Counter ---
+
+// Every heap allocation in the process (Qt's included) is counted, so a
+// benchmark can check that its steady state doesn't touch the heap. With
+// glibc the malloc family itself is interposed - Qt containers allocate
+// with malloc/realloc, not operator new; elsewhere only operator new is
+// seen.
+static std::atomic<qint64> allocationCount{0};
+
+#if defined(__GLIBC__)
+#define BSG_COUNT_MALLOC 1
+extern "C" {
+void* __libc_malloc(std::size_t size) noexcept;
+void* __libc_calloc(std::size_t count, std::size_t size) noexcept;
+void* __libc_realloc(void* p, std::size_t size) noexcept;
+void* __libc_memalign(std::size_t alignment, std::size_t size) noexcept;
+void __libc_free(void* p) noexcept;
+
+void* malloc(std::size_t size) noexcept {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+void* calloc(std::size_t count, std::size_t size) noexcept {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+void* realloc(void* p, std::size_t size) noexcept {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(p, size);
+}
+void* memalign(std::size_t alignment, std::size_t size) noexcept {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+void* aligned_alloc(std::size_t alignment, std::size_t size) noexcept {
+    return memalign(alignment, size);
+}
+int posix_memalign(void** out, std::size_t alignment, std::size_t size) noexcept {
+    void* p = memalign(alignment, size);
+    if (!p) return ENOMEM;
+    *out = p;
+    return 0;
+}
+void free(void* p) noexcept {
+    __libc_free(p);
+}
+}
+#else
+#define BSG_COUNT_MALLOC 0
+#endif
+
+void* operator new(std::size_t size) {
+    if (!BSG_COUNT_MALLOC) allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+const int VIEW_WIDTH = 1280;
+const int VIEW_HEIGHT = 800;
+const int SHAPE_SPACING = 40;     // Средняя площадь на фигуру - SHAPE_SPACING^2
+const int MIN_SHAPE_SIZE = 4;
+const int MAX_SHAPE_SIZE = 60;
+const int POINT_QUERIES = 10000;  // Запросов за прогон shapeAt
+const int HANDLE_QUERIES = 1000;  // ... и getHandleAt
+const int HOVER_STEPS = 10000;    // Шагов по 1 пикселю при наведении
+const int LINE_HIT_THRESHOLD = 5; // Порог попадания, как в Canvas (для shapeAt_baseline)
+const int DRAG_STEPS = 16;        // Шагов мыши за прогон move/resize
+const qreal MARQUEE_FRACTION = 0.1; // Доля площади схемы под рамкой
+const int MAX_RUNS = 1000;
+const int HUB_CONNECTORS = 50;    // Связей у перетаскиваемого блока
+const int GUIDE_QUERIES = 10000;  // Привязок рамки к направляющим за прогон
+const int GUIDE_TOLERANCE = 6;    // Допуск привязки в пикселях
+const qint64 GUIDE_BUDGET_NS = 1000000; // Направляющие: не дольше 1 мс на операцию
+const int PAN_STEPS = 64;         // Шагов вида по диагонали схемы за прогон paged_view
+const qint64 PAGED_MEMORY = qint64(4) << 20; // Лимит страничной схемы: меньше ее страниц
+
+// Результат одного замера
+struct BenchResult {
+    QString name;
+    int shapes = 0;
+    qint64 items = 0;       // Сколько фигур обработано (выделение и т.п.)
+    qint64 opsPerRun = 1;
+    int runs = 0;
+    qint64 totalNs = 0;
+    qint64 bestNs = 0;      // Самый быстрый прогон
+    qint64 allocs = 0;      // Выделений памяти во всех прогонах, кроме первого
+    bool zeroAlloc = false; // Путь обязан обходиться без выделений
+    qint64 budgetNs = 0;    // Предел ns/op (0 - без предела)
+
+    double nsPerOp() const {
+        return runs ? double(totalNs) / (qint64(runs) * opsPerRun) : 0.0;
+    }
+
+    double allocsPerOp() const {
+        return runs > 1 ? double(allocs) / (qint64(runs - 1) * opsPerRun) : 0.0;
+    }
+
+    QJsonObject toJson() const {
+        QJsonObject o;
+        o["name"] = name;
+        o["shapes"] = shapes;
+        o["items"] = items;
+        o["runs"] = runs;
+        o["ops_per_run"] = opsPerRun;
+        o["ns_per_op"] = nsPerOp();
+        o["best_ns_per_op"] = double(bestNs) / opsPerRun;
+        o["total_ms"] = totalNs / 1e6;
+        o["allocs_per_op"] = allocsPerOp();
+        o["zero_alloc"] = zeroAlloc;
+        if (budgetNs > 0) o["budget_ns_per_op"] = double(budgetNs);
+        return o;
+    }
+};
+
+/**
+ * @brief Повторяет прогон, пока суммарное время не превысит minNs.
+ *
+ * Прогонов не меньше двух: первый прогревает буферы, выделения
+ * считаются по остальным.
+ */
+template <typename Run>
+BenchResult measure(const QString& name, int shapes, qint64 opsPerRun, qint64 minNs, Run&& run) {
+    BenchResult r;
+    r.name = name;
+    r.shapes = shapes;
+    r.opsPerRun = opsPerRun;
+    QElapsedTimer timer;
+    while (r.runs < MAX_RUNS && (r.runs < 2 || r.totalNs < minNs)) {
+        qint64 allocsBefore = allocationCount.load(std::memory_order_relaxed);
+        timer.start();
+        r.items = run();
+        qint64 ns = timer.nsecsElapsed();
+        if (r.runs > 0) r.allocs += allocationCount.load(std::memory_order_relaxed) - allocsBefore;
+        r.totalNs += ns;
+        r.bestNs = (r.runs == 0) ? ns : qMin(r.bestNs, ns);
+        ++r.runs;
+    }
+    return r;
+}
+
+QMouseEvent mouseEvent(QEvent::Type type, const QPoint& pos, Qt::MouseButton button,
+                       Qt::MouseButtons buttons) {
+    return QMouseEvent(type, QPointF(pos), QPointF(pos), button, buttons, Qt::NoModifier);
+}
+
+} // namespace
+
+// --- Canvas Bench ---
+
+// Holds a canvas over a synthetic document and drives its private hot
+// paths directly (friend of Canvas), so each number covers one path.
+class CanvasBench {
+public:
+    CanvasBench(int shapeCount, qint64 minNs, bool baseline)
+        : shapeCount(shapeCount), minNs(minNs), baseline(baseline), rng(42) {
+        buildDocument();
+        canvas.resize(VIEW_WIDTH, VIEW_HEIGHT);
+        canvas.coalesceMoves = false; // Замеряем саму обработку каждого движения
+        canvas.guidesEnabled = false; // Направляющие - отдельным замером
+        // Вид 1:1 на центр схемы
+        canvas.setView(QPointF(VIEW_WIDTH / 2.0, VIEW_HEIGHT / 2.0) - world.center(), 1.0);
+    }
+
+    void run(std::vector<BenchResult>& out) {
+        out.push_back(benchShapeAt());
+        if (baseline) out.push_back(benchShapeAtBaseline());
+        out.push_back(benchHandleAt());
+        if (baseline) out.push_back(benchHandleAtBaseline());
+        out.push_back(benchHover());
+        out.push_back(benchHoverShape());
+        out.push_back(benchPaint("paint", false));
+        out.push_back(benchPaint("paint_fit", true));
+        out.push_back(benchFrame());
+        out.push_back(benchMarquee());
+        if (baseline) out.push_back(benchMarqueeBaseline());
+        out.push_back(benchMarqueeLive(MarqueeMode::Contain, "marquee_live"));
+        out.push_back(benchMarqueeLive(MarqueeMode::Intersect, "marquee_live_touch"));
+        out.push_back(benchMove());
+        out.push_back(benchGroupMove());
+        out.push_back(benchGroupFrame());
+        out.push_back(benchGuidesBuild("guides_build", 1.0));
+        out.push_back(benchGuidesBuild("guides_build_half", 0.5));
+        out.push_back(benchGuidesBuild("guides_build_fit", 0)); // Мелкие схемы - без обзора, видно все
+        out.push_back(benchGuides("guides", 1.0));
+        out.push_back(benchGuides("guides_half", 0.5));
+        out.push_back(benchPagedView());
+        out.push_back(benchResize()); // Меняет геометрию фигур
+        out.push_back(benchReroute()); // Последним: добавляет связи
+    }
+
+private:
+    /**
+     * @brief Строит схему: фигуры равномерно по квадрату, три стиля.
+     */
+    void buildDocument() {
+        int side = qMax(VIEW_WIDTH, int(std::sqrt(double(shapeCount)) * SHAPE_SPACING));
+        world = QRectF(0, 0, side, side);
+
+        StyleTable& styles = canvas.doc.getStyles();
+        ShapeStyle filled;
+        filled.fill = QColor(200, 220, 255);
+        ShapeStyle dashed;
+        dashed.strokeStyle = Qt::DashLine;
+        StyleIndex styleSet[3] = {0, styles.intern(filled), styles.intern(dashed)};
+
+        std::uniform_int_distribution<int> pos(0, side - MAX_SHAPE_SIZE);
+        std::uniform_int_distribution<int> extent(MIN_SHAPE_SIZE, MAX_SHAPE_SIZE);
+        std::vector<ShapeType> types(shapeCount);
+        std::vector<QPoint> p1s(shapeCount), p2s(shapeCount);
+        std::vector<StyleIndex> styleIdx(shapeCount);
+        for (int i = 0; i < shapeCount; ++i) {
+            types[i] = ShapeType(i % 3); // Line, Rectangle, Circle поровну
+            p1s[i] = QPoint(pos(rng), pos(rng));
+            p2s[i] = p1s[i] + QPoint(extent(rng), extent(rng));
+            styleIdx[i] = styleSet[(i / 3) % 3];
+        }
+        canvas.doc.assign(std::move(types), std::move(p1s), std::move(p2s), std::move(styleIdx));
+    }
+
+    QPoint randomPoint() {
+        std::uniform_int_distribution<int> d(0, int(world.width()) - 1);
+        return QPoint(d(rng), d(rng));
+    }
+
+    QRect marqueeRect() const {
+        qreal side = world.width() * std::sqrt(MARQUEE_FRACTION);
+        QRectF r(0, 0, side, side);
+        r.moveCenter(world.center());
+        return r.toRect();
+    }
+
+    BenchResult benchShapeAt() {
+        queryPoints.resize(POINT_QUERIES);
+        for (QPoint& p : queryPoints) p = randomPoint();
+        BenchResult r = measure("shapeAt", shapeCount, POINT_QUERIES, minNs, [&]() {
+            qint64 hits = 0;
+            for (const QPoint& p : queryPoints) hits += canvas.shapeAt(p) != NoShape;
+            return hits;
+        });
+        r.zeroAlloc = true;
+        return r;
+    }
+
+    /**
+     * @brief Те же точки, что в shapeAt, но перебором всех слотов сверху вниз.
+     */
+    BenchResult benchShapeAtBaseline() {
+        const Document& doc = canvas.doc;
+        const qreal m = canvas.toWorldLength(LINE_HIT_THRESHOLD);
+        BenchResult r = measure("shapeAt_baseline", shapeCount, POINT_QUERIES, minNs, [&]() {
+            qint64 hits = 0;
+            for (const QPoint& p : queryPoints) {
+                for (int i = doc.size() - 1; i >= 0; --i) {
+                    if (!doc.boundsAt(i).adjusted(-m, -m, m, m).contains(p)) continue;
+                    if (Geometry::hitTest(doc.shapeInSlot(i), p, m)) {
+                        ++hits;
+                        break;
+                    }
+                }
+            }
+            return hits;
+        });
+        r.zeroAlloc = true;
+        return r;
+    }
+
+    BenchResult benchHandleAt() {
+        // Выделяем случайные фигуры и целимся в угол (конец) каждой
+        std::uniform_int_distribution<int> d(0, shapeCount - 1);
+        handleShapes.clear();
+        handlePoints.clear();
+        for (int i = 0; i < HANDLE_QUERIES; ++i) {
+            int slot = d(rng);
+            handleShapes.push_back(canvas.doc.idAt(slot));
+            handlePoints.push_back(canvas.doc.p2At(slot));
+        }
+        return measureHandleAt("getHandleAt");
+    }
+
+    /**
+     * @brief Те же выделение и точки, что в getHandleAt, без индекса.
+     */
+    BenchResult benchHandleAtBaseline() {
+        canvas.doc.setIndexEnabled(false);
+        BenchResult r = measureHandleAt("getHandleAt_baseline");
+        canvas.doc.setIndexEnabled(true);
+        return r;
+    }
+
+    BenchResult measureHandleAt(const QString& name) {
+        for (ShapeId id : handleShapes) canvas.selection.insert(id);
+        BenchResult r = measure(name, shapeCount, (qint64)handlePoints.size(), minNs, [&]() {
+            qint64 hits = 0;
+            for (const QPoint& p : handlePoints) hits += canvas.getHandleAt(p).first != NoShape;
+            return hits;
+        });
+        r.zeroAlloc = true;
+        canvas.selection.clear();
+        return r;
+    }
+
+    BenchResult benchHover() {
+        // Курсор ползет по пикселю вдоль диагонали вида, как при ведении мышью;
+        // items - сколько раз пришлось заново делать hit-test
+        QPoint from(VIEW_WIDTH / 4, VIEW_HEIGHT / 4);
+        return measure("hover", shapeCount, HOVER_STEPS, minNs, [&]() {
+            canvas.hover.valid = false;
+            qint64 misses = 0;
+            for (int i = 0; i < HOVER_STEPS; ++i) {
+                QPoint pos = from + QPoint(i % (VIEW_WIDTH / 2), (i / 3) % (VIEW_HEIGHT / 2));
+                QRect before = canvas.hover.region;
+                canvas.updateCursorIcon(canvas.toWorld(pos));
+                misses += canvas.hover.region != before;
+            }
+            return misses;
+        });
+    }
+
+    BenchResult benchHoverShape() {
+        // Курсор дрожит над одной фигурой, а кэш наведения сброшен на каждом
+        // шаге (как после правки схемы): весь hit-test и подбор курсора
+        // идут заново, но курсор тот же - выделений быть не должно
+        QPoint center = canvas.toWorld(QPoint(VIEW_WIDTH / 2, VIEW_HEIGHT / 2));
+        ShapeId target = NoShape;
+        for (int r = SHAPE_SPACING; target == NoShape && r <= 8 * SHAPE_SPACING; r *= 2) {
+            canvas.doc.query(QRectF(center - QPoint(r, r), QSizeF(2 * r, 2 * r)), [&](ShapeId id) {
+                if (target == NoShape && canvas.doc.getType(id) == ShapeType::Rectangle) target = id;
+            });
+        }
+        if (target == NoShape) return BenchResult{"hover_shape", shapeCount};
+        QPoint inside = canvas.doc.getBounds(target).center().toPoint();
+        BenchResult r = measure("hover_shape", shapeCount, HOVER_STEPS, minNs, [&]() {
+            qint64 hits = 0;
+            for (int i = 0; i < HOVER_STEPS; ++i) {
+                canvas.hover.valid = false;
+                canvas.updateCursorIcon(inside + QPoint(i % 3 - 1, (i / 3) % 3 - 1));
+                hits += canvas.hover.cursor != Qt::ArrowCursor;
+            }
+            return hits;
+        });
+        r.zeroAlloc = true;
+        return r;
+    }
+
+    BenchResult benchPaint(const QString& name, bool fit) {
+        QPointF pan = canvas.panOffset;
+        qreal zoom = canvas.zoom;
+        if (fit) canvas.zoomToFit();
+        QImage frame(VIEW_WIDTH, VIEW_HEIGHT, QImage::Format_ARGB32_Premultiplied);
+        BenchResult r = measure(name, shapeCount, 1, minNs, [&]() {
+            canvas.render(&frame); // Полный paintEvent в QImage
+            return qint64(0);
+        });
+        canvas.setView(pan, zoom);
+        return r;
+    }
+
+    BenchResult benchFrame() {
+        // Кадр 1:1 с выделением (рамки и ручки) одним и тем же QPainter -
+        // как paintEvent, но без создания QPainter, которое выделяет сам Qt
+        selectMarquee();
+        QImage frame(VIEW_WIDTH, VIEW_HEIGHT, QImage::Format_ARGB32_Premultiplied);
+        QPainter painter(&frame);
+        const QRect full(0, 0, VIEW_WIDTH, VIEW_HEIGHT);
+        BenchResult r = measure("frame", shapeCount, 1, minNs, [&]() {
+            painter.resetTransform();
+            canvas.paintScene(&painter, full);
+            return qint64(canvas.visibleShapes.size());
+        });
+        r.zeroAlloc = true;
+        canvas.selection.clear();
+        return r;
+    }
+
+    BenchResult benchMarquee(const QString& name = "marquee") {
+        // Рамка на всю площадь одним шагом
+        QRect rect = marqueeRect();
+        QMouseEvent release = mouseEvent(QEvent::MouseButtonRelease, QPoint(), Qt::LeftButton, Qt::NoButton);
+        return measure(name, shapeCount, 1, minNs, [&]() {
+            canvas.beginMarquee(rect.topLeft(), false);
+            canvas.updateMarquee(rect.bottomRight());
+            canvas.mouseReleaseEvent(&release);
+            return qint64(canvas.selection.size());
+        });
+    }
+
+    /**
+     * @brief Та же рамка тем же путем, что в marquee, но без индекса.
+     */
+    BenchResult benchMarqueeBaseline() {
+        canvas.doc.setIndexEnabled(false);
+        BenchResult r = benchMarquee("marquee_baseline");
+        canvas.doc.setIndexEnabled(true);
+        return r;
+    }
+
+    BenchResult benchMarqueeLive(MarqueeMode mode, const QString& name) {
+        // Рамка растет из угла до полной за DRAG_STEPS шагов и сжимается
+        // обратно: каждый шаг выделяет или снимает одну полосу фигур
+        QRect rect = marqueeRect();
+        QMouseEvent release = mouseEvent(QEvent::MouseButtonRelease, QPoint(), Qt::LeftButton, Qt::NoButton);
+        canvas.setMarqueeMode(mode);
+        BenchResult r = measure(name, shapeCount, 2 * DRAG_STEPS, minNs, [&]() {
+            canvas.beginMarquee(rect.topLeft(), false);
+            qint64 selected = 0;
+            for (int i = 1; i <= 2 * DRAG_STEPS; ++i) {
+                int k = i <= DRAG_STEPS ? i : 2 * DRAG_STEPS + 1 - i;
+                canvas.updateMarquee(rect.topLeft() + (rect.bottomRight() - rect.topLeft()) * k / DRAG_STEPS);
+                selected += canvas.selection.size();
+            }
+            canvas.mouseReleaseEvent(&release);
+            return selected;
+        });
+        canvas.setMarqueeMode(MarqueeMode::Contain);
+        canvas.clearSelection();
+        return r;
+    }
+
+    // Выделяет все фигуры под рамкой (для move и resize)
+    void selectMarquee() {
+        canvas.clearSelection();
+        QRect rect = marqueeRect();
+        canvas.doc.query(QRectF(rect), [&](ShapeId id) {
+            if (rect.contains(canvas.doc.getBounds(id).toRect())) canvas.selection.insert(id);
+        });
+    }
+
+    BenchResult benchMove() {
+        selectMarquee();
+        // Туда-обратно на шаг сетки: схема в итоге не меняется
+        QPoint from = canvas.view.map(world.center()).toPoint();
+        QPoint step(canvas.gridSize, 0);
+        BenchResult r = measure("move", shapeCount, DRAG_STEPS, minNs, [&]() {
+            canvas.beginMove(canvas.toWorld(from));
+            for (int i = 0; i < DRAG_STEPS; ++i) {
+                QPoint pos = (i % 2 == 0) ? from + step : from;
+                QMouseEvent move = mouseEvent(QEvent::MouseMove, pos, Qt::NoButton, Qt::LeftButton);
+                canvas.mouseMoveEvent(&move);
+            }
+            canvas.moving = false;
+            return qint64(canvas.selection.size());
+        });
+        return r;
+    }
+
+    // Объединяет фигуры под рамкой в одну свернутую группу и выделяет ее
+    GroupId groupMarquee() {
+        selectMarquee();
+        GroupRecord rec;
+        rec.shapes = canvas.selection.getItems();
+        GroupId g = canvas.doc.addGroup(rec);
+        if (g != NoGroup) canvas.selectUnit(g, true);
+        return g;
+    }
+
+    BenchResult benchGroupMove() {
+        // То же перетаскивание, что и move, но фигуры - одна свернутая группа:
+        // шаг сдвигает только ее картинку, фигуры сдвигаются при отпускании
+        GroupId g = groupMarquee();
+        if (g == NoGroup) return BenchResult{"group_move", shapeCount};
+        QPoint from = canvas.view.map(world.center()).toPoint();
+        QPoint step(canvas.gridSize, 0);
+        BenchResult r = measure("group_move", shapeCount, DRAG_STEPS, minNs, [&]() {
+            canvas.beginMove(canvas.toWorld(from));
+            for (int i = 0; i < DRAG_STEPS; ++i) {
+                QPoint pos = (i % 2 == 0) ? from + step : from;
+                QMouseEvent move = mouseEvent(QEvent::MouseMove, pos, Qt::NoButton, Qt::LeftButton);
+                canvas.mouseMoveEvent(&move);
+            }
+            canvas.moving = false;
+            canvas.finishUnitMove();
+            return qint64(canvas.selection.size());
+        });
+        canvas.doc.removeGroup(g);
+        canvas.clearSelection();
+        return r;
+    }
+
+    BenchResult benchGroupFrame() {
+        // Кадр 1:1, как frame, но фигуры под рамкой - одна выделенная
+        // свернутая группа, которая проигрывается из картинки
+        GroupId g = groupMarquee();
+        if (g == NoGroup) return BenchResult{"group_frame", shapeCount};
+        QImage frame(VIEW_WIDTH, VIEW_HEIGHT, QImage::Format_ARGB32_Premultiplied);
+        QPainter painter(&frame);
+        const QRect full(0, 0, VIEW_WIDTH, VIEW_HEIGHT);
+        BenchResult r = measure("group_frame", shapeCount, 1, minNs, [&]() {
+            painter.resetTransform();
+            canvas.paintScene(&painter, full);
+            return qint64(canvas.visibleShapes.size() + canvas.visibleUnits.size());
+        });
+        painter.end();
+        canvas.doc.removeGroup(g);
+        canvas.pruneGroupPictures();
+        canvas.clearSelection();
+        return r;
+    }
+
+    /**
+     * @brief Вид на центр схемы в масштабе zoom (0 - "Вписать").
+     */
+    void setZoom(qreal zoom) {
+        if (zoom > 0) {
+            canvas.setView(QPointF(VIEW_WIDTH / 2.0, VIEW_HEIGHT / 2.0) - world.center() * zoom, zoom);
+        } else {
+            canvas.zoomToFit();
+        }
+    }
+
+    BenchResult benchGuidesBuild(const QString& name, qreal zoom) {
+        // Индекс по видимой части без выделенных - в начале каждого перетаскивания
+        QPointF pan = canvas.panOffset;
+        qreal oldZoom = canvas.zoom;
+        selectMarquee();
+        setZoom(zoom);
+        canvas.guidesEnabled = true;
+        QPoint focus = canvas.toWorld(QPoint(VIEW_WIDTH / 2, VIEW_HEIGHT / 2));
+        BenchResult r = measure(name, shapeCount, 1, minNs, [&]() {
+            canvas.prepareSnap(true, focus);
+            return qint64(canvas.snapIndex.getLineCount());
+        });
+        r.budgetNs = GUIDE_BUDGET_NS;
+        canvas.guidesEnabled = false;
+        canvas.selection.clear();
+        canvas.setView(pan, oldZoom);
+        return r;
+    }
+
+    BenchResult benchGuides(const QString& name, qreal zoom) {
+        // Рамки в видимой части - как выделение на каждом шаге перетаскивания;
+        // items - сколько раз сработала привязка
+        QPointF pan = canvas.panOffset;
+        qreal oldZoom = canvas.zoom;
+        setZoom(zoom);
+        canvas.guidesEnabled = true;
+        canvas.prepareSnap(false, canvas.toWorld(QPoint(VIEW_WIDTH / 2, VIEW_HEIGHT / 2)));
+        QRectF visible = canvas.snapIndex.getArea();
+        int tolerance = qCeil(canvas.toWorldLength(GUIDE_TOLERANCE));
+        std::uniform_real_distribution<qreal> x(visible.left(), visible.right());
+        std::uniform_real_distribution<qreal> y(visible.top(), visible.bottom());
+        std::uniform_real_distribution<qreal> extent(MIN_SHAPE_SIZE, MAX_SHAPE_SIZE * 4);
+        std::vector<QRectF> rects(GUIDE_QUERIES);
+        for (QRectF& rect : rects) rect = QRectF(x(rng), y(rng), extent(rng), extent(rng));
+        BenchResult r = measure(name, shapeCount, GUIDE_QUERIES, minNs, [&]() {
+            qint64 snapped = 0;
+            for (const QRectF& rect : rects) {
+                SnapResult s = canvas.snapIndex.snapRect(rect, tolerance);
+                snapped += s.snappedX + s.snappedY;
+            }
+            return snapped;
+        });
+        r.zeroAlloc = true;
+        r.budgetNs = GUIDE_BUDGET_NS;
+        canvas.snapIndex.clear();
+        canvas.guidesEnabled = false;
+        canvas.setView(pan, oldZoom);
+        return r;
+    }
+
+    /**
+     * @brief Проход вида 1:1 по диагонали страничной копии схемы.
+     *
+     * Схема сохраняется в .bsg, по ней строится файл страниц, лимит
+     * памяти - PAGED_MEMORY. На каждом шаге перебираются фигуры вида,
+     * как при отрисовке. items - прочитанные с диска страницы: при
+     * лимите меньше схемы они вытесняются и читаются снова.
+     */
+    BenchResult benchPagedView() {
+        QTemporaryDir temp;
+        QString pagePath = temp.filePath("bench.bsgp");
+        PagedDocument paged;
+        paged.setMemoryLimit(PAGED_MEMORY);
+        QString error;
+        if (!buildPaged(temp, pagePath, &error) || !paged.open(pagePath, &error)) {
+            std::fprintf(stderr, "paged_view skipped: %s\n", qPrintable(error));
+            return BenchResult{"paged_view", shapeCount};
+        }
+        QRectF view(world.topLeft(), QSizeF(VIEW_WIDTH, VIEW_HEIGHT));
+        QPointF step = QPointF(world.width() - VIEW_WIDTH, world.height() - VIEW_HEIGHT) / PAN_STEPS;
+        return measure("paged_view", shapeCount, PAN_STEPS, minNs, [&]() {
+            qint64 loads = paged.getLoadCount();
+            for (int i = 0; i < PAN_STEPS; ++i) {
+                paged.query(view.translated(step * i), [](const PagedShape&) {});
+            }
+            return paged.getLoadCount() - loads;
+        });
+    }
+
+    /**
+     * @brief Сохраняет схему в .bsg во временную папку и строит по ней файл страниц.
+     */
+    bool buildPaged(const QTemporaryDir& temp, const QString& pagePath, QString* error) {
+        QString schemePath = temp.filePath("bench.bsg");
+        return temp.isValid() && DocumentIO::saveBinary(canvas.doc, schemePath, error) &&
+               PagedDocument::build(schemePath, pagePath, error);
+    }
+
+    BenchResult benchResize() {
+        selectMarquee();
+        if (canvas.selection.isEmpty()) return BenchResult{"resize", shapeCount};
+        ShapeId primary = *canvas.selection.begin();
+        bool isLine = canvas.doc.getType(primary) == ShapeType::Line;
+        QPoint corner = canvas.doc.getShape(primary).bounds().bottomRight().toPoint();
+        return measure("resize", shapeCount, DRAG_STEPS, minNs, [&]() {
+            canvas.beginResize(primary, isLine ? HandlePosition::End : HandlePosition::BottomRight);
+            for (int i = 0; i < DRAG_STEPS; ++i) {
+                canvas.applyResize(corner + QPoint(i * canvas.gridSize, i * canvas.gridSize), Qt::NoModifier);
+            }
+            canvas.resizing = false;
+            canvas.resizeIds.clear();
+            return qint64(canvas.selection.size());
+        });
+    }
+
+    BenchResult benchReroute() {
+        // Блок у центра схемы, связанный с HUB_CONNECTORS ближайшими блоками
+        std::vector<ShapeId> blocks;
+        QRectF around(world.center() - QPointF(400, 400), QSizeF(800, 800));
+        canvas.doc.query(around, [&](ShapeId id) {
+            if (isBlock(canvas.doc.getType(id))) blocks.push_back(id);
+        });
+        if (blocks.size() < 2) return BenchResult{"reroute", shapeCount};
+        std::sort(blocks.begin(), blocks.end());
+        ShapeId hub = blocks.front();
+        for (int i = 0; i < HUB_CONNECTORS; ++i) {
+            ShapeId target = blocks[1 + i % (blocks.size() - 1)];
+            Shape s{ShapeType::Connector, QRect(), QPoint(), QPoint()};
+            s.link = ConnectorLink{hub, target, Port(i % 4), Port((i + 2) % 4)};
+            s.start = Geometry::portPoint(canvas.doc.getBounds(hub), s.link.fromPort);
+            s.end = Geometry::portPoint(canvas.doc.getBounds(target), s.link.toPort);
+            canvas.doc.addShape(s);
+        }
+
+        // Как при перетаскивании: сдвиг блока, растянутые маршруты и задания,
+        // затем сами маршруты (в редакторе их строит поток роутера)
+        canvas.clearSelection();
+        canvas.selection.insert(hub);
+        QPoint from = canvas.view.map(canvas.doc.getBounds(hub).center()).toPoint();
+        QPoint step(canvas.gridSize, canvas.gridSize);
+        OrthogonalRouter router;
+        std::vector<QPoint> route;
+        return measure("reroute", shapeCount, DRAG_STEPS, minNs, [&]() {
+            canvas.beginMove(canvas.toWorld(from));
+            qint64 routed = 0;
+            for (int i = 0; i < DRAG_STEPS; ++i) {
+                QPoint pos = (i % 2 == 0) ? from + step : from;
+                QMouseEvent move = mouseEvent(QEvent::MouseMove, pos, Qt::NoButton, Qt::LeftButton);
+                canvas.mouseMoveEvent(&move);
+                for (ShapeId id : canvas.doc.getConnectors(hub)) {
+                    RouteJob job = Routing::makeJob(canvas.doc, id, canvas.gridSize);
+                    routed += router.route(job, route);
+                    canvas.doc.setRoute(id, std::move(route));
+                }
+            }
+            canvas.moving = false;
+            return routed;
+        });
+    }
+
+    int shapeCount;
+    qint64 minNs;
+    bool baseline;                   // Добавлять замеры перебором (--baseline)
+    std::mt19937 rng;
+    std::vector<QPoint> queryPoints; // Точки shapeAt, общие с shapeAt_baseline
+    std::vector<ShapeId> handleShapes; // Выделение getHandleAt, общее с getHandleAt_baseline
+    std::vector<QPoint> handlePoints;
+    QRectF world;
+    Canvas canvas;
+};
+
+// --- Layout Bench ---
+
+/**
+ * @brief Раскладка блок-схемы из blockCount блоков.
+ *
+ * Граф как у сгенерированных по коду схем: цепочка блоков с ветвлениями
+ * (ромб "если - иначе") и циклами (обратная связь к началу тела).
+ */
+static BenchResult benchLayout(int blockCount, qint64 minNs) {
+    Document doc;
+    std::mt19937 rng(7);
+    std::vector<ShapeId> blocks(blockCount);
+    for (ShapeId& id : blocks) {
+        id = doc.addShape(Shape{ShapeType::Rectangle, QRect(0, 0, 120, 60), QPoint(), QPoint()});
+    }
+    auto connect = [&](int from, int to) {
+        Shape s{ShapeType::Connector, QRect(), QPoint(), QPoint()};
+        s.link = ConnectorLink{blocks[from], blocks[to], Port::Bottom, Port::Top};
+        doc.addShape(s);
+    };
+    for (int v = 1; v < blockCount;) {
+        int kind = rng() % 10;
+        if (kind < 6 || v + 3 >= blockCount) {
+            connect(v - 1, v);
+            v += 1;
+        } else if (kind < 8) {
+            connect(v - 1, v);
+            connect(v - 1, v + 1);
+            connect(v, v + 2);
+            connect(v + 1, v + 2);
+            v += 3;
+        } else {
+            int body = 1 + rng() % 3;
+            for (int k = 0; k < body; ++k) connect(v - 1 + k, v + k);
+            connect(v + body - 1, v - 1);
+            v += body;
+        }
+    }
+
+    LayoutOptions options;
+    LayoutResult layout;
+    return measure("layout", blockCount, 1, minNs, [&]() {
+        Layout::layered(doc, blocks, options, layout);
+        return qint64(layout.layers);
+    });
+}
+
+int main(int argc, char *argv[]) {
+    // Без дисплея: --headless нужно разобрать до создания QApplication
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--headless") == 0) {
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+        }
+    }
+    QApplication app(argc, argv);
+    QCoreApplication::setApplicationName("bsgbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks BlockSchemeGenerator canvas hot paths.");
+    parser.addHelpOption();
+    QCommandLineOption headlessOpt("headless", "Run without a display (offscreen platform).");
+    QCommandLineOption outputOpt({"o", "output"}, "Write JSON results to a file (default: stdout).", "file");
+    QCommandLineOption sizesOpt("sizes", "Comma-separated shape counts (default: 1000,10000,100000,1000000).",
+                                "list", "1000,10000,100000,1000000");
+    QCommandLineOption minTimeOpt("min-time", "Minimum time per benchmark in ms (default: 200).", "ms", "200");
+    parser.addOption(headlessOpt);
+    parser.addOption(outputOpt);
+    parser.addOption(sizesOpt);
+    QCommandLineOption baselineOpt("baseline", "Also run shapeAt and marquee as full scans without the index.");
+    parser.addOption(minTimeOpt);
+    parser.addOption(baselineOpt);
+    parser.process(app);
+
+    std::vector<int> sizes;
+    for (const QString& s : parser.value(sizesOpt).split(',', Qt::SkipEmptyParts)) {
+        int n = s.trimmed().toInt();
+        if (n <= 0) {
+            std::fprintf(stderr, "Invalid size '%s'\n", qPrintable(s));
+            return 2;
+        }
+        sizes.push_back(n);
+    }
+    qint64 minNs = qint64(qMax(1, parser.value(minTimeOpt).toInt())) * 1000000;
+
+    std::vector<BenchResult> results;
+    for (int n : sizes) {
+        std::fprintf(stderr, "%d shapes...\n", n);
+        size_t first = results.size();
+        CanvasBench(n, minNs, parser.isSet(baselineOpt)).run(results);
+        results.push_back(benchLayout(n, minNs));
+        for (size_t i = first; i < results.size(); ++i) {
+            const BenchResult& r = results[i];
+            std::fprintf(stderr, "  %-12s %12.0f ns/op  %8.2f allocs/op  (%d runs)\n", qPrintable(r.name),
+                         r.nsPerOp(),
+                         r.allocsPerOp(), r.runs);
+        }
+    }
+
+    // Горячие пути без выделений памяти и в пределах времени: нарушение - ошибка
+    int status = 0;
+    for (const BenchResult& r : results) {
+        if (r.zeroAlloc && r.allocs > 0) {
+            std::fprintf(stderr, "%s (%d shapes) allocates in steady state: %.2f allocs/op\n",
+                         qPrintable(r.name), r.shapes, r.allocsPerOp());
+            status = 1;
+        }
+        if (r.budgetNs > 0 && r.nsPerOp() > r.budgetNs) {
+            std::fprintf(stderr, "%s (%d shapes) is over budget: %.0f ns/op > %lld ns/op\n",
+                         qPrintable(r.name), r.shapes, r.nsPerOp(), (long long)r.budgetNs);
+            status = 1;
+        }
+    }
+
+    QJsonArray list;
+    for (const BenchResult& r : results) {
+        if (r.runs > 0) list.append(r.toJson());
+    }
+    QJsonObject root;
+    root["tool"] = "bsgbench";
+    root["version"] = QString(PROJECT_VERSION_STRING);
+    root["qt"] = qVersion();
+    root["platform"] = QGuiApplication::platformName();
+    root["cpu"] = QSysInfo::currentCpuArchitecture();
+    root["threads"] = QThread::idealThreadCount();
+    root["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    root["results"] = list;
+    QByteArray json = QJsonDocument(root).toJson();
+
+    QString outPath = parser.value(outputOpt);
+    if (outPath.isEmpty()) {
+        std::fwrite(json.constData(), 1, json.size(), stdout);
+        return status;
+    }
+    QFile file(outPath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+        std::fprintf(stderr, "Cannot write %s\n", qPrintable(outPath));
+        return 1;
+    }
+    return status;
+}
@@ -0,0 +1,192 @@
+// bsggen - пакетная генерация блок-схем по исходному коду.
+//
+//   bsggen [-o <dir>] [-f bsg|json] [-p] [-j <jobs>] <files or dirs>...
+//
+// По каждому файлу строится схема (по одной блок-схеме на функцию) и
+// сохраняется рядом с ним или в <dir> (с подпапкой файла относительно
+// аргумента). Файлы обрабатываются параллельно, каждый читается потоком
+// через один буфер - размер входа не ограничен.
+// Диалект - по расширению (.txt, .pseudo, .alg, .kum - псевдокод), с -p
+// все файлы считаются псевдокодом.
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QHash>
+#include <QSet>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <cstdio>
+#include <vector>
+#include "documentio.h"
+#include "flowchartgen.h"
+
+namespace {
+
+const QStringList SOURCE_PATTERNS = {"*.c", "*.h", "*.cpp", "*.hpp", "*.cc", "*.java", "*.js",
+                                     "*.cs", "*.txt", "*.pseudo", "*.alg", "*.kum"};
+
+// Один исходный файл
+struct GenJob {
+    QString input;
+    QString output;
+    FlowchartStats stats;
+    bool ok = false;
+    QString error;
+};
+
+// Входной файл и его путь относительно аргумента, в котором он нашелся
+struct InputFile {
+    QString path;
+    QString relative; // Под -o повторяется в выходной папке
+};
+
+/**
+ * @brief Разворачивает аргументы (файлы и папки) в список исходников.
+ *
+ * Файлы, указанные явно, берутся с любым расширением.
+ */
+std::vector<InputFile> collectInputs(const QStringList& args) {
+    std::vector<InputFile> files;
+    QSet<QString> seen; // Файл, попавший в два аргумента, - один раз
+    auto add = [&](const QString& path, const QString& relative) {
+        QString key = QFileInfo(path).absoluteFilePath();
+        if (seen.contains(key)) return;
+        seen.insert(key);
+        files.push_back(InputFile{path, relative});
+    };
+    for (const QString& arg : args) {
+        QFileInfo fi(arg);
+        if (fi.isDir()) {
+            QDir root(arg);
+            QDirIterator it(arg, SOURCE_PATTERNS, QDir::Files, QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                QString file = it.next();
+                add(file, root.relativeFilePath(file));
+            }
+        } else if (fi.isFile()) {
+            add(fi.filePath(), fi.fileName());
+        } else {
+            std::fprintf(stderr, "Skipping %s: no such file\n", qPrintable(arg));
+        }
+    }
+    return files;
+}
+
+/**
+ * @brief Пути результатов: рядом с входным файлом или в outDir, с его
+ *        подпапкой относительно аргумента.
+ *
+ * Выход - имя с расширением исходника: a.c и a.h не затирают друг друга.
+ * Совпасть могут только одноименные файлы из разных аргументов - задания
+ * идут параллельно и затерли бы друг друга, поэтому это ошибка до
+ * начала работы.
+ */
+bool assignOutputs(std::vector<GenJob>& jobs, const std::vector<InputFile>& inputs, const QString& outDir,
+                   const QString& format) {
+    QHash<QString, QString> owners; // Выход -> вход
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        QFileInfo fi(inputs[i].path);
+        QDir dir = fi.dir();
+        if (!outDir.isEmpty()) {
+            dir = QDir(QDir(outDir).filePath(QFileInfo(inputs[i].relative).path()));
+            if (!dir.mkpath(".")) {
+                std::fprintf(stderr, "Cannot create %s\n", qPrintable(dir.path()));
+                return false;
+            }
+        }
+        jobs[i].input = inputs[i].path;
+        jobs[i].output = dir.filePath(fi.fileName() + "." + format);
+        QString key = QDir::cleanPath(QFileInfo(jobs[i].output).absoluteFilePath());
+        if (owners.contains(key)) {
+            std::fprintf(stderr, "%s and %s would both be written to %s\n", qPrintable(owners.value(key)),
+                         qPrintable(inputs[i].path), qPrintable(jobs[i].output));
+            return false;
+        }
+        owners.insert(key, inputs[i].path);
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("bsggen");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Generates BlockSchemeGenerator flowcharts from source code.");
+    parser.addHelpOption();
+    QCommandLineOption outputOpt({"o", "output"}, "Output directory (default: next to each input).", "dir");
+    QCommandLineOption formatOpt({"f", "format"}, "Output format: bsg or json (default: bsg).",
+                                 "format", "bsg");
+    QCommandLineOption pseudoOpt({"p", "pseudo"}, "Read every input as pseudocode.");
+    QCommandLineOption jobsOpt({"j", "jobs"}, "Parallel jobs (default: number of cores).", "jobs");
+    parser.addOption(outputOpt);
+    parser.addOption(formatOpt);
+    parser.addOption(pseudoOpt);
+    parser.addOption(jobsOpt);
+    parser.addPositionalArgument("inputs", "Source files or directories.", "<inputs...>");
+    parser.process(app);
+
+    QString format = parser.value(formatOpt).toLower();
+    if (format != "bsg" && format != "json") {
+        std::fprintf(stderr, "Unknown format '%s' (expected bsg or json)\n", qPrintable(format));
+        return 2;
+    }
+    SourceDialect dialect = parser.isSet(pseudoOpt) ? SourceDialect::Pseudo : SourceDialect::Auto;
+    if (parser.isSet(jobsOpt)) {
+        int jobs = parser.value(jobsOpt).toInt();
+        if (jobs > 0) QThreadPool::globalInstance()->setMaxThreadCount(jobs);
+    }
+
+    std::vector<InputFile> inputs = collectInputs(parser.positionalArguments());
+    if (inputs.empty()) {
+        parser.showHelp(2);
+    }
+
+    QString outDir = parser.value(outputOpt);
+    if (!outDir.isEmpty() && !QDir().mkpath(outDir)) {
+        std::fprintf(stderr, "Cannot create %s\n", qPrintable(outDir));
+        return 2;
+    }
+
+    std::vector<GenJob> jobs(inputs.size());
+    if (!assignOutputs(jobs, inputs, outDir, format)) return 2;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Каждое задание - свой документ, общих данных нет
+    QtConcurrent::blockingMap(jobs, [&](GenJob& job) {
+        Document doc;
+        FlowchartOptions options;
+        options.layout.trials = 1; // Ядра и так заняты другими файлами
+        FlowchartGenerator generator(doc, options);
+        if (!generator.generateFile(job.input, dialect, &job.error)) return;
+        job.stats = generator.getStats();
+        job.ok = DocumentIO::save(doc, job.output, &job.error);
+    });
+
+    int failed = 0;
+    FlowchartStats total;
+    for (const GenJob& job : jobs) {
+        if (!job.ok) {
+            std::fprintf(stderr, "FAILED %s: %s\n", qPrintable(job.input), qPrintable(job.error));
+            failed++;
+            continue;
+        }
+        total.bytes += job.stats.bytes;
+        total.charts += job.stats.charts;
+        total.blocks += job.stats.blocks;
+        total.connectors += job.stats.connectors;
+    }
+    std::printf("Generated %d of %d files: %d charts, %d blocks, %d connectors from %.1f MB "
+                "in %.2f s (%d threads)\n",
+                int(jobs.size()) - failed, int(jobs.size()), total.charts, total.blocks,
+                total.connectors, total.bytes / 1048576.0, timer.elapsed() / 1000.0,
+                QThreadPool::globalInstance()->maxThreadCount());
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,289 @@
+// bsgrender - пакетный рендеринг схем в PNG/SVG/TIFF/raw без дисплея.
+//
+//   bsgrender [-o <dir>] [-f png|svg|tiff|raw] [-s <scale>] [-j <jobs>]
+//             [-t [--tile-size <px>]] [-l] [--memory-limit <MB>] <files or dirs>...
+//
+// Каждый документ загружается и рисуется независимо, документы
+// обрабатываются параллельно на всех ядрах. В тайловом режиме (-t, для
+// tiff и raw - всегда) документы идут по одному, а параллельно рисуются
+// тайлы одного изображения - так экспортируются схемы любого размера.
+// С -o картинки ложатся в <dir> с подпапками схем относительно
+// аргумента; два входа с одним выходом - ошибка.
+// С -l блоки сначала раскладываются по слоям (как кнопка "Раскладка").
+// С --memory-limit схема (.bsg) не загружается целиком: по ней строится
+// временный файл страниц, и тайлы рисуются из PagedDocument в пределах
+// лимита - для схем больше памяти. Связи тогда рисуются "локтями".
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QHash>
+#include <QSet>
+#include <QTemporaryDir>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <cstdio>
+#include <vector>
+#include "documentio.h"
+#include "pageddocument.h"
+#include "sceneexport.h"
+#include "layout.h"
+#include "router.h"
+
+namespace {
+
+const int ROUTE_GRID = 20; // Шаг решетки маршрутов связей - как сетка редактора
+
+// Одна схема для рендеринга
+struct RenderJob {
+    QString input;
+    QString output;
+    bool ok = false;
+    QString error;
+};
+
+// Входной файл и его путь относительно аргумента, в котором он нашелся
+struct InputFile {
+    QString path;
+    QString relative; // Под -o повторяется в выходной папке
+};
+
+bool isSchemeFile(const QFileInfo& fi) {
+    QString suffix = fi.suffix().toLower();
+    return suffix == "bsg" || suffix == "json";
+}
+
+/**
+ * @brief Готовит загруженную схему к рендерингу: раскладка (по желанию)
+ *        и маршруты связей - в файле они не хранятся.
+ */
+void prepare(Document& doc, bool layout, int layoutTrials) {
+    if (layout) {
+        std::vector<ShapeId> blocks;
+        for (int slot = 0; slot < doc.size(); ++slot) blocks.push_back(doc.idAt(slot));
+        LayoutOptions options;
+        options.gridSize = ROUTE_GRID;
+        options.trials = layoutTrials;
+        LayoutResult result;
+        if (Layout::layered(doc, blocks, options, result)) Layout::apply(doc, result);
+    }
+    Routing::routeAll(doc, ROUTE_GRID);
+}
+
+/**
+ * @brief Тайловый экспорт схемы через файл страниц во временной папке.
+ */
+bool renderPaged(const RenderJob& job, const ExportOptions& options, qint64 memoryLimit, QString* error) {
+    if (QFileInfo(job.input).suffix().toLower() != "bsg") {
+        *error = "--memory-limit needs a binary scheme (.bsg)";
+        return false;
+    }
+    QTemporaryDir temp;
+    if (!temp.isValid()) {
+        *error = QString("Cannot create a temporary directory: %1").arg(temp.errorString());
+        return false;
+    }
+    QString pagePath = temp.filePath("scheme.bsgp");
+    if (!PagedDocument::build(job.input, pagePath, error)) return false;
+    PagedDocument doc;
+    doc.setMemoryLimit(memoryLimit);
+    if (!doc.open(pagePath, error)) return false;
+    return SceneExport::saveTiled(doc, job.output, options, error);
+}
+
+/**
+ * @brief Разворачивает аргументы (файлы и папки) в список схем.
+ */
+std::vector<InputFile> collectInputs(const QStringList& args) {
+    std::vector<InputFile> files;
+    QSet<QString> seen; // Файл, попавший в два аргумента, - один раз
+    auto add = [&](const QString& path, const QString& relative) {
+        QString key = QFileInfo(path).absoluteFilePath();
+        if (seen.contains(key)) return;
+        seen.insert(key);
+        files.push_back(InputFile{path, relative});
+    };
+    for (const QString& arg : args) {
+        QFileInfo fi(arg);
+        if (fi.isDir()) {
+            QDir root(arg);
+            QDirIterator it(arg, QStringList{"*.bsg", "*.json"}, QDir::Files,
+                            QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                QString file = it.next();
+                add(file, root.relativeFilePath(file));
+            }
+        } else if (isSchemeFile(fi)) {
+            add(fi.filePath(), fi.fileName());
+        } else {
+            std::fprintf(stderr, "Skipping %s: not a scheme file\n", qPrintable(arg));
+        }
+    }
+    return files;
+}
+
+/**
+ * @brief Пути результатов: рядом с входным файлом или в outDir, с его
+ *        подпапкой относительно аргумента.
+ *
+ * Разные схемы не должны писать в один файл (a.bsg и a.json рядом, два
+ * аргумента с одинаковыми именами): задания идут параллельно и затерли
+ * бы друг друга. Такое совпадение - ошибка до начала работы.
+ */
+bool assignOutputs(std::vector<RenderJob>& jobs, const std::vector<InputFile>& inputs, const QString& outDir,
+                   const QString& format) {
+    QHash<QString, QString> owners; // Выход -> вход
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        QFileInfo fi(inputs[i].path);
+        QDir dir = fi.dir();
+        if (!outDir.isEmpty()) {
+            dir = QDir(QDir(outDir).filePath(QFileInfo(inputs[i].relative).path()));
+            if (!dir.mkpath(".")) {
+                std::fprintf(stderr, "Cannot create %s\n", qPrintable(dir.path()));
+                return false;
+            }
+        }
+        jobs[i].input = inputs[i].path;
+        jobs[i].output = dir.filePath(fi.completeBaseName() + "." + format);
+        QString key = QDir::cleanPath(QFileInfo(jobs[i].output).absoluteFilePath());
+        if (owners.contains(key)) {
+            std::fprintf(stderr, "%s and %s would both be written to %s\n", qPrintable(owners.value(key)),
+                         qPrintable(inputs[i].path), qPrintable(jobs[i].output));
+            return false;
+        }
+        owners.insert(key, inputs[i].path);
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    // Рисуем только в QImage/QSvgGenerator - окна не нужны
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication app(argc, argv);
+    QCoreApplication::setApplicationName("bsgrender");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders BlockSchemeGenerator schemes to PNG, SVG, TIFF or raw RGBA.");
+    parser.addHelpOption();
+    QCommandLineOption outputOpt({"o", "output"}, "Output directory (default: next to each input).", "dir");
+    QCommandLineOption formatOpt({"f", "format"}, "Output format: png, svg, tiff or raw (default: png).",
+                                 "format", "png");
+    QCommandLineOption scaleOpt({"s", "scale"}, "Pixels per document unit (default: 1).", "scale", "1");
+    QCommandLineOption jobsOpt({"j", "jobs"}, "Parallel jobs (default: number of cores).", "jobs");
+    QCommandLineOption tiledOpt({"t", "tiled"}, "Tiled export streamed to disk, no image size limit.");
+    QCommandLineOption tileSizeOpt("tile-size", "Tile side in pixels for tiled export (default: 512).",
+                                   "px", "512");
+    QCommandLineOption layoutOpt({"l", "layout"}, "Lay the blocks out in layers before rendering.");
+    QCommandLineOption memoryOpt("memory-limit",
+                                 "Render .bsg schemes out of core through a page file, within this "
+                                 "much memory (implies -t).", "MB");
+    parser.addOption(outputOpt);
+    parser.addOption(formatOpt);
+    parser.addOption(scaleOpt);
+    parser.addOption(jobsOpt);
+    parser.addOption(tiledOpt);
+    parser.addOption(tileSizeOpt);
+    parser.addOption(layoutOpt);
+    parser.addOption(memoryOpt);
+    parser.addPositionalArgument("inputs", "Scheme files (.bsg, .json) or directories.", "<inputs...>");
+    parser.process(app);
+
+    QString format = parser.value(formatOpt).toLower();
+    if (format != "png" && format != "svg" && format != "tiff" && format != "raw") {
+        std::fprintf(stderr, "Unknown format '%s' (expected png, svg, tiff or raw)\n", qPrintable(format));
+        return 2;
+    }
+    bool paged = parser.isSet(memoryOpt);
+    bool tiled = parser.isSet(tiledOpt) || paged || format == "tiff" || format == "raw";
+    bool layout = parser.isSet(layoutOpt);
+    qint64 memoryLimit = 0;
+    if (paged) {
+        int mb = parser.value(memoryOpt).toInt();
+        if (mb <= 0) {
+            std::fprintf(stderr, "Invalid memory limit '%s'\n", qPrintable(parser.value(memoryOpt)));
+            return 2;
+        }
+        if (layout) {
+            std::fprintf(stderr, "Layout needs the whole scheme in memory and cannot be used with --memory-limit\n");
+            return 2;
+        }
+        memoryLimit = qint64(mb) << 20;
+    }
+    if (tiled && format == "svg") {
+        std::fprintf(stderr, "SVG is vector output and cannot be tiled\n");
+        return 2;
+    }
+    ExportOptions options;
+    bool scaleOk = false;
+    options.scale = parser.value(scaleOpt).toDouble(&scaleOk);
+    if (!scaleOk || options.scale <= 0) {
+        std::fprintf(stderr, "Invalid scale '%s'\n", qPrintable(parser.value(scaleOpt)));
+        return 2;
+    }
+    options.tileSize = parser.value(tileSizeOpt).toInt();
+    if (options.tileSize <= 0) {
+        std::fprintf(stderr, "Invalid tile size '%s'\n", qPrintable(parser.value(tileSizeOpt)));
+        return 2;
+    }
+    if (parser.isSet(jobsOpt)) {
+        int jobs = parser.value(jobsOpt).toInt();
+        if (jobs > 0) QThreadPool::globalInstance()->setMaxThreadCount(jobs);
+    }
+
+    std::vector<InputFile> inputs = collectInputs(parser.positionalArguments());
+    if (inputs.empty()) {
+        parser.showHelp(2);
+    }
+
+    QString outDir = parser.value(outputOpt);
+    if (!outDir.isEmpty() && !QDir().mkpath(outDir)) {
+        std::fprintf(stderr, "Cannot create %s\n", qPrintable(outDir));
+        return 2;
+    }
+
+    std::vector<RenderJob> jobs(inputs.size());
+    if (!assignOutputs(jobs, inputs, outDir, format)) return 2;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if (tiled) {
+        // Параллельно рисуются тайлы внутри saveTiled, документы - по очереди
+        for (RenderJob& job : jobs) {
+            if (paged) {
+                job.ok = renderPaged(job, options, memoryLimit, &job.error);
+                continue;
+            }
+            Document doc;
+            if (!DocumentIO::load(job.input, doc, &job.error)) continue;
+            prepare(doc, layout, 0);
+            job.ok = SceneExport::saveTiled(doc, job.output, options, &job.error);
+        }
+    } else {
+        // Каждое задание - свой документ и свой QPainter, общих данных нет
+        QtConcurrent::blockingMap(jobs, [&](RenderJob& job) {
+            Document doc;
+            if (!DocumentIO::load(job.input, doc, &job.error)) return;
+            prepare(doc, layout, 1); // Ядра и так заняты другими документами
+            job.ok = (format == "svg") ? SceneExport::saveSvg(doc, job.output, options, &job.error)
+                                       : SceneExport::savePng(doc, job.output, options, &job.error);
+        });
+    }
+
+    int failed = 0;
+    for (const RenderJob& job : jobs) {
+        if (job.ok) continue;
+        std::fprintf(stderr, "FAILED %s: %s\n", qPrintable(job.input), qPrintable(job.error));
+        failed++;
+    }
+    std::printf("Rendered %d of %d schemes in %.2f s (%d threads)\n",
+                int(jobs.size()) - failed, int(jobs.size()), timer.elapsed() / 1000.0,
+                QThreadPool::globalInstance()->maxThreadCount());
+    return failed == 0 ? 0 : 1;
+}
@@ -1,12 +1,90 @@
 #include "canvas.h"
+#include "documentio.h"
+#include "flowchartgen.h"
+#include "layout.h"
+#include "tracer.h"
 #include <QApplication>
 #include <algorithm>
 #include <QDebug>
 #include <QtMath> // Для qRound и qMax
+#include <QElapsedTimer>
+#include <QScopeGuard>
+#include <QScreen>
+#include <cmath>
 
 // Глобальные константы
+// Размеры ниже - в пикселях экрана, при любом масштабе
 const int HANDLE_SIZE = 8;
 const int CLICK_THRESHOLD = 5; // Порог "клика" (в пикселях)
+const int LINE_HIT_THRESHOLD = 5; // Порог попадания в линию (в пикселях)
+const int DAMAGE_MARGIN = HANDLE_SIZE + 2; // Запас под рамку выделения и ручки
+const int SELECTION_FRAME_GAP = 3; // Отступ рамки выделения от фигуры
+const qreal MIN_ZOOM = 0.001;
+const qreal MAX_ZOOM = 32.0;
+const qreal ZOOM_STEP = 1.25; // Масштаб за один "щелчок" колеса
+const qreal MIN_GRID_SPACING = 4; // Более частую сетку не рисуем (в пикселях)
+const int FRAME_STATS_PERIOD = 120; // Раз во сколько кадров печатать статистику
+const int MAX_DAMAGE_SHAPES = 256; // Больше фигур - проще перерисовать весь виджет
+const int FIT_MARGIN = 20; // Поля при "Вписать" (в пикселях)
+const int GUIDE_SNAP_PX = 6; // Порог привязки к краям и центрам других фигур (в пикселях)
+const qreal MARQUEE_SLACK = 2; // Запас полос рамки на округление границ фигур (в мировых единицах)
+
+// Уровни детализации при уменьшении (размеры - в пикселях экрана)
+const qreal LOD_SPLAT_PX = 1.5; // Фигура мельче - рисуется точкой
+const qreal LOD_BOX_PX = 4; // Эллипс мельче - рисуется рамкой
+const qreal LOD_TEXT_PX = 5; // Шрифт мельче - надписи не рисуются
+const qreal HANDLES_MIN_ZOOM = 0.3; // При меньшем масштабе ручки не показываем
+const qreal OVERVIEW_MAX_ZOOM = 0.5; // Обзор по карте плотности - только мельче этого
+const int OVERVIEW_MIN_SHAPES = 20000; // ... и только для больших схем
+const qreal OVERVIEW_CELL_PX = 3; // Ячейка карты плотности на экране не мельче
+const int OVERVIEW_MAX_SELECTION = 10000; // Больше выделенных - рамки в обзоре не рисуем
+const qreal DENSITY_SATURATION = 4; // Столько фигур в ячейке дают ~63% непрозрачности
+const int HUD_PERIOD_MS = 500; // Как часто обновляются цифры HUD
+const int HUD_MARGIN = 6;
+const qreal HOVER_REGION_PX = 16; // Наибольший полуразмер области, где курсор не пересчитывается
+
+/**
+ * @brief Перо толщиной 1 пиксель экрана при любом масштабе.
+ */
+static QPen cosmeticPen(const QColor& color, Qt::PenStyle style) {
+    QPen pen(color, 1, style);
+    pen.setCosmetic(true);
+    return pen;
+}
+
+/**
+ * @brief На сколько можно сдвинуть p (по любой оси), не пересекая границу rect.
+ *
+ * Снаружи - расстояние до прямоугольника, внутри - до ближайшего края.
+ */
+static qreal edgeDistance(const QRectF& rect, const QPointF& p) {
+    qreal dx = qMax(rect.left() - p.x(), p.x() - rect.right());
+    qreal dy = qMax(rect.top() - p.y(), p.y() - rect.bottom());
+    return qAbs(qMax(dx, dy));
+}
+
+/**
+ * @brief Часть a вне b - не больше четырех полос (сверху, снизу, слева, справа).
+ *
+ * @return Число полос в out.
+ */
+static int subtractRect(const QRectF& a, const QRectF& b, QRectF out[4]) {
+    if (a.isEmpty()) return 0;
+    QRectF common = a & b;
+    if (common.isEmpty()) {
+        out[0] = a;
+        return 1;
+    }
+    int n = 0;
+    if (common.top() > a.top()) out[n++] = QRectF(a.left(), a.top(), a.width(), common.top() - a.top());
+    if (common.bottom() < a.bottom())
+        out[n++] = QRectF(a.left(), common.bottom(), a.width(), a.bottom() - common.bottom());
+    if (common.left() > a.left())
+        out[n++] = QRectF(a.left(), common.top(), common.left() - a.left(), common.height());
+    if (common.right() < a.right())
+        out[n++] = QRectF(common.right(), common.top(), a.right() - common.right(), common.height());
+    return n;
+}
 
 //==================================================================
 // 1. Public-функции (Конструктор и Сеттеры)
@@ -18,7 +96,35 @@ const int CLICK_THRESHOLD = 5; // Порог "клика" (в пикселях)
 Canvas::Canvas(QWidget *parent) : QWidget(parent) {
     setMouseTracking(true);
     setFocusPolicy(Qt::StrongFocus);
+    setAttribute(Qt::WA_OpaquePaintEvent); // Фон заливаем сами (только грязную область)
     setTool(Tool::Select); // Устанавливаем инструмент по умолчанию
+
+    // Замер времени кадра (для профилирования): BSG_FRAME_STATS=1
+    // BSG_GRID_LINES=1 возвращает старую отрисовку сетки линиями - для сравнения
+    frameStatsEnabled = qEnvironmentVariableIntValue("BSG_FRAME_STATS") != 0;
+    gridLinesMode = qEnvironmentVariableIntValue("BSG_GRID_LINES") != 0;
+
+    // Фигуры рисует отдельный поток, виджет только показывает готовый кадр
+    setAsyncRendering(qEnvironmentVariableIntValue("BSG_ASYNC_RENDER") != 0);
+
+    // Трассировка событий с самого старта (BSG_TRACE=1) и HUD (BSG_HUD=1)
+    if (qEnvironmentVariableIntValue("BSG_TRACE") != 0) Trace::setEnabled(true);
+    connect(&hudTimer, &QTimer::timeout, this, &Canvas::updateHud);
+    setHudEnabled(qEnvironmentVariableIntValue("BSG_HUD") != 0);
+
+    selectionPen = cosmeticPen(Qt::blue, Qt::DashLine);
+    previewPen = cosmeticPen(Qt::gray, Qt::DashLine);
+    guidePen = cosmeticPen(QColor(230, 0, 140), Qt::SolidLine);
+    handleBrush = QBrush(Qt::blue);
+    marqueeBrush = QBrush(QColor(0, 0, 255, 30));
+
+    // Движения мыши обрабатываются не чаще раза за кадр экрана;
+    // BSG_COALESCE_MOVES=0 обрабатывает каждое событие - для сравнения
+    coalesceMoves = !qEnvironmentVariableIsSet("BSG_COALESCE_MOVES") ||
+                    qEnvironmentVariableIntValue("BSG_COALESCE_MOVES") != 0;
+    moveTimer.setSingleShot(true);
+    moveTimer.setTimerType(Qt::PreciseTimer);
+    connect(&moveTimer, &QTimer::timeout, this, &Canvas::flushMove);
 }
 
 /**
@@ -51,6 +157,350 @@ void Canvas::setSnapEnabled(bool enabled) {
     snapEnabled = enabled;
 }
 
+/**
+ * @brief Включает или выключает привязку к краям и центрам других фигур.
+ */
+void Canvas::setGuidesEnabled(bool enabled) {
+    guidesEnabled = enabled;
+    if (!enabled) {
+        clearGuides();
+        snapIndex.clear();
+    }
+}
+
+/**
+ * @brief Выделять рамкой фигуры целиком внутри нее или все, которых она касается.
+ */
+void Canvas::setMarqueeMode(MarqueeMode mode) {
+    marqueeMode = mode;
+}
+
+/**
+ * @brief Количество выделенных фигур.
+ */
+int Canvas::getSelectedCount() const {
+    return selection.size();
+}
+
+/**
+ * @brief Сохраняет схему в файл (формат по расширению: .json или бинарный).
+ */
+bool Canvas::saveDocument(const QString& path, QString* error) const {
+    return DocumentIO::save(doc, path, error);
+}
+
+/**
+ * @brief Загружает схему из файла, заменяя текущую.
+ *
+ * Выделение и история отмены сбрасываются - старые id больше не действуют.
+ */
+bool Canvas::loadDocument(const QString& path, QString* error) {
+    Document loaded;
+    if (!DocumentIO::load(path, loaded, error)) return false;
+
+    auto notify = qScopeGuard([this] { flushSelectionChanged(); });
+    drawing = moving = resizing = selecting = connecting = false;
+    marqueeAdded.clear();
+    resizingShape = NoShape;
+    connectFrom = NoShape;
+    pendingRoutes.clear(); // Маршруты старого документа больше не нужны
+    resizeIds.clear();
+    resizeOriginal.clear();
+    moveTotal = QPoint();
+    moveShapes.clear();
+    moveUnits.clear();
+    moveLinks.clear();
+    moveHidden.clear();
+    groupPictures.clear();
+    if (!selection.isEmpty()) {
+        selection.clear();
+        selectionChangedPending = true;
+    }
+    undoStack.clear();
+
+    // Стиль новых фигур переносим в таблицу нового документа
+    ShapeStyle style = doc.getStyles().getStyle(currentStyle);
+    doc = std::move(loaded);
+    currentStyle = doc.getStyles().intern(style);
+
+    // Маршруты не сохраняются - прокладываем их заново
+    for (int slot = 0; slot < doc.size(); ++slot) {
+        if (doc.typeAt(slot) == ShapeType::Connector) staleConnectors.push_back(doc.idAt(slot));
+    }
+    rerouteStale();
+    update();
+    return true;
+}
+
+/**
+ * @brief Строит блок-схемы по исходному коду и добавляет их справа от схемы.
+ *
+ * Новые фигуры выделяются; импорт - одна команда отмены.
+ */
+bool Canvas::importSource(const QString& path, QString* error) {
+    if (isBusy()) return false;
+
+    FlowchartOptions options;
+    options.layout.gridSize = gridSize;
+    QRectF extent = doc.getExtent();
+    if (!extent.isNull()) {
+        int x = (int)std::ceil(extent.right() / gridSize) * gridSize + options.chartGap;
+        options.origin = QPoint(x, (int)std::floor(extent.top() / gridSize) * gridSize);
+    }
+    FlowchartGenerator generator(doc, options);
+    bool ok = generator.generateFile(path, SourceDialect::Auto, error);
+
+    const std::vector<ShapeId>& created = generator.getCreated();
+    if (created.empty()) return ok;
+    std::vector<RestoredShape> shapes;
+    shapes.reserve(created.size());
+    for (ShapeId id : created) shapes.push_back(RestoredShape{doc.slotOf(id), id, doc.getShape(id)});
+
+    auto notify = qScopeGuard([this] { flushSelectionChanged(); });
+    if (!selection.isEmpty()) {
+        selection.clear();
+        selectionChangedPending = true;
+    }
+    for (ShapeId id : created) setSelected(id, true);
+    invalidateShapes(created);
+    for (ShapeId id : created) {
+        if (doc.getType(id) == ShapeType::Connector) staleConnectors.push_back(id);
+    }
+    rerouteStale();
+    undoStack.push(std::make_unique<CreateShapesCommand>(std::move(shapes)));
+    return ok;
+}
+
+/**
+ * @brief Устанавливает стиль для новых фигур.
+ *
+ * Стиль регистрируется в общей таблице, фигура хранит только его индекс.
+ */
+void Canvas::setShapeStyle(const ShapeStyle& style) {
+    currentStyle = doc.getStyles().intern(style);
+}
+
+/**
+ * @brief Устанавливает бюджет памяти истории отмены (в байтах).
+ */
+void Canvas::setUndoByteLimit(size_t bytes) {
+    undoStack.setByteLimit(bytes);
+}
+
+/**
+ * @brief Отменяет последнее действие (Ctrl+Z).
+ */
+void Canvas::undo() {
+    stepHistory(false);
+}
+
+/**
+ * @brief Повторяет отмененное действие (Ctrl+Shift+Z).
+ */
+void Canvas::redo() {
+    stepHistory(true);
+}
+
+/**
+ * @brief Включает отрисовку фигур в отдельном потоке (BSG_ASYNC_RENDER=1).
+ */
+void Canvas::setAsyncRendering(bool enabled) {
+    if (enabled == (renderThread != nullptr)) return;
+    if (enabled) {
+        renderThread = new RenderThread(this);
+        // Кадр готов - показываем его (сигнал приходит из другого потока)
+        connect(renderThread, &RenderThread::frameReady, this, [this]() { update(); });
+    } else {
+        delete renderThread; // Дожидается конца текущего кадра
+        renderThread = nullptr;
+    }
+    frameRequested = false;
+    update();
+}
+
+/**
+ * @brief Показывает или прячет HUD: время кадра, частота событий, число фигур.
+ */
+void Canvas::setHudEnabled(bool enabled) {
+    if (enabled == hudEnabled) return;
+    hudEnabled = enabled;
+    hudFrames = hudEvents = 0;
+    hudFrameNs = hudFrameMaxNs = 0;
+    hudText.clear();
+    if (enabled) {
+        hudElapsed.start();
+        hudTimer.start(HUD_PERIOD_MS);
+    } else {
+        hudTimer.stop();
+    }
+    update(hudRect());
+}
+
+/**
+ * @brief Подбирает масштаб и сдвиг так, чтобы вся схема была видна (Ctrl+0).
+ *
+ * Мелкие схемы не увеличиваются больше 100%.
+ */
+void Canvas::zoomToFit() {
+    if (isBusy()) return;
+    QRectF extent = doc.getExtent();
+    if (extent.isNull()) {
+        setView(QPointF(), 1.0);
+        update();
+        return;
+    }
+
+    qreal w = qMax(1, width() - 2 * FIT_MARGIN);
+    qreal h = qMax(1, height() - 2 * FIT_MARGIN);
+    qreal fit = qMin(w / qMax<qreal>(extent.width(), 1), h / qMax<qreal>(extent.height(), 1));
+    qreal newZoom = qBound(MIN_ZOOM, qMin(fit, 1.0), MAX_ZOOM);
+    setView(QPointF(width() / 2.0, height() / 2.0) - extent.center() * newZoom, newZoom);
+    update();
+}
+
+/**
+ * @brief Раскладывает блоки по слоям вместе со связями между ними.
+ *
+ * selectionOnly - только выделенные блоки: остальные остаются на месте,
+ * связи с ними в раскладке не участвуют. Раскладка - одна команда отмены.
+ */
+void Canvas::autoLayout(bool selectionOnly) {
+    if (isBusy()) return;
+
+    std::vector<ShapeId> blocks;
+    if (selectionOnly) {
+        blocks.assign(selection.begin(), selection.end());
+    } else {
+        for (int slot = 0; slot < doc.size(); ++slot) blocks.push_back(doc.idAt(slot));
+    }
+    LayoutOptions options;
+    options.gridSize = gridSize;
+    LayoutResult result;
+    if (!Layout::layered(doc, blocks, options, result)) return;
+
+    std::vector<QPoint> deltas(result.blocks.size());
+    for (size_t i = 0; i < result.blocks.size(); ++i) {
+        deltas[i] = result.positions[i] - doc.getBounds(result.blocks[i]).toRect().topLeft();
+    }
+    std::vector<ConnectorLink> oldLinks;
+    oldLinks.reserve(result.connectors.size());
+    for (ShapeId c : result.connectors) oldLinks.push_back(doc.getLink(c));
+    auto cmd = std::make_unique<LayoutCommand>(std::move(result.blocks), std::move(deltas),
+                                               std::move(result.connectors), std::move(oldLinks),
+                                               std::move(result.links));
+
+    // Вся схема - перекладываем все связи, без поиска по блокам
+    const std::vector<ShapeId>& ids = cmd->getShapes();
+    invalidateShapes(ids);
+    if (selectionOnly) {
+        for (ShapeId id : ids) markStale(id);
+    }
+    cmd->redo(doc);
+    invalidateShapes(ids);
+    if (selectionOnly) {
+        for (ShapeId id : ids) markStale(id);
+    } else {
+        for (int slot = 0; slot < doc.size(); ++slot) {
+            if (doc.typeAt(slot) == ShapeType::Connector) staleConnectors.push_back(doc.idAt(slot));
+        }
+    }
+    rerouteStale();
+    undoStack.push(std::move(cmd));
+}
+
+/**
+ * @brief Объединяет выделенные фигуры и свернутые группы в новую группу.
+ *
+ * Новая группа свернута и вкладывается в группу первого элемента;
+ * элементы из других групп в нее не попадают. Связь входит, только
+ * если выделены оба ее конца.
+ */
+void Canvas::groupSelection() {
+    if (isBusy() || selection.isEmpty()) return;
+
+    GroupRecord rec;
+    collectSelectedUnits(rec.subgroups);
+    for (ShapeId id : selection) {
+        if (doc.getUnit(id) != NoGroup) continue;
+        if (doc.getType(id) == ShapeType::Connector) {
+            const ConnectorLink& link = doc.getLink(id);
+            if (!selection.contains(link.from) || !selection.contains(link.to)) continue;
+        }
+        rec.shapes.push_back(id);
+    }
+    if (rec.shapes.size() + rec.subgroups.size() < 2) return;
+    rec.parent = !rec.subgroups.empty() ? doc.getParentGroup(rec.subgroups.front())
+                                        : doc.getGroup(rec.shapes.front());
+
+    auto notify = qScopeGuard([this] { flushSelectionChanged(); });
+    GroupId g = doc.addGroup(rec);
+    if (g == NoGroup) return;
+    GroupRecord added{g, doc.getParentGroup(g), true, doc.getGroupShapes(g), doc.getSubgroups(g)};
+    undoStack.push(std::make_unique<GroupCommand>(doc, std::vector<GroupRecord>{added}, true));
+
+    // Выделение - вся группа: отброшенные связи и фигуры тоже уходят
+    clearSelection();
+    selectUnit(g, true);
+    pruneGroupPictures();
+    update(damageRect(doc.getGroupBounds(g)));
+}
+
+/**
+ * @brief Расформировывает выделенные свернутые группы.
+ *
+ * Их элементы переходят к родительской группе и остаются выделенными.
+ */
+void Canvas::ungroupSelection() {
+    if (isBusy()) return;
+    std::vector<GroupId> units;
+    collectSelectedUnits(units);
+    if (units.empty()) return;
+
+    for (GroupId g : units) update(damageRect(doc.getGroupBounds(g)));
+    std::vector<GroupRecord> removed = doc.removeGroups(units); // Один пересчет верхних слотов
+    undoStack.push(std::make_unique<GroupCommand>(doc, std::move(removed), false));
+    pruneGroupPictures();
+    selectionChangedPending = true; // Рамки теперь у каждой фигуры
+    flushSelectionChanged();
+}
+
+/**
+ * @brief Раскрывает выделенные свернутые группы, а если их нет -
+ * сворачивает ближайшие группы выделенных фигур.
+ *
+ * Это вид, а не правка схемы: в историю отмены не попадает.
+ */
+void Canvas::toggleGroupsCollapsed() {
+    if (isBusy() || selection.isEmpty()) return;
+    std::vector<GroupId> targets;
+    collectSelectedUnits(targets);
+    bool collapse = targets.empty();
+    if (collapse) {
+        for (ShapeId id : selection) {
+            GroupId g = doc.getGroup(id);
+            if (g != NoGroup && std::find(targets.begin(), targets.end(), g) == targets.end()) {
+                targets.push_back(g);
+            }
+        }
+        if (targets.empty()) return;
+    }
+
+    auto notify = qScopeGuard([this] { flushSelectionChanged(); });
+    for (GroupId g : targets) {
+        update(damageRect(doc.getGroupBounds(g)));
+        doc.setGroupCollapsed(g, collapse);
+    }
+    // Свернутая группа выделяется целиком
+    if (collapse) {
+        for (GroupId g : targets) {
+            GroupId unit = doc.getUnit(doc.firstGroupShape(g));
+            if (unit != NoGroup) selectUnit(unit, true);
+        }
+    }
+    selectionChangedPending = true;
+    pruneGroupPictures();
+}
+
 //==================================================================
 // 2. Protected-функции (Главные обработчики событий)
 //==================================================================
@@ -59,249 +509,447 @@ void Canvas::setSnapEnabled(bool enabled) {
  * @brief Главная функция отрисовки.
  */
 void Canvas::paintEvent(QPaintEvent *e) {
+    BSG_TRACE_SCOPE("paint");
     QPainter p(this);
-    p.fillRect(rect(), Qt::white);
-    p.setRenderHint(QPainter::Antialiasing);
-
-    // 0. РИСУЕМ СЕТКУ (самый нижний слой)
-    if (gridEnabled) {
-        drawGrid(&p);
-    }
+    paintScene(&p, e->rect());
+}
 
-    // 1. РИСУЕМ ВСЕ ФИГУРЫ
-    for (const auto &s : shapes) {
-        QPen pen(Qt::black, 2); p.setPen(pen); p.setBrush(Qt::NoBrush);
-        switch (s.type) {
-        case ShapeType::Line: p.drawLine(s.start, s.end); break;
-        case ShapeType::Rectangle: p.drawRect(s.rect); break;
-        case ShapeType::Circle: p.drawEllipse(s.rect); break;
+/**
+ * @brief Рисует кадр: сетку, фигуры, выделение, предпросмотр, рамку и HUD.
+ *
+ * Перерисовываем только поврежденную область dirty - Qt уже обрезает
+ * рисование по региону события, а мы отсекаем фигуры вне dirty.
+ * В установившемся режиме кадр не выделяет память: буферы, перья и
+ * кисти переиспользуются (bsgbench проверяет это).
+ */
+void Canvas::paintScene(QPainter* painter, const QRect& dirty) {
+    QElapsedTimer frameTimer;
+    if (frameStatsEnabled || hudEnabled) frameTimer.start();
+
+    QPainter& p = *painter;
+
+    // 0. РИСУЕМ ФОН И СЕТКУ (самый нижний слой)
+    // Плитка сетки уже содержит белый фон, отдельная заливка не нужна
+    {
+        BSG_TRACE_SCOPE("grid");
+        if (gridEnabled && !gridLinesMode) {
+            drawGrid(&p, dirty);
+        } else {
+            p.fillRect(dirty, Qt::white);
+        }
+        p.setRenderHint(QPainter::Antialiasing);
+        if (gridEnabled && gridLinesMode) {
+            drawGridLines(&p, dirty);
         }
     }
+    qint64 gridNs = frameStatsEnabled ? frameTimer.nsecsElapsed() : 0;
+
+    // Дальше рисуем в мировых координатах
+    p.setTransform(view);
+
+    // 1-2. В асинхронном режиме фигуры и выделение рисует поток рендера,
+    // а здесь только копируется последний готовый кадр - тогда медленный
+    // кадр не задерживает обработку мыши. Обзор и так дешев - рисуем сразу
+    bool overview = isOverview();
+    if (renderThread && !overview) {
+        BSG_TRACE_SCOPE("shapes");
+        requestFrame();
+        renderThread->drawFrame(&p, view);
+    } else {
+        // Видимая (грязная) часть мира с запасом на перо и ручки
+        qreal margin = toWorldLength(DAMAGE_MARGIN) + doc.getStyles().getMaxStrokeWidth() / 2;
+        QRectF worldDirty = viewInverse.mapRect(QRectF(dirty)).adjusted(-margin, -margin, margin, margin);
+
+        // 1. РИСУЕМ ВСЕ ФИГУРЫ
+        // В обзоре большой схемы - готовой картой плотности (время кадра не
+        // зависит от числа фигур), иначе пакетами по стилю и типу; фигуры
+        // мельче пикселя становятся точками, мелкие эллипсы - рамками
+        visibleShapes.clear();
+        visibleUnits.clear();
+        if (overview) {
+            BSG_TRACE_SCOPE("shapes");
+            drawDensity(&p, worldDirty);
+        } else {
+            BSG_TRACE_SCOPE("shapes");
+            // Только фигуры, задевающие грязную область, по слоту - порядок наложения.
+            // Свернутая группа рисуется одним слоем - на высоте своей верхней фигуры
+            bool hide = !moveHidden.isEmpty();
+            doc.queryItems(worldDirty, [&](ShapeId id) {
+                if (!hide || !moveHidden.contains(id)) visibleShapes.push_back(doc.slotOf(id));
+            }, [this](GroupId g) {
+                if (!isUnitMoving(g)) visibleUnits.push_back(g);
+            });
+            std::sort(visibleShapes.begin(), visibleShapes.end());
+            std::sort(visibleUnits.begin(), visibleUnits.end(), [this](GroupId a, GroupId b) {
+                return doc.getGroupTopSlot(a) < doc.getGroupTopSlot(b);
+            });
+            applyDetailLimits();
+            size_t drawn = 0;
+            for (GroupId g : visibleUnits) {
+                size_t below = std::lower_bound(visibleShapes.begin() + drawn, visibleShapes.end(),
+                                                doc.getGroupTopSlot(g)) - visibleShapes.begin();
+                renderer.drawShapes(&p, doc, visibleShapes.data() + drawn, int(below - drawn));
+                drawn = below;
+                drawUnit(&p, g, worldDirty, QPoint());
+            }
+            renderer.drawShapes(&p, doc, visibleShapes.data() + drawn, int(visibleShapes.size() - drawn));
+        }
 
-    // 2. РИСУЕМ ВЫДЕЛЕНИЕ И РУЧКИ
-    // Рисуем выделение если: активен инструмент выделения, идет moving/resizing,
-    // ИЛИ есть хотя бы одна выделенная фигура
-    bool hasSelection = std::any_of(shapes.begin(), shapes.end(),
-                                    [](const Shape& s) { return s.selected; });
-
-    if (currentTool == Tool::Select || moving || resizing || hasSelection) {
-        QPen selectionPen(Qt::blue, 1, Qt::DashLine);
-        QBrush handleBrush(Qt::blue);
-        for (const auto &s : shapes) {
-            if (!s.selected) continue;
-            QRectF b = s.bounds();
-
+        // 2. РИСУЕМ ВЫДЕЛЕНИЕ И РУЧКИ
+        // Рамки и ручки собираем в массивы и рисуем двумя вызовами drawRects
+        // Рамка и ручки имеют постоянный экранный размер (косметическое перо)
+        BSG_TRACE_SCOPE("selection");
+        collectSelection(worldDirty, overview);
+        if (!selectionFrames.empty()) {
             p.setPen(selectionPen);
             p.setBrush(Qt::NoBrush);
-            p.drawRect(b.adjusted(-3, -3, 3, 3)); // Рамка выделения
-
+            p.drawRects(selectionFrames.data(), (int)selectionFrames.size());
+        }
+        if (!selectionHandles.empty()) {
             p.setPen(Qt::NoPen);
             p.setBrush(handleBrush);
-            auto handles = getResizeHandles(s);
-            for (const QRectF& handleRect : handles.values()) {
-                p.drawRect(handleRect); // Ручки ресайза
-            }
+            p.drawRects(selectionHandles.data(), (int)selectionHandles.size());
         }
     }
 
+    // Перетаскиваемые группы - их картинки со сдвигом, поверх остального
+    if (!moveUnits.empty()) {
+        BSG_TRACE_SCOPE("units");
+        qreal margin = toWorldLength(DAMAGE_MARGIN) + doc.getStyles().getMaxStrokeWidth() / 2;
+        drawMovingUnits(&p, viewInverse.mapRect(QRectF(dirty)).adjusted(-margin, -margin, margin, margin));
+    }
+
     // 3. РИСУЕМ ПРЕДПРОСМОТР РИСОВАНИЯ
     if (drawing) {
-        p.setPen(QPen(Qt::gray, 1, Qt::DashLine)); p.setBrush(Qt::NoBrush);
-
-        QPoint snappedLastPos = snapToGrid(lastMousePos);
+        BSG_TRACE_SCOPE("preview");
+        p.setPen(previewPen); p.setBrush(Qt::NoBrush);
 
         // Используем хелпер для Shift/Ctrl
-        QRect r = calculateRect(startPoint, snappedLastPos);
+        QRect r = calculateRect(startPoint, drawEnd);
 
         if (currentShape == ShapeType::Line) {
-            p.drawLine(startPoint, snappedLastPos);
+            p.drawLine(startPoint, drawEnd);
         } else if (currentShape == ShapeType::Rectangle) {
             p.drawRect(r); // Рисуем прямоугольник с учетом Shift/Ctrl
         } else if (currentShape == ShapeType::Circle) {
             p.drawEllipse(r); // Рисуем эллипс/круг с учетом Shift/Ctrl
+        } else if (currentShape == ShapeType::Diamond) {
+            QPoint c = r.center();
+            const QPoint corners[4] = {QPoint(c.x(), r.top()), QPoint(r.right(), c.y()),
+                                       QPoint(c.x(), r.bottom()), QPoint(r.left(), c.y())};
+            p.drawConvexPolygon(corners, 4);
         }
     }
+    if (connecting && connectPreview.size() >= 2) {
+        BSG_TRACE_SCOPE("preview");
+        p.setPen(previewPen); p.setBrush(Qt::NoBrush);
+        p.drawPolyline(connectPreview.data(), (int)connectPreview.size());
+    }
+
+    // Направляющие выравнивания при перетаскивании
+    if (guides.snappedX || guides.snappedY) {
+        BSG_TRACE_SCOPE("guides");
+        p.setPen(guidePen);
+        if (guides.snappedX) p.drawLine(guides.guideX);
+        if (guides.snappedY) p.drawLine(guides.guideY);
+    }
 
     // 4. РИСУЕМ ПРЯМОУГОЛЬНИК ВЫДЕЛЕНИЯ
     if (selecting) {
-        p.setPen(QPen(Qt::blue, 1, Qt::DashLine));
-        p.setBrush(QColor(0, 0, 255, 30));
+        BSG_TRACE_SCOPE("marquee");
+        p.setPen(selectionPen);
+        p.setBrush(marqueeBrush);
         p.drawRect(selectionRect);
     }
+
+    if (frameStatsEnabled) {
+        reportFrameStats(gridNs, frameTimer.nsecsElapsed());
+    }
+
+    // 5. HUD поверх всего (время этого кадра попадет в следующий отчет)
+    if (hudEnabled) {
+        qint64 ns = frameTimer.nsecsElapsed();
+        hudFrames++;
+        hudFrameNs += ns;
+        hudFrameMaxNs = qMax(hudFrameMaxNs, ns);
+        if (dirty.intersects(hudRect())) drawHud(&p);
+    }
 }
 
 /**
  * @brief Обрабатывает нажатие кнопки мыши.
  */
 void Canvas::mousePressEvent(QMouseEvent *event) {
-    if (event->button() != Qt::LeftButton)
+    BSG_TRACE_SCOPE("mousePress", "input");
+    hudEvents++;
+    flushMove(); // Нажатие - там, где мышь была в последний раз
+    // Панорамирование: инструмент "Рука" или средняя кнопка с любым инструментом
+    bool panButtonPressed = event->button() == Qt::MiddleButton ||
+                            (event->button() == Qt::LeftButton && currentTool == Tool::Hand);
+    if (panButtonPressed && !panning && !isBusy()) {
+        beginPan(event);
+        return;
+    }
+    if (event->button() != Qt::LeftButton || panning || currentTool == Tool::Hand)
         return;
 
-    lastMousePos = event->pos(); // Сохраняем *реальную* позицию
-    QPoint snappedPos = snapToGrid(event->pos()); // Используем *привязанную*
+    auto notify = qScopeGuard([this] { flushSelectionChanged(); });
+
+    QPoint pos = toWorld(event->pos()); // Дальше все в мировых координатах
+    lastMousePos = pos; // Сохраняем *реальную* позицию
+    QPoint snappedPos = snapToGrid(pos); // Используем *привязанную*
 
     if (currentTool == Tool::Select) {
         // Логика Tool::Select (без изменений)
-        auto [handleShape, handlePos] = getHandleAt(event->pos());
-        if (handleShape != nullptr) {
-            resizing = true;
-            resizingShape = handleShape;
-            currentResizeHandle = handlePos;
-            originalShapes.clear();
-            for (auto& s : shapes) {
-                if (s.selected) {
-                    s.originalRect = s.rect;
-                    s.originalStart = s.start;
-                    s.originalEnd = s.end;
-                    originalShapes.push_back(s);
-                }
-            }
-            update();
+        auto [handleShape, handlePos] = getHandleAt(pos);
+        if (handleShape != NoShape) {
+            beginResize(handleShape, handlePos);
             return;
         }
 
-        Shape* s = shapeAt(event->pos());
-        if (s) {
-            moving = true;
+        ShapeId s = shapeAt(pos);
+        if (s != NoShape) {
             if (event->modifiers() & Qt::ShiftModifier) {
-                s->selected = !s->selected;
-            } else if (!s->selected) {
-                for (auto &shape : shapes) shape.selected = false;
-                s->selected = true;
+                setItemSelected(s, !isSelected(s));
+            } else if (!isSelected(s)) {
+                clearSelection();
+                setItemSelected(s, true);
             }
-            update();
+            invalidateShape(s);
+            beginMove(pos);
             return;
         }
 
-        selecting = true;
-        selectionRect = QRect(snappedPos, QSize(0, 0));
-        if (!(event->modifiers() & Qt::ShiftModifier)) {
-            for (auto &shape : shapes) shape.selected = false;
-        }
-        update();
+        beginMarquee(snappedPos, event->modifiers() & Qt::ShiftModifier);
         return;
 
     } else if (currentTool == Tool::Draw) {
         // СНАЧАЛА проверяем ручки ресайза
-        auto [handleShape, handlePos] = getHandleAt(event->pos());
-        if (handleShape != nullptr) {
-            resizing = true;
-            resizingShape = handleShape;
-            currentResizeHandle = handlePos;
-            originalShapes.clear();
-            for (auto& s : shapes) {
-                if (s.selected) {
-                    s.originalRect = s.rect;
-                    s.originalStart = s.start;
-                    s.originalEnd = s.end;
-                    originalShapes.push_back(s);
-                }
-            }
-            update();
+        auto [handleShape, handlePos] = getHandleAt(pos);
+        if (handleShape != NoShape) {
+            beginResize(handleShape, handlePos);
             return;
         }
 
         // Затем проверяем, не попали ли в фигуру
-        Shape* s = shapeAt(event->pos());
-        if (s) {
+        ShapeId s = shapeAt(pos);
+        if (s != NoShape) {
             // Попали в фигуру: выделяем ее (как Tool::Select)
             if (event->modifiers() & Qt::ShiftModifier) {
-                s->selected = !s->selected;
-            } else if (!s->selected) {
-                for (auto &shape : shapes) shape.selected = false;
-                s->selected = true;
+                setItemSelected(s, !isSelected(s));
+            } else if (!isSelected(s)) {
+                clearSelection();
+                setItemSelected(s, true);
             }
+            invalidateShape(s);
 
             // Явно сбрасываем drawing и включаем moving
             drawing = false;
-            moving = true;
-
-            update();
+            beginMove(pos);
             return;
 
         } else {
             // Попали в пустое место: начинаем рисование
             drawing = true;
             moving = false;
-            startPoint = snappedPos;
-            for (auto &shape : shapes) shape.selected = false;
-            update();
+            clearSelection();
+            prepareSnap(false, pos);
+            startPoint = snapDrawPoint(pos);
+            drawEnd = startPoint;
+            previewRect = QRect();
             return;
         }
+
+    } else if (currentTool == Tool::Connect) {
+        // Связь тянется от блока, из ближайшего к курсору порта
+        ShapeId s = shapeAt(pos);
+        if (s == NoShape || !isBlock(doc.getType(s))) return;
+        connecting = true;
+        connectFrom = s;
+        connectFromPort = Geometry::nearestPort(doc.getBounds(s), pos);
+        previewRect = QRect();
+        updateConnectPreview(pos);
+        return;
     }
 }
 
 /**
  * @brief Обрабатывает движение мыши.
+ *
+ * Мышь (и особенно планшет) присылает события чаще, чем обновляется экран.
+ * Здесь только запоминается последняя позиция, а сама обработка
+ * (processMove) идет не чаще раза за кадр: сразу, если кадр с прошлой
+ * обработки уже прошел, иначе - по таймеру, с самой свежей позицией.
  */
 void Canvas::mouseMoveEvent(QMouseEvent *event) {
-    QPoint snappedPos = snapToGrid(event->pos());
+    BSG_TRACE_SCOPE("mouseMove", "input");
+    hudEvents++;
+    pendingMovePos = event->pos();
+    pendingMoveModifiers = event->modifiers();
+    if (movePending) return; // Таймер уже заведен, он возьмет эту позицию
+
+    qint64 wait = (coalesceMoves && moveClock.isValid()) ? frameIntervalMs() - moveClock.elapsed() : 0;
+    if (wait <= 0) {
+        processMove(pendingMovePos, pendingMoveModifiers);
+        return;
+    }
+    movePending = true;
+    moveTimer.start(int(wait));
+}
 
-    QPoint delta;
-    if (moving || resizing) { // Перемещение и ресайз всегда привязаны
-        delta = snappedPos - snapToGrid(lastMousePos);
-    } else {
-        delta = event->pos() - lastMousePos;
+/**
+ * @brief Обрабатывает отложенное движение мыши, если оно есть.
+ */
+void Canvas::flushMove() {
+    if (!movePending) return;
+    movePending = false;
+    moveTimer.stop();
+    processMove(pendingMovePos, pendingMoveModifiers);
+}
+
+/**
+ * @brief Обработка движения мыши: перетаскивание, рамка, предпросмотр, курсор.
+ */
+void Canvas::processMove(const QPoint& widgetPos, Qt::KeyboardModifiers modifiers) {
+    BSG_TRACE_SCOPE("processMove", "input");
+    moveClock.start();
+
+    // 0. ПАНОРАМИРОВАНИЕ (в пикселях виджета)
+    if (panning) {
+        QPoint d = widgetPos - panLastPos;
+        panLastPos = widgetPos;
+        panBy(d);
+        return;
     }
 
-    lastMousePos = event->pos();
+    QPoint pos = toWorld(widgetPos);
+    QPoint snappedPos = snapToGrid(pos);
+    lastMousePos = pos;
+    if (moving || resizing || drawing) refreshSnap();
 
     // 1. РЕСАЙЗ
+    // Ручка цепляется за линии других фигур по тем осям, по которым она ходит
     if (resizing) {
-        applyResize(snappedPos, event->modifiers());
+        if (!snapIndex.isEmpty()) {
+            HandlePosition h = currentResizeHandle;
+            bool alongX = h != HandlePosition::Top && h != HandlePosition::Bottom;
+            bool alongY = h != HandlePosition::Left && h != HandlePosition::Right;
+            SnapResult r = snapIndex.snapPoint(pos, qCeil(toWorldLength(GUIDE_SNAP_PX)), alongX, alongY);
+            if (r.snappedX) snappedPos.setX(pos.x() + r.offset.x());
+            if (r.snappedY) snappedPos.setY(pos.y() + r.offset.y());
+            setGuides(r);
+        }
+        applyResize(snappedPos, modifiers);
         return;
     }
 
     // 2. ПЕРЕМЕЩЕНИЕ
+    // Сдвиг от начала перетаскивания: по сетке, а по оси, где край или
+    // центр выделения рядом с линией другой фигуры, - точно на нее
     if (moving) {
+        QPoint target = snappedPos - snapToGrid(moveStart);
+        if (!snapIndex.isEmpty()) {
+            QPoint raw = pos - moveStart;
+            SnapResult r = snapIndex.snapRect(moveBounds.translated(raw), qCeil(toWorldLength(GUIDE_SNAP_PX)));
+            if (r.snappedX) target.setX(raw.x() + r.offset.x());
+            if (r.snappedY) target.setY(raw.y() + r.offset.y());
+            setGuides(r);
+        }
+        QPoint delta = target - moveTotal;
         if (delta.isNull()) return;
-
-        for (auto &s : shapes) {
-            if (!s.selected) continue;
-            if (s.type == ShapeType::Line) {
-                s.start += delta; s.end += delta;
-            } else {
-                s.rect.translate(delta);
+        invalidateMovingUnits(moveTotal); // Группы двигаются только сдвигом картинки
+        moveTotal += delta;
+        invalidateMovingUnits(moveTotal);
+
+        // Проходим только по перетаскиваемым фигурам, а не по всему документу.
+        // Связи не двигаются сами - они следуют за своими блоками.
+        // Карта плотности следует за шагом, а не пересчитывается целиком
+        bool followDensity = densityMap.isBuiltFor(doc);
+        for (ShapeId id : moveShapes) {
+            markStale(id); // Связи у старого положения
+            invalidateShape(id); // Старое положение
+            int slot = doc.slotOf(id);
+            if (followDensity && slot >= 0) {
+                densityMap.moveShape(doc.p1At(slot), doc.p2At(slot),
+                                     doc.p1At(slot) + delta, doc.p2At(slot) + delta);
             }
+            doc.translateShape(id, delta);
+            invalidateShape(id); // Новое положение
+            markStale(id);
         }
-        update();
+        if (followDensity) densityMap.markCurrent(doc);
+        rerouteStale();
         return;
     }
 
     // 3. ПРЯМОУГОЛЬНОЕ ВЫДЕЛЕНИЕ
     if (selecting) {
-        selectionRect.setBottomRight(snappedPos); // Обновляем привязанным
-        update();
+        updateMarquee(snappedPos);
         return;
     }
 
     // 4. РИСОВАНИЕ
     if (drawing) {
-        update(); // Обновляем "призрачный" предпросмотр
+        // Обновляем "призрачный" предпросмотр: старую и новую области
+        drawEnd = snapDrawPoint(pos);
+        update(damageRect(previewRect));
+        previewRect = previewBounds();
+        update(damageRect(previewRect));
+        return;
+    }
+
+    // 5. НОВАЯ СВЯЗЬ
+    if (connecting) {
+        updateConnectPreview(pos);
         return;
     }
 
-    // 5. Обновление курсора, если ничего не делаем
-    updateCursorIcon(event->pos());
+    // 6. Обновление курсора, если ничего не делаем
+    updateCursorIcon(pos);
 }
 
 /**
  * @brief Обрабатывает отпускание кнопки мыши.
  */
 void Canvas::mouseReleaseEvent(QMouseEvent *event) {
+    BSG_TRACE_SCOPE("mouseRelease", "input");
+    hudEvents++;
+    flushMove(); // Перетаскивание должно дойти до последней позиции
+    QPoint pos = toWorld(event->pos());
+
+    if (panning) {
+        if (event->button() == panButton) {
+            panning = false;
+            panButton = Qt::NoButton;
+            updateCursorIcon(pos);
+        }
+        return;
+    }
     if (event->button() != Qt::LeftButton)
         return;
 
-    QPoint snappedPos = snapToGrid(event->pos());
+    auto notify = qScopeGuard([this] { flushSelectionChanged(); });
 
     // 1. ЗАВЕРШЕНИЕ РЕСАЙЗА
     if (resizing) {
+        // Весь ресайз - одна запись: якорь и масштаб + исходная геометрия
+        if (resizeApplied && !resizeIds.empty()) {
+            std::vector<QPoint> p1s(resizeIds.size()), p2s(resizeIds.size());
+            for (int i = 0; i < resizeOriginal.size(); ++i) {
+                p1s[i] = resizeOriginal.p1At(i);
+                p2s[i] = resizeOriginal.p2At(i);
+            }
+            undoStack.push(std::make_unique<ResizeCommand>(resizeIds, std::move(p1s),
+                                                           std::move(p2s), lastResize));
+        }
         resizing = false;
-        resizingShape = nullptr;
+        resizeApplied = false;
+        resizingShape = NoShape;
         currentResizeHandle = HandlePosition::None;
-        originalShapes.clear();
-        update();
-        updateCursorIcon(event->pos());
+        resizeIds.clear();
+        resizeOriginal.clear();
+        clearGuides();
+        updateCursorIcon(pos);
         return;
     }
 
@@ -309,69 +957,169 @@ void Canvas::mouseReleaseEvent(QMouseEvent *event) {
     // ВАЖНО: обрабатываем ПЕРЕД рисованием и выделением!
     if (moving) {
         moving = false;
+        clearGuides();
+        // Все перемещение за drag - одна запись с суммарным сдвигом
+        finishUnitMove();
         // НЕ сбрасываем выделение - фигура остается выделенной
-        update();
-        updateCursorIcon(event->pos());
+        updateCursorIcon(pos);
         return;
     }
 
     // 3. ЗАВЕРШЕНИЕ ПРЯМОУГОЛЬНОГО ВЫДЕЛЕНИЯ
+    // Выделение уже следует за рамкой - остается убрать саму рамку
     if (selecting) {
         selecting = false;
-        QRect selRect = selectionRect.normalized();
-        for(auto& s : shapes) {
-            if (selRect.contains(s.bounds().toRect())) {
-                s.selected = true;
-            }
-        }
-        update();
-        updateCursorIcon(event->pos());
+        marqueeAdded.clear();
+        update(damageRect(selectionRect.normalized()));
+        updateCursorIcon(pos);
         return;
     }
 
     // 4. ЗАВЕРШЕНИЕ РИСОВАНИЯ
     if (drawing) {
         drawing = false;
-        QPoint endPoint = snappedPos;
+        update(damageRect(previewRect)); // Убираем предпросмотр
+        QPoint endPoint = snapDrawPoint(pos);
+        clearGuides();
 
         int manhattan = (startPoint - endPoint).manhattanLength();
-        bool isClick = (manhattan < CLICK_THRESHOLD);
+        bool isClick = (manhattan * zoom < CLICK_THRESHOLD); // Порог - в пикселях экрана
 
         if (!isClick) {
+            Shape s{currentShape, QRect(), QPoint(), QPoint(), currentStyle};
             if (currentShape == ShapeType::Line) {
-                shapes.push_back({currentShape, QRect(), startPoint, endPoint, true});
+                s.start = startPoint;
+                s.end = endPoint;
             } else {
-                QRect r = calculateRect(startPoint, endPoint);
-                shapes.push_back({currentShape, r, {}, {}, true});
+                s.rect = calculateRect(startPoint, endPoint);
             }
+            ShapeId id = doc.addShape(s);
+            undoStack.push(std::make_unique<CreateShapeCommand>(id, doc.slotOf(id), s));
+            markStale(id); // Новый блок мог лечь поперек маршрутов
+            rerouteStale();
 
             // выделяем созданную фигуру
-            for (auto &s : shapes) s.selected = false;
-            if (!shapes.empty()) shapes.back().selected = true;
+            clearSelection();
+            setSelected(id, true);
+            invalidateShape(id);
         }
         // Убрали обработку короткого клика - она не нужна, т.к. moving уже обработан выше
 
-        update();
-        updateCursorIcon(event->pos());
+        updateCursorIcon(pos);
         return;
     }
 
-    update();
-    updateCursorIcon(event->pos());
+    // 5. ЗАВЕРШЕНИЕ СВЯЗИ
+    if (connecting) {
+        connecting = false;
+        update(damageRect(previewRect)); // Убираем предпросмотр
+        ShapeId target = connectTarget(pos);
+        if (target != NoShape) {
+            QRectF toBounds = doc.getBounds(target);
+            Shape s{ShapeType::Connector, QRect(), QPoint(), QPoint(), currentStyle};
+            s.link = ConnectorLink{connectFrom, target, connectFromPort,
+                                   Geometry::nearestPort(toBounds, pos)};
+            s.start = Geometry::portPoint(doc.getBounds(connectFrom), s.link.fromPort);
+            s.end = Geometry::portPoint(toBounds, s.link.toPort);
+            ShapeId id = doc.addShape(s);
+            undoStack.push(std::make_unique<CreateShapeCommand>(id, doc.slotOf(id), s));
+            markStale(id);
+            rerouteStale();
+
+            clearSelection();
+            setSelected(id, true);
+            invalidateShape(id);
+        }
+        connectFrom = NoShape;
+        connectPreview.clear();
+        updateCursorIcon(pos);
+        return;
+    }
+
+    updateCursorIcon(pos);
 }
 
 /**
  * @brief Обрабатывает нажатие клавиш.
  */
 void Canvas::keyPressEvent(QKeyEvent *event) {
+    auto notify = qScopeGuard([this] { flushSelectionChanged(); });
+
+    // Ctrl+Shift+Z проверяем явно: на Windows стандартный Redo - Ctrl+Y
+    bool redoKey = event->matches(QKeySequence::Redo) ||
+                   (event->key() == Qt::Key_Z &&
+                    event->modifiers() == (Qt::ControlModifier | Qt::ShiftModifier));
+    if (redoKey) {
+        redo();
+        return;
+    }
+    if (event->matches(QKeySequence::Undo)) {
+        undo();
+        return;
+    }
+    if (event->key() == Qt::Key_0 && event->modifiers() == Qt::ControlModifier) {
+        zoomToFit();
+        return;
+    }
+    if (event->key() == Qt::Key_G && event->modifiers() == Qt::ControlModifier) {
+        groupSelection();
+        return;
+    }
+    if (event->key() == Qt::Key_G && event->modifiers() == (Qt::ControlModifier | Qt::ShiftModifier)) {
+        ungroupSelection();
+        return;
+    }
+    if (event->key() == Qt::Key_E && event->modifiers() == Qt::ControlModifier) {
+        toggleGroupsCollapsed();
+        return;
+    }
+
     if (event->key() == Qt::Key_Delete || event->key() == Qt::Key_Backspace) {
-        // Удаляем все выделенные фигуры
-        shapes.erase(
-            std::remove_if(shapes.begin(), shapes.end(),
-                           [](const Shape &s) { return s.selected; }),
-            shapes.end());
-        update();
+        if (selection.isEmpty() || isBusy()) return;
+
+        // Удаляем все выделенные фигуры, запомнив их слоты для отмены.
+        // Связи удаляемых блоков уходят вместе с ними
+        std::vector<ShapeId> removed(selection.begin(), selection.end());
+        for (ShapeId id : selection) {
+            const std::vector<ShapeId>& own = doc.getConnectors(id);
+            removed.insert(removed.end(), own.begin(), own.end());
+        }
+        std::sort(removed.begin(), removed.end());
+        removed.erase(std::unique(removed.begin(), removed.end()), removed.end());
+        std::vector<RestoredShape> restored;
+        restored.reserve(removed.size());
+        for (ShapeId id : removed) {
+            restored.push_back({doc.slotOf(id), id, doc.getShape(id), doc.getGroup(id)});
+        }
+        std::sort(restored.begin(), restored.end(),
+                  [](const RestoredShape& a, const RestoredShape& b) { return a.slot < b.slot; });
+
+        clearSelection(); // Заодно перерисовывает их области
+        invalidateShapes(removed); // И области связей
+        doc.removeShapes(removed);
+        undoStack.push(std::make_unique<DeleteShapesCommand>(std::move(restored)));
+    }
+}
+
+/**
+ * @brief Колесо мыши: масштаб относительно точки под курсором.
+ */
+void Canvas::wheelEvent(QWheelEvent *event) {
+    BSG_TRACE_SCOPE("wheel", "input");
+    hudEvents++;
+    flushMove(); // Отложенная позиция относится к старому виду
+    qreal steps = event->angleDelta().y() / 120.0;
+    if (steps == 0 || isBusy()) {
+        event->ignore();
+        return;
     }
+
+    qreal newZoom = qBound(MIN_ZOOM, zoom * qPow(ZOOM_STEP, steps), MAX_ZOOM);
+    QPointF anchor = event->position();
+    QPointF world = viewInverse.map(anchor); // Эта точка мира остается под курсором
+    setView(anchor - world * newZoom, newZoom);
+    update();
+    event->accept();
 }
 
 //==================================================================
@@ -380,231 +1128,790 @@ void Canvas::keyPressEvent(QKeyEvent *event) {
 
 // --- Логика Ресайза ---
 
+/**
+ * @brief Начинает ресайз: запоминает исходную геометрию всех выделенных фигур.
+ *
+ * Геометрия упаковывается в массивы по координатам один раз за
+ * перетаскивание; каждый шаг пересчитывает ее целиком (applyResize).
+ */
+void Canvas::beginResize(ShapeId handleShape, HandlePosition handlePos) {
+    resizing = true;
+    resizingShape = handleShape;
+    currentResizeHandle = handlePos;
+    resizeApplied = false;
+    resizePrimary = doc.getShape(handleShape);
+
+    resizeIds.clear();
+    for (ShapeId id : selection) {
+        // Связи следуют за блоками; свернутые группы не масштабируются
+        if (doc.getType(id) != ShapeType::Connector && doc.getUnit(id) == NoGroup) resizeIds.push_back(id);
+    }
+    resizeOriginal.clear();
+    resizeOriginal.reserve(resizeIds.size());
+    for (ShapeId id : resizeIds) {
+        int slot = doc.slotOf(id);
+        resizeOriginal.append(doc.typeAt(slot), doc.p1At(slot), doc.p2At(slot));
+    }
+    prepareSnap(true, resizePrimary.bounds().center().toPoint());
+}
+
 /**
  * @brief Применяет логику ресайза ко всем выделенным фигурам.
+ *
+ * Масштаб считается один раз по главной фигуре, затем один пакетный
+ * проход (Geometry::resizeBatch) масштабирует все фигуры относительно
+ * их якорей, и документ получает новые точки одним вызовом.
  */
 void Canvas::applyResize(const QPoint &mousePos, Qt::KeyboardModifiers modifiers) {
+    BSG_TRACE_SCOPE("applyResize");
+    if (resizingShape == NoShape || resizeIds.empty()) return;
     bool keepProportions = modifiers & Qt::ShiftModifier; bool fromCenter = modifiers & Qt::ControlModifier;
-    if (!resizingShape) return;
-    auto primaryOrigIt = std::find_if(originalShapes.begin(), originalShapes.end(),
-                                      [this](const Shape& s) { return s.originalRect == resizingShape->originalRect && s.originalStart == resizingShape->originalStart; });
-    if (primaryOrigIt == originalShapes.end()) return;
-    const Shape& primaryOriginal = *primaryOrigIt;
-    qreal g_scaleX = 1.0, g_scaleY = 1.0; QPointF primaryAnchor; QPointF origHandlePos; QPointF origVector;
-    if (primaryOriginal.type == ShapeType::Line) {
-        origHandlePos = (currentResizeHandle == HandlePosition::Start) ? QPointF(primaryOriginal.originalStart) : QPointF(primaryOriginal.originalEnd);
-        if (fromCenter) primaryAnchor = QLineF(primaryOriginal.originalStart, primaryOriginal.originalEnd).center();
-        else primaryAnchor = (currentResizeHandle == HandlePosition::Start) ? QPointF(primaryOriginal.originalEnd) : QPointF(primaryOriginal.originalStart);
-        origVector = origHandlePos - primaryAnchor;
-    } else {
-        QRectF origRect = primaryOriginal.bounds(); primaryAnchor = getAnchorPoint(origRect, currentResizeHandle, fromCenter);
-        switch(currentResizeHandle) {
-        case HandlePosition::TopLeft:       origHandlePos = origRect.topLeft(); break;
-        case HandlePosition::Top:           origHandlePos = QPointF(origRect.center().x(), origRect.top()); break;
-        case HandlePosition::TopRight:      origHandlePos = origRect.topRight(); break;
-        case HandlePosition::Left:          origHandlePos = QPointF(origRect.left(), origRect.center().y()); break;
-        case HandlePosition::Right:         origHandlePos = QPointF(origRect.right(), origRect.center().y()); break;
-        case HandlePosition::BottomLeft:    origHandlePos = origRect.bottomLeft(); break;
-        case HandlePosition::Bottom:        origHandlePos = QPointF(origRect.center().x(), origRect.bottom()); break;
-        case HandlePosition::BottomRight:   origHandlePos = origRect.bottomRight(); break;
-        default:                            origHandlePos = primaryAnchor;
-        }
-        origVector = origHandlePos - primaryAnchor;
-    }
-    QPointF newVector = mousePos - primaryAnchor;
-    if (qAbs(origVector.x()) > 1e-3) g_scaleX = newVector.x() / origVector.x();
-    if (qAbs(origVector.y()) > 1e-3) g_scaleY = newVector.y() / origVector.y();
-    if (keepProportions) {
-        qreal scale;
-        if (primaryOriginal.type == ShapeType::Line) {
-            qreal origLen = QLineF(QPointF(0,0), origVector).length(); qreal newLen = QLineF(QPointF(0,0), newVector).length();
-            scale = (origLen == 0) ? 1.0 : (newLen / origLen);
-        } else {
-            if (currentResizeHandle == HandlePosition::Left || currentResizeHandle == HandlePosition::Right) scale = g_scaleX;
-            else if (currentResizeHandle == HandlePosition::Top || currentResizeHandle == HandlePosition::Bottom) scale = g_scaleY;
-            else scale = (qAbs(g_scaleX) > qAbs(g_scaleY)) ? g_scaleX : g_scaleY;
-        }
-        g_scaleX = scale; g_scaleY = scale;
-    }
-    if (primaryOriginal.type != ShapeType::Line && !keepProportions) {
-        if (currentResizeHandle == HandlePosition::Top || currentResizeHandle == HandlePosition::Bottom) g_scaleX = 1.0;
-        if (currentResizeHandle == HandlePosition::Left || currentResizeHandle == HandlePosition::Right) g_scaleY = 1.0;
-    }
-    if (primaryOriginal.type != ShapeType::Line && fromCenter && keepProportions) {
-        if (currentResizeHandle == HandlePosition::Top || currentResizeHandle == HandlePosition::Bottom) g_scaleX = g_scaleY;
-        if (currentResizeHandle == HandlePosition::Left || currentResizeHandle == HandlePosition::Right) g_scaleY = g_scaleX;
-    }
-    int orig_idx = 0;
-    for (auto& s : shapes) {
-        if (!s.selected) continue;
-        const Shape& orig = originalShapes[orig_idx++]; QPointF s_anchor;
-        if (fromCenter) {
-            s_anchor = (orig.type == ShapeType::Line) ? QLineF(orig.originalStart, orig.originalEnd).center() : orig.bounds().center();
-        } else {
-            if (primaryOriginal.type == ShapeType::Line) {
-                if (orig.type == ShapeType::Line) {
-                    s_anchor = (currentResizeHandle == HandlePosition::Start) ? QPointF(orig.originalEnd) : QPointF(orig.originalStart);
-                } else {
-                    s_anchor = (currentResizeHandle == HandlePosition::Start) ? orig.bounds().bottomRight() : orig.bounds().topLeft();
-                }
-            } else {
-                s_anchor = getAnchorPoint(orig.bounds(), currentResizeHandle, false);
-            }
-        }
-        if (orig.type == ShapeType::Line) {
-            s.start = scalePoint(orig.originalStart, s_anchor, g_scaleX, g_scaleY).toPoint();
-            s.end = scalePoint(orig.originalEnd, s_anchor, g_scaleX, g_scaleY).toPoint();
-        } else {
-            QPointF newTopLeft = scalePoint(orig.rect.topLeft(), s_anchor, g_scaleX, g_scaleY);
-            QPointF newBottomRight = scalePoint(orig.rect.bottomRight(), s_anchor, g_scaleX, g_scaleY);
-            s.rect = QRectF(newTopLeft, newBottomRight).normalized().toRect();
+    lastResize = Geometry::computeResize(resizePrimary, currentResizeHandle,
+                                         mousePos, keepProportions, fromCenter);
+    Geometry::resizeBatch(resizeOriginal, lastResize, resizeP1s, resizeP2s);
+
+    invalidateShapes(resizeIds); // Старая геометрия
+    for (ShapeId id : resizeIds) markStale(id);
+    bool followDensity = densityMap.isBuiltFor(doc);
+    if (followDensity) {
+        for (size_t i = 0; i < resizeIds.size(); ++i) {
+            int slot = doc.slotOf(resizeIds[i]);
+            if (slot >= 0) densityMap.moveShape(doc.p1At(slot), doc.p2At(slot), resizeP1s[i], resizeP2s[i]);
         }
     }
-    update();
+    doc.setPoints(resizeIds, resizeP1s, resizeP2s);
+    if (followDensity) densityMap.markCurrent(doc);
+    invalidateShapes(resizeIds); // Новая геометрия
+    for (ShapeId id : resizeIds) markStale(id);
+    rerouteStale();
+    resizeApplied = true;
 }
 
 /**
- * @brief Вычисляет "якорную" точку для ресайза.
+ * @brief Прямоугольник рисования с учетом текущих Shift (квадрат) и Ctrl (от центра).
  */
-QPointF Canvas::getAnchorPoint(const QRectF& rect, HandlePosition handle, bool fromCenter) {
-    if (fromCenter) return rect.center();
-    switch (handle) {
-    case HandlePosition::TopLeft:       return rect.bottomRight();
-    case HandlePosition::Top:           return QPointF(rect.center().x(), rect.bottom());
-    case HandlePosition::TopRight:      return rect.bottomLeft();
-    case HandlePosition::Left:          return QPointF(rect.right(), rect.center().y());
-    case HandlePosition::Right:         return QPointF(rect.left(), rect.center().y());
-    case HandlePosition::BottomLeft:    return rect.topRight();
-    case HandlePosition::Bottom:        return QPointF(rect.center().x(), rect.top());
-    case HandlePosition::BottomRight:   return rect.topLeft();
-    default:                            return rect.center();
-    }
+QRect Canvas::calculateRect(const QPoint& p1, const QPoint& p2) const {
+    Qt::KeyboardModifiers mods = QApplication::keyboardModifiers();
+    return Geometry::calculateRect(p1, p2, mods & Qt::ShiftModifier, mods & Qt::ControlModifier);
 }
 
+// --- Связи ---
+
 /**
- * @brief Масштабирует точку 'p' относительно якоря 'anchor'.
+ * @brief Отмечает связи, которым нужен новый маршрут после правки фигуры.
+ *
+ * Это сама связь, связи блока и связи, чей маршрут проходит через блок
+ * или вплотную к нему (в пределах клетки сетки). Вызывается и до, и
+ * после правки: до - чтобы освободившееся место использовали маршруты,
+ * которые его огибали. Остальные связи не трогаются.
  */
-QPointF Canvas::scalePoint(const QPointF &p, const QPointF &anchor, qreal sx, qreal sy) {
-    return QPointF(
-        anchor.x() + (p.x() - anchor.x()) * sx,
-        anchor.y() + (p.y() - anchor.y()) * sy
-        );
+void Canvas::markStale(ShapeId id) {
+    if (doc.getConnectorCount() == 0) return;
+    int slot = doc.slotOf(id);
+    if (slot < 0) return;
+    ShapeType type = doc.typeAt(slot);
+    if (type == ShapeType::Connector) {
+        staleConnectors.push_back(id);
+        return;
+    }
+    if (!isBlock(type)) return; // Линии маршрутам не мешают
+
+    const std::vector<ShapeId>& own = doc.getConnectors(id);
+    staleConnectors.insert(staleConnectors.end(), own.begin(), own.end());
+
+    qreal m = gridSize;
+    QRectF area = doc.boundsAt(slot).adjusted(-m, -m, m, m);
+    doc.query(area, [&](ShapeId other) {
+        if (doc.getType(other) != ShapeType::Connector) return;
+        const std::vector<QPoint>& route = doc.getRoute(other);
+        if (Geometry::polylineCrosses(route.data(), (int)route.size(), area)) {
+            staleConnectors.push_back(other);
+        }
+    });
 }
 
 /**
- * @brief Вычисляет геометрию QRect на основе двух точек и модификаторов.
+ * @brief Перестраивает отмеченные связи.
  *
- * Учитывает Shift (для квадратов) и Ctrl (для рисования от центра).
- *
- * @param p1 Первая точка (обычно startPoint).
- * @param p2 Вторая точка (обычно позиция мыши).
- * @return QRect Вычисленный прямоугольник.
+ * Концы связи сразу переходят на порты, а маршрут растягивается за ними
+ * (Document::followPorts) - это дешево и видно в том же кадре. Обход
+ * препятствий считает поток роутера; результат придет в applyRoutes.
  */
-QRect Canvas::calculateRect(const QPoint& p1, const QPoint& p2) const {
-    bool shift = QApplication::keyboardModifiers() & Qt::ShiftModifier;
-    bool ctrl = QApplication::keyboardModifiers() & Qt::ControlModifier;
-
-    QRect r;
-
-    if (ctrl) {
-        // Ctrl: Рисование от центра (p1 - центр)
-        int w = qAbs(p2.x() - p1.x()) * 2;
-        int h = qAbs(p2.y() - p1.y()) * 2;
-        if (shift) {
-            w = h = qMax(w, h); // Ctrl + Shift = квадрат от центра
-        }
-        r = QRect(p1.x() - w/2, p1.y() - h/2, w, h);
-    } else if (shift) {
-        // Shift: Квадрат (p1 - угол)
-        int w = p2.x() - p1.x();
-        int h = p2.y() - p1.y();
-        int size = qMax(qAbs(w), qAbs(h));
-
-        // Сохраняем направление (квадрант)
-        r = QRect(p1.x(), p1.y(),
-                  (w < 0) ? -size : size,
-                  (h < 0) ? -size : size);
-    } else {
-        // Свободное рисование
-        r = QRect(p1, p2);
-    }
+void Canvas::rerouteStale() {
+    if (staleConnectors.empty()) return;
+    BSG_TRACE_SCOPE("rerouteStale", "route");
+    std::sort(staleConnectors.begin(), staleConnectors.end());
+    staleConnectors.erase(std::unique(staleConnectors.begin(), staleConnectors.end()),
+                          staleConnectors.end());
+
+    bool wholeWidget = (int)staleConnectors.size() > MAX_DAMAGE_SHAPES;
+    bool followDensity = densityMap.isBuiltFor(doc);
+    for (ShapeId id : staleConnectors) {
+        if (!doc.contains(id)) continue;
+        if (!wholeWidget) invalidateShape(id); // Старый маршрут
+        int slot = doc.slotOf(id);
+        QPoint oldP1 = doc.p1At(slot), oldP2 = doc.p2At(slot);
+        if (doc.followPorts(id) && followDensity) {
+            densityMap.moveShape(oldP1, oldP2, doc.p1At(slot), doc.p2At(slot));
+        }
+        if (!wholeWidget) invalidateShape(id); // Временный маршрут
 
-    return r.normalized(); // Всегда возвращаем L-T < R-B
+        RouteJob job = Routing::makeJob(doc, id, gridSize);
+        job.serial = ++routeSerial;
+        pendingRoutes[id] = job.serial;
+        routeJobs.push_back(std::move(job));
+    }
+    staleConnectors.clear();
+    if (followDensity) densityMap.markCurrent(doc);
+    if (wholeWidget) update();
+
+    if (!router) {
+        router = new ConnectorRouter(this);
+        // Маршруты готовы - забираем их (сигнал приходит из другого потока)
+        connect(router, &ConnectorRouter::routesReady, this, &Canvas::applyRoutes);
+    }
+    router->submit(routeJobs);
 }
 
-// --- Логика Определения (Hit-testing) ---
+/**
+ * @brief Применяет маршруты, готовые в потоке роутера.
+ *
+ * Маршрут принимается, только если он ответ на последнее задание
+ * для этой связи; ответы на устаревшие задания отбрасываются.
+ */
+void Canvas::applyRoutes() {
+    BSG_TRACE_SCOPE("applyRoutes", "route");
+    router->takeResults(routeResults);
+    bool followDensity = densityMap.isBuiltFor(doc); // Маршрут не меняет p1/p2
+    for (RouteResult& result : routeResults) {
+        auto it = pendingRoutes.find(result.id);
+        if (it == pendingRoutes.end() || it->second != result.serial) continue;
+        pendingRoutes.erase(it);
+        invalidateShape(result.id);
+        doc.setRoute(result.id, std::move(result.route));
+        invalidateShape(result.id);
+    }
+    routeResults.clear();
+    if (followDensity) densityMap.markCurrent(doc);
+}
 
 /**
- * @brief Находит фигуру в указанной позиции.
+ * @brief Блок под курсором, к которому можно провести новую связь.
  */
-Shape* Canvas::shapeAt(const QPoint &pos) {
-    // Ищем от конца к началу, чтобы приоритет был у верхних фигур
-    for (auto it = shapes.rbegin(); it != shapes.rend(); ++it) {
-        Shape &s = *it;
-        if (s.type == ShapeType::Line) {
-            // Проверка для линии: ищем ближайшую точку на отрезке
-            QLineF line(s.start, s.end);
-            if (line.length() == 0) continue;
+ShapeId Canvas::connectTarget(const QPoint& pos) {
+    ShapeId s = shapeAt(pos);
+    if (s == NoShape || s == connectFrom || !isBlock(doc.getType(s))) return NoShape;
+    return s;
+}
 
-            QPointF p = pos; QPointF a = line.p1(); QPointF b = line.p2(); QPointF ab = b - a;
-            QPointF ap = p - a; qreal t = QPointF::dotProduct(ap, ab) / QPointF::dotProduct(ab, ab);
+/**
+ * @brief Обновляет предпросмотр новой связи.
+ *
+ * Над подходящим блоком - маршрут до его ближайшего порта, иначе -
+ * отрезок до курсора.
+ */
+void Canvas::updateConnectPreview(const QPoint& pos) {
+    update(damageRect(previewRect)); // Старый предпросмотр
+    QPoint start = Geometry::portPoint(doc.getBounds(connectFrom), connectFromPort);
+    ShapeId target = connectTarget(pos);
+    if (target != NoShape) {
+        QRectF bounds = doc.getBounds(target);
+        Port port = Geometry::nearestPort(bounds, pos);
+        Geometry::elbowRoute(start, connectFromPort, Geometry::portPoint(bounds, port), port,
+                             gridSize / 2, connectPreview);
+    } else {
+        connectPreview.clear();
+        connectPreview.push_back(start);
+        connectPreview.push_back(pos);
+    }
 
-            t = qBound(0.0, t, 1.0); // Ограничиваем t от 0 до 1 (точка должна быть на отрезке)
-            QPointF closest = a + t * ab;
+    previewRect = QRect(connectPreview.front(), QSize(1, 1));
+    for (const QPoint& p : connectPreview) {
+        previewRect |= QRect(p, QSize(1, 1));
+    }
+    update(damageRect(previewRect));
+}
 
-            qreal distance = QLineF(p, closest).length();
-            if (distance < 5) return &s; // Порог 5 пикселей
+// --- Логика Определения (Hit-testing) ---
 
-        } else {
-            // Проверка для прямоугольника/круга: попадание в область
-            // Даем небольшой отступ (-2, 2) для удобства
-            if (s.rect.adjusted(-2, -2, 2, 2).contains(pos)) return &s;
+/**
+ * @brief Находит фигуру в указанной позиции.
+ */
+ShapeId Canvas::shapeAt(const QPoint &pos) {
+    // Берем только кандидатов из ячеек под курсором (с запасом на порог)
+    const qreal m = toWorldLength(LINE_HIT_THRESHOLD);
+    QRectF area(pos.x() - m, pos.y() - m, 2 * m, 2 * m);
+
+    // Приоритет у верхних фигур - ищем кандидата с наибольшим слотом
+    int best = -1;
+    doc.query(area, [&](ShapeId id) {
+        int i = doc.slotOf(id);
+        if (i <= best) return;
+        if (doc.typeAt(i) == ShapeType::Connector) {
+            const std::vector<QPoint>& route = doc.getRoute(id);
+            if (Geometry::polylineDistance(pos, route.data(), (int)route.size()) < m) best = i;
+        } else if (Geometry::hitTest(doc.shapeInSlot(i), pos, m)) {
+            best = i;
         }
-    }
-    return nullptr;
+    });
+    return best >= 0 ? doc.idAt(best) : NoShape;
 }
 
 /**
  * @brief Находит ручку ресайза в указанной позиции.
  */
-std::pair<Shape*, HandlePosition> Canvas::getHandleAt(const QPoint &pos) {
-    // if (currentTool != Tool::Select) {
-    //     return {nullptr, HandlePosition::None};
-    // }
-    for (auto& s : shapes) {
-        if (!s.selected) continue;
-        auto handles = getResizeHandles(s);
-        for (auto it = handles.constBegin(); it != handles.constEnd(); ++it) {
-            if (it.value().contains(pos)) {
-                return {&s, it.key()};
+std::pair<ShapeId, HandlePosition> Canvas::getHandleAt(const QPoint &pos) {
+    // Мелкие ручки не рисуются - значит, и не ловятся
+    if (zoom < HANDLES_MIN_ZOOM) return {NoShape, HandlePosition::None};
+
+    // Ручки выступают за границы фигуры на половину HANDLE_SIZE,
+    // поэтому ищем фигуры, чьи границы не дальше этого расстояния
+    const qreal h2 = toWorldLength(HANDLE_SIZE / 2.0);
+    QRectF area(pos.x() - h2, pos.y() - h2, 2 * h2, 2 * h2);
+
+    // Как и раньше, при совпадении побеждает фигура с меньшим слотом
+    int found = -1;
+    HandlePosition foundPos = HandlePosition::None;
+    doc.queryItems(area, [&](ShapeId id) {
+        int i = doc.slotOf(id);
+        if (found >= 0 && i >= found) return;
+        if (!selection.contains(id)) return;
+        const HandleSet handles = getResizeHandles(doc.shapeInSlot(i));
+        for (int k = 0; k < handles.count; ++k) {
+            if (handles.rects[k].contains(pos)) {
+                found = i;
+                foundPos = handles.positions[k];
+                return;
             }
         }
-    }
-    return {nullptr, HandlePosition::None};
+    }, [](GroupId) {}); // У свернутой группы ручек нет
+    if (found < 0) return {NoShape, HandlePosition::None};
+    return {doc.idAt(found), foundPos};
 }
 
 /**
  * @brief Вычисляет геометрию ручек ресайза для фигуры.
+ *
+ * Ручки идут в порядке HandlePosition - он же приоритет при попадании.
  */
-QMap<HandlePosition, QRectF> Canvas::getResizeHandles(const Shape &s) const {
-    QMap<HandlePosition, QRectF> handles; qreal h = HANDLE_SIZE; qreal h2 = h / 2.0;
+Canvas::HandleSet Canvas::getResizeHandles(const Shape &s) const {
+    HandleSet handles; qreal h = toWorldLength(HANDLE_SIZE); qreal h2 = h / 2.0;
+    if (s.type == ShapeType::Connector) return handles; // Связь следует за блоками
+    auto add = [&](HandlePosition pos, qreal x, qreal y) {
+        handles.positions[handles.count] = pos;
+        handles.rects[handles.count] = QRectF(x - h2, y - h2, h, h);
+        handles.count++;
+    };
     if (s.type == ShapeType::Line) {
-        handles[HandlePosition::Start] = QRectF(s.start.x() - h2, s.start.y() - h2, h, h);
-        handles[HandlePosition::End] = QRectF(s.end.x() - h2, s.end.y() - h2, h, h);
+        add(HandlePosition::Start, s.start.x(), s.start.y());
+        add(HandlePosition::End, s.end.x(), s.end.y());
     } else {
         QRectF r = s.bounds();
-        handles[HandlePosition::TopLeft] = QRectF(r.topLeft().x() - h2, r.topLeft().y() - h2, h, h);
-        handles[HandlePosition::Top] = QRectF(r.center().x() - h2, r.top() - h2, h, h);
-        handles[HandlePosition::TopRight] = QRectF(r.topRight().x() - h2, r.topRight().y() - h2, h, h);
-        handles[HandlePosition::Left] = QRectF(r.left() - h2, r.center().y() - h2, h, h);
-        handles[HandlePosition::Right] = QRectF(r.right() - h2, r.center().y() - h2, h, h);
-        handles[HandlePosition::BottomLeft] = QRectF(r.bottomLeft().x() - h2, r.bottomLeft().y() - h2, h, h);
-        handles[HandlePosition::Bottom] = QRectF(r.center().x() - h2, r.bottom() - h2, h, h);
-        handles[HandlePosition::BottomRight] = QRectF(r.bottomRight().x() - h2, r.bottomRight().y() - h2, h, h);
+        add(HandlePosition::TopLeft, r.left(), r.top());
+        add(HandlePosition::Top, r.center().x(), r.top());
+        add(HandlePosition::TopRight, r.right(), r.top());
+        add(HandlePosition::Left, r.left(), r.center().y());
+        add(HandlePosition::Right, r.right(), r.center().y());
+        add(HandlePosition::BottomLeft, r.left(), r.bottom());
+        add(HandlePosition::Bottom, r.center().x(), r.bottom());
+        add(HandlePosition::BottomRight, r.right(), r.bottom());
     }
     return handles;
 }
 
+// --- Выделение ---
+
+/**
+ * @brief Выделена ли фигура.
+ */
+bool Canvas::isSelected(ShapeId id) const {
+    return selection.contains(id);
+}
+
+/**
+ * @brief Выделяет фигуру или снимает с нее выделение.
+ */
+void Canvas::setSelected(ShapeId id, bool selected) {
+    bool changed = selected ? selection.insert(id) : selection.remove(id);
+    if (changed) selectionChangedPending = true;
+}
+
+/**
+ * @brief Начинает выделение рамкой из точки pos.
+ *
+ * additive (Shift) - рамка добавляет к текущему выделению, иначе оно
+ * сбрасывается.
+ */
+void Canvas::beginMarquee(const QPoint& pos, bool additive) {
+    selecting = true;
+    selectionRect = QRect(pos, QSize(0, 0));
+    marqueeAdded.clear();
+    if (!additive) clearSelection();
+}
+
+/**
+ * @brief Тянет угол рамки в corner, обновляя выделение на лету.
+ *
+ * Выделенность может поменяться только у фигур, задевающих полосы
+ * между старой и новой рамкой: их и перепроверяем, сравнивая с
+ * текущим выделением. Работа на шаг пропорциональна фигурам в этих
+ * полосах, а не под всей рамкой.
+ */
+void Canvas::updateMarquee(const QPoint& corner) {
+    BSG_TRACE_SCOPE("marqueeUpdate");
+    auto notify = qScopeGuard([this] { flushSelectionChanged(); });
+    QRect oldRect = selectionRect.normalized();
+    selectionRect.setBottomRight(corner);
+    QRect newRect = selectionRect.normalized();
+    if (newRect == oldRect) return;
+    update(damageRect(oldRect)); // Старая рамка
+    update(damageRect(newRect)); // Новая рамка
+
+    QRectF strips[8];
+    int count = subtractRect(QRectF(newRect), QRectF(oldRect), strips);
+    count += subtractRect(QRectF(oldRect), QRectF(newRect), strips + count);
+
+    QRectF changed;
+    for (int i = 0; i < count; ++i) {
+        QRectF area = strips[i].adjusted(-MARQUEE_SLACK, -MARQUEE_SLACK, MARQUEE_SLACK, MARQUEE_SLACK);
+        doc.queryItems(area, [&](ShapeId id) {
+            bool hit = marqueeHits(id, newRect);
+            if (hit && !selection.contains(id)) {
+                setSelected(id, true);
+                marqueeAdded.insert(id);
+            } else if (!hit && marqueeAdded.remove(id)) {
+                setSelected(id, false);
+            } else {
+                return;
+            }
+            changed |= doc.getBounds(id);
+        }, [&](GroupId g) {
+            // Свернутая группа - целиком; в marqueeAdded ее представляет одна фигура
+            ShapeId first = doc.firstGroupShape(g);
+            bool hit = marqueeHitsUnit(g, newRect);
+            if (hit && !selection.contains(first)) {
+                selectUnit(g, true);
+                marqueeAdded.insert(first);
+            } else if (!hit && marqueeAdded.remove(first)) {
+                selectUnit(g, false);
+            } else {
+                return;
+            }
+            changed |= doc.getGroupBounds(g);
+        });
+    }
+    // Рамки и ручки фигур, сменивших выделенность, - одной областью
+    if (!changed.isNull()) update(damageRect(changed));
+}
+
+/**
+ * @brief Выделяет ли рамка rect фигуру в текущем режиме.
+ *
+ * При пересечении линии и связи проверяются по самой ломаной, а не
+ * по границам, - иначе косая линия выделялась бы рамкой рядом с ней.
+ */
+bool Canvas::marqueeHits(ShapeId id, const QRect& rect) const {
+    int slot = doc.slotOf(id);
+    QRectF b = doc.boundsAt(slot);
+    if (marqueeMode == MarqueeMode::Contain) return rect.contains(b.toRect());
+
+    QRectF area(rect);
+    ShapeType type = doc.typeAt(slot);
+    if (type == ShapeType::Connector) {
+        const std::vector<QPoint>& route = doc.getRoute(id);
+        return Geometry::polylineCrosses(route.data(), (int)route.size(), area);
+    }
+    if (type == ShapeType::Line) {
+        const QPoint ends[2] = {doc.p1At(slot), doc.p2At(slot)};
+        return Geometry::polylineCrosses(ends, 2, area);
+    }
+    // Границы нулевой ширины QRectF::intersects считает пустыми
+    return b.right() > area.left() && b.left() < area.right() && b.bottom() > area.top() &&
+           b.top() < area.bottom();
+}
+
+/**
+ * @brief Выделяет ли рамка rect свернутую группу: по ее общим границам.
+ */
+bool Canvas::marqueeHitsUnit(GroupId g, const QRect& rect) const {
+    QRectF b = doc.getGroupBounds(g);
+    if (marqueeMode == MarqueeMode::Contain) return rect.contains(b.toRect());
+    QRectF area(rect);
+    return b.right() > area.left() && b.left() < area.right() && b.bottom() > area.top() &&
+           b.top() < area.bottom();
+}
+
+/**
+ * @brief Отправляет selectionChanged, если выделение менялось.
+ *
+ * Сигнал отправляется один раз на событие, а не на каждую фигуру.
+ */
+void Canvas::flushSelectionChanged() {
+    if (!selectionChangedPending) return;
+    selectionChangedPending = false;
+    emit selectionChanged();
+}
+
+// --- Группы ---
+
+/**
+ * @brief Выделяет фигуру; фигура свернутой группы выделяет всю группу.
+ */
+void Canvas::setItemSelected(ShapeId id, bool selected) {
+    GroupId unit = doc.getUnit(id);
+    if (unit != NoGroup) selectUnit(unit, selected);
+    else setSelected(id, selected);
+}
+
+/**
+ * @brief Выделяет все фигуры группы (всех уровней) или снимает с них выделение.
+ */
+void Canvas::selectUnit(GroupId g, bool selected) {
+    groupScratch.clear();
+    doc.collectGroupShapes(g, groupScratch);
+    for (ShapeId id : groupScratch) setSelected(id, selected);
+}
+
+/**
+ * @brief Выделена ли свернутая группа (она выделяется только целиком).
+ */
+bool Canvas::isUnitSelected(GroupId g) const {
+    ShapeId first = doc.firstGroupShape(g);
+    return first != NoShape && selection.contains(first);
+}
+
+/**
+ * @brief Перетаскивается ли сейчас свернутая группа.
+ */
+bool Canvas::isUnitMoving(GroupId g) const {
+    return std::find(moveUnits.begin(), moveUnits.end(), g) != moveUnits.end();
+}
+
+/**
+ * @brief Свернутые группы, в которые входят выделенные фигуры, без повторов.
+ */
+void Canvas::collectSelectedUnits(std::vector<GroupId>& out) const {
+    for (ShapeId id : selection) {
+        GroupId unit = doc.getUnit(id);
+        if (unit != NoGroup && std::find(out.begin(), out.end(), unit) == out.end()) out.push_back(unit);
+    }
+}
+
+/**
+ * @brief Картинка свернутой группы.
+ *
+ * Записывается заново, только если группа менялась или сменился масштаб
+ * (от него зависят пороги упрощения); иначе кадр проигрывает готовые
+ * команды рисования без поиска и сортировки фигур.
+ */
+const QPicture& Canvas::unitPicture(GroupId g) {
+    GroupPicture& cached = groupPictures[g];
+    quint64 revision = doc.getGroupRevision(g);
+    if (cached.revision == revision && cached.zoom == zoom) return cached.picture;
+
+    BSG_TRACE_SCOPE("unitPicture");
+    groupScratch.clear();
+    doc.collectGroupShapes(g, groupScratch);
+    pictureSlots.clear();
+    for (ShapeId id : groupScratch) pictureSlots.push_back(doc.slotOf(id));
+    std::sort(pictureSlots.begin(), pictureSlots.end());
+
+    cached.picture = QPicture();
+    QPainter recorder(&cached.picture);
+    recorder.setRenderHint(QPainter::Antialiasing);
+    renderer.drawShapes(&recorder, doc, pictureSlots);
+    recorder.end();
+    cached.revision = revision;
+    cached.zoom = zoom;
+    return cached.picture;
+}
+
+/**
+ * @brief Рисует свернутую группу со сдвигом offset (перетаскивание).
+ *
+ * Если видна большая часть группы - картинкой; если только край -
+ * фигурами края, найденными по дереву группы.
+ */
+void Canvas::drawUnit(QPainter* p, GroupId g, const QRectF& worldArea, const QPoint& offset) {
+    QRectF bounds = doc.getGroupBounds(g).translated(offset);
+    QRectF visible = bounds & worldArea;
+    bool mostlyVisible = worldArea.contains(bounds) ||
+                         2 * visible.width() * visible.height() >= bounds.width() * bounds.height();
+    if (!offset.isNull()) {
+        p->save();
+        p->translate(offset);
+    }
+    if (mostlyVisible) {
+        p->drawPicture(QPointF(), unitPicture(g));
+    } else {
+        pictureSlots.clear();
+        doc.queryGroup(g, worldArea.translated(-offset),
+                       [this](ShapeId id) { pictureSlots.push_back(doc.slotOf(id)); });
+        std::sort(pictureSlots.begin(), pictureSlots.end());
+        renderer.drawShapes(p, doc, pictureSlots);
+    }
+    if (!offset.isNull()) p->restore();
+}
+
+/**
+ * @brief Рисует перетаскиваемые группы, их рамки и связи, выходящие наружу.
+ */
+void Canvas::drawMovingUnits(QPainter* p, const QRectF& worldArea) {
+    applyDetailLimits();
+    const qreal gap = toWorldLength(SELECTION_FRAME_GAP);
+    selectionFrames.clear();
+    for (GroupId g : moveUnits) {
+        QRectF bounds = doc.getGroupBounds(g).translated(moveTotal);
+        if (!bounds.adjusted(-gap, -gap, gap, gap).intersects(worldArea)) continue;
+        drawUnit(p, g, worldArea, moveTotal);
+        selectionFrames.push_back(bounds.adjusted(-gap, -gap, gap, gap));
+    }
+    p->setBrush(Qt::NoBrush);
+    if (!selectionFrames.empty()) {
+        p->setPen(selectionPen);
+        p->drawRects(selectionFrames.data(), (int)selectionFrames.size());
+    }
+    p->setPen(previewPen);
+    for (ShapeId c : moveLinks) {
+        if (linkPreviewRoute(c, moveTotal)) p->drawPolyline(linkPreview.data(), (int)linkPreview.size());
+    }
+}
+
+/**
+ * @brief Временный маршрут связи, выходящей из перетаскиваемой группы.
+ *
+ * Концы в перетаскиваемых группах сдвинуты на offset; маршрут - "локоть"
+ * между портами, как у предпросмотра новой связи.
+ */
+bool Canvas::linkPreviewRoute(ShapeId connector, const QPoint& offset) {
+    linkPreview.clear();
+    if (!doc.contains(connector)) return false;
+    const ConnectorLink& link = doc.getLink(connector);
+    if (!doc.contains(link.from) || !doc.contains(link.to)) return false;
+    QRectF from = doc.getBounds(link.from);
+    QRectF to = doc.getBounds(link.to);
+    if (isUnitMoving(doc.getUnit(link.from))) from.translate(offset);
+    if (isUnitMoving(doc.getUnit(link.to))) to.translate(offset);
+    Geometry::elbowRoute(Geometry::portPoint(from, link.fromPort), link.fromPort,
+                         Geometry::portPoint(to, link.toPort), link.toPort, gridSize / 2, linkPreview);
+    return linkPreview.size() >= 2;
+}
+
+/**
+ * @brief Перерисовывает перетаскиваемые группы и их связи при сдвиге offset.
+ */
+void Canvas::invalidateMovingUnits(const QPoint& offset) {
+    for (GroupId g : moveUnits) {
+        update(damageRect(doc.getGroupBounds(g).translated(offset)));
+    }
+    for (ShapeId c : moveLinks) {
+        if (!linkPreviewRoute(c, offset)) continue;
+        QRect bounds(linkPreview.front(), QSize(1, 1));
+        for (const QPoint& pt : linkPreview) bounds |= QRect(pt, QSize(1, 1));
+        update(damageRect(bounds));
+    }
+}
+
+/**
+ * @brief Завершает перетаскивание: сдвиг групп переносится в их фигуры.
+ *
+ * Пока мышь нажата, группа двигается только сдвигом картинки; фигуры
+ * хранят мировые координаты, поэтому один раз, при отпускании, они
+ * сдвигаются пакетом (Document::translateShapes). Все перемещение -
+ * одна запись отмены вместе со свободными фигурами.
+ */
+void Canvas::finishUnitMove() {
+    if (!moveTotal.isNull()) {
+        std::vector<ShapeId> moved = moveShapes;
+        if (!moveUnits.empty()) {
+            invalidateMovingUnits(moveTotal);
+            size_t first = moved.size();
+            for (GroupId g : moveUnits) {
+                update(damageRect(doc.getGroupBounds(g))); // Старое положение
+                doc.collectGroupShapes(g, moved);
+            }
+            // Связи не двигаются сами - они следуют за своими блоками
+            moved.erase(std::remove_if(moved.begin() + first, moved.end(), [this](ShapeId id) {
+                return doc.getType(id) == ShapeType::Connector;
+            }), moved.end());
+            std::vector<ShapeId> baked(moved.begin() + first, moved.end());
+            for (ShapeId id : baked) markStale(id);
+            if (densityMap.isBuiltFor(doc)) {
+                for (ShapeId id : baked) {
+                    int slot = doc.slotOf(id);
+                    if (slot < 0) continue;
+                    densityMap.moveShape(doc.p1At(slot), doc.p2At(slot),
+                                         doc.p1At(slot) + moveTotal, doc.p2At(slot) + moveTotal);
+                }
+                doc.translateShapes(baked, moveTotal);
+                densityMap.markCurrent(doc);
+            } else {
+                doc.translateShapes(baked, moveTotal);
+            }
+            for (ShapeId id : baked) markStale(id);
+            for (GroupId g : moveUnits) update(damageRect(doc.getGroupBounds(g)));
+        }
+        undoStack.push(std::make_unique<TranslateCommand>(std::move(moved), moveTotal));
+        moveTotal = QPoint();
+    }
+    moveShapes.clear();
+    moveUnits.clear();
+    moveLinks.clear();
+    moveHidden.clear();
+    rerouteStale(); // Скрытые связи снова рисуются - уже по новым маршрутам
+}
+
+/**
+ * @brief Забывает картинки групп, которые больше не рисуются целиком.
+ */
+void Canvas::pruneGroupPictures() {
+    for (auto it = groupPictures.begin(); it != groupPictures.end();) {
+        if (doc.containsGroup(it->first) && doc.isGroupCollapsed(it->first)) ++it;
+        else it = groupPictures.erase(it);
+    }
+}
+
+// --- Отмена / Повтор ---
+
+/**
+ * @brief Отменяет (forward = false) или повторяет (true) одну запись истории.
+ *
+ * Затронутые фигуры перерисовываются и становятся выделением.
+ */
+void Canvas::stepHistory(bool forward) {
+    if (isBusy()) return; // Не вмешиваемся в незавершенный drag
+
+    const UndoCommand* cmd = forward ? undoStack.getRedoCommand() : undoStack.getUndoCommand();
+    if (!cmd) return;
+
+    auto notify = qScopeGuard([this] { flushSelectionChanged(); });
+    const std::vector<ShapeId>& ids = cmd->getShapes();
+
+    invalidateShapes(ids); // Старая геометрия
+    for (ShapeId id : ids) markStale(id);
+    clearSelection();
+    if (forward) undoStack.redo(doc);
+    else undoStack.undo(doc);
+
+    for (ShapeId id : ids) {
+        if (doc.contains(id)) setSelected(id, true);
+    }
+    pruneGroupPictures();
+    invalidateShapes(ids); // Новая геометрия
+    for (ShapeId id : ids) markStale(id);
+    rerouteStale();
+}
+
+/**
+ * @brief Идет ли сейчас действие мышью (рисование, перемещение, ресайз, рамка).
+ */
+bool Canvas::isBusy() const {
+    return drawing || moving || resizing || selecting || connecting;
+}
+
+// --- Вид (мир -> виджет) ---
+
+/**
+ * @brief Переводит точку виджета в мировые координаты.
+ */
+QPoint Canvas::toWorld(const QPoint& widgetPos) const {
+    return viewInverse.map(QPointF(widgetPos)).toPoint();
+}
+
+/**
+ * @brief Устанавливает сдвиг и масштаб вида.
+ *
+ * Сдвиг округляется до целых пикселей - тогда панорамирование может
+ * сдвигать уже нарисованное (scroll), а сетка не "плывет".
+ */
+void Canvas::setView(const QPointF& pan, qreal newZoom) {
+    zoom = newZoom;
+    panOffset = QPointF(qRound(pan.x()), qRound(pan.y()));
+    view = QTransform(zoom, 0, 0, zoom, panOffset.x(), panOffset.y());
+    viewInverse = view.inverted();
+}
+
+/**
+ * @brief Начинает панорамирование.
+ */
+void Canvas::beginPan(const QMouseEvent* event) {
+    panning = true;
+    panButton = event->button();
+    panLastPos = event->pos();
+    setCursor(Qt::ClosedHandCursor);
+}
+
+/**
+ * @brief Сдвигает вид на delta пикселей.
+ *
+ * Уже нарисованные пиксели сдвигаются scroll(), перерисовывается только
+ * открывшаяся полоса - поэтому панорамирование не зависит от размера схемы.
+ */
+void Canvas::panBy(const QPoint& delta) {
+    if (delta.isNull()) return;
+    setView(panOffset + delta, zoom);
+    scroll(delta.x(), delta.y());
+}
+
+// --- Частичная перерисовка ---
+
+/**
+ * @brief Область виджета, которую нужно перерисовать для данных границ.
+ *
+ * Границы задаются в мировых координатах, результат - в координатах
+ * виджета с запасом под толщину пера, рамку выделения и ручки ресайза.
+ */
+QRect Canvas::damageRect(const QRectF& bounds) const {
+    if (bounds.isNull()) return QRect();
+    qreal pen = doc.getStyles().getMaxStrokeWidth() / 2; // Перо масштабируется вместе с фигурой
+    QRectF r = view.mapRect(bounds.normalized().adjusted(-pen, -pen, pen, pen));
+    return r.toAlignedRect().adjusted(-DAMAGE_MARGIN, -DAMAGE_MARGIN, DAMAGE_MARGIN, DAMAGE_MARGIN);
+}
+
+/**
+ * @brief Запрашивает перерисовку области фигуры.
+ */
+void Canvas::invalidateShape(ShapeId id) {
+    if (!doc.contains(id)) return;
+    GroupId unit = doc.getUnit(id); // Рамка свернутой группы - вокруг всей группы
+    update(damageRect(unit != NoGroup ? doc.getGroupBounds(unit) : doc.getBounds(id)));
+}
+
+/**
+ * @brief Запрашивает перерисовку областей нескольких фигур.
+ *
+ * Для больших наборов дешевле перерисовать весь виджет.
+ */
+void Canvas::invalidateShapes(const std::vector<ShapeId>& ids) {
+    if ((int)ids.size() > MAX_DAMAGE_SHAPES) {
+        update();
+        return;
+    }
+    for (ShapeId id : ids) {
+        invalidateShape(id);
+    }
+}
+
+/**
+ * @brief Снимает выделение со всех фигур, перерисовывая только выделенные.
+ */
+void Canvas::clearSelection() {
+    if (selection.isEmpty()) return;
+    invalidateShapes(selection.getItems());
+    selection.clear();
+    selectionChangedPending = true;
+}
+
+/**
+ * @brief Границы "призрачного" предпросмотра рисования.
+ */
+QRect Canvas::previewBounds() const {
+    if (currentShape == ShapeType::Line) {
+        return QRect(startPoint, drawEnd).normalized();
+    }
+    return calculateRect(startPoint, drawEnd);
+}
+
 // --- Логика UI ---
 
 /**
@@ -617,63 +1924,432 @@ void Canvas::updateCursorIcon(const QPoint &pos) {
         return;
     }
 
+    // "Рука" только двигает вид
+    if (panning || currentTool == Tool::Hand) {
+        setCursor(panning ? Qt::ClosedHandCursor : Qt::OpenHandCursor);
+        return;
+    }
+
+    // Пока курсор в той же области попадания, hit-test дал бы тот же ответ
+    bool cached = hover.valid && hover.region.contains(pos) &&
+                  hover.revision == doc.getRevision() && hover.selection == selection.getVersion() &&
+                  hover.zoom == zoom && hover.tool == currentTool;
+    if (!cached) {
+        int r = hoverRadius(pos);
+        hover.valid = true;
+        hover.region = QRect(pos.x() - r, pos.y() - r, 2 * r + 1, 2 * r + 1);
+        hover.revision = doc.getRevision();
+        hover.selection = selection.getVersion();
+        hover.zoom = zoom;
+        hover.tool = currentTool;
+        hover.cursor = hoverCursor(pos);
+    }
+    if (cursor().shape() != hover.cursor) setCursor(hover.cursor);
+}
+
+/**
+ * @brief Курсор над точкой pos: ручка ресайза, фигура или пустое место.
+ */
+Qt::CursorShape Canvas::hoverCursor(const QPoint& pos) {
+    // "Связь" тянется только от блоков, ручки ей не нужны
+    if (currentTool == Tool::Connect) {
+        ShapeId s = shapeAt(pos);
+        return (s != NoShape && isBlock(doc.getType(s))) ? Qt::PointingHandCursor : Qt::ArrowCursor;
+    }
+
     // Проверяем ручки ресайза (независимо от инструмента)
     auto [handleShape, handlePos] = getHandleAt(pos);
-    if (handleShape) {
+    if (handleShape != NoShape) {
         switch (handlePos) {
         case HandlePosition::TopLeft: case HandlePosition::BottomRight:
         case HandlePosition::Start: case HandlePosition::End:
-            setCursor(Qt::SizeFDiagCursor); break;
+            return Qt::SizeFDiagCursor;
         case HandlePosition::TopRight: case HandlePosition::BottomLeft:
-            setCursor(Qt::SizeBDiagCursor); break;
+            return Qt::SizeBDiagCursor;
         case HandlePosition::Top: case HandlePosition::Bottom:
-            setCursor(Qt::SizeVerCursor); break;
+            return Qt::SizeVerCursor;
         case HandlePosition::Left: case HandlePosition::Right:
-            setCursor(Qt::SizeHorCursor); break;
-        default: setCursor(Qt::ArrowCursor); break;
+            return Qt::SizeHorCursor;
+        default: return Qt::ArrowCursor;
         }
-        return;
     }
 
     // Проверяем попадание на фигуру
-    if (shapeAt(pos)) {
-        setCursor(Qt::SizeAllCursor);
+    if (shapeAt(pos) != NoShape) return Qt::SizeAllCursor;
+
+    // По умолчанию курсор зависит от инструмента
+    return currentTool == Tool::Draw ? Qt::CrossCursor : Qt::ArrowCursor;
+}
+
+/**
+ * @brief Полуразмер квадрата вокруг pos (в мировых координатах), внутри
+ * которого shapeAt и getHandleAt дают тот же результат.
+ *
+ * Результат меняется, только когда курсор пересекает границу чьей-то
+ * области: запаса кандидата в spatial index, прямоугольника попадания,
+ * ручки или порога расстояния до линии. Берем наименьший запас по всем
+ * фигурам рядом. Сдвиг внутри квадрата радиуса r меняет расстояние до
+ * линии не больше чем на r*sqrt(2). Фигуры дальше HOVER_REGION_PX от
+ * курсора попасть в квадрат не могут.
+ */
+int Canvas::hoverRadius(const QPoint& pos) const {
+    const qreal m = toWorldLength(LINE_HIT_THRESHOLD);
+    const bool handles = zoom >= HANDLES_MIN_ZOOM;
+    const qreal h2 = toWorldLength(HANDLE_SIZE / 2.0);
+    qreal r = toWorldLength(HOVER_REGION_PX);
+
+    // Кандидаты shapeAt/getHandleAt для любой точки квадрата (2 - отступ hitTest у рамок)
+    const qreal reach = qMax(qMax(m, h2), 2.0) + r;
+    QRectF area(pos.x() - reach, pos.y() - reach, 2 * reach, 2 * reach);
+    doc.query(area, [&](ShapeId id) {
+        int i = doc.slotOf(id);
+        QRectF bounds = doc.boundsAt(i);
+        r = qMin(r, edgeDistance(bounds.adjusted(-m, -m, m, m), pos));
+
+        const Shape s = doc.shapeInSlot(i);
+        if (s.type == ShapeType::Connector) {
+            const std::vector<QPoint>& route = doc.getRoute(id);
+            for (size_t k = 1; k < route.size(); ++k) {
+                r = qMin(r, qAbs(Geometry::segmentDistance(pos, route[k - 1], route[k]) - m) / M_SQRT2);
+            }
+        } else if (s.type == ShapeType::Line) {
+            if (s.start != s.end) {
+                r = qMin(r, qAbs(Geometry::segmentDistance(pos, s.start, s.end) - m) / M_SQRT2);
+            }
+        } else {
+            r = qMin(r, edgeDistance(QRectF(s.rect.adjusted(-2, -2, 2, 2)), pos));
+        }
+
+        if (handles && selection.contains(id)) {
+            r = qMin(r, edgeDistance(bounds.adjusted(-h2, -h2, h2, h2), pos));
+            const HandleSet hs = getResizeHandles(s);
+            for (int k = 0; k < hs.count; ++k) {
+                r = qMin(r, edgeDistance(hs.rects[k], pos));
+            }
+        }
+    });
+    return qMax(0, int(r) - 1); // Запас на целые координаты и включительные границы
+}
+
+/**
+ * @brief Интервал между кадрами экрана (мс).
+ */
+int Canvas::frameIntervalMs() const {
+    qreal hz = screen() ? screen()->refreshRate() : 0;
+    if (hz <= 0) hz = 60;
+    return qMax(1, qRound(1000.0 / hz));
+}
+
+/**
+ * @brief Собирает рамки и ручки выделенных фигур в selectionFrames/selectionHandles.
+ *
+ * Невыделенные фигуры ничего не рисуют, так что отдельная проверка
+ * "есть ли выделение" (проход по всем фигурам) не нужна: смотрим только
+ * видимые фигуры (visibleShapes), а в обзоре, где они не собираются, -
+ * само выделение. При сильном уменьшении ручки не рисуются - они
+ * закрыли бы фигуру.
+ */
+void Canvas::collectSelection(const QRectF& worldArea, bool overview) {
+    selectionFrames.clear();
+    selectionHandles.clear();
+    const qreal gap = toWorldLength(SELECTION_FRAME_GAP);
+    const bool showHandles = zoom >= HANDLES_MIN_ZOOM;
+    auto addSelected = [&](const Shape& s, const QRectF& bounds) {
+        selectionFrames.push_back(bounds.adjusted(-gap, -gap, gap, gap)); // Рамка выделения
+        if (!showHandles) return;
+        const HandleSet handles = getResizeHandles(s);
+        selectionHandles.insert(selectionHandles.end(), handles.rects,
+                                handles.rects + handles.count); // Ручки ресайза
+    };
+    // У свернутой группы одна рамка вокруг всей группы и нет ручек
+    auto addUnit = [&](GroupId g) {
+        if (isUnitSelected(g)) selectionFrames.push_back(doc.getGroupBounds(g).adjusted(-gap, -gap, gap, gap));
+    };
+    if (!overview) {
+        for (int slot : visibleShapes) {
+            ShapeId id = doc.idAt(slot);
+            if (!selection.contains(id) || doc.getUnit(id) != NoGroup) continue;
+            addSelected(doc.shapeInSlot(slot), doc.boundsAt(slot));
+        }
+        for (GroupId g : visibleUnits) addUnit(g);
+    } else if (selection.size() <= OVERVIEW_MAX_SELECTION) {
+        for (ShapeId id : selection) {
+            if (doc.getUnit(id) != NoGroup) continue;
+            QRectF bounds = doc.getBounds(id);
+            if (bounds.intersects(worldArea)) addSelected(doc.getShape(id), bounds);
+        }
+        doc.queryUnits(worldArea, [&](GroupId g) {
+            if (!isUnitMoving(g)) addUnit(g);
+        });
+    }
+}
+
+/**
+ * @brief Пороги упрощения рендерера для текущего масштаба.
+ */
+void Canvas::applyDetailLimits() {
+    renderer.setDetailLimits(toWorldLength(LOD_SPLAT_PX), toWorldLength(LOD_BOX_PX),
+                             toWorldLength(LOD_TEXT_PX));
+}
+
+/**
+ * @brief Отдает потоку рендера снимок сцены, если она изменилась.
+ *
+ * Снимок - копия только видимых фигур (по всему виджету), их выделения,
+ * стилей и вида; дальше поток работает с ним, не трогая документ.
+ */
+void Canvas::requestFrame() {
+    FrameKey key{doc.getRevision(), selection.getVersion(), view, size(), devicePixelRatioF(),
+                 !moveUnits.empty()};
+    if (frameRequested && key == lastFrame) return;
+    frameRequested = true;
+    lastFrame = key;
+
+    qreal margin = toWorldLength(DAMAGE_MARGIN) + doc.getStyles().getMaxStrokeWidth() / 2;
+    QRectF worldArea = viewInverse.mapRect(QRectF(rect())).adjusted(-margin, -margin, margin, margin);
+    // Фигуры свернутых групп поток рисует по одной, в их слоях; перетаскиваемые
+    // группы и их внешние связи рисует сам виджет поверх кадра
+    visibleShapes.clear();
+    visibleUnits.clear();
+    bool hide = !moveHidden.isEmpty();
+    doc.queryItems(worldArea, [&](ShapeId id) {
+        if (!hide || !moveHidden.contains(id)) visibleShapes.push_back(doc.slotOf(id));
+    }, [&](GroupId g) {
+        if (isUnitMoving(g)) return;
+        visibleUnits.push_back(g);
+        doc.queryGroup(g, worldArea, [this](ShapeId id) { visibleShapes.push_back(doc.slotOf(id)); });
+    });
+    std::sort(visibleShapes.begin(), visibleShapes.end());
+
+    frameSnapshot.shapes.clear();
+    for (int slot : visibleShapes) {
+        frameSnapshot.shapes.append(doc, slot);
+    }
+    collectSelection(worldArea, false);
+    std::swap(frameSnapshot.selectionFrames, selectionFrames);
+    std::swap(frameSnapshot.selectionHandles, selectionHandles);
+    frameSnapshot.styles = doc.getStyles();
+    frameSnapshot.view = view;
+    frameSnapshot.size = size();
+    frameSnapshot.dpr = key.dpr;
+    frameSnapshot.splatSize = toWorldLength(LOD_SPLAT_PX);
+    frameSnapshot.boxSize = toWorldLength(LOD_BOX_PX);
+    frameSnapshot.textSize = toWorldLength(LOD_TEXT_PX);
+
+    renderThread->render(frameSnapshot); // Взамен получаем старые буферы
+}
+
+/**
+ * @brief Включен ли обзорный режим (карта плотности вместо фигур).
+ */
+bool Canvas::isOverview() const {
+    return zoom < OVERVIEW_MAX_ZOOM && doc.size() >= OVERVIEW_MIN_SHAPES;
+}
+
+/**
+ * @brief Рисует область мира по карте плотности.
+ *
+ * Каждая ячейка карты - один пиксель картинки, прозрачность по числу
+ * фигур в ячейке; картинка растягивается на ячейки без сглаживания.
+ * Ячейки привязаны к мировой сетке, поэтому частичные перерисовки
+ * стыкуются без швов. Карта пересчитывается, только если документ
+ * изменился не шагом перетаскивания: перемещение, ресайз и связи,
+ * идущие за портами, переносят фигуры в карте сами (moveShape).
+ */
+void Canvas::drawDensity(QPainter* p, const QRectF& worldArea) {
+    if (!densityMap.isBuiltFor(doc)) {
+        densityMap.build(doc);
+    }
+
+    int level = densityMap.levelFor(toWorldLength(OVERVIEW_CELL_PX));
+    QRect range = densityMap.cellRange(level, worldArea);
+    if (range.isEmpty()) return;
+
+    if (densityImage.width() < range.width() || densityImage.height() < range.height()) {
+        densityImage = QImage(qMax(range.width(), densityImage.width()),
+                              qMax(range.height(), densityImage.height()),
+                              QImage::Format_ARGB32_Premultiplied);
+    }
+    densityImage.fill(Qt::transparent);
+
+    // Непрозрачность по числу фигур: 1 - exp(-n / DENSITY_SATURATION)
+    static const std::vector<QRgb> shades = [] {
+        std::vector<QRgb> t(64);
+        for (size_t n = 0; n < t.size(); ++n) {
+            int a = qRound(255 * (1 - std::exp(-qreal(n) / DENSITY_SATURATION)));
+            t[n] = qPremultiply(qRgba(0, 0, 0, a));
+        }
+        return t;
+    }();
+
+    densityMap.forEachCell(level, range, [&](int cx, int cy, quint32 count) {
+        QRgb* line = reinterpret_cast<QRgb*>(densityImage.scanLine(cy - range.top()));
+        line[cx - range.left()] = shades[qMin<size_t>(count, shades.size() - 1)];
+    });
+
+    qreal cell = densityMap.getCellSize(level);
+    QRectF target(range.left() * cell, range.top() * cell, range.width() * cell, range.height() * cell);
+    p->drawImage(target, densityImage, QRectF(0, 0, range.width(), range.height()));
+}
+
+/**
+ * @brief Рисует фон сетки из закэшированной плитки.
+ *
+ * Плитка (gridSize x gridSize с белым фоном и двумя линиями)
+ * рисуется один раз и затем просто размножается drawTiledPixmap.
+ */
+void Canvas::drawGrid(QPainter* p, const QRect& area) {
+    qreal spacing = gridSize * zoom; // Шаг сетки на экране
+    if (gridSize <= 0 || spacing < MIN_GRID_SPACING) {
+        p->fillRect(area, Qt::white);
         return;
     }
 
-    // По умолчанию ставим курсор в зависимости от инструмента
-    if (currentTool == Tool::Draw) {
-        setCursor(Qt::CrossCursor);
-    } else {
-        setCursor(Qt::ArrowCursor);
+    // Плитка годится, только если шаг - целое число пикселей устройства,
+    // иначе ошибка округления копится от плитки к плитке
+    qreal dpr = devicePixelRatioF();
+    qreal devSpacing = spacing * dpr;
+    if (qAbs(devSpacing - qRound(devSpacing)) > 1e-3) {
+        p->fillRect(area, Qt::white);
+        drawGridLines(p, area);
+        return;
     }
+
+    if (gridTile.isNull() || gridTileSize != gridSize || gridTileZoom != zoom || gridTileDpr != dpr) {
+        rebuildGridTile(dpr);
+    }
+
+    // Смещение внутри плитки, чтобы линии оставались на мировых x,y кратных gridSize
+    qreal ox = std::fmod(area.left() - panOffset.x(), spacing);
+    qreal oy = std::fmod(area.top() - panOffset.y(), spacing);
+    if (ox < 0) ox += spacing;
+    if (oy < 0) oy += spacing;
+    p->drawTiledPixmap(QRectF(area), gridTile, QPointF(ox, oy));
 }
 
 /**
- * @brief Рисует фон сетки (линиями).
+ * @brief Перерисовывает плитку сетки под текущие gridSize, масштаб и DPI.
+ */
+void Canvas::rebuildGridTile(qreal dpr) {
+    gridTileSize = gridSize;
+    gridTileZoom = zoom;
+    gridTileDpr = dpr;
+
+    int devSize = qMax(1, qRound(gridSize * zoom * dpr));
+    qreal size = devSize / dpr;
+    gridTile = QPixmap(devSize, devSize);
+    gridTile.setDevicePixelRatio(dpr);
+    gridTile.fill(Qt::white);
+
+    // Сетка стала бледнее. Без сглаживания - линия ровно в 1 пиксель
+    QPainter tp(&gridTile);
+    tp.setPen(QPen(QColor(240, 240, 240), 1, Qt::SolidLine));
+    tp.drawLine(QLineF(0, 0, size, 0));
+    tp.drawLine(QLineF(0, 0, 0, size));
+}
+
+/**
+ * @brief Рисует фон сетки линиями.
+ *
+ * Используется при дробном шаге сетки на экране и при BSG_GRID_LINES=1
+ * (старый способ, для сравнения).
  */
-void Canvas::drawGrid(QPainter* p) {
-    if (gridSize <= 0) return;
+void Canvas::drawGridLines(QPainter* p, const QRect& area) {
+    qreal spacing = gridSize * zoom;
+    if (gridSize <= 0 || spacing < MIN_GRID_SPACING) return;
 
     // Сетка стала бледнее
     QPen pen(QColor(240, 240, 240), 1, Qt::SolidLine); // Используем сплошную линию
     p->setPen(pen);
 
-    int w = width();
-    int h = height();
+    // Рисуем только линии, попадающие в перерисовываемую область.
+    // Позиция каждой линии считается от начала мира, без накопления ошибки
+    int x1 = area.right() + 1;
+    int y1 = area.bottom() + 1;
 
-    for (int x = 0; x < w; x += gridSize) {
-        p->drawLine(x, 0, x, h);
+    for (int k = qFloor((area.left() - panOffset.x()) / spacing); ; ++k) {
+        int x = qRound(panOffset.x() + k * spacing);
+        if (x >= x1) break;
+        p->drawLine(x, area.top(), x, y1);
     }
-    for (int y = 0; y < h; y += gridSize) {
-        p->drawLine(0, y, w, y);
+    for (int k = qFloor((area.top() - panOffset.y()) / spacing); ; ++k) {
+        int y = qRound(panOffset.y() + k * spacing);
+        if (y >= y1) break;
+        p->drawLine(area.left(), y, x1, y);
     }
 }
 
+/**
+ * @brief Копит время кадра и сетки, периодически печатает средние значения.
+ */
+void Canvas::reportFrameStats(qint64 gridNs, qint64 frameNs) {
+    statFrames++;
+    statGridNs += gridNs;
+    statFrameNs += frameNs;
+    if (statFrames < FRAME_STATS_PERIOD) return;
+
+    qDebug().noquote() << QString("frame: %1 us, grid (%2): %3 us (avg of %4 frames)")
+                              .arg(statFrameNs / 1000.0 / statFrames, 0, 'f', 1)
+                              .arg(gridLinesMode ? "lines" : "tile")
+                              .arg(statGridNs / 1000.0 / statFrames, 0, 'f', 1)
+                              .arg(statFrames);
+    statFrames = 0;
+    statGridNs = 0;
+    statFrameNs = 0;
+}
+
+/**
+ * @brief Пересчитывает цифры HUD за прошедший период и перерисовывает его.
+ */
+void Canvas::updateHud() {
+    qreal seconds = qMax<qint64>(1, hudElapsed.restart()) / 1000.0;
+    QString frame = hudFrames > 0
+        ? QString("frame %1 ms (max %2)").arg(hudFrameNs / 1e6 / hudFrames, 0, 'f', 2)
+                                          .arg(hudFrameMaxNs / 1e6, 0, 'f', 2)
+        : QString("frame -");
+    QRect old = hudRect();
+    hudText = QString("%1, %2 fps\nevents %3/s\nshapes %4, selected %5\nzoom %6%%7")
+                  .arg(frame)
+                  .arg(qRound(hudFrames / seconds))
+                  .arg(qRound(hudEvents / seconds))
+                  .arg(doc.size())
+                  .arg(selection.size())
+                  .arg(qRound(zoom * 100))
+                  .arg(Trace::isEnabled() ? ", tracing" : "");
+    hudFrames = hudEvents = 0;
+    hudFrameNs = hudFrameMaxNs = 0;
+    update(old.united(hudRect()));
+}
+
+/**
+ * @brief Область HUD в координатах виджета (левый верхний угол).
+ */
+QRect Canvas::hudRect() const {
+    QFontMetrics fm(font());
+    QRect text = fm.boundingRect(QRect(0, 0, width(), height()), Qt::AlignLeft | Qt::AlignTop,
+                                 hudText.isEmpty() ? QString("frame -") : hudText);
+    return text.translated(HUD_MARGIN, HUD_MARGIN).adjusted(-HUD_MARGIN / 2, -HUD_MARGIN / 2,
+                                                            HUD_MARGIN / 2, HUD_MARGIN / 2);
+}
+
+/**
+ * @brief Рисует HUD полупрозрачной плашкой поверх холста.
+ */
+void Canvas::drawHud(QPainter* p) {
+    p->resetTransform();
+    QRect r = hudRect();
+    p->setPen(Qt::NoPen);
+    p->setBrush(QColor(0, 0, 0, 160));
+    p->drawRect(r);
+    p->setPen(Qt::white);
+    p->drawText(r.adjusted(HUD_MARGIN / 2, HUD_MARGIN / 2, 0, 0), Qt::AlignLeft | Qt::AlignTop,
+                hudText.isEmpty() ? QString("frame -") : hudText);
+}
+
 /**
  * @brief Привязывает точку к ближайшему узлу сетки.
  */
-QPoint Canvas::snapToGrid(const QPoint& pos) {
+QPoint Canvas::snapToGrid(const QPoint& pos) const {
     if (!snapEnabled || gridSize <= 0) {
         return pos; // Привязка выключена, возвращаем как есть
     }
@@ -684,3 +2360,114 @@ QPoint Canvas::snapToGrid(const QPoint& pos) {
 
     return QPoint(snappedX, snappedY);
 }
+
+// --- Направляющие выравнивания ---
+
+/**
+ * @brief Начинает перетаскивание выделения из точки pos.
+ *
+ * Границы выделения запоминаются один раз - по ним на каждом шаге
+ * ищутся линии выравнивания.
+ */
+void Canvas::beginMove(const QPoint& pos) {
+    moving = true;
+    moveTotal = QPoint();
+    moveStart = pos;
+    lastMousePos = pos;
+    moveBounds = QRectF();
+
+    // Выделение делится на свободные фигуры и свернутые группы (целиком)
+    moveShapes.clear();
+    moveUnits.clear();
+    for (ShapeId id : selection) {
+        GroupId unit = doc.getUnit(id);
+        if (unit != NoGroup) {
+            if (std::find(moveUnits.begin(), moveUnits.end(), unit) == moveUnits.end()) {
+                moveUnits.push_back(unit);
+            }
+        } else if (doc.getType(id) != ShapeType::Connector) {
+            moveShapes.push_back(id);
+            moveBounds |= doc.getBounds(id);
+        }
+    }
+
+    // Связи, выходящие из групп наружу, до отпускания рисуются "локтем"
+    moveLinks.clear();
+    moveHidden.clear();
+    for (GroupId g : moveUnits) {
+        moveBounds |= doc.getGroupBounds(g);
+        groupScratch.clear();
+        doc.collectGroupShapes(g, groupScratch);
+        for (ShapeId id : groupScratch) {
+            for (ShapeId c : doc.getConnectors(id)) {
+                const ConnectorLink& link = doc.getLink(c);
+                bool inside = doc.getUnit(c) == g && doc.getUnit(link.from) == g && doc.getUnit(link.to) == g;
+                if (!inside && moveHidden.insert(c)) moveLinks.push_back(c);
+            }
+        }
+    }
+    for (ShapeId c : moveLinks) invalidateShape(c); // До отпускания - только "локтем"
+    prepareSnap(true, pos);
+}
+
+/**
+ * @brief Строит индекс линий выравнивания по видимой части схемы.
+ *
+ * excludeSelection - перетаскиваются выделенные фигуры, к себе они не
+ * привязываются. focus - начало перетаскивания: при мелком масштабе
+ * в индекс идут только ближайшие к нему фигуры.
+ */
+void Canvas::prepareSnap(bool excludeSelection, const QPoint& focus) {
+    snapExcludesSelection = excludeSelection;
+    snapFocus = focus;
+    snapIndex.clear();
+    if (!guidesEnabled || isOverview()) return;
+    BSG_TRACE_SCOPE("snapIndex");
+    snapIndex.build(doc, viewInverse.mapRect(QRectF(rect())), excludeSelection ? &selection : nullptr,
+                    focus);
+}
+
+/**
+ * @brief Перестраивает индекс, если за время перетаскивания сменился вид.
+ */
+void Canvas::refreshSnap() {
+    if (!guidesEnabled) return;
+    QRectF visible = viewInverse.mapRect(QRectF(rect()));
+    if (visible != snapIndex.getArea()) prepareSnap(snapExcludesSelection, snapFocus);
+}
+
+/**
+ * @brief Точка рисования: по сетке, а рядом с линией другой фигуры - на нее.
+ */
+QPoint Canvas::snapDrawPoint(const QPoint& pos) {
+    QPoint snapped = snapToGrid(pos);
+    if (snapIndex.isEmpty()) return snapped;
+    SnapResult r = snapIndex.snapPoint(pos, qCeil(toWorldLength(GUIDE_SNAP_PX)));
+    if (r.snappedX) snapped.setX(pos.x() + r.offset.x());
+    if (r.snappedY) snapped.setY(pos.y() + r.offset.y());
+    setGuides(r);
+    return snapped;
+}
+
+/**
+ * @brief Показывает новые направляющие, перерисовывая старые и новые.
+ */
+void Canvas::setGuides(const SnapResult& result) {
+    auto lineRect = [](const QLine& l) { return QRectF(QPointF(l.p1()), QPointF(l.p2())).normalized(); };
+    bool same = guides.snappedX == result.snappedX && guides.snappedY == result.snappedY &&
+                (!result.snappedX || guides.guideX == result.guideX) &&
+                (!result.snappedY || guides.guideY == result.guideY);
+    if (same) return;
+    if (guides.snappedX) update(damageRect(lineRect(guides.guideX)));
+    if (guides.snappedY) update(damageRect(lineRect(guides.guideY)));
+    guides = result;
+    if (guides.snappedX) update(damageRect(lineRect(guides.guideX)));
+    if (guides.snappedY) update(damageRect(lineRect(guides.guideY)));
+}
+
+/**
+ * @brief Убирает направляющие (конец перетаскивания).
+ */
+void Canvas::clearGuides() {
+    setGuides(SnapResult());
+}
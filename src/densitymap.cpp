@@ -0,0 +1,136 @@
+#include "densitymap.h"
+#include <QtMath> // Для qFloor
+
+//==================================================================
+// 1. Public-функции
+//==================================================================
+
+/**
+ * @brief Пересчитывает все уровни по текущему состоянию документа.
+ *
+ * Нулевой уровень считается проходом по массивам точек, каждый
+ * следующий - слиянием четверок ячеек предыдущего.
+ */
+void DensityMap::build(const Document& doc) {
+    levels.clear();
+    levels.emplace_back();
+
+    const std::vector<QPoint>& p1s = doc.getP1s();
+    const std::vector<QPoint>& p2s = doc.getP2s();
+    Level& base = levels.front();
+    for (size_t i = 0; i < p1s.size(); ++i) {
+        int cx, cy;
+        baseCell(p1s[i], p2s[i], cx, cy);
+        ++base[cellKey(cx, cy)];
+    }
+
+    // Уровни до тех пор, пока ячеек не останется совсем мало
+    // (схема вокруг начала координат всегда занимает до 4 ячеек)
+    while ((int)levels.size() < MAX_LEVELS && levels.back().size() > 4) {
+        Level next;
+        next.reserve(levels.back().size() / 2);
+        for (const auto& [key, count] : levels.back()) {
+            int cx = int(qint32(quint32(key >> 32)));
+            int cy = int(qint32(quint32(key & 0xffffffffu)));
+            // Сдвиг вправо - деление с округлением вниз и для отрицательных
+            next[cellKey(cx >> 1, cy >> 1)] += count;
+        }
+        levels.push_back(std::move(next));
+    }
+
+    revision = doc.getRevision();
+    built = true;
+}
+
+/**
+ * @brief Переносит одну фигуру из ячейки старых точек в ячейку новых.
+ *
+ * Правка шага перетаскивания стоит O(число уровней) вместо полного
+ * пересчета. Опустевшие ячейки удаляются, чтобы обход forEachCell
+ * не рос от перемещений. Число уровней не меняется - это только
+ * порог для выбора уровня, а не инвариант.
+ */
+void DensityMap::moveShape(const QPoint& oldP1, const QPoint& oldP2, const QPoint& p1, const QPoint& p2) {
+    if (!built) return;
+    int ox, oy, nx, ny;
+    baseCell(oldP1, oldP2, ox, oy);
+    baseCell(p1, p2, nx, ny);
+    for (Level& cells : levels) {
+        if (ox == nx && oy == ny) return; // Дальше ячейки тоже совпадают
+        auto it = cells.find(cellKey(ox, oy));
+        if (it != cells.end() && --it->second == 0) cells.erase(it);
+        ++cells[cellKey(nx, ny)];
+        ox >>= 1; oy >>= 1;
+        nx >>= 1; ny >>= 1;
+    }
+}
+
+/**
+ * @brief Принимает текущую ревизию документа без пересчета.
+ *
+ * Вызывается после правки, которую карта уже повторила через
+ * moveShape (или которая не меняет точки фигур).
+ */
+void DensityMap::markCurrent(const Document& doc) {
+    if (built) revision = doc.getRevision();
+}
+
+/**
+ * @brief Освобождает все уровни.
+ */
+void DensityMap::clear() {
+    levels.clear();
+    built = false;
+}
+
+/**
+ * @brief Проверяет, построена ли карта по текущей ревизии документа.
+ */
+bool DensityMap::isBuiltFor(const Document& doc) const {
+    return built && revision == doc.getRevision();
+}
+
+/**
+ * @brief Выбирает самый подробный уровень с ячейкой не меньше cellSize.
+ */
+int DensityMap::levelFor(qreal cellSize) const {
+    int level = 0;
+    while (level + 1 < (int)levels.size() && getCellSize(level) < cellSize) {
+        ++level;
+    }
+    return level;
+}
+
+/**
+ * @brief Возвращает диапазон ячеек уровня, покрывающий область.
+ */
+QRect DensityMap::cellRange(int level, const QRectF& area) const {
+    qreal size = getCellSize(level);
+    int left = qFloor(area.left() / size);
+    int top = qFloor(area.top() / size);
+    int right = qFloor(area.right() / size);
+    int bottom = qFloor(area.bottom() / size);
+    return QRect(QPoint(left, top), QPoint(right, bottom));
+}
+
+//==================================================================
+// 2. Private-функции
+//==================================================================
+
+/**
+ * @brief Упаковывает координаты ячейки в ключ хеш-таблицы.
+ */
+quint64 DensityMap::cellKey(int cx, int cy) {
+    return (quint64(quint32(cx)) << 32) | quint32(cy);
+}
+
+/**
+ * @brief Ячейка нулевого уровня, в которую попадает центр границ фигуры.
+ */
+void DensityMap::baseCell(const QPoint& p1, const QPoint& p2, int& cx, int& cy) {
+    // Центр границ в удвоенных координатах, чтобы не терять половинки
+    qint64 cx2 = qint64(p1.x()) + p2.x();
+    qint64 cy2 = qint64(p1.y()) + p2.y();
+    cx = int(qFloor(cx2 / (2.0 * BASE_CELL)));
+    cy = int(qFloor(cy2 / (2.0 * BASE_CELL)));
+}
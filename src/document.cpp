@@ -0,0 +1,1009 @@
+#include "document.h"
+#include "geometry.h"
+#include <algorithm>
+#include <atomic>
+
+// Источник номеров ревизий, общий для всех документов
+static std::atomic<quint64> revisionCounter{0};
+
+const int CONNECTOR_STUB = 10; // Выход маршрута-"локтя" из порта
+
+/**
+ * @brief Границы ломаной.
+ */
+static QRectF routeBounds(const std::vector<QPoint>& route) {
+    if (route.empty()) return QRectF();
+    int x0 = route[0].x(), y0 = route[0].y(), x1 = x0, y1 = y0;
+    for (const QPoint& p : route) {
+        x0 = qMin(x0, p.x()); y0 = qMin(y0, p.y());
+        x1 = qMax(x1, p.x()); y1 = qMax(y1, p.y());
+    }
+    return QRectF(QPointF(x0, y0), QPointF(x1, y1));
+}
+
+//==================================================================
+// 1. Редактирование
+//==================================================================
+
+/**
+ * @brief Конструктор пустого документа.
+ */
+Document::Document() {
+    touch();
+}
+
+/**
+ * @brief Добавляет фигуру поверх остальных и возвращает ее id.
+ */
+ShapeId Document::addShape(const Shape& s) {
+    ShapeId id = nextId++;
+    touch();
+    int slot = size();
+
+    types.push_back(s.type);
+    p1s.emplace_back();
+    p2s.emplace_back();
+    styleIdx.push_back(0);
+    ids.push_back(id);
+    slotById.push_back(slot);
+
+    writeSlot(slot, s);
+    index.insert(id, boundsAt(slot));
+    return id;
+}
+
+/**
+ * @brief Заменяет геометрию и стиль фигуры.
+ */
+void Document::setShape(ShapeId id, const Shape& s) {
+    int slot = slotOf(id);
+    if (slot < 0) return;
+    touch();
+    writeSlot(slot, s);
+    reindex(id, slot);
+}
+
+/**
+ * @brief Заменяет только геометрию фигуры (тип и стиль не меняются).
+ */
+void Document::setPoints(ShapeId id, const QPoint& p1, const QPoint& p2) {
+    int slot = slotOf(id);
+    if (slot < 0) return;
+    touch();
+    p1s[slot] = p1;
+    p2s[slot] = p2;
+    reindex(id, slot);
+}
+
+/**
+ * @brief Заменяет геометрию многих фигур сразу (ресайз выделения).
+ *
+ * Одна ревизия на весь набор; удаленные фигуры пропускаются.
+ * Предки групп пересчитываются один раз в конце, а не на каждую фигуру.
+ */
+void Document::setPoints(const std::vector<ShapeId>& shapeIds, const std::vector<QPoint>& newP1s,
+                         const std::vector<QPoint>& newP2s) {
+    touch();
+    std::vector<GroupId> changed;
+    for (size_t i = 0; i < shapeIds.size(); ++i) {
+        int slot = slotOf(shapeIds[i]);
+        if (slot < 0) continue;
+        p1s[slot] = newP1s[i];
+        p2s[slot] = newP2s[i];
+        reindex(shapeIds[i], slot, &changed);
+    }
+    finishReindex(changed);
+}
+
+/**
+ * @brief Сдвигает фигуру на delta.
+ */
+void Document::translateShape(ShapeId id, const QPoint& delta) {
+    int slot = slotOf(id);
+    if (slot < 0) return;
+    touch();
+    p1s[slot] += delta;
+    p2s[slot] += delta;
+    reindex(id, slot);
+}
+
+/**
+ * @brief Сдвигает много фигур на delta за одну ревизию (перенос выделения, группы).
+ */
+void Document::translateShapes(const std::vector<ShapeId>& shapeIds, const QPoint& delta) {
+    touch();
+    std::vector<GroupId> changed;
+    for (ShapeId id : shapeIds) {
+        int slot = slotOf(id);
+        if (slot < 0) continue;
+        p1s[slot] += delta;
+        p2s[slot] += delta;
+        reindex(id, slot, &changed);
+    }
+    finishReindex(changed);
+}
+
+/**
+ * @brief Удаляет фигуры. Порядок наложения остальных сохраняется.
+ *
+ * Один проход уплотнения по всем массивам - O(n) на весь список.
+ * Группы остаются, даже опустев: undo вернет фигуры в них.
+ */
+void Document::removeShapes(const std::vector<ShapeId>& removed) {
+    bool any = false;
+    std::vector<GroupId> changed;
+    for (ShapeId id : removed) {
+        int slot = slotOf(id);
+        if (slot < 0) continue;
+        if (types[slot] == ShapeType::Connector) unlink(id);
+        labels.erase(id);
+        index.remove(id);
+        slotById[id] = -1;
+        if (Membership* m = membership(id)) {
+            if (m->group != NoGroup) changed.push_back(m->group);
+            *m = Membership();
+        }
+        any = true;
+    }
+    if (!any) return;
+    touch();
+
+    int out = 0;
+    for (int in = 0; in < size(); ++in) {
+        ShapeId id = ids[in];
+        if (slotById[id] < 0) continue; // Удаленная фигура
+        if (out != in) {
+            types[out] = types[in];
+            p1s[out] = p1s[in];
+            p2s[out] = p2s[in];
+            styleIdx[out] = styleIdx[in];
+            ids[out] = id;
+        }
+        slotById[id] = out++;
+    }
+    types.resize(out);
+    p1s.resize(out);
+    p2s.resize(out);
+    styleIdx.resize(out);
+    ids.resize(out);
+
+    if (changed.empty()) {
+        if (groupCount > 0) updateTopSlots();
+        return;
+    }
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    for (GroupId g : changed) {
+        std::vector<ShapeId>& list = groups[g].shapes;
+        list.erase(std::remove_if(list.begin(), list.end(), [this](ShapeId id) { return slotOf(id) < 0; }),
+                   list.end());
+    }
+    rebuildGroups(changed);
+    updateTopSlots();
+}
+
+/**
+ * @brief Возвращает удаленные фигуры на прежние места с прежними id (для undo).
+ *
+ * Записи должны идти по возрастанию слота - слота, который фигура
+ * займет после восстановления. Один проход слияния - O(n + k).
+ */
+void Document::restoreShapes(const std::vector<RestoredShape>& restored) {
+    if (restored.empty()) return;
+    touch();
+
+    int oldSize = size();
+    int newSize = oldSize + (int)restored.size();
+    types.resize(newSize);
+    p1s.resize(newSize);
+    p2s.resize(newSize);
+    styleIdx.resize(newSize);
+    ids.resize(newSize);
+
+    // Сливаем с конца: старые фигуры сдвигаются вверх, освобождая слоты
+    int in = oldSize - 1;
+    int r = (int)restored.size() - 1;
+    for (int out = newSize - 1; out >= 0; --out) {
+        if (r >= 0 && restored[r].slot == out) {
+            const RestoredShape& rs = restored[r--];
+            if (rs.id >= (int)slotById.size()) slotById.resize(rs.id + 1, -1);
+            if (rs.id >= nextId) nextId = rs.id + 1;
+            ids[out] = rs.id;
+            writeSlot(out, rs.shape);
+        } else {
+            types[out] = types[in];
+            p1s[out] = p1s[in];
+            p2s[out] = p2s[in];
+            styleIdx[out] = styleIdx[in];
+            ids[out] = ids[in];
+            --in;
+        }
+        slotById[ids[out]] = out;
+    }
+
+    // Фигура из группы возвращается в нее (в сетку - только если группа раскрыта)
+    std::vector<GroupId> changed;
+    for (const RestoredShape& rs : restored) {
+        if (containsGroup(rs.group)) {
+            groups[rs.group].shapes.push_back(rs.id);
+            changed.push_back(rs.group);
+        } else {
+            index.insert(rs.id, boundsAt(rs.slot));
+        }
+    }
+    if (changed.empty()) {
+        if (groupCount > 0) updateTopSlots();
+        return;
+    }
+    rebuildGroups(changed);
+    updateTopSlots();
+}
+
+/**
+ * @brief Удаляет все фигуры и стили. Новые id продолжают нумерацию.
+ */
+void Document::clear() {
+    touch();
+    for (int slot = 0; slot < size(); ++slot) {
+        slotById[ids[slot]] = -1;
+    }
+    types.clear();
+    p1s.clear();
+    p2s.clear();
+    styleIdx.clear();
+    ids.clear();
+    index.clear();
+    styles.clear();
+    connectors.clear();
+    attached.clear();
+    labels.clear();
+    clearGroups();
+}
+
+/**
+ * @brief Заменяет все фигуры готовыми массивами (загрузка из файла).
+ *
+ * Массивы забираются целиком, без разбора по фигурам; остается только
+ * раздать id по порядку и построить пространственный индекс.
+ */
+void Document::assign(std::vector<ShapeType> newTypes, std::vector<QPoint> newP1s,
+                      std::vector<QPoint> newP2s, std::vector<StyleIndex> newStyles) {
+    touch();
+    int n = (int)newTypes.size();
+    newP1s.resize(n);
+    newP2s.resize(n);
+    newStyles.resize(n);
+
+    types = std::move(newTypes);
+    p1s = std::move(newP1s);
+    p2s = std::move(newP2s);
+    styleIdx = std::move(newStyles);
+
+    ids.resize(n);
+    slotById.resize(n);
+    for (int slot = 0; slot < n; ++slot) {
+        ids[slot] = slot;
+        slotById[slot] = slot;
+    }
+    nextId = n;
+
+    // Связи без блоков; загрузчик задает их потом через setLink, как и надписи
+    connectors.clear();
+    attached.clear();
+    labels.clear();
+    for (int slot = 0; slot < n; ++slot) {
+        if (types[slot] == ShapeType::Connector) link(slot, ConnectorLink());
+    }
+
+    clearGroups();
+    index.clear();
+    for (int slot = 0; slot < n; ++slot) {
+        index.insert(slot, boundsAt(slot));
+    }
+}
+
+//==================================================================
+// 2. Доступ
+//==================================================================
+
+/**
+ * @brief Проверяет, существует ли фигура.
+ */
+bool Document::contains(ShapeId id) const {
+    return slotOf(id) >= 0;
+}
+
+/**
+ * @brief Позиция фигуры в порядке наложения (-1, если ее нет).
+ */
+int Document::slotOf(ShapeId id) const {
+    if (id < 0 || id >= (int)slotById.size()) return -1;
+    return slotById[id];
+}
+
+/**
+ * @brief Возвращает копию фигуры по id.
+ */
+Shape Document::getShape(ShapeId id) const {
+    int slot = slotOf(id);
+    if (slot < 0) return Shape{ShapeType::Line, QRect(), QPoint(), QPoint()};
+    return shapeInSlot(slot);
+}
+
+/**
+ * @brief Собирает копию фигуры из параллельных массивов.
+ */
+Shape Document::shapeInSlot(int slot) const {
+    Shape s{types[slot], QRect(), QPoint(), QPoint(), styleIdx[slot]};
+    s.setPoints(p1s[slot], p2s[slot]);
+    if (s.type == ShapeType::Connector) s.link = getLink(ids[slot]);
+    s.label = getLabel(ids[slot]);
+    return s;
+}
+
+/**
+ * @brief Общие границы всех фигур (пустой QRectF для пустого документа).
+ */
+QRectF Document::getExtent() const {
+    if (ids.empty()) return QRectF();
+
+    int x0 = p1s[0].x(), y0 = p1s[0].y(), x1 = x0, y1 = y0;
+    auto grow = [&](const QPoint& p) {
+        x0 = qMin(x0, p.x()); y0 = qMin(y0, p.y());
+        x1 = qMax(x1, p.x()); y1 = qMax(y1, p.y());
+    };
+    for (int slot = 0; slot < size(); ++slot) {
+        grow(p1s[slot]);
+        grow(p2s[slot]);
+    }
+    QRectF extent(QPointF(x0, y0), QPointF(x1, y1));
+    for (const auto& entry : connectors) {
+        extent = extent.united(entry.second.bounds); // Маршрут может выходить за порты
+    }
+    return extent;
+}
+
+//==================================================================
+// 3. Связи
+//==================================================================
+
+/**
+ * @brief Что соединяет связь (пустая связь, если это не связь).
+ */
+const ConnectorLink& Document::getLink(ShapeId id) const {
+    static const ConnectorLink none;
+    auto it = connectors.find(id);
+    return it != connectors.end() ? it->second.link : none;
+}
+
+/**
+ * @brief Задает, что соединяет связь (загрузка из файла).
+ *
+ * Точки p1/p2 не меняются - в файле они уже стоят на портах.
+ */
+void Document::setLink(ShapeId id, const ConnectorLink& newLink) {
+    int slot = slotOf(id);
+    if (slot < 0 || types[slot] != ShapeType::Connector) return;
+    touch();
+    unlink(id);
+    link(slot, newLink);
+    reindex(id, slot);
+}
+
+/**
+ * @brief Маршрут связи (пустой, если это не связь).
+ */
+const std::vector<QPoint>& Document::getRoute(ShapeId id) const {
+    static const std::vector<QPoint> none;
+    auto it = connectors.find(id);
+    return it != connectors.end() ? it->second.route : none;
+}
+
+/**
+ * @brief Устанавливает маршрут связи.
+ *
+ * Маршрут, посчитанный для старых положений портов, не принимается:
+ * его концы должны совпадать с текущими p1/p2.
+ */
+bool Document::setRoute(ShapeId id, std::vector<QPoint> route) {
+    int slot = slotOf(id);
+    if (slot < 0 || types[slot] != ShapeType::Connector) return false;
+    if (route.size() < 2 || route.front() != p1s[slot] || route.back() != p2s[slot]) return false;
+    touch();
+    ConnectorData& c = connectors[id];
+    c.route = std::move(route);
+    c.bounds = routeBounds(c.route);
+    reindex(id, slot);
+    return true;
+}
+
+/**
+ * @brief Переносит концы связи на текущие порты ее блоков.
+ *
+ * Маршрут растягивается вслед за портами с сохранением изломов, а если
+ * так нельзя - заменяется "локтем". Это временный маршрут на время,
+ * пока роутер не посчитает новый.
+ */
+bool Document::followPorts(ShapeId id) {
+    int slot = slotOf(id);
+    if (slot < 0 || types[slot] != ShapeType::Connector) return false;
+    ConnectorData& c = connectors[id];
+    int fromSlot = slotOf(c.link.from);
+    int toSlot = slotOf(c.link.to);
+    QPoint a = fromSlot >= 0 ? Geometry::portPoint(boundsAt(fromSlot), c.link.fromPort) : p1s[slot];
+    QPoint b = toSlot >= 0 ? Geometry::portPoint(boundsAt(toSlot), c.link.toPort) : p2s[slot];
+    if (a == p1s[slot] && b == p2s[slot]) return false;
+
+    touch();
+    p1s[slot] = a;
+    p2s[slot] = b;
+    if (!Geometry::stretchRoute(c.route, a, c.link.fromPort, b, c.link.toPort)) {
+        Geometry::elbowRoute(a, c.link.fromPort, b, c.link.toPort, CONNECTOR_STUB, c.route);
+    }
+    c.bounds = routeBounds(c.route);
+    reindex(id, slot);
+    return true;
+}
+
+/**
+ * @brief Связи, присоединенные к блоку.
+ */
+const std::vector<ShapeId>& Document::getConnectors(ShapeId block) const {
+    static const std::vector<ShapeId> none;
+    auto it = attached.find(block);
+    return it != attached.end() ? it->second : none;
+}
+
+/**
+ * @brief Надпись фигуры (пустая, если ее нет).
+ */
+const QString& Document::getLabel(ShapeId id) const {
+    static const QString none;
+    auto it = labels.find(id);
+    return it != labels.end() ? it->second : none;
+}
+
+/**
+ * @brief Задает надпись фигуры; пустая строка убирает ее.
+ *
+ * Габариты не меняются - текст рисуется внутри блока или у связи.
+ */
+void Document::setLabel(ShapeId id, const QString& text) {
+    if (slotOf(id) < 0) return;
+    auto it = labels.find(id);
+    if (text.isEmpty()) {
+        if (it == labels.end()) return;
+        labels.erase(it);
+    } else if (it != labels.end()) {
+        if (it->second == text) return;
+        it->second = text;
+    } else {
+        labels.emplace(id, text);
+    }
+    touch();
+    if (const Membership* m = membership(id)) {
+        if (m->group != NoGroup) groupChanged(m->group); // Картинка группы устарела
+    }
+}
+
+//==================================================================
+// 4. Группы
+//==================================================================
+
+/**
+ * @brief Создает группу и возвращает ее id (NoGroup, если членов нет).
+ *
+ * Члены должны быть прямыми детьми group.parent (или не состоять в
+ * группах, если родителя нет); остальные пропускаются. В родителе они
+ * заменяются новой группой.
+ */
+GroupId Document::addGroup(const GroupRecord& rec) {
+    GroupId g = insertGroup(rec);
+    if (g != NoGroup) updateTopSlots();
+    return g;
+}
+
+/**
+ * @brief Расформировывает группу: ее фигуры и подгруппы переходят к родителю.
+ *
+ * Возвращает запись, по которой addGroup вернет группу с тем же id.
+ */
+GroupRecord Document::removeGroup(GroupId g) {
+    GroupRecord rec = eraseGroup(g);
+    if (rec.id != NoGroup) updateTopSlots();
+    return rec;
+}
+
+/**
+ * @brief Создает группы по порядку записей.
+ *
+ * Верхние слоты (проход по всем фигурам) пересчитываются один раз на
+ * всю пачку, а не на каждую группу: загрузка файла с G группами стоит
+ * O(G + n), а не O(G * n).
+ */
+std::vector<GroupId> Document::addGroups(const std::vector<GroupRecord>& records) {
+    std::vector<GroupId> added;
+    added.reserve(records.size());
+    for (const GroupRecord& rec : records) added.push_back(insertGroup(rec));
+    updateTopSlots();
+    return added;
+}
+
+/**
+ * @brief Расформировывает группы по порядку; верхние слоты - один раз.
+ */
+std::vector<GroupRecord> Document::removeGroups(const std::vector<GroupId>& ids) {
+    std::vector<GroupRecord> removed;
+    removed.reserve(ids.size());
+    for (GroupId g : ids) removed.push_back(eraseGroup(g));
+    updateTopSlots();
+    return removed;
+}
+
+/**
+ * @brief Создает группу без пересчета верхних слотов (см. addGroup).
+ */
+GroupId Document::insertGroup(const GroupRecord& rec) {
+    GroupId parent = containsGroup(rec.parent) ? rec.parent : NoGroup;
+    std::vector<ShapeId> shapes;
+    std::vector<GroupId> subgroups;
+    for (ShapeId id : rec.shapes) {
+        if (contains(id) && getGroup(id) == parent) shapes.push_back(id);
+    }
+    for (GroupId s : rec.subgroups) {
+        if (containsGroup(s) && groups[s].parent == parent) subgroups.push_back(s);
+    }
+    std::sort(shapes.begin(), shapes.end());
+    shapes.erase(std::unique(shapes.begin(), shapes.end()), shapes.end());
+    std::sort(subgroups.begin(), subgroups.end());
+    subgroups.erase(std::unique(subgroups.begin(), subgroups.end()), subgroups.end());
+    if (shapes.empty() && subgroups.empty()) return NoGroup;
+    touch();
+
+    // Id удаленной группы возвращается (undo), иначе - новый
+    GroupId g = rec.id;
+    if (g < 0 || containsGroup(g)) g = (int)groups.size();
+    if (g >= (int)groups.size()) groups.resize(g + 1);
+    if (members.size() < slotById.size()) members.resize(slotById.size());
+
+    GroupData& d = groups[g];
+    d = GroupData();
+    d.alive = true;
+    d.collapsed = rec.collapsed;
+    d.parent = parent;
+    d.shapes = shapes;
+    d.subgroups = subgroups;
+    groupCount++;
+    for (ShapeId id : shapes) members[id].group = g;
+    for (GroupId s : subgroups) groups[s].parent = g;
+
+    std::vector<GroupId> changed{g};
+    if (parent != NoGroup) {
+        GroupData& p = groups[parent];
+        p.shapes.erase(std::remove_if(p.shapes.begin(), p.shapes.end(),
+                                      [&](ShapeId id) { return members[id].group != parent; }),
+                       p.shapes.end());
+        p.subgroups.erase(std::remove_if(p.subgroups.begin(), p.subgroups.end(),
+                                         [&](GroupId s) { return groups[s].parent != parent; }),
+                          p.subgroups.end());
+        p.subgroups.push_back(g);
+        changed.push_back(parent);
+    }
+    rebuildGroups(changed);
+    relinkUnits(g);
+    return g;
+}
+
+/**
+ * @brief Расформировывает группу без пересчета верхних слотов (см. removeGroup).
+ */
+GroupRecord Document::eraseGroup(GroupId g) {
+    GroupRecord rec;
+    if (!containsGroup(g)) return rec;
+    touch();
+
+    GroupData& d = groups[g];
+    rec.id = g;
+    rec.parent = d.parent;
+    rec.collapsed = d.collapsed;
+    rec.shapes = std::move(d.shapes);
+    rec.subgroups = std::move(d.subgroups);
+    GroupId parent = d.parent;
+    if (d.unit) units.remove(g);
+    d = GroupData();
+    groupCount--;
+
+    for (ShapeId id : rec.shapes) members[id].group = parent;
+    for (GroupId s : rec.subgroups) groups[s].parent = parent;
+
+    if (parent != NoGroup) {
+        GroupData& p = groups[parent];
+        p.subgroups.erase(std::remove(p.subgroups.begin(), p.subgroups.end(), g), p.subgroups.end());
+        p.shapes.insert(p.shapes.end(), rec.shapes.begin(), rec.shapes.end());
+        p.subgroups.insert(p.subgroups.end(), rec.subgroups.begin(), rec.subgroups.end());
+        std::vector<GroupId> changed{parent};
+        rebuildGroups(changed);
+        relinkUnits(parent);
+    } else {
+        for (ShapeId id : rec.shapes) {
+            members[id] = Membership();
+            index.update(id, getBounds(id));
+        }
+        for (GroupId s : rec.subgroups) {
+            groups[s].itemInParent = -1;
+            assignUnit(s, NoGroup);
+        }
+    }
+    return rec;
+}
+
+/**
+ * @brief Сворачивает или раскрывает группу.
+ *
+ * Свернутая группа без свернутых предков становится единицей: ее
+ * фигуры уходят из сетки фигур в сетку единиц.
+ */
+void Document::setGroupCollapsed(GroupId g, bool collapsed) {
+    if (!containsGroup(g) || groups[g].collapsed == collapsed) return;
+    touch();
+    groups[g].collapsed = collapsed;
+    relinkUnits(g);
+    groupChanged(g);
+}
+
+/**
+ * @brief Проверяет, существует ли группа.
+ */
+bool Document::containsGroup(GroupId g) const {
+    return g >= 0 && g < (int)groups.size() && groups[g].alive;
+}
+
+/**
+ * @brief Ближайшая группа фигуры (NoGroup, если фигура ни в какой).
+ */
+GroupId Document::getGroup(ShapeId id) const {
+    const Membership* m = membership(id);
+    return m ? m->group : NoGroup;
+}
+
+/**
+ * @brief Единица (свернутая группа), в составе которой рисуется фигура.
+ */
+GroupId Document::getUnit(ShapeId id) const {
+    const Membership* m = membership(id);
+    return m ? m->unit : NoGroup;
+}
+
+/**
+ * @brief Родительская группа (NoGroup для группы верхнего уровня).
+ */
+GroupId Document::getParentGroup(GroupId g) const {
+    return containsGroup(g) ? groups[g].parent : NoGroup;
+}
+
+/**
+ * @brief Свернута ли группа.
+ */
+bool Document::isGroupCollapsed(GroupId g) const {
+    return containsGroup(g) && groups[g].collapsed;
+}
+
+/**
+ * @brief Фигуры, входящие в группу напрямую.
+ */
+const std::vector<ShapeId>& Document::getGroupShapes(GroupId g) const {
+    static const std::vector<ShapeId> none;
+    return containsGroup(g) ? groups[g].shapes : none;
+}
+
+/**
+ * @brief Подгруппы группы.
+ */
+const std::vector<GroupId>& Document::getSubgroups(GroupId g) const {
+    static const std::vector<GroupId> none;
+    return containsGroup(g) ? groups[g].subgroups : none;
+}
+
+/**
+ * @brief Дописывает в out все фигуры группы, включая вложенные.
+ */
+void Document::collectGroupShapes(GroupId g, std::vector<ShapeId>& out) const {
+    if (!containsGroup(g)) return;
+    const GroupData& d = groups[g];
+    out.insert(out.end(), d.shapes.begin(), d.shapes.end());
+    for (GroupId s : d.subgroups) collectGroupShapes(s, out);
+}
+
+/**
+ * @brief Какая-нибудь одна фигура группы (NoShape, если их нет).
+ *
+ * Выделение единицы - это выделение всех ее фигур, так что проверки
+ * одной достаточно.
+ */
+ShapeId Document::firstGroupShape(GroupId g) const {
+    if (!containsGroup(g)) return NoShape;
+    const GroupData& d = groups[g];
+    if (!d.shapes.empty()) return d.shapes.front();
+    for (GroupId s : d.subgroups) {
+        ShapeId id = firstGroupShape(s);
+        if (id != NoShape) return id;
+    }
+    return NoShape;
+}
+
+/**
+ * @brief Границы всех фигур группы (пустой QRectF, если фигур нет).
+ *
+ * Корень ее дерева: всегда актуален, ничего не пересчитывается.
+ */
+QRectF Document::getGroupBounds(GroupId g) const {
+    if (!containsGroup(g) || groups[g].tree.isEmpty()) return QRectF();
+    return groups[g].tree.getBounds();
+}
+
+/**
+ * @brief Верхний слот среди фигур группы (-1, если фигур нет).
+ */
+int Document::getGroupTopSlot(GroupId g) const {
+    return containsGroup(g) ? groups[g].topSlot : -1;
+}
+
+/**
+ * @brief Ревизия группы: меняется с любой правкой ее фигур.
+ */
+quint64 Document::getGroupRevision(GroupId g) const {
+    return containsGroup(g) ? groups[g].revision : 0;
+}
+
+//==================================================================
+// 5. Private-функции
+//==================================================================
+
+/**
+ * @brief Присваивает документу новую ревизию.
+ */
+void Document::touch() {
+    revision = ++revisionCounter;
+}
+
+/**
+ * @brief Раскладывает фигуру по параллельным массивам.
+ */
+void Document::writeSlot(int slot, const Shape& s) {
+    types[slot] = s.type;
+    s.toPoints(p1s[slot], p2s[slot]);
+    styleIdx[slot] = s.style;
+
+    // Прежняя запись связи (setShape мог сменить тип) и новая
+    unlink(ids[slot]);
+    if (s.type == ShapeType::Connector) link(slot, s.link);
+    if (s.label.isEmpty()) labels.erase(ids[slot]);
+    else labels[ids[slot]] = s.label;
+}
+
+/**
+ * @brief Границы маршрута связи.
+ */
+QRectF Document::connectorBounds(ShapeId id) const {
+    auto it = connectors.find(id);
+    return it != connectors.end() ? it->second.bounds : QRectF();
+}
+
+/**
+ * @brief Заводит запись связи в слоте и присоединяет ее к блокам.
+ *
+ * Слот, а не id: при восстановлении slotById еще не заполнен.
+ */
+void Document::link(int slot, const ConnectorLink& newLink) {
+    ShapeId id = ids[slot];
+    ConnectorData& c = connectors[id];
+    c.link = newLink;
+    if (newLink.from != NoShape) attached[newLink.from].push_back(id);
+    if (newLink.to != NoShape && newLink.to != newLink.from) attached[newLink.to].push_back(id);
+    Geometry::elbowRoute(p1s[slot], newLink.fromPort, p2s[slot], newLink.toPort, CONNECTOR_STUB, c.route);
+    c.bounds = routeBounds(c.route);
+}
+
+/**
+ * @brief Удаляет запись связи и отсоединяет ее от блоков.
+ */
+void Document::unlink(ShapeId id) {
+    auto it = connectors.find(id);
+    if (it == connectors.end()) return;
+    for (ShapeId block : {it->second.link.from, it->second.link.to}) {
+        auto list = attached.find(block);
+        if (list == attached.end()) continue;
+        list->second.erase(std::remove(list->second.begin(), list->second.end(), id), list->second.end());
+        if (list->second.empty()) attached.erase(list);
+    }
+    connectors.erase(it);
+}
+
+/**
+ * @brief Фигура сменила границы: сетка или дерево ее группы.
+ *
+ * Лист дерева пересчитывается сразу; предки - тоже сразу или, если
+ * передан deferred, один раз на всю пачку в finishReindex. Границы
+ * групп не бывают "грязными" - константные запросы (в том числе из
+ * потоков экспорта) ничего не пересчитывают.
+ */
+void Document::reindex(ShapeId id, int slot, std::vector<GroupId>* deferred) {
+    QRectF b = boundsAt(slot);
+    const Membership* m = membership(id);
+    if (!m || m->group == NoGroup) {
+        index.update(id, b);
+        return;
+    }
+    if (m->unit == NoGroup) index.update(id, b);
+    groups[m->group].tree.refit(m->item, b);
+    if (!deferred) {
+        groupChanged(m->group);
+    } else if (deferred->empty() || deferred->back() != m->group) {
+        deferred->push_back(m->group);
+    }
+}
+
+/**
+ * @brief Пересчитывает предков групп, отложенных reindex.
+ */
+void Document::finishReindex(std::vector<GroupId>& deferred) {
+    std::sort(deferred.begin(), deferred.end());
+    deferred.erase(std::unique(deferred.begin(), deferred.end()), deferred.end());
+    for (GroupId g : deferred) groupChanged(g);
+}
+
+/**
+ * @brief Запись о группе фигуры (nullptr, если групп не было).
+ */
+Document::Membership* Document::membership(ShapeId id) {
+    return id >= 0 && id < (int)members.size() ? &members[id] : nullptr;
+}
+
+const Document::Membership* Document::membership(ShapeId id) const {
+    return id >= 0 && id < (int)members.size() ? &members[id] : nullptr;
+}
+
+/**
+ * @brief Строит дерево группы заново по текущим спискам членов.
+ *
+ * Заодно раздает членам номера элементов и кладет фигуры в сетку или
+ * убирает из нее - по тому, входит ли группа в единицу.
+ */
+void Document::rebuildGroup(GroupId g) {
+    if (members.size() < slotById.size()) members.resize(slotById.size());
+    GroupData& d = groups[g];
+    GroupId unit = unitAbove(g);
+
+    std::vector<QRectF> boxes;
+    boxes.reserve(d.shapes.size() + d.subgroups.size());
+    for (size_t i = 0; i < d.shapes.size(); ++i) {
+        ShapeId id = d.shapes[i];
+        QRectF b = getBounds(id);
+        boxes.push_back(b);
+        members[id] = Membership{g, (int)i, unit};
+        if (unit == NoGroup) index.update(id, b);
+        else index.remove(id);
+    }
+    for (size_t i = 0; i < d.subgroups.size(); ++i) {
+        GroupData& sub = groups[d.subgroups[i]];
+        sub.parent = g;
+        sub.itemInParent = int(d.shapes.size() + i);
+        boxes.push_back(sub.tree.getBounds());
+    }
+    d.tree.build(boxes);
+}
+
+/**
+ * @brief Дерево группы изменилось: новые ревизии и границы вверх до корня.
+ *
+ * Глубина вложенности мала, подъем - O(глубина * log(членов)).
+ */
+void Document::groupChanged(GroupId g) {
+    for (;;) {
+        GroupData& d = groups[g];
+        d.revision = revision;
+        if (d.unit) {
+            const QRectF& b = d.tree.getBounds();
+            if (BoundsTree::isVoid(b)) units.remove(g);
+            else units.update(g, b);
+        }
+        if (d.parent == NoGroup) return;
+        groups[d.parent].tree.refit(d.itemInParent, d.tree.getBounds());
+        g = d.parent;
+    }
+}
+
+/**
+ * @brief Заново раздает единицы в поддереве группы g.
+ */
+void Document::relinkUnits(GroupId g) {
+    GroupId parent = groups[g].parent;
+    assignUnit(g, parent != NoGroup ? unitAbove(parent) : NoGroup);
+}
+
+/**
+ * @brief Назначает поддереву g единицу (inherited - единица предков).
+ *
+ * Фигуры, сменившие "свободна / в единице", переходят между сеткой
+ * фигур и сеткой единиц.
+ */
+void Document::assignUnit(GroupId g, GroupId inherited) {
+    GroupData& d = groups[g];
+    GroupId unit = inherited != NoGroup ? inherited : (d.collapsed ? g : NoGroup);
+    bool isUnit = unit == g;
+    if (d.unit && !isUnit) units.remove(g);
+    d.unit = isUnit;
+    if (isUnit && !d.tree.isEmpty()) units.update(g, d.tree.getBounds());
+
+    for (ShapeId id : d.shapes) {
+        Membership& m = members[id];
+        if (m.unit == unit) continue;
+        if (unit == NoGroup) index.insert(id, getBounds(id));
+        else if (m.unit == NoGroup) index.remove(id);
+        m.unit = unit;
+    }
+    for (GroupId s : d.subgroups) assignUnit(s, unit);
+}
+
+/**
+ * @brief Самая внешняя свернутая группа на пути от g к корню (включая g).
+ */
+GroupId Document::unitAbove(GroupId g) const {
+    GroupId unit = NoGroup;
+    for (GroupId p = g; p != NoGroup; p = groups[p].parent) {
+        if (groups[p].collapsed) unit = p;
+    }
+    return unit;
+}
+
+/**
+ * @brief Глубина вложенности группы (0 - верхний уровень).
+ */
+int Document::groupDepth(GroupId g) const {
+    int depth = 0;
+    for (GroupId p = groups[g].parent; p != NoGroup; p = groups[p].parent) depth++;
+    return depth;
+}
+
+/**
+ * @brief Перестраивает группы с новыми списками членов, от глубоких к внешним.
+ *
+ * Так подгруппа уже перестроена, когда ее границы берет родитель.
+ */
+void Document::rebuildGroups(std::vector<GroupId>& changed) {
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    std::vector<std::pair<int, GroupId>> byDepth;
+    byDepth.reserve(changed.size());
+    for (GroupId g : changed) byDepth.emplace_back(-groupDepth(g), g);
+    std::sort(byDepth.begin(), byDepth.end());
+    for (const auto& entry : byDepth) {
+        rebuildGroup(entry.second);
+        groupChanged(entry.second);
+    }
+}
+
+/**
+ * @brief Пересчитывает верхние слоты групп одним проходом по слотам.
+ *
+ * Слоты идут по возрастанию, так что последний записанный и есть верхний.
+ */
+void Document::updateTopSlots() {
+    if (groupCount == 0) return;
+    for (GroupData& d : groups) d.topSlot = -1;
+    for (int slot = 0; slot < size(); ++slot) {
+        const Membership* m = membership(ids[slot]);
+        if (!m) continue; // Фигура новее последней группировки
+        for (GroupId g = m->group; g != NoGroup; g = groups[g].parent) groups[g].topSlot = slot;
+    }
+}
+
+/**
+ * @brief Убирает все группы (фигуры остаются).
+ */
+void Document::clearGroups() {
+    groups.clear();
+    members.clear();
+    units.clear();
+    groupCount = 0;
+}
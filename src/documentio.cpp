@@ -0,0 +1,1229 @@
+#include "documentio.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QByteArray>
+#include <QtEndian>
+#include <cstring>
+#include <limits>
+
+// Блоки координат пишутся и читаются как массивы qint32 целиком
+static_assert(sizeof(QPoint) == 2 * sizeof(qint32), "QPoint must be two packed ints");
+static_assert(sizeof(ShapeType) == sizeof(quint8), "ShapeType must be one byte");
+
+namespace {
+
+// Бинарный формат
+const char BINARY_MAGIC[4] = {'B', 'S', 'G', 'D'};
+const quint32 BINARY_VERSION = 4; // 2: блок связей, 3: надписи, 4: группы
+const quint32 HEADER_SIZE = 40;
+const quint32 HEADER_SIZE_V3 = 32; // До версии 4 (без числа групп)
+const quint32 STYLE_RECORD_SIZE = DocumentIO::STYLE_RECORD_BYTES;
+const quint32 CONNECTOR_RECORD_SIZE = 16;
+const quint32 MAX_LABEL_BYTES = 1 << 20; // Защита от испорченной длины
+const quint32 GROUP_COLLAPSED = 1;       // Флаг записи группы
+
+// JSON
+const char JSON_FORMAT_NAME[] = "BlockSchemeGenerator";
+const int JSON_VERSION = 4; // 2: связи, 3: ромбы и надписи, 4: группы
+const double JSON_MAX_INDEX = 9007199254740992.0; // 2^53: больше число в JSON не точное
+
+const int IO_CHUNK = 64 * 1024; // Размер порции при потоковой записи/чтении
+
+void setError(QString* error, const QString& text) {
+    if (error) *error = text;
+}
+
+//==================================================================
+// 1. Бинарный формат: вспомогательные функции
+//==================================================================
+
+qint64 align8(qint64 v) {
+    return (v + 7) & ~qint64(7);
+}
+
+// Смещения блоков файла для заданных размеров
+struct BinaryLayout {
+    qint64 styles, types, styleIdx, p1, p2, connectors, labels, total;
+
+    BinaryLayout(quint32 headerSize, quint32 styleCount, quint32 shapeCount, quint32 connectorCount) {
+        styles = headerSize;
+        types = align8(styles + qint64(styleCount) * STYLE_RECORD_SIZE);
+        styleIdx = align8(types + qint64(shapeCount));
+        p1 = align8(styleIdx + qint64(shapeCount) * 2);
+        p2 = p1 + qint64(shapeCount) * 8;
+        connectors = p2 + qint64(shapeCount) * 8;
+        labels = align8(connectors + qint64(connectorCount) * CONNECTOR_RECORD_SIZE);
+        total = connectors + qint64(connectorCount) * CONNECTOR_RECORD_SIZE; // Без надписей
+    }
+};
+
+/**
+ * @brief Пишет массив целых в little-endian.
+ *
+ * На little-endian машине это одна запись всего блока, иначе
+ * блок переворачивается порциями.
+ */
+template <typename T>
+bool writeBlock(QIODevice& dev, const T* values, qint64 count) {
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    qint64 bytes = count * qint64(sizeof(T));
+    return dev.write(reinterpret_cast<const char*>(values), bytes) == bytes;
+#else
+    std::vector<T> chunk;
+    for (qint64 done = 0; done < count; ) {
+        qint64 n = qMin<qint64>(count - done, IO_CHUNK / sizeof(T));
+        chunk.resize(n);
+        for (qint64 i = 0; i < n; ++i) chunk[i] = qToLittleEndian(values[done + i]);
+        qint64 bytes = n * qint64(sizeof(T));
+        if (dev.write(reinterpret_cast<const char*>(chunk.data()), bytes) != bytes) return false;
+        done += n;
+    }
+    return true;
+#endif
+}
+
+/**
+ * @brief Читает массив целых из little-endian блока.
+ */
+template <typename T>
+void readBlock(const uchar* src, T* values, qint64 count) {
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    std::memcpy(values, src, size_t(count) * sizeof(T));
+#else
+    for (qint64 i = 0; i < count; ++i) values[i] = qFromLittleEndian<T>(src + i * sizeof(T));
+#endif
+}
+
+/**
+ * @brief Дописывает нули до выравнивания на 8 байт.
+ */
+bool writePadding(QIODevice& dev, qint64& pos) {
+    static const char zeros[8] = {};
+    qint64 pad = align8(pos) - pos;
+    pos += pad;
+    return pad == 0 || dev.write(zeros, pad) == pad;
+}
+
+/**
+ * @brief Разбирает заголовок бинарного файла data[0, size).
+ *
+ * Проверяет заголовок и размеры массивов, декодирует стили; блоки
+ * scheme указывают прямо в data.
+ */
+bool parseBinary(const uchar* data, qint64 size, const QString& path, DocumentIO::BinaryScheme& scheme,
+                 QString* error) {
+    auto fail = [&](const QString& what) {
+        setError(error, QString("%1: %2").arg(path, what));
+        return false;
+    };
+
+    if (size < HEADER_SIZE_V3 || std::memcmp(data, BINARY_MAGIC, 4) != 0) {
+        return fail("not a scheme file");
+    }
+    quint32 version = qFromLittleEndian<quint32>(data + 4);
+    quint32 headerSize = qFromLittleEndian<quint32>(data + 8);
+    quint32 styleCount = qFromLittleEndian<quint32>(data + 12);
+    quint32 shapeCount = qFromLittleEndian<quint32>(data + 16);
+    quint32 connectorCount = version >= 2 ? qFromLittleEndian<quint32>(data + 24) : 0;
+    quint32 labelCount = version >= 3 ? qFromLittleEndian<quint32>(data + 28) : 0;
+    if (version == 0 || version > BINARY_VERSION) {
+        return fail(QString("unsupported format version %1").arg(version));
+    }
+    quint32 minHeaderSize = version >= 4 ? HEADER_SIZE : HEADER_SIZE_V3;
+    if (headerSize < minHeaderSize || headerSize > size) {
+        return fail("corrupted header");
+    }
+    quint32 groupCount = version >= 4 ? qFromLittleEndian<quint32>(data + 32) : 0;
+    if (styleCount > 65536 || connectorCount > shapeCount || labelCount > shapeCount ||
+        qint64(groupCount) * 12 > size) {
+        return fail("corrupted header");
+    }
+    BinaryLayout layout(headerSize, styleCount, shapeCount, connectorCount);
+    if (layout.total > size) {
+        return fail("file is truncated");
+    }
+
+    scheme.styles.resize(styleCount);
+    for (quint32 i = 0; i < styleCount; ++i) {
+        scheme.styles[i] = DocumentIO::readStyleRecord(data + layout.styles + qint64(i) * STYLE_RECORD_SIZE);
+    }
+    scheme.shapeCount = shapeCount;
+    scheme.connectorCount = connectorCount;
+    scheme.labelCount = labelCount;
+    scheme.groupCount = groupCount;
+    scheme.types = data + layout.types;
+    scheme.styleIdx = data + layout.styleIdx;
+    scheme.p1 = data + layout.p1;
+    scheme.p2 = data + layout.p2;
+    scheme.connectors = data + layout.connectors;
+    scheme.labels = data + layout.labels;
+    scheme.end = data + size;
+    return true;
+}
+
+//==================================================================
+// 2. JSON: потоковая запись
+//==================================================================
+
+// Буфер, который сбрасывается в устройство порциями
+class ChunkWriter {
+public:
+    explicit ChunkWriter(QIODevice& d) : dev(d) { buf.reserve(IO_CHUNK + 256); }
+
+    void put(const char* s) { buf.append(s, qsizetype(std::strlen(s))); flushIfFull(); }
+    void put(const QByteArray& s) { buf.append(s); flushIfFull(); }
+    void putInt(qint64 v) { put(QByteArray::number(v)); }
+    void putString(const QString& s) {
+        static const char hex[] = "0123456789abcdef";
+        buf.append('"');
+        const QByteArray utf8 = s.toUtf8();
+        for (char c : utf8) {
+            if (c == '"' || c == '\\') {
+                buf.append('\\');
+                buf.append(c);
+            } else if (c == '\n') {
+                buf.append("\\n", 2);
+            } else if ((unsigned char)c < 0x20) {
+                char esc[6] = {'\\', 'u', '0', '0', hex[(c >> 4) & 0xf], hex[c & 0xf]};
+                buf.append(esc, 6);
+            } else {
+                buf.append(c);
+            }
+        }
+        buf.append('"');
+        flushIfFull();
+    }
+    void putColor(const QColor& c) {
+        // "#AARRGGBB"
+        static const char hex[] = "0123456789abcdef";
+        quint32 v = c.rgba();
+        char s[11] = {'"', '#'};
+        for (int i = 0; i < 8; ++i) s[2 + i] = hex[(v >> (28 - 4 * i)) & 0xf];
+        buf.append(s, 10);
+        buf.append('"');
+        flushIfFull();
+    }
+    bool finish() { flush(); return ok; }
+
+private:
+    void flushIfFull() { if (buf.size() >= IO_CHUNK) flush(); }
+    void flush() {
+        if (ok && !buf.isEmpty() && dev.write(buf) != buf.size()) ok = false;
+        buf.clear();
+    }
+
+    QIODevice& dev;
+    QByteArray buf;
+    bool ok = true;
+};
+
+const char* typeName(ShapeType t) {
+    switch (t) {
+    case ShapeType::Line:      return "line";
+    case ShapeType::Rectangle: return "rect";
+    case ShapeType::Circle:    return "circle";
+    case ShapeType::Connector: return "connector";
+    case ShapeType::Diamond:   return "diamond";
+    }
+    return "line";
+}
+
+bool typeFromName(const QByteArray& name, ShapeType& t) {
+    if (name == "line")      { t = ShapeType::Line; return true; }
+    if (name == "rect")      { t = ShapeType::Rectangle; return true; }
+    if (name == "circle")    { t = ShapeType::Circle; return true; }
+    if (name == "connector") { t = ShapeType::Connector; return true; }
+    if (name == "diamond")   { t = ShapeType::Diamond; return true; }
+    return false;
+}
+
+const char* portName(Port p) {
+    switch (p) {
+    case Port::Top:    return "top";
+    case Port::Right:  return "right";
+    case Port::Bottom: return "bottom";
+    case Port::Left:   return "left";
+    }
+    return "right";
+}
+
+bool portFromName(const QByteArray& name, Port& p) {
+    if (name == "top")    { p = Port::Top; return true; }
+    if (name == "right")  { p = Port::Right; return true; }
+    if (name == "bottom") { p = Port::Bottom; return true; }
+    if (name == "left")   { p = Port::Left; return true; }
+    return false;
+}
+
+// Связь, как она записана в файле: блоки - номерами слотов
+struct LinkRecord {
+    qint64 slot = -1;
+    qint64 from = -1;
+    qint64 to = -1;
+    Port fromPort = Port::Right;
+    Port toPort = Port::Left;
+};
+
+/**
+ * @brief Передает связи из файла загруженному документу (id = слоты).
+ *
+ * Ссылка не на блок (чужой слот, линия, другая связь) отбрасывается -
+ * связь остается висеть на своих точках.
+ */
+void applyLinks(Document& doc, const std::vector<LinkRecord>& links) {
+    auto blockAt = [&](qint64 slot) {
+        return (slot >= 0 && slot < doc.size() && isBlock(doc.typeAt(int(slot)))) ? ShapeId(slot) : NoShape;
+    };
+    for (const LinkRecord& rec : links) {
+        if (rec.slot < 0 || rec.slot >= doc.size() || doc.typeAt(int(rec.slot)) != ShapeType::Connector) continue;
+        doc.setLink(ShapeId(rec.slot), ConnectorLink{blockAt(rec.from), blockAt(rec.to), rec.fromPort, rec.toPort});
+    }
+}
+
+// Надпись, как она записана в файле (UTF-8)
+struct LabelRecord {
+    qint64 slot = -1;
+    QByteArray text;
+};
+
+/**
+ * @brief Передает надписи из файла загруженному документу (id = слоты).
+ */
+void applyLabels(Document& doc, const std::vector<LabelRecord>& labels) {
+    for (const LabelRecord& rec : labels) {
+        if (rec.slot < 0 || rec.slot >= doc.size()) continue;
+        doc.setLabel(ShapeId(rec.slot), QString::fromUtf8(rec.text));
+    }
+}
+
+// Группа, как она записана в файле: фигуры - слотами, подгруппы -
+// номерами групп, записанных раньше (вложенные идут первыми)
+struct GroupEntry {
+    bool collapsed = true;
+    std::vector<qint64> shapes;
+    std::vector<qint64> subgroups;
+};
+
+/**
+ * @brief Группы документа в порядке записи: каждая после своих подгрупп.
+ *
+ * Группы без фигур не пишутся - загрузчику их не из чего создать.
+ */
+void collectGroups(const Document& doc, std::vector<GroupEntry>& out) {
+    std::vector<qint64> entryOf(doc.getGroupCapacity(), -1);
+    auto visit = [&](auto& self, GroupId g) -> void {
+        for (GroupId s : doc.getSubgroups(g)) self(self, s);
+        if (doc.firstGroupShape(g) == NoShape) return;
+        GroupEntry e;
+        e.collapsed = doc.isGroupCollapsed(g);
+        for (ShapeId id : doc.getGroupShapes(g)) e.shapes.push_back(doc.slotOf(id));
+        for (GroupId s : doc.getSubgroups(g)) {
+            if (entryOf[s] >= 0) e.subgroups.push_back(entryOf[s]);
+        }
+        entryOf[g] = qint64(out.size());
+        out.push_back(std::move(e));
+    };
+    for (GroupId g = 0; g < doc.getGroupCapacity(); ++g) {
+        if (doc.containsGroup(g) && doc.getParentGroup(g) == NoGroup) visit(visit, g);
+    }
+}
+
+/**
+ * @brief Создает группы из файла в загруженном документе (id фигур = слоты).
+ *
+ * Группа i получает id base + i, так что подгруппы ссылаются на еще не
+ * созданные группы, и все создаются одной пачкой addGroups. Неверные
+ * ссылки (чужой слот, группа не раньше этой) пропускаются; addGroup сам
+ * отбросит фигуру, уже попавшую в другую группу, и подгруппу, которая
+ * не создалась.
+ */
+void applyGroups(Document& doc, const std::vector<GroupEntry>& entries) {
+    GroupId base = doc.getGroupCapacity();
+    std::vector<GroupRecord> records(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        GroupRecord& rec = records[i];
+        rec.id = base + GroupId(i);
+        rec.collapsed = entries[i].collapsed;
+        for (qint64 slot : entries[i].shapes) {
+            if (slot >= 0 && slot < doc.size()) rec.shapes.push_back(ShapeId(slot));
+        }
+        for (qint64 sub : entries[i].subgroups) {
+            if (sub >= 0 && sub < qint64(i)) rec.subgroups.push_back(base + GroupId(sub));
+        }
+    }
+    if (!records.empty()) doc.addGroups(records);
+}
+
+//==================================================================
+// 3. JSON: потоковое чтение
+//==================================================================
+
+// Pull-парсер: отдает токены по одному, читая файл порциями.
+// Дерево документа не строится. Разделители ',' и ':' проверяет сам
+// парсер (по стеку открытых скобок) и наружу не отдает: пропущенный
+// или лишний разделитель - Invalid. Остальную структуру проверяет тот,
+// кто читает токены.
+class JsonReader {
+public:
+    enum Token { BeginObject, EndObject, BeginArray, EndArray, String, Number, Literal, End, Invalid };
+
+    explicit JsonReader(QIODevice& d) : dev(d) {}
+
+    Token next();
+    bool skipValue(Token first); // Пропускает значение, начатое токеном first
+    const QByteArray& text() const { return value; } // Строка, число или литерал
+    double number() const { return value.toDouble(); } // Не зависит от локали, в отличие от strtod
+    qint64 offset() const { return consumed + pos; }
+
+private:
+    int peekChar() {
+        if (pos >= buf.size() && !fill()) return -1;
+        return (unsigned char)buf.at(pos);
+    }
+    int getChar() {
+        int c = peekChar();
+        if (c >= 0) ++pos;
+        return c;
+    }
+    bool fill() {
+        consumed += buf.size();
+        buf = dev.read(IO_CHUNK);
+        pos = 0;
+        return !buf.isEmpty();
+    }
+    void skipSpace() {
+        int c;
+        while ((c = peekChar()) == ' ' || c == '\t' || c == '\n' || c == '\r') ++pos;
+    }
+    bool readString();
+    bool readHex4(uint& code);
+    void appendUtf8(uint code);
+
+    // Что может идти дальше
+    enum Expect { ExpectValue, ExpectValueOrEnd, ExpectKey, ExpectKeyOrEnd, ExpectColon, ExpectSeparator };
+
+    QIODevice& dev;
+    QByteArray buf;
+    qsizetype pos = 0;
+    qint64 consumed = 0;
+    QByteArray value;
+    std::vector<char> open;       // Стек открытых скобок: '{' или '['
+    Expect expect = ExpectValue;
+};
+
+JsonReader::Token JsonReader::next() {
+    skipSpace();
+    if (expect == ExpectColon) {
+        if (getChar() != ':') return Invalid;
+        skipSpace();
+        expect = ExpectValue;
+    } else if (expect == ExpectSeparator) {
+        if (open.empty()) return peekChar() < 0 ? End : Invalid; // После корневого значения - ничего
+        if (peekChar() == ',') {
+            ++pos;
+            skipSpace();
+            expect = open.back() == '{' ? ExpectKey : ExpectValue;
+        }
+    }
+    int c = getChar();
+    if (c < 0) return End;
+
+    bool wantValue = expect == ExpectValue || expect == ExpectValueOrEnd;
+    bool wantKey = expect == ExpectKey || expect == ExpectKeyOrEnd;
+    switch (c) {
+    case '{':
+    case '[':
+        if (!wantValue) return Invalid;
+        open.push_back(char(c));
+        expect = c == '{' ? ExpectKeyOrEnd : ExpectValueOrEnd;
+        return c == '{' ? BeginObject : BeginArray;
+    case '}':
+    case ']':
+        // Закрыть можно пустой контейнер или после значения, но не после ','
+        if (open.empty() || open.back() != (c == '}' ? '{' : '[') ||
+            (expect != ExpectSeparator && expect != (c == '}' ? ExpectKeyOrEnd : ExpectValueOrEnd))) {
+            return Invalid;
+        }
+        open.pop_back();
+        expect = ExpectSeparator;
+        return c == '}' ? EndObject : EndArray;
+    case '"':
+        if (!wantKey && !wantValue) return Invalid;
+        expect = wantKey ? ExpectColon : ExpectSeparator;
+        return readString() ? String : Invalid;
+    default:
+        if (!wantValue) return Invalid;
+        expect = ExpectSeparator;
+        break;
+    }
+
+    value.clear();
+    value.append(char(c));
+    if (c == '-' || (c >= '0' && c <= '9')) {
+        while ((c = peekChar()) >= 0 &&
+               ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-')) {
+            value.append(char(c));
+            ++pos;
+        }
+        bool ok = false;
+        value.toDouble(&ok);
+        return ok ? Number : Invalid;
+    }
+    if (c >= 'a' && c <= 'z') {
+        while ((c = peekChar()) >= 'a' && c <= 'z') {
+            value.append(char(c));
+            ++pos;
+        }
+        if (value == "true" || value == "false" || value == "null") return Literal;
+    }
+    return Invalid;
+}
+
+bool JsonReader::skipValue(Token first) {
+    if (first != BeginObject && first != BeginArray) {
+        return first == String || first == Number || first == Literal;
+    }
+    int depth = 1;
+    while (depth > 0) {
+        Token t = next();
+        if (t == BeginObject || t == BeginArray) ++depth;
+        else if (t == EndObject || t == EndArray) --depth;
+        else if (t == End || t == Invalid) return false;
+    }
+    return true;
+}
+
+bool JsonReader::readString() {
+    value.clear();
+    for (;;) {
+        int c = getChar();
+        if (c < 0) return false;
+        if (c == '"') return true;
+        if (c != '\\') {
+            value.append(char(c));
+            continue;
+        }
+        c = getChar();
+        switch (c) {
+        case '"': case '\\': case '/': value.append(char(c)); break;
+        case 'b': value.append('\b'); break;
+        case 'f': value.append('\f'); break;
+        case 'n': value.append('\n'); break;
+        case 'r': value.append('\r'); break;
+        case 't': value.append('\t'); break;
+        case 'u': {
+            uint code;
+            if (!readHex4(code)) return false;
+            // Суррогатная пара
+            if (code >= 0xD800 && code < 0xDC00 && peekChar() == '\\') {
+                ++pos;
+                uint low;
+                if (getChar() != 'u' || !readHex4(low)) return false;
+                if (low >= 0xDC00 && low < 0xE000) {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                } else {
+                    appendUtf8(code);
+                    code = low;
+                }
+            }
+            appendUtf8(code);
+            break;
+        }
+        default: return false;
+        }
+    }
+}
+
+bool JsonReader::readHex4(uint& code) {
+    code = 0;
+    for (int i = 0; i < 4; ++i) {
+        int c = getChar();
+        int d;
+        if (c >= '0' && c <= '9') d = c - '0';
+        else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+        else return false;
+        code = (code << 4) | uint(d);
+    }
+    return true;
+}
+
+void JsonReader::appendUtf8(uint code) {
+    if (code < 0x80) {
+        value.append(char(code));
+    } else if (code < 0x800) {
+        value.append(char(0xC0 | (code >> 6)));
+        value.append(char(0x80 | (code & 0x3F)));
+    } else if (code < 0x10000) {
+        value.append(char(0xE0 | (code >> 12)));
+        value.append(char(0x80 | ((code >> 6) & 0x3F)));
+        value.append(char(0x80 | (code & 0x3F)));
+    } else {
+        value.append(char(0xF0 | (code >> 18)));
+        value.append(char(0x80 | ((code >> 12) & 0x3F)));
+        value.append(char(0x80 | ((code >> 6) & 0x3F)));
+        value.append(char(0x80 | (code & 0x3F)));
+    }
+}
+
+/**
+ * @brief Разбирает цвет "#AARRGGBB" или "#RRGGBB".
+ */
+bool parseColor(const QByteArray& s, QColor& color) {
+    if ((s.size() != 9 && s.size() != 7) || s.at(0) != '#') return false;
+    quint32 v = 0;
+    for (qsizetype i = 1; i < s.size(); ++i) {
+        char c = s.at(i);
+        int d;
+        if (c >= '0' && c <= '9') d = c - '0';
+        else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+        else return false;
+        v = (v << 4) | quint32(d);
+    }
+    if (s.size() == 7) v |= 0xff000000u;
+    color = QColor::fromRgba(v);
+    return true;
+}
+
+// Разбор документа поверх JsonReader с сообщениями об ошибках
+class JsonSchemeParser {
+public:
+    JsonSchemeParser(JsonReader& r, QString* e) : in(r), error(e) {}
+
+    bool parse();
+
+    std::vector<ShapeStyle> styles;
+    std::vector<ShapeType> types;
+    std::vector<QPoint> p1s;
+    std::vector<QPoint> p2s;
+    std::vector<StyleIndex> styleIdx;
+    std::vector<LinkRecord> links;
+    std::vector<LabelRecord> labels;
+    std::vector<GroupEntry> groups;
+
+private:
+    bool fail(const QString& what) {
+        setError(error, QString("JSON: %1 (byte %2)").arg(what).arg(in.offset()));
+        return false;
+    }
+    bool readNumber(double& v);
+    bool readNumber(double& v, double min, double max);
+    bool readPoint(QPoint& p);
+    bool readStyle();
+    bool readShape();
+    bool readGroup();
+    bool readPort(Port& p);
+    bool readIndices(std::vector<qint64>& out);
+
+    JsonReader& in;
+    QString* error;
+};
+
+bool JsonSchemeParser::parse() {
+    if (in.next() != JsonReader::BeginObject) return fail("expected an object");
+
+    JsonReader::Token t;
+    while ((t = in.next()) != JsonReader::EndObject) {
+        if (t != JsonReader::String) return fail("expected a key");
+        QByteArray key = in.text();
+
+        if (key == "format") {
+            if (in.next() != JsonReader::String || in.text() != JSON_FORMAT_NAME) {
+                return fail("not a BlockSchemeGenerator scheme");
+            }
+        } else if (key == "version") {
+            double v;
+            if (!readNumber(v)) return false;
+            if (v > JSON_VERSION) return fail(QString("unsupported version %1").arg(v));
+        } else if (key == "styles" || key == "shapes" || key == "groups") {
+            if (in.next() != JsonReader::BeginArray) return fail("expected an array");
+            while ((t = in.next()) != JsonReader::EndArray) {
+                if (t != JsonReader::BeginObject) return fail("expected an object");
+                bool ok = key == "styles" ? readStyle() : key == "shapes" ? readShape() : readGroup();
+                if (!ok) return false;
+            }
+        } else if (!in.skipValue(in.next())) {
+            return fail("invalid value");
+        }
+    }
+    if (in.next() != JsonReader::End) return fail("unexpected content after the scheme");
+    return true;
+}
+
+bool JsonSchemeParser::readNumber(double& v) {
+    if (in.next() != JsonReader::Number) return fail("expected a number");
+    v = in.number();
+    return true;
+}
+
+// Число, которое дальше приводится к целому: вне [min, max] приведение
+// было бы неопределенным поведением
+bool JsonSchemeParser::readNumber(double& v, double min, double max) {
+    if (!readNumber(v)) return false;
+    if (!(v >= min && v <= max)) return fail("number out of range");
+    return true;
+}
+
+bool JsonSchemeParser::readPoint(QPoint& p) {
+    const double min = std::numeric_limits<int>::min();
+    const double max = std::numeric_limits<int>::max();
+    double x, y;
+    if (in.next() != JsonReader::BeginArray) return fail("expected [x, y]");
+    if (!readNumber(x, min, max) || !readNumber(y, min, max)) return false;
+    if (in.next() != JsonReader::EndArray) return fail("expected [x, y]");
+    p = QPoint(qRound(x), qRound(y));
+    return true;
+}
+
+bool JsonSchemeParser::readPort(Port& p) {
+    if (in.next() != JsonReader::String || !portFromName(in.text(), p)) return fail("invalid port");
+    return true;
+}
+
+bool JsonSchemeParser::readStyle() {
+    ShapeStyle st;
+    JsonReader::Token t;
+    while ((t = in.next()) != JsonReader::EndObject) {
+        if (t != JsonReader::String) return fail("expected a key");
+        QByteArray key = in.text();
+        double v;
+        if (key == "stroke" || key == "fill") {
+            QColor c;
+            if (in.next() != JsonReader::String || !parseColor(in.text(), c)) return fail("invalid color");
+            (key == "stroke" ? st.stroke : st.fill) = c;
+        } else if (key == "width") {
+            if (!readNumber(v)) return false;
+            st.strokeWidth = v;
+        } else if (key == "penStyle") {
+            if (!readNumber(v)) return false;
+            if (v < Qt::NoPen || v > Qt::DashDotDotLine) return fail("invalid pen style");
+            st.strokeStyle = Qt::PenStyle(int(v));
+        } else if (!in.skipValue(in.next())) {
+            return fail("invalid value");
+        }
+    }
+    styles.push_back(st);
+    return true;
+}
+
+bool JsonSchemeParser::readShape() {
+    ShapeType type = ShapeType::Line;
+    QPoint p1, p2;
+    double style = 0;
+    double from = -1, to = -1;
+    LinkRecord link;
+    JsonReader::Token t;
+    while ((t = in.next()) != JsonReader::EndObject) {
+        if (t != JsonReader::String) return fail("expected a key");
+        QByteArray key = in.text();
+        if (key == "type") {
+            if (in.next() != JsonReader::String || !typeFromName(in.text(), type)) {
+                return fail("invalid shape type");
+            }
+        } else if (key == "p1") {
+            if (!readPoint(p1)) return false;
+        } else if (key == "p2") {
+            if (!readPoint(p2)) return false;
+        } else if (key == "style") {
+            if (!readNumber(style)) return false;
+        } else if (key == "from") {
+            if (!readNumber(from, -JSON_MAX_INDEX, JSON_MAX_INDEX)) return false;
+        } else if (key == "to") {
+            if (!readNumber(to, -JSON_MAX_INDEX, JSON_MAX_INDEX)) return false;
+        } else if (key == "fromPort") {
+            if (!readPort(link.fromPort)) return false;
+        } else if (key == "toPort") {
+            if (!readPort(link.toPort)) return false;
+        } else if (key == "label") {
+            if (in.next() != JsonReader::String) return fail("expected a string");
+            if (!in.text().isEmpty()) labels.push_back(LabelRecord{qint64(types.size()), in.text()});
+        } else if (!in.skipValue(in.next())) {
+            return fail("invalid value");
+        }
+    }
+    if (type == ShapeType::Connector) {
+        link.slot = qint64(types.size());
+        link.from = qint64(from);
+        link.to = qint64(to);
+        links.push_back(link);
+    }
+    types.push_back(type);
+    p1s.push_back(p1);
+    p2s.push_back(p2);
+    styleIdx.push_back(StyleIndex(qBound(0.0, style, 65535.0)));
+    return true;
+}
+
+bool JsonSchemeParser::readGroup() {
+    GroupEntry group;
+    JsonReader::Token t;
+    while ((t = in.next()) != JsonReader::EndObject) {
+        if (t != JsonReader::String) return fail("expected a key");
+        QByteArray key = in.text();
+        if (key == "collapsed") {
+            if (in.next() != JsonReader::Literal || in.text() == "null") return fail("expected true or false");
+            group.collapsed = (in.text() == "true");
+        } else if (key == "shapes") {
+            if (!readIndices(group.shapes)) return false;
+        } else if (key == "groups") {
+            if (!readIndices(group.subgroups)) return false;
+        } else if (!in.skipValue(in.next())) {
+            return fail("invalid value");
+        }
+    }
+    groups.push_back(std::move(group));
+    return true;
+}
+
+bool JsonSchemeParser::readIndices(std::vector<qint64>& out) {
+    if (in.next() != JsonReader::BeginArray) return fail("expected an array");
+    JsonReader::Token t;
+    while ((t = in.next()) != JsonReader::EndArray) {
+        if (t != JsonReader::Number) return fail("expected a number");
+        double v = in.number();
+        if (!(v >= -JSON_MAX_INDEX && v <= JSON_MAX_INDEX)) return fail("number out of range");
+        out.push_back(qint64(v));
+    }
+    return true;
+}
+
+/**
+ * @brief Регистрирует стили файла и переводит индексы фигур в индексы таблицы.
+ */
+void internStyles(StyleTable& table, const std::vector<ShapeStyle>& fileStyles,
+                  std::vector<StyleIndex>& styleIdx) {
+    std::vector<StyleIndex> remap(fileStyles.size());
+    for (size_t i = 0; i < fileStyles.size(); ++i) {
+        remap[i] = table.intern(fileStyles[i]);
+    }
+    for (StyleIndex& s : styleIdx) {
+        s = s < remap.size() ? remap[s] : 0;
+    }
+}
+
+/**
+ * @brief Формат по расширению файла.
+ */
+bool isJsonPath(const QString& path) {
+    return QFileInfo(path).suffix().compare("json", Qt::CaseInsensitive) == 0;
+}
+
+} // namespace
+
+namespace DocumentIO {
+
+//==================================================================
+// 4. Бинарный формат
+//==================================================================
+
+/**
+ * @brief Координаты фигуры i прямо из отображения файла.
+ */
+QPoint BinaryScheme::p1At(qint64 i) const {
+    return QPoint(qFromLittleEndian<qint32>(p1 + 8 * i), qFromLittleEndian<qint32>(p1 + 8 * i + 4));
+}
+
+QPoint BinaryScheme::p2At(qint64 i) const {
+    return QPoint(qFromLittleEndian<qint32>(p2 + 8 * i), qFromLittleEndian<qint32>(p2 + 8 * i + 4));
+}
+
+StyleIndex BinaryScheme::styleAt(qint64 i) const {
+    return qFromLittleEndian<quint16>(styleIdx + 2 * i);
+}
+
+/**
+ * @brief Отображает бинарный файл в память без копирования массивов.
+ *
+ * В отличие от loadBinary, без запасного чтения целиком: файл, который
+ * не отображается, в память тем более не поместится.
+ */
+bool mapBinary(QFile& file, BinaryScheme& scheme, QString* error) {
+    qint64 size = file.size();
+    const uchar* data = size > 0 ? file.map(0, size) : nullptr;
+    if (!data) {
+        setError(error, QString("Cannot map %1: %2").arg(file.fileName(), file.errorString()));
+        return false;
+    }
+    return parseBinary(data, size, file.fileName(), scheme, error);
+}
+
+/**
+ * @brief Запись стиля: ARGB обводки и заливки, толщина (double), тип пера.
+ */
+void writeStyleRecord(const ShapeStyle& style, uchar* rec) {
+    double width = style.strokeWidth;
+    quint64 widthBits;
+    std::memcpy(&widthBits, &width, sizeof(widthBits));
+    std::memset(rec, 0, STYLE_RECORD_BYTES);
+    qToLittleEndian<quint32>(style.stroke.rgba(), rec);
+    qToLittleEndian<quint32>(style.fill.rgba(), rec + 4);
+    qToLittleEndian<quint64>(widthBits, rec + 8);
+    qToLittleEndian<quint32>(quint32(style.strokeStyle), rec + 16);
+}
+
+/**
+ * @brief Читает запись стиля; неизвестный тип пера - сплошное.
+ */
+ShapeStyle readStyleRecord(const uchar* rec) {
+    quint64 widthBits = qFromLittleEndian<quint64>(rec + 8);
+    double width;
+    std::memcpy(&width, &widthBits, sizeof(width));
+    quint32 penStyle = qFromLittleEndian<quint32>(rec + 16);
+
+    ShapeStyle st;
+    st.stroke = QColor::fromRgba(qFromLittleEndian<quint32>(rec));
+    st.fill = QColor::fromRgba(qFromLittleEndian<quint32>(rec + 4));
+    st.strokeWidth = width;
+    st.strokeStyle = penStyle <= Qt::DashDotDotLine ? Qt::PenStyle(penStyle) : Qt::SolidLine;
+    return st;
+}
+
+/**
+ * @brief Сохраняет документ в бинарный файл.
+ */
+bool saveBinary(const Document& doc, const QString& path, QString* error) {
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        setError(error, QString("Cannot write %1: %2").arg(path, file.errorString()));
+        return false;
+    }
+
+    const StyleTable& table = doc.getStyles();
+    quint32 styleCount = quint32(table.size());
+    quint32 shapeCount = quint32(doc.size());
+    quint32 connectorCount = quint32(doc.getConnectorCount());
+    quint32 labelCount = quint32(doc.getLabelCount());
+    std::vector<GroupEntry> groups;
+    collectGroups(doc, groups);
+    quint32 groupCount = quint32(groups.size());
+
+    // Заголовок
+    uchar header[HEADER_SIZE] = {};
+    std::memcpy(header, BINARY_MAGIC, 4);
+    qToLittleEndian<quint32>(BINARY_VERSION, header + 4);
+    qToLittleEndian<quint32>(HEADER_SIZE, header + 8);
+    qToLittleEndian<quint32>(styleCount, header + 12);
+    qToLittleEndian<quint32>(shapeCount, header + 16);
+    qToLittleEndian<quint32>(connectorCount, header + 24);
+    qToLittleEndian<quint32>(labelCount, header + 28);
+    qToLittleEndian<quint32>(groupCount, header + 32);
+
+    // Таблица стилей
+    QByteArray styleBlock(qsizetype(styleCount) * STYLE_RECORD_SIZE, '\0');
+    for (quint32 i = 0; i < styleCount; ++i) {
+        writeStyleRecord(table.getStyle(StyleIndex(i)),
+                         reinterpret_cast<uchar*>(styleBlock.data()) + i * STYLE_RECORD_SIZE);
+    }
+
+    // Связи: слот связи, слоты блоков (-1 - нет), порты
+    QByteArray connectorBlock(qsizetype(connectorCount) * CONNECTOR_RECORD_SIZE, '\0');
+    uchar* rec = reinterpret_cast<uchar*>(connectorBlock.data());
+    for (int slot = 0; slot < doc.size(); ++slot) {
+        if (doc.typeAt(slot) != ShapeType::Connector) continue;
+        const ConnectorLink& link = doc.getLink(doc.idAt(slot));
+        qToLittleEndian<quint32>(quint32(slot), rec);
+        qToLittleEndian<qint32>(qint32(doc.slotOf(link.from)), rec + 4);
+        qToLittleEndian<qint32>(qint32(doc.slotOf(link.to)), rec + 8);
+        rec[12] = quint8(link.fromPort);
+        rec[13] = quint8(link.toPort);
+        rec += CONNECTOR_RECORD_SIZE;
+    }
+
+    // Надписи: слот, длина в байтах, UTF-8 с выравниванием на 4
+    QByteArray labelBlock;
+    for (int slot = 0; slot < doc.size() && labelCount; ++slot) {
+        const QString& label = doc.getLabel(doc.idAt(slot));
+        if (label.isEmpty()) continue;
+        QByteArray text = label.toUtf8();
+        uchar head[8];
+        qToLittleEndian<quint32>(quint32(slot), head);
+        qToLittleEndian<quint32>(quint32(text.size()), head + 4);
+        labelBlock.append(reinterpret_cast<const char*>(head), 8);
+        labelBlock.append(text);
+        while (labelBlock.size() % 4) labelBlock.append('\0');
+    }
+
+    // Группы: флаги, число фигур и подгрупп, затем слоты фигур и номера подгрупп
+    QByteArray groupBlock;
+    auto put32 = [&](quint32 v) {
+        uchar bytes[4];
+        qToLittleEndian<quint32>(v, bytes);
+        groupBlock.append(reinterpret_cast<const char*>(bytes), 4);
+    };
+    for (const GroupEntry& g : groups) {
+        put32(g.collapsed ? GROUP_COLLAPSED : 0);
+        put32(quint32(g.shapes.size()));
+        put32(quint32(g.subgroups.size()));
+        for (qint64 slot : g.shapes) put32(quint32(slot));
+        for (qint64 sub : g.subgroups) put32(quint32(sub));
+    }
+
+    // Блоки массивов документа - как есть
+    qint64 pos = HEADER_SIZE + styleBlock.size();
+    bool ok = file.write(reinterpret_cast<const char*>(header), HEADER_SIZE) == HEADER_SIZE &&
+              file.write(styleBlock) == styleBlock.size() &&
+              writePadding(file, pos);
+    ok = ok && writeBlock(file, reinterpret_cast<const quint8*>(doc.getTypes().data()), shapeCount);
+    pos += shapeCount;
+    ok = ok && writePadding(file, pos);
+    ok = ok && writeBlock(file, doc.getStyleIndices().data(), shapeCount);
+    pos += qint64(shapeCount) * 2;
+    ok = ok && writePadding(file, pos);
+    ok = ok && writeBlock(file, reinterpret_cast<const qint32*>(doc.getP1s().data()), qint64(shapeCount) * 2);
+    ok = ok && writeBlock(file, reinterpret_cast<const qint32*>(doc.getP2s().data()), qint64(shapeCount) * 2);
+    ok = ok && file.write(connectorBlock) == connectorBlock.size();
+    pos = BinaryLayout(HEADER_SIZE, styleCount, shapeCount, connectorCount).total;
+    ok = ok && (labelBlock.isEmpty() || (writePadding(file, pos) && file.write(labelBlock) == labelBlock.size()));
+    if (!labelBlock.isEmpty()) pos += labelBlock.size(); // writePadding уже довел pos до начала надписей
+    ok = ok && (groupBlock.isEmpty() || (writePadding(file, pos) && file.write(groupBlock) == groupBlock.size()));
+
+    if (!ok || !file.commit()) {
+        setError(error, QString("Cannot write %1: %2").arg(path, file.errorString()));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Загружает документ из бинарного файла.
+ *
+ * Файл отображается в память, массивы копируются блоками - без
+ * разбора по фигурам. Если отображение недоступно, файл читается целиком.
+ */
+bool loadBinary(const QString& path, Document& doc, QString* error) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        setError(error, QString("Cannot open %1: %2").arg(path, file.errorString()));
+        return false;
+    }
+
+    qint64 size = file.size();
+    const uchar* data = size > 0 ? file.map(0, size) : nullptr;
+    QByteArray fallback;
+    if (!data) {
+        fallback = file.readAll();
+        data = reinterpret_cast<const uchar*>(fallback.constData());
+        size = fallback.size();
+    }
+
+    auto fail = [&](const QString& what) {
+        setError(error, QString("%1: %2").arg(path, what));
+        return false;
+    };
+
+    BinaryScheme scheme;
+    if (!parseBinary(data, size, path, scheme, error)) return false;
+    quint32 shapeCount = scheme.shapeCount;
+    quint32 connectorCount = scheme.connectorCount;
+    quint32 labelCount = scheme.labelCount;
+    quint32 groupCount = scheme.groupCount;
+
+    // Массивы фигур
+    Document loaded;
+    std::vector<ShapeStyle> fileStyles = std::move(scheme.styles);
+    std::vector<ShapeType> types(shapeCount);
+    std::vector<StyleIndex> styleIdx(shapeCount);
+    std::vector<QPoint> p1s(shapeCount);
+    std::vector<QPoint> p2s(shapeCount);
+    readBlock(scheme.types, reinterpret_cast<quint8*>(types.data()), shapeCount);
+    readBlock(scheme.styleIdx, styleIdx.data(), shapeCount);
+    readBlock(scheme.p1, reinterpret_cast<qint32*>(p1s.data()), qint64(shapeCount) * 2);
+    readBlock(scheme.p2, reinterpret_cast<qint32*>(p2s.data()), qint64(shapeCount) * 2);
+
+    for (ShapeType t : types) {
+        if (quint8(t) > quint8(ShapeType::Diamond)) return fail("unknown shape type");
+    }
+
+    std::vector<LinkRecord> links(connectorCount);
+    for (quint32 i = 0; i < connectorCount; ++i) {
+        const uchar* rec = scheme.connectors + qint64(i) * CONNECTOR_RECORD_SIZE;
+        if (rec[12] > quint8(Port::Left) || rec[13] > quint8(Port::Left)) return fail("invalid port");
+        links[i].slot = qFromLittleEndian<quint32>(rec);
+        links[i].from = qFromLittleEndian<qint32>(rec + 4);
+        links[i].to = qFromLittleEndian<qint32>(rec + 8);
+        links[i].fromPort = Port(rec[12]);
+        links[i].toPort = Port(rec[13]);
+    }
+
+    // Надписи - записи переменной длины, каждая проверяется по размеру файла
+    std::vector<LabelRecord> labels(labelCount);
+    qint64 at = scheme.labels - data;
+    for (quint32 i = 0; i < labelCount; ++i) {
+        if (at + 8 > size) return fail("file is truncated");
+        quint32 bytes = qFromLittleEndian<quint32>(data + at + 4);
+        if (bytes > MAX_LABEL_BYTES || at + 8 + bytes > size) return fail("invalid label");
+        labels[i].slot = qFromLittleEndian<quint32>(data + at);
+        labels[i].text = QByteArray(reinterpret_cast<const char*>(data + at + 8), bytes);
+        at += 8 + ((bytes + 3) & ~quint32(3));
+    }
+
+    // Группы - тоже переменной длины; в группе не больше фигур, чем в файле
+    std::vector<GroupEntry> groups(groupCount);
+    at = align8(at);
+    for (quint32 i = 0; i < groupCount; ++i) {
+        if (at + 12 > size) return fail("file is truncated");
+        quint32 flags = qFromLittleEndian<quint32>(data + at);
+        quint32 shapes = qFromLittleEndian<quint32>(data + at + 4);
+        quint32 subgroups = qFromLittleEndian<quint32>(data + at + 8);
+        if (shapes > shapeCount || subgroups > i) return fail("invalid group");
+        at += 12;
+        if (at + 4 * (qint64(shapes) + subgroups) > size) return fail("file is truncated");
+        GroupEntry& g = groups[i];
+        g.collapsed = flags & GROUP_COLLAPSED;
+        g.shapes.resize(shapes);
+        g.subgroups.resize(subgroups);
+        for (quint32 k = 0; k < shapes; ++k, at += 4) g.shapes[k] = qFromLittleEndian<quint32>(data + at);
+        for (quint32 k = 0; k < subgroups; ++k, at += 4) g.subgroups[k] = qFromLittleEndian<quint32>(data + at);
+    }
+
+    internStyles(loaded.getStyles(), fileStyles, styleIdx);
+    loaded.assign(std::move(types), std::move(p1s), std::move(p2s), std::move(styleIdx));
+    applyLinks(loaded, links);
+    applyLabels(loaded, labels);
+    applyGroups(loaded, groups);
+    doc = std::move(loaded);
+    return true;
+}
+
+//==================================================================
+// 5. JSON
+//==================================================================
+
+/**
+ * @brief Сохраняет документ в JSON (одна фигура - одна строка).
+ */
+bool saveJson(const Document& doc, const QString& path, QString* error) {
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        setError(error, QString("Cannot write %1: %2").arg(path, file.errorString()));
+        return false;
+    }
+
+    ChunkWriter out(file);
+    out.put("{\n  \"format\": \"");
+    out.put(JSON_FORMAT_NAME);
+    out.put("\",\n  \"version\": ");
+    out.putInt(JSON_VERSION);
+
+    const StyleTable& table = doc.getStyles();
+    out.put(",\n  \"styles\": [");
+    for (int i = 0; i < table.size(); ++i) {
+        const ShapeStyle& st = table.getStyle(StyleIndex(i));
+        out.put(i ? ",\n    {\"stroke\": " : "\n    {\"stroke\": ");
+        out.putColor(st.stroke);
+        out.put(", \"width\": ");
+        out.put(QByteArray::number(st.strokeWidth, 'g', 15));
+        out.put(", \"penStyle\": ");
+        out.putInt(int(st.strokeStyle));
+        out.put(", \"fill\": ");
+        out.putColor(st.fill);
+        out.put("}");
+    }
+    out.put("\n  ],\n  \"shapes\": [");
+
+    for (int slot = 0; slot < doc.size(); ++slot) {
+        const QPoint& p1 = doc.p1At(slot);
+        const QPoint& p2 = doc.p2At(slot);
+        out.put(slot ? ",\n    {\"type\": \"" : "\n    {\"type\": \"");
+        out.put(typeName(doc.typeAt(slot)));
+        out.put("\", \"p1\": [");
+        out.putInt(p1.x());
+        out.put(", ");
+        out.putInt(p1.y());
+        out.put("], \"p2\": [");
+        out.putInt(p2.x());
+        out.put(", ");
+        out.putInt(p2.y());
+        out.put("], \"style\": ");
+        out.putInt(doc.styleAt(slot));
+        if (doc.typeAt(slot) == ShapeType::Connector) {
+            const ConnectorLink& link = doc.getLink(doc.idAt(slot));
+            out.put(", \"from\": ");
+            out.putInt(doc.slotOf(link.from));
+            out.put(", \"fromPort\": \"");
+            out.put(portName(link.fromPort));
+            out.put("\", \"to\": ");
+            out.putInt(doc.slotOf(link.to));
+            out.put(", \"toPort\": \"");
+            out.put(portName(link.toPort));
+            out.put("\"");
+        }
+        const QString& label = doc.getLabel(doc.idAt(slot));
+        if (!label.isEmpty()) {
+            out.put(", \"label\": ");
+            out.putString(label);
+        }
+        out.put("}");
+    }
+    out.put("\n  ]");
+
+    std::vector<GroupEntry> groups;
+    collectGroups(doc, groups);
+    if (!groups.empty()) {
+        out.put(",\n  \"groups\": [");
+        for (size_t i = 0; i < groups.size(); ++i) {
+            out.put(i ? ",\n    {\"collapsed\": " : "\n    {\"collapsed\": ");
+            out.put(groups[i].collapsed ? "true" : "false");
+            out.put(", \"shapes\": [");
+            for (size_t k = 0; k < groups[i].shapes.size(); ++k) {
+                if (k) out.put(", ");
+                out.putInt(int(groups[i].shapes[k]));
+            }
+            out.put("], \"groups\": [");
+            for (size_t k = 0; k < groups[i].subgroups.size(); ++k) {
+                if (k) out.put(", ");
+                out.putInt(int(groups[i].subgroups[k]));
+            }
+            out.put("]}");
+        }
+        out.put("\n  ]");
+    }
+    out.put("\n}\n");
+
+    if (!out.finish() || !file.commit()) {
+        setError(error, QString("Cannot write %1: %2").arg(path, file.errorString()));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Загружает документ из JSON потоковым разбором.
+ */
+bool loadJson(const QString& path, Document& doc, QString* error) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        setError(error, QString("Cannot open %1: %2").arg(path, file.errorString()));
+        return false;
+    }
+
+    JsonReader reader(file);
+    JsonSchemeParser parser(reader, error);
+    if (!parser.parse()) return false;
+
+    Document loaded;
+    internStyles(loaded.getStyles(), parser.styles, parser.styleIdx);
+    loaded.assign(std::move(parser.types), std::move(parser.p1s),
+                  std::move(parser.p2s), std::move(parser.styleIdx));
+    applyLinks(loaded, parser.links);
+    applyLabels(loaded, parser.labels);
+    applyGroups(loaded, parser.groups);
+    doc = std::move(loaded);
+    return true;
+}
+
+//==================================================================
+// 6. Выбор формата
+//==================================================================
+
+bool save(const Document& doc, const QString& path, QString* error) {
+    return isJsonPath(path) ? saveJson(doc, path, error) : saveBinary(doc, path, error);
+}
+
+bool load(const QString& path, Document& doc, QString* error) {
+    return isJsonPath(path) ? loadJson(path, doc, error) : loadBinary(path, doc, error);
+}
+
+}
@@ -0,0 +1,1232 @@
+#include "flowchartgen.h"
+#include "geometry.h"
+#include "tracer.h"
+#include <QFile>
+#include <QFileInfo>
+#include <cstring>
+#include <initializer_list>
+
+namespace {
+
+const int IO_CHUNK = 64 * 1024;    // Буфер чтения исходника
+const int MAX_LABEL_BYTES = 160;   // Длиннее - обрезается с "…"
+
+// Размеры блоков по надписи (шрифт ShapeRenderer::LABEL_FONT_SIZE)
+const int CHAR_WIDTH = 7;
+const int LINE_HEIGHT = 16;
+const int TEXT_PADDING = 12;
+const int PROCESS_MIN_WIDTH = 120;
+const int PROCESS_MAX_WIDTH = 320;
+const int DECISION_MIN_WIDTH = 140;
+const int DECISION_MAX_WIDTH = 360;
+const int TERMINATOR_MIN_WIDTH = 100;
+const int TERMINATOR_MAX_WIDTH = 240;
+const int MIN_HEIGHT = 40;
+
+// Ключевые слова псевдокода (в нижнем регистре)
+const std::initializer_list<const char*> FUNCTION_WORDS = {
+    "function", "procedure", "func", "def", "sub", "algorithm",
+    "алгоритм", "алг", "функция", "процедура"};
+const std::initializer_list<const char*> IF_WORDS = {"if", "если"};
+const std::initializer_list<const char*> ELSE_WORDS = {"else", "иначе"};
+const std::initializer_list<const char*> ELSEIF_WORDS = {"elif", "elseif", "elsif"};
+const std::initializer_list<const char*> WHILE_WORDS = {"while", "пока"};
+const std::initializer_list<const char*> FOR_WORDS = {"for", "foreach", "для"};
+const std::initializer_list<const char*> REPEAT_WORDS = {"repeat", "do", "повторять", "повторить"};
+const std::initializer_list<const char*> UNTIL_WORDS = {"until", "до"};
+const std::initializer_list<const char*> END_WORDS = {
+    "end", "endif", "endwhile", "endfor", "endfunction", "endprocedure", "endsub",
+    "done", "fi", "next", "wend", "кц", "кон", "все", "всё", "конец"};
+const std::initializer_list<const char*> GROUP_WORDS = {"begin", "start", "нач", "начало"};
+const std::initializer_list<const char*> RETURN_WORDS = {"return", "вернуть", "возврат"};
+const std::initializer_list<const char*> BREAK_WORDS = {"break", "выход", "прервать"};
+const std::initializer_list<const char*> CONTINUE_WORDS = {"continue", "продолжить"};
+const std::initializer_list<const char*> TAIL_WORDS = {"then", "do", "то", "begin"};
+
+// Не имена функций: заголовки управляющих конструкций вне функций (JS)
+const std::initializer_list<const char*> C_STATEMENT_WORDS = {"if", "while", "for", "switch", "catch", "with"};
+// После скобок параметров функции до '{'
+const std::initializer_list<const char*> C_QUALIFIERS = {
+    "const", "override", "final", "noexcept", "volatile", "mutable", "async"};
+
+// Классы токенов для расстановки пробелов в надписи (labelAdd)
+enum { PrevNone, PrevOperand, PrevOpen, PrevClose, PrevTight, PrevOperator };
+
+void setError(QString* error, const QString& text) {
+    if (error) *error = text;
+}
+
+bool oneOf(const QByteArray& word, std::initializer_list<const char*> words) {
+    for (const char* w : words) {
+        if (word == w) return true;
+    }
+    return false;
+}
+
+bool isWordChar(int c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           c == '_' || c == '$' || c >= 0x80;
+}
+
+/**
+ * @brief Число символов UTF-8 в строке.
+ */
+int charCount(const QByteArray& text) {
+    int n = 0;
+    for (char c : text) {
+        if ((c & 0xC0) != 0x80) ++n;
+    }
+    return n;
+}
+
+/**
+ * @brief Размер блока под надпись: ширина по самой длинной строке (до
+ *        предела, дальше - перенос), высота по числу строк; кратно сетке.
+ *
+ * Текст ромба занимает вписанный прямоугольник - вдвое меньший.
+ */
+QSize blockSize(ShapeType type, int lines, int longest, int grid) {
+    int minWidth = PROCESS_MIN_WIDTH, maxWidth = PROCESS_MAX_WIDTH, scale = 1;
+    if (type == ShapeType::Diamond) {
+        minWidth = DECISION_MIN_WIDTH;
+        maxWidth = DECISION_MAX_WIDTH;
+        scale = 2;
+    } else if (type == ShapeType::Circle) {
+        minWidth = TERMINATOR_MIN_WIDTH;
+        maxWidth = TERMINATOR_MAX_WIDTH;
+    }
+    int width = qBound(minWidth, scale * (longest * CHAR_WIDTH + 2 * TEXT_PADDING), maxWidth);
+    int perLine = qMax(1, (width / scale - 2 * TEXT_PADDING) / CHAR_WIDTH);
+    int rows = lines * ((qMax(1, longest) + perLine - 1) / perLine);
+    int height = qMax(MIN_HEIGHT * scale, scale * (rows * LINE_HEIGHT + 2 * TEXT_PADDING));
+    grid = qMax(1, grid);
+    return QSize((width + grid - 1) / grid * grid, (height + grid - 1) / grid * grid);
+}
+
+} // namespace
+
+//==================================================================
+// 1. Токенизатор
+//==================================================================
+
+/**
+ * @brief Конструктор: буфер чтения и буферы токена выделяются один раз.
+ *
+ * reserve() обязателен: без него Qt 5 освобождает память QByteArray
+ * при resize(0), и каждый токен выделял бы ее заново.
+ */
+SourceTokenizer::SourceTokenizer(QIODevice& device, bool lines)
+    : dev(device), lineMode(lines), buf(IO_CHUNK) {
+    token.text.reserve(MAX_TOKEN_BYTES + 4); // + хвост символа UTF-8 на границе
+    token.folded.reserve(MAX_TOKEN_BYTES + 4);
+}
+
+/**
+ * @brief Совпадает ли текущий токен (слово или знак) с text.
+ */
+bool SourceTokenizer::is(const char* text) const {
+    return (token.kind == SourceToken::Word || token.kind == SourceToken::Punct) && token.text == text;
+}
+
+/**
+ * @brief Читает следующий токен.
+ *
+ * Текст прежнего токена затирается на месте - память буферов токена
+ * сохраняется, так что чтение не выделяет памяти на каждый токен.
+ */
+const SourceToken& SourceTokenizer::next() {
+    token.text.truncate(0);
+    token.folded.truncate(0);
+    cut = false;
+    for (;;) {
+        int c = getChar();
+        if (c < 0) {
+            token.kind = SourceToken::End;
+            return token;
+        }
+        if (c == '\n') {
+            atLineStart = true;
+            if (lineMode) {
+                token.kind = SourceToken::Newline;
+                return token;
+            }
+            continue;
+        }
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') continue;
+
+        // Комментарии и директивы препроцессора
+        if (c == '/' && peekChar() == '/') {
+            skipLine();
+            continue;
+        }
+        if (c == '/' && peekChar() == '*') {
+            ++pos;
+            skipBlockComment();
+            continue;
+        }
+        if (c == '#' && (lineMode || atLineStart)) {
+            skipLine();
+            continue;
+        }
+
+        atLineStart = false;
+        if (c >= '0' && c <= '9') readNumber(c);
+        else if (isWordChar(c)) readWord(c);
+        else if (c == '"' || c == '\'' || c == '`') readString(c);
+        else readPunct(c);
+        return token;
+    }
+}
+
+/**
+ * @brief Дочитывает буфер из устройства; пропускает BOM в начале файла.
+ */
+bool SourceTokenizer::fill() {
+    if (failed) return false;
+    bool first = (consumed == 0 && len == 0);
+    consumed += len;
+    pos = 0;
+    len = dev.read(buf.data(), IO_CHUNK);
+    if (len < 0) {
+        failed = true;
+        len = 0;
+    }
+    if (first && len >= 3 && std::memcmp(buf.data(), "\xEF\xBB\xBF", 3) == 0) pos = 3;
+    return pos < len;
+}
+
+/**
+ * @brief Дописывает байт к токену; длинный токен обрезается, но только
+ *        на границе символа UTF-8.
+ */
+void SourceTokenizer::append(int c) {
+    if (cut) return;
+    if (token.text.size() >= MAX_TOKEN_BYTES && (c & 0xC0) != 0x80) {
+        cut = true;
+        return;
+    }
+    token.text.append(char(c));
+}
+
+/**
+ * @brief Пропускает остаток строки (перевод строки остается), с учетом
+ *        продолжения строки обратной косой чертой.
+ */
+void SourceTokenizer::skipLine() {
+    int c;
+    while ((c = peekChar()) >= 0 && c != '\n') {
+        ++pos;
+        if (c == '\\' && peekChar() == '\n') ++pos;
+    }
+}
+
+void SourceTokenizer::skipBlockComment() {
+    int c;
+    while ((c = getChar()) >= 0) {
+        if (c == '*' && peekChar() == '/') {
+            ++pos;
+            return;
+        }
+    }
+}
+
+void SourceTokenizer::readWord(int c) {
+    token.kind = SourceToken::Word;
+    append(c);
+    while ((c = peekChar()) >= 0 && isWordChar(c)) {
+        append(c);
+        ++pos;
+    }
+    if (lineMode) fold();
+}
+
+void SourceTokenizer::readNumber(int c) {
+    token.kind = SourceToken::Number;
+    append(c);
+    int prev = c;
+    while ((c = peekChar()) >= 0) {
+        bool exponentSign = (c == '+' || c == '-') &&
+                            (prev == 'e' || prev == 'E' || prev == 'p' || prev == 'P');
+        if (!isWordChar(c) && c != '.' && c != '\'' && !exponentSign) break;
+        append(c);
+        ++pos;
+        prev = c;
+    }
+}
+
+/**
+ * @brief Строковый или символьный литерал вместе с кавычками.
+ *
+ * Незакрытый литерал кончается на конце строки.
+ */
+void SourceTokenizer::readString(int quote) {
+    token.kind = SourceToken::String;
+    append(quote);
+    int c;
+    while ((c = peekChar()) >= 0 && c != '\n') {
+        ++pos;
+        append(c);
+        if (c == quote) return;
+        if (c == '\\' && (c = getChar()) >= 0) append(c);
+    }
+}
+
+/**
+ * @brief Знак: двух- и трехсимвольные операторы - одним токеном.
+ */
+void SourceTokenizer::readPunct(int c) {
+    static const char* const pairs[] = {"==", "!=", "<=", ">=", "&&", "||", "++", "--", "+=", "-=",
+                                        "*=", "/=", "%=", "&=", "|=", "^=", "<<", ">>", "->", "::",
+                                        ":=", ".."};
+    token.kind = SourceToken::Punct;
+    append(c);
+    int d = peekChar();
+    for (const char* p : pairs) {
+        if (p[0] == c && p[1] == d) {
+            append(d);
+            ++pos;
+            break;
+        }
+    }
+    if (lineMode && c == '<' && d == '-' && token.text.size() == 1) { // Присваивание "<-"
+        append(d);
+        ++pos;
+        return;
+    }
+    if (token.text.size() == 2) {
+        d = peekChar();
+        if (((c == '<' || c == '>') && token.text.at(1) == c && d == '=') ||
+            (c == '.' && token.text.at(1) == '.' && d == '.')) {
+            append(d);
+            ++pos;
+        }
+    }
+}
+
+/**
+ * @brief Слово в нижнем регистре (ASCII и кириллица) - для ключевых слов.
+ */
+void SourceTokenizer::fold() {
+    qsizetype n = token.text.size();
+    token.folded.resize(n);
+    char* s = token.folded.data();
+    std::memcpy(s, token.text.constData(), size_t(n));
+    for (qsizetype i = 0; i < n; ++i) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 'A' && c <= 'Z') {
+            s[i] = char(c + 32);
+        } else if (c == 0xD0 && i + 1 < n) {
+            unsigned char d = (unsigned char)s[i + 1];
+            if (d >= 0x90 && d <= 0x9F) {        // А-П
+                s[i + 1] = char(d + 0x20);
+            } else if (d >= 0xA0 && d <= 0xAF) { // Р-Я
+                s[i] = char(0xD1);
+                s[i + 1] = char(d - 0x20);
+            } else if (d == 0x81) {              // Ё
+                s[i] = char(0xD1);
+                s[i + 1] = char(0x91);
+            }
+            ++i;
+        }
+    }
+}
+
+//==================================================================
+// 2. Генератор: public-функции
+//==================================================================
+
+/**
+ * @brief Конструктор: схемы будут добавляться в doc начиная с options.origin.
+ */
+FlowchartGenerator::FlowchartGenerator(Document& d, const FlowchartOptions& o)
+    : doc(d), options(o), nextX(o.origin.x()) {
+    label.reserve(MAX_LABEL_BYTES + SourceTokenizer::MAX_TOKEN_BYTES + 8); // См. SourceTokenizer
+}
+
+/**
+ * @brief Строит блок-схемы по исходному коду из устройства.
+ */
+bool FlowchartGenerator::generate(QIODevice& source, SourceDialect dialect, QString* error) {
+    BSG_TRACE_SCOPE("flowchart", "generate");
+    bool pseudo = (dialect == SourceDialect::Pseudo);
+    SourceTokenizer in(source, pseudo);
+    if (pseudo) {
+        parsePseudo(in);
+    } else {
+        in.next();
+        while (!in.isAtEnd()) {
+            parseScope(in, 0);
+            if (in.is("}")) in.next(); // Лишняя скобка
+        }
+    }
+    stats.bytes += in.getBytesRead();
+    if (in.hasError()) {
+        setError(error, QString("Read error: %1").arg(source.errorString()));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Строит блок-схемы по файлу; диалект по умолчанию - по расширению.
+ */
+bool FlowchartGenerator::generateFile(const QString& path, SourceDialect dialect, QString* error) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        setError(error, QString("Cannot open %1: %2").arg(path, file.errorString()));
+        return false;
+    }
+    if (dialect == SourceDialect::Auto) dialect = dialectFor(path);
+    QString what;
+    if (!generate(file, dialect, &what)) {
+        setError(error, QString("%1: %2").arg(path, what));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Диалект по расширению файла.
+ */
+SourceDialect FlowchartGenerator::dialectFor(const QString& path) {
+    QString suffix = QFileInfo(path).suffix().toLower();
+    if (suffix == "txt" || suffix == "pseudo" || suffix == "alg" || suffix == "kum") {
+        return SourceDialect::Pseudo;
+    }
+    return SourceDialect::CLike;
+}
+
+//==================================================================
+// 3. C-подобный код
+//==================================================================
+
+/**
+ * @brief Разбирает область видимости (файл, namespace, класс) до '}'.
+ *
+ * Заголовок копится до '{' или ';': функция - это '{' сразу после
+ * скобок параметров (и квалификаторов, списка инициализации, "-> тип").
+ * Тела с '=' перед ними (инициализаторы, лямбды) пропускаются, прочие
+ * '{' (namespace, class, extern "C") разбираются как вложенные области.
+ */
+void FlowchartGenerator::parseScope(SourceTokenizer& in, int depth) {
+    QByteArray name, lastWord;
+    bool prevWord = false;     // Предыдущий токен - слово
+    bool afterParams = false;  // После скобок параметров
+    bool trailing = false;     // После ':', "->" или throws - до '{' что угодно
+    bool assign = false;
+    auto reset = [&]() {
+        name.clear();
+        lastWord.clear();
+        prevWord = afterParams = trailing = assign = false;
+    };
+
+    while (!in.isAtEnd() && !in.is("}")) {
+        const SourceToken& t = in.current();
+        if (t.kind == SourceToken::Word) {
+            if (afterParams && !trailing) {
+                if (t.text == "throws") trailing = true;
+                else if (!oneOf(t.text, C_QUALIFIERS)) afterParams = false;
+            }
+            lastWord = t.text;
+            prevWord = true;
+            in.next();
+            continue;
+        }
+
+        if (in.is(";")) {
+            reset();
+            in.next();
+        } else if (in.is("(")) {
+            bool named = prevWord && !oneOf(lastWord, C_STATEMENT_WORDS);
+            if (named && name.isEmpty()) name = lastWord;
+            in.next();
+            for (int level = 1; !in.isAtEnd() && level > 0; in.next()) {
+                if (in.is("(")) ++level;
+                else if (in.is(")")) --level;
+            }
+            afterParams = named || trailing;
+            prevWord = false;
+        } else if (in.is("{")) {
+            if (trailing && prevWord) {
+                skipBraces(in); // Инициализатор члена: x{1}
+                prevWord = false;
+                continue;
+            }
+            if (afterParams && !assign && !name.isEmpty()) {
+                parseFunction(in, name);
+            } else if (!assign && depth < MAX_DEPTH) {
+                in.next();
+                parseScope(in, depth + 1);
+                if (in.is("}")) in.next();
+            } else {
+                skipBraces(in);
+            }
+            reset();
+        } else {
+            if (in.is("=")) assign = true;
+            if (afterParams && (in.is(":") || in.is("->"))) trailing = true;
+            else if (!trailing) afterParams = false;
+            prevWord = false;
+            in.next();
+        }
+    }
+}
+
+/**
+ * @brief Схема одной функции: начало, тело, конец; затем раскладка.
+ */
+void FlowchartGenerator::parseFunction(SourceTokenizer& in, const QByteArray& name) {
+    Exits exits;
+    beginChart(name, exits);
+    in.next(); // '{'
+    while (!in.isAtEnd() && !in.is("}")) statement(in, exits, 1);
+    if (in.is("}")) in.next();
+    endChart(exits);
+}
+
+/**
+ * @brief Разбирает один оператор; exits - ветки, входящие в него, на
+ *        выходе - ветки, выходящие из него.
+ */
+void FlowchartGenerator::statement(SourceTokenizer& in, Exits& exits, int depth) {
+    const SourceToken& t = in.current();
+
+    // Слишком глубокая вложенность - оператор целиком одним блоком
+    if (depth > MAX_DEPTH) {
+        labelClear();
+        readStatement(in);
+        addProcess(exits, label, true);
+        return;
+    }
+
+    if (in.is("{")) {
+        in.next();
+        while (!in.isAtEnd() && !in.is("}")) statement(in, exits, depth + 1);
+        if (in.is("}")) in.next();
+        return;
+    }
+    if (in.is(";")) {
+        in.next();
+        return;
+    }
+
+    if (t.kind == SourceToken::Word) {
+        if (in.is("if")) {
+            in.next();
+            labelClear();
+            readParens(in);
+            labelAddText("?");
+            ShapeId d = addDecision(exits, label);
+            Exits no{Exit{d, "нет"}};
+            exits.push_back(Exit{d, "да"});
+            statement(in, exits, depth + 1);
+            if (in.is("else")) {
+                in.next();
+                statement(in, no, depth + 1);
+            }
+            exits.insert(exits.end(), no.begin(), no.end());
+            return;
+        }
+        if (in.is("while")) {
+            in.next();
+            labelClear();
+            readParens(in);
+            labelAddText("?");
+            ShapeId d = addDecision(exits, label);
+            jumps.push_back(Jumps{true, {}, {}});
+            exits.push_back(Exit{d, "да"});
+            statement(in, exits, depth + 1);
+            join(exits, d);
+            join(jumps.back().continues, d);
+            exits.push_back(Exit{d, "нет"});
+            exits.insert(exits.end(), jumps.back().breaks.begin(), jumps.back().breaks.end());
+            jumps.pop_back();
+            return;
+        }
+        if (in.is("for") || in.is("foreach")) {
+            parseFor(in, exits, depth);
+            return;
+        }
+        if (in.is("do")) {
+            // Условие - после тела: обратная ветка ведет к первому блоку тела
+            in.next();
+            lastProcess = NoShape;
+            size_t first = chartBlocks.size();
+            jumps.push_back(Jumps{true, {}, {}});
+            statement(in, exits, depth + 1);
+            labelClear();
+            if (in.is("while")) {
+                in.next();
+                readParens(in);
+                labelAddText("?");
+                if (in.is(";")) in.next();
+            }
+            exits.insert(exits.end(), jumps.back().continues.begin(), jumps.back().continues.end());
+            bool emptyBody = chartBlocks.size() == first;
+            ShapeId d = addDecision(exits, label);
+            if (!emptyBody) { // Пустое тело: обратная ветка замкнула бы условие само на себя
+                Exits again{Exit{d, "да"}};
+                join(again, chartBlocks[first]);
+            }
+            exits.push_back(Exit{d, "нет"});
+            exits.insert(exits.end(), jumps.back().breaks.begin(), jumps.back().breaks.end());
+            jumps.pop_back();
+            return;
+        }
+        if (in.is("switch")) {
+            parseSwitch(in, exits, depth);
+            return;
+        }
+        if (in.is("return") || in.is("throw")) {
+            // Ветка уходит в конец функции; "return;" блока не дает
+            labelClear();
+            labelAdd(t);
+            in.next();
+            bool bare = in.is(";") || in.is("}");
+            readStatement(in);
+            if (!bare) addProcess(exits, label, true);
+            returns.insert(returns.end(), exits.begin(), exits.end());
+            exits.clear();
+            return;
+        }
+        if (in.is("break") || in.is("continue")) {
+            bool isBreak = in.is("break");
+            in.next();
+            labelClear();
+            readStatement(in); // Метка (Java) и ';'
+            if (Jumps* j = findJumps(!isBreak)) {
+                Exits& target = isBreak ? j->breaks : j->continues;
+                target.insert(target.end(), exits.begin(), exits.end());
+                exits.clear();
+            }
+            return;
+        }
+        if (in.is("try")) {
+            // Обработчики исключений - не основной путь, пропускаются
+            in.next();
+            statement(in, exits, depth + 1);
+            while (in.is("catch") || in.is("finally")) {
+                if (in.is("finally")) {
+                    in.next();
+                    statement(in, exits, depth + 1);
+                    continue;
+                }
+                in.next();
+                if (in.is("(")) {
+                    labelClear();
+                    readParens(in);
+                }
+                if (in.is("{")) skipBraces(in);
+            }
+            return;
+        }
+        if (in.is("else")) { // Без if
+            in.next();
+            return;
+        }
+        if (in.is("case") || in.is("default")) { // Вне switch
+            while (!in.isAtEnd() && !in.is(":") && !in.is("}")) in.next();
+            if (in.is(":")) in.next();
+            return;
+        }
+    }
+
+    labelClear();
+    readStatement(in);
+    addProcess(exits, label, true);
+}
+
+/**
+ * @brief for: инициализация - процесс, условие - решение, шаг - процесс
+ *        перед возвратом к условию. for-each - одно решение с заголовком.
+ */
+void FlowchartGenerator::parseFor(SourceTokenizer& in, Exits& exits, int depth) {
+    QByteArray keyword = in.current().text;
+    QByteArray parts[3];
+    int part = 0;
+    in.next();
+    if (in.is("(")) {
+        labelClear();
+        in.next();
+        for (int level = 1; !in.isAtEnd(); in.next()) {
+            if (in.is("(")) {
+                ++level;
+            } else if (in.is(")") && --level == 0) {
+                in.next();
+                break;
+            } else if (level == 1 && in.is(";") && part < 2) {
+                parts[part++] = label;
+                labelClear();
+                continue;
+            }
+            labelAdd(in.current());
+        }
+        parts[part] = label;
+    }
+
+    bool classic = (part == 2);
+    QByteArray cond;
+    if (classic) {
+        addProcess(exits, parts[0], true);
+        cond = parts[1].isEmpty() ? keyword + " (;;)" : parts[1] + "?";
+    } else {
+        cond = keyword + " (" + parts[0] + ")";
+    }
+    ShapeId d = addDecision(exits, cond);
+    jumps.push_back(Jumps{true, {}, {}});
+    exits.push_back(Exit{d, "да"});
+    statement(in, exits, depth + 1);
+
+    // continue ведет к шагу - он всегда отдельный блок
+    exits.insert(exits.end(), jumps.back().continues.begin(), jumps.back().continues.end());
+    if (classic && !parts[2].isEmpty()) {
+        lastProcess = NoShape;
+        addProcess(exits, parts[2], false);
+    }
+    join(exits, d);
+    exits.push_back(Exit{d, "нет"});
+    exits.insert(exits.end(), jumps.back().breaks.begin(), jumps.back().breaks.end());
+    jumps.pop_back();
+}
+
+/**
+ * @brief switch: решение с веткой на каждую группу меток case; без
+ *        break управление проваливается в следующую группу.
+ */
+void FlowchartGenerator::parseSwitch(SourceTokenizer& in, Exits& exits, int depth) {
+    in.next();
+    labelClear();
+    readParens(in);
+    ShapeId d = addDecision(exits, label);
+    jumps.push_back(Jumps{false, {}, {}});
+    bool hasDefault = false;
+    bool caseOpen = false; // Метки подряд - одна ветка
+
+    if (in.is("{")) {
+        in.next();
+        while (!in.isAtEnd() && !in.is("}")) {
+            bool isDefault = in.is("default");
+            if (!isDefault && !in.is("case")) {
+                caseOpen = false;
+                statement(in, exits, depth + 1);
+                continue;
+            }
+            in.next();
+            labelClear();
+            while (!in.isAtEnd() && !in.is(":") && !in.is("}")) {
+                labelAdd(in.current());
+                in.next();
+            }
+            if (in.is(":")) in.next();
+            QByteArray value = isDefault ? QByteArray("иначе") : label;
+            hasDefault = hasDefault || isDefault;
+            if (caseOpen) {
+                QByteArray& text = exits.back().label;
+                if (text.size() < MAX_LABEL_BYTES) text += ", " + value;
+            } else {
+                exits.push_back(Exit{d, value});
+            }
+            caseOpen = true;
+            lastProcess = NoShape;
+        }
+        if (in.is("}")) in.next();
+    } else {
+        statement(in, exits, depth + 1);
+    }
+
+    if (!hasDefault) exits.push_back(Exit{d, "иначе"});
+    exits.insert(exits.end(), jumps.back().breaks.begin(), jumps.back().breaks.end());
+    jumps.pop_back();
+}
+
+/**
+ * @brief Дописывает в надпись содержимое скобок (условие) и проходит ')'.
+ */
+void FlowchartGenerator::readParens(SourceTokenizer& in) {
+    if (!in.is("(")) return;
+    in.next();
+    for (int level = 1; !in.isAtEnd(); in.next()) {
+        if (in.is("(")) {
+            ++level;
+        } else if (in.is(")") && --level == 0) {
+            in.next();
+            return;
+        }
+        labelAdd(in.current());
+    }
+}
+
+/**
+ * @brief Дописывает в надпись простой оператор до ';' (включая его).
+ *
+ * Скобки и фигурные скобки внутри (лямбды, инициализаторы) учитываются;
+ * '{' в начале уровня оператора заканчивает его на парной '}'. Закрывающая
+ * '}' блока не забирается.
+ */
+void FlowchartGenerator::readStatement(SourceTokenizer& in) {
+    int level = 0;
+    bool braceBlock = false;
+    for (; !in.isAtEnd(); in.next()) {
+        if (level == 0) {
+            if (in.is(";")) {
+                in.next();
+                return;
+            }
+            if (in.is("}")) return;
+        }
+        if (in.is("(") || in.is("[") || in.is("{")) {
+            if (level == 0 && in.is("{")) braceBlock = true;
+            ++level;
+        } else if (in.is(")") || in.is("]") || in.is("}")) {
+            level = qMax(0, level - 1);
+            if (level == 0 && braceBlock && in.is("}")) {
+                labelAdd(in.current());
+                in.next();
+                if (in.is(";")) in.next();
+                return;
+            }
+        }
+        labelAdd(in.current());
+    }
+}
+
+/**
+ * @brief Пропускает блок в фигурных скобках вместе с ними.
+ */
+void FlowchartGenerator::skipBraces(SourceTokenizer& in) {
+    int level = 0;
+    do {
+        if (in.is("{")) ++level;
+        else if (in.is("}")) --level;
+        in.next();
+    } while (level > 0 && !in.isAtEnd());
+}
+
+//==================================================================
+// 4. Псевдокод
+//==================================================================
+
+/**
+ * @brief Разбирает псевдокод: функции - отдельные схемы, операторы вне
+ *        функций - общая схема (до "конец"/"end" или следующей функции).
+ */
+void FlowchartGenerator::parsePseudo(SourceTokenizer& in) {
+    Exits exits;
+    in.next();
+    for (;;) {
+        while (in.current().kind == SourceToken::Newline || in.is(";")) in.next();
+        if (in.isAtEnd()) break;
+
+        const SourceToken& t = in.current();
+        bool word = (t.kind == SourceToken::Word);
+        if (word && oneOf(t.folded, FUNCTION_WORDS)) {
+            if (inChart) endChart(exits);
+            in.next();
+            readLine(in, true); // Имя и параметры
+            beginChart(label, exits);
+            // "нач"/"begin" тела функции замыкается ее же end
+            while (in.current().kind == SourceToken::Newline) in.next();
+            if (in.current().kind == SourceToken::Word && oneOf(in.current().folded, GROUP_WORDS)) {
+                skipLine(in);
+            }
+            if (oneOf(pseudoBlock(in, exits, 1), END_WORDS)) skipLine(in);
+            endChart(exits);
+        } else if (word && oneOf(t.folded, END_WORDS)) {
+            skipLine(in);
+            if (inChart) endChart(exits);
+        } else if (word && (oneOf(t.folded, ELSE_WORDS) || oneOf(t.folded, ELSEIF_WORDS) ||
+                            oneOf(t.folded, UNTIL_WORDS))) {
+            skipLine(in); // Без своей конструкции
+        } else {
+            if (!inChart) beginChart(QByteArray(), exits);
+            pseudoStatement(in, exits, 1);
+        }
+    }
+    if (inChart) endChart(exits);
+}
+
+/**
+ * @brief Операторы до завершающего слова (end, else, until...).
+ *
+ * Строка с завершающим словом не забирается; возвращается само слово
+ * (пустое - конец файла). Заголовок следующей функции тоже завершает
+ * блок - так пропущенный end не склеивает функции.
+ */
+QByteArray FlowchartGenerator::pseudoBlock(SourceTokenizer& in, Exits& exits, int depth) {
+    for (;;) {
+        while (in.current().kind == SourceToken::Newline || in.is(";")) in.next();
+        if (in.isAtEnd()) return QByteArray();
+        const SourceToken& t = in.current();
+        if (t.kind == SourceToken::Word &&
+            (oneOf(t.folded, END_WORDS) || oneOf(t.folded, ELSE_WORDS) ||
+             oneOf(t.folded, ELSEIF_WORDS) || oneOf(t.folded, UNTIL_WORDS) ||
+             oneOf(t.folded, FUNCTION_WORDS))) {
+            return t.folded;
+        }
+        pseudoStatement(in, exits, depth);
+    }
+}
+
+/**
+ * @brief Один оператор псевдокода (строка или конструкция до своего end).
+ */
+void FlowchartGenerator::pseudoStatement(SourceTokenizer& in, Exits& exits, int depth) {
+    QByteArray kw = in.current().kind == SourceToken::Word ? in.current().folded : QByteArray();
+    if (depth > MAX_DEPTH) kw.clear();
+
+    // КуМир: "нц пока ..." / "нц для ..." ... "кц"
+    if (kw == "нц") {
+        in.next();
+        if (in.current().kind != SourceToken::Word) {
+            skipLine(in);
+            return;
+        }
+        kw = in.current().folded;
+    }
+
+    if (oneOf(kw, IF_WORDS)) {
+        pseudoIf(in, exits, depth);
+        return;
+    }
+    if (oneOf(kw, WHILE_WORDS) || oneOf(kw, FOR_WORDS)) {
+        // Условие while - без ключевого слова, заголовок for - целиком
+        bool isWhile = oneOf(kw, WHILE_WORDS);
+        if (isWhile) in.next();
+        bool inlineBody = readLine(in, true);
+        if (isWhile) labelAddText("?");
+        ShapeId d = addDecision(exits, label);
+        jumps.push_back(Jumps{true, {}, {}});
+        exits.push_back(Exit{d, "да"});
+        if (inlineBody) pseudoStatement(in, exits, depth + 1);
+        else if (oneOf(pseudoBlock(in, exits, depth + 1), END_WORDS)) skipLine(in);
+        join(exits, d);
+        join(jumps.back().continues, d);
+        exits.push_back(Exit{d, "нет"});
+        exits.insert(exits.end(), jumps.back().breaks.begin(), jumps.back().breaks.end());
+        jumps.pop_back();
+        return;
+    }
+    if (oneOf(kw, REPEAT_WORDS)) {
+        // repeat ... until cond: выход, когда условие выполнено
+        in.next();
+        skipLine(in);
+        lastProcess = NoShape;
+        size_t first = chartBlocks.size();
+        jumps.push_back(Jumps{true, {}, {}});
+        QByteArray term = pseudoBlock(in, exits, depth + 1);
+        exits.insert(exits.end(), jumps.back().continues.begin(), jumps.back().continues.end());
+        if (oneOf(term, UNTIL_WORDS)) {
+            in.next();
+            while (in.current().kind == SourceToken::Word && oneOf(in.current().folded, {"тех", "пор", "пока"})) {
+                in.next();
+            }
+            if (in.is(",")) in.next();
+            readLine(in, true);
+            labelAddText("?");
+            bool emptyBody = chartBlocks.size() == first;
+            ShapeId d = addDecision(exits, label);
+            if (!emptyBody) { // Как у do-while: без петли условия на себя
+                Exits again{Exit{d, "нет"}};
+                join(again, chartBlocks[first]);
+            }
+            exits.push_back(Exit{d, "да"});
+        } else {
+            if (oneOf(term, END_WORDS)) skipLine(in);
+            if (chartBlocks.size() > first) join(exits, chartBlocks[first]); // Бесконечный цикл
+        }
+        exits.insert(exits.end(), jumps.back().breaks.begin(), jumps.back().breaks.end());
+        jumps.pop_back();
+        return;
+    }
+    if (oneOf(kw, RETURN_WORDS)) {
+        qsizetype keyword = in.current().text.size();
+        readLine(in, false);
+        if (label.size() > keyword) addProcess(exits, label, true);
+        returns.insert(returns.end(), exits.begin(), exits.end());
+        exits.clear();
+        return;
+    }
+    if (oneOf(kw, BREAK_WORDS) || oneOf(kw, CONTINUE_WORDS)) {
+        bool isBreak = oneOf(kw, BREAK_WORDS);
+        skipLine(in);
+        if (Jumps* j = findJumps(!isBreak)) {
+            Exits& target = isBreak ? j->breaks : j->continues;
+            target.insert(target.end(), exits.begin(), exits.end());
+            exits.clear();
+        }
+        return;
+    }
+    if (oneOf(kw, GROUP_WORDS)) {
+        // begin ... end - просто группа операторов
+        skipLine(in);
+        if (oneOf(pseudoBlock(in, exits, depth + 1), END_WORDS)) skipLine(in);
+        return;
+    }
+
+    readLine(in, false);
+    addProcess(exits, label, true);
+}
+
+/**
+ * @brief if/elif/else ... end; "else if" и elif замыкаются общим end.
+ *        "if x then y" в одну строку - без end.
+ */
+void FlowchartGenerator::pseudoIf(SourceTokenizer& in, Exits& exits, int depth) {
+    if (depth > MAX_DEPTH) { // Длинная цепочка elif - дальше строками
+        readLine(in, false);
+        addProcess(exits, label, true);
+        return;
+    }
+    in.next();
+    bool inlineBody = readLine(in, true);
+    labelAddText("?");
+    ShapeId d = addDecision(exits, label);
+    Exits no{Exit{d, "нет"}};
+    exits.push_back(Exit{d, "да"});
+    if (inlineBody) {
+        pseudoStatement(in, exits, depth + 1);
+        exits.insert(exits.end(), no.begin(), no.end());
+        return;
+    }
+
+    QByteArray term = pseudoBlock(in, exits, depth + 1);
+    if (oneOf(term, ELSEIF_WORDS)) {
+        pseudoIf(in, no, depth + 1);
+    } else if (oneOf(term, ELSE_WORDS)) {
+        in.next();
+        if (in.current().kind == SourceToken::Word && oneOf(in.current().folded, IF_WORDS)) {
+            pseudoIf(in, no, depth + 1);
+        } else {
+            skipLine(in);
+            if (oneOf(pseudoBlock(in, no, depth + 1), END_WORDS)) skipLine(in);
+        }
+    } else if (oneOf(term, END_WORDS)) {
+        skipLine(in);
+    }
+    exits.insert(exits.end(), no.begin(), no.end());
+}
+
+/**
+ * @brief Надпись из остатка строки и переход на следующую.
+ *
+ * С dropTail заголовок кончается на "then"/"do"/":" вне скобок; если
+ * после него в строке есть оператор, строка не дочитывается и
+ * возвращается true.
+ */
+bool FlowchartGenerator::readLine(SourceTokenizer& in, bool dropTail) {
+    labelClear();
+    int level = 0;
+    for (; !in.isAtEnd() && in.current().kind != SourceToken::Newline && !in.is(";"); in.next()) {
+        const SourceToken& t = in.current();
+        if (in.is("(") || in.is("[")) ++level;
+        else if (in.is(")") || in.is("]")) level = qMax(0, level - 1);
+        if (dropTail && level == 0 &&
+            (in.is(":") || (t.kind == SourceToken::Word && oneOf(t.folded, TAIL_WORDS)))) {
+            in.next();
+            if (!in.isAtEnd() && in.current().kind != SourceToken::Newline && !in.is(";")) return true;
+            break;
+        }
+        labelAdd(t);
+    }
+    if (!in.isAtEnd()) in.next();
+    return false;
+}
+
+/**
+ * @brief Пропускает остаток строки вместе с ее концом.
+ */
+void FlowchartGenerator::skipLine(SourceTokenizer& in) {
+    while (!in.isAtEnd() && in.current().kind != SourceToken::Newline && !in.is(";")) in.next();
+    if (!in.isAtEnd()) in.next();
+}
+
+//==================================================================
+// 5. Построение схемы
+//==================================================================
+
+/**
+ * @brief Начинает схему функции: блок начала - единственный выход.
+ */
+void FlowchartGenerator::beginChart(const QByteArray& name, Exits& exits) {
+    chartBlocks.clear();
+    jumps.clear();
+    returns.clear();
+    exits.clear();
+    lastProcess = NoShape;
+    inChart = true;
+    ShapeId start = addBlock(ShapeType::Circle, name.isEmpty() ? QByteArray("начало") : name);
+    exits.push_back(Exit{start, QByteArray()});
+}
+
+/**
+ * @brief Заканчивает схему: блок конца, раскладка по слоям, место справа
+ *        от предыдущей схемы.
+ */
+void FlowchartGenerator::endChart(Exits& exits) {
+    lastProcess = NoShape;
+    ShapeId end = addBlock(ShapeType::Circle, "конец");
+    join(exits, end);
+    join(returns, end);
+    jumps.clear();
+    inChart = false;
+    stats.charts++;
+
+    LayoutResult result;
+    if (!Layout::layered(doc, chartBlocks, options.layout, result)) return;
+    QRect chart;
+    for (size_t i = 0; i < result.blocks.size(); ++i) {
+        result.positions[i] += QPoint(nextX, options.origin.y());
+        chart |= QRect(result.positions[i], doc.getBounds(result.blocks[i]).toRect().size());
+    }
+    Layout::apply(doc, result);
+    extent |= chart;
+    nextX = chart.right() + 1 + options.chartGap;
+}
+
+/**
+ * @brief Новый блок с надписью (в начале координат - место даст раскладка).
+ */
+ShapeId FlowchartGenerator::addBlock(ShapeType type, const QByteArray& text) {
+    QSize size = blockSize(type, 1, charCount(text), options.layout.gridSize);
+    Shape s{type, QRect(QPoint(0, 0), size), QPoint(), QPoint()};
+    s.label = QString::fromUtf8(text);
+    ShapeId id = doc.addShape(s);
+    chartBlocks.push_back(id);
+    created.push_back(id);
+    stats.blocks++;
+    return id;
+}
+
+/**
+ * @brief Блок действия. Операторы подряд (единственный вход - из
+ *        предыдущего блока действия) дописываются в него строками.
+ */
+void FlowchartGenerator::addProcess(Exits& exits, const QByteArray& text, bool mergeable) {
+    if (text.isEmpty()) return;
+    int chars = charCount(text);
+    if (mergeable && lastProcess != NoShape && lastLines < options.maxStatementLines &&
+        exits.size() == 1 && exits[0].from == lastProcess && exits[0].label.isEmpty()) {
+        QString merged = doc.getLabel(lastProcess);
+        merged += "\n";
+        merged += QString::fromUtf8(text);
+        doc.setLabel(lastProcess, merged);
+        lastLines++;
+        lastWidth = qMax(lastWidth, chars);
+        QPoint topLeft = doc.getBounds(lastProcess).toRect().topLeft();
+        QSize size = blockSize(ShapeType::Rectangle, lastLines, lastWidth, options.layout.gridSize);
+        doc.setPoints(lastProcess, topLeft, topLeft + QPoint(size.width(), size.height()));
+        return;
+    }
+    ShapeId id = addBlock(ShapeType::Rectangle, text);
+    join(exits, id);
+    exits.push_back(Exit{id, QByteArray()});
+    lastProcess = id;
+    lastLines = 1;
+    lastWidth = chars;
+}
+
+/**
+ * @brief Блок решения; ветки из него добавляет вызывающий.
+ */
+ShapeId FlowchartGenerator::addDecision(Exits& exits, const QByteArray& text) {
+    lastProcess = NoShape;
+    ShapeId id = addBlock(ShapeType::Diamond, text);
+    join(exits, id);
+    return id;
+}
+
+/**
+ * @brief Соединяет все ветки с блоком to и очищает список.
+ *
+ * Порты - временные: их выставит раскладка.
+ */
+void FlowchartGenerator::join(Exits& exits, ShapeId to) {
+    QRectF toBounds = doc.getBounds(to);
+    for (const Exit& e : exits) {
+        Shape s{ShapeType::Connector, QRect(), QPoint(), QPoint()};
+        s.link = ConnectorLink{e.from, to, Port::Bottom, Port::Top};
+        s.start = Geometry::portPoint(doc.getBounds(e.from), Port::Bottom);
+        s.end = Geometry::portPoint(toBounds, Port::Top);
+        s.label = QString::fromUtf8(e.label);
+        created.push_back(doc.addShape(s));
+        stats.connectors++;
+    }
+    exits.clear();
+}
+
+/**
+ * @brief Ближайший цикл (или цикл/switch для break).
+ */
+FlowchartGenerator::Jumps* FlowchartGenerator::findJumps(bool loop) {
+    for (auto it = jumps.rbegin(); it != jumps.rend(); ++it) {
+        if (it->loop || !loop) return &*it;
+    }
+    return nullptr;
+}
+
+//==================================================================
+// 6. Надписи
+//==================================================================
+
+void FlowchartGenerator::labelClear() {
+    label.truncate(0);
+    labelPrev = PrevNone;
+    labelFull = false;
+}
+
+/**
+ * @brief Дописывает токен в надпись.
+ *
+ * Пробелы - как в аккуратно отформатированном коде: вокруг бинарных
+ * операторов и между словами, но не внутри вызовов, индексов и после
+ * унарных операторов. Длинная надпись обрезается многоточием.
+ */
+void FlowchartGenerator::labelAdd(const SourceToken& t) {
+    if (labelFull || t.kind == SourceToken::End || t.kind == SourceToken::Newline) return;
+    const QByteArray& s = t.text;
+    bool space;
+    int kind;
+    if (t.kind != SourceToken::Punct) {
+        space = labelPrev == PrevOperand || labelPrev == PrevClose || labelPrev == PrevOperator;
+        kind = PrevOperand;
+    } else if (s == "(" || s == "[") {
+        space = labelPrev == PrevOperator;
+        kind = PrevOpen;
+    } else if (s == ")" || s == "]") {
+        space = false;
+        kind = PrevClose;
+    } else if (s == "," || s == ";") {
+        space = false;
+        kind = PrevOperator;
+    } else if (s == "." || s == "->" || s == "::") {
+        space = false;
+        kind = PrevTight;
+    } else if ((s == "++" || s == "--") && (labelPrev == PrevOperand || labelPrev == PrevClose)) {
+        space = false; // Постфиксный
+        kind = PrevClose;
+    } else if (labelPrev == PrevOperand || labelPrev == PrevClose) {
+        space = true;  // Бинарный
+        kind = PrevOperator;
+    } else {
+        space = labelPrev == PrevOperator; // Унарный
+        kind = PrevTight;
+    }
+    if (labelPrev == PrevNone) space = false;
+
+    if (label.size() + (space ? 1 : 0) + s.size() > MAX_LABEL_BYTES) {
+        label.append("…");
+        labelFull = true;
+        return;
+    }
+    if (space) label.append(' ');
+    label.append(s);
+    labelPrev = kind;
+}
+
+/**
+ * @brief Дописывает текст как есть (знак вопроса условия).
+ */
+void FlowchartGenerator::labelAddText(const char* text) {
+    if (labelFull || label.isEmpty()) return;
+    label.append(text);
+}
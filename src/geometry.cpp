@@ -0,0 +1,450 @@
+#include "geometry.h"
+#include <QLineF>
+#include <QtMath>
+#include <algorithm>
+#include <limits>
+
+/**
+ * @brief Очищает массивы (память остается для следующего ресайза).
+ */
+void PackedGeometry::clear() {
+    x1.clear();
+    y1.clear();
+    x2.clear();
+    y2.clear();
+    isLine.clear();
+}
+
+/**
+ * @brief Резервирует место под n фигур.
+ */
+void PackedGeometry::reserve(size_t n) {
+    x1.reserve(n);
+    y1.reserve(n);
+    x2.reserve(n);
+    y2.reserve(n);
+    isLine.reserve(n);
+}
+
+/**
+ * @brief Добавляет фигуру (точки - как в Document).
+ */
+void PackedGeometry::append(ShapeType type, const QPoint& p1, const QPoint& p2) {
+    x1.push_back(p1.x());
+    y1.push_back(p1.y());
+    x2.push_back(p2.x());
+    y2.push_back(p2.y());
+    isLine.push_back(type == ShapeType::Line ? 1 : 0);
+}
+
+namespace Geometry {
+
+/**
+ * @brief Вычисляет "якорную" точку для ресайза.
+ */
+QPointF getAnchorPoint(const QRectF& rect, HandlePosition handle, bool fromCenter) {
+    if (fromCenter) return rect.center();
+    switch (handle) {
+    case HandlePosition::TopLeft:       return rect.bottomRight();
+    case HandlePosition::Top:           return QPointF(rect.center().x(), rect.bottom());
+    case HandlePosition::TopRight:      return rect.bottomLeft();
+    case HandlePosition::Left:          return QPointF(rect.right(), rect.center().y());
+    case HandlePosition::Right:         return QPointF(rect.left(), rect.center().y());
+    case HandlePosition::BottomLeft:    return rect.topRight();
+    case HandlePosition::Bottom:        return QPointF(rect.center().x(), rect.top());
+    case HandlePosition::BottomRight:   return rect.topLeft();
+    default:                            return rect.center();
+    }
+}
+
+/**
+ * @brief Масштабирует точку 'p' относительно якоря 'anchor'.
+ */
+QPointF scalePoint(const QPointF &p, const QPointF &anchor, qreal sx, qreal sy) {
+    return QPointF(
+        anchor.x() + (p.x() - anchor.x()) * sx,
+        anchor.y() + (p.y() - anchor.y()) * sy
+        );
+}
+
+/**
+ * @brief Положение якоря внутри границ фигуры: доля ширины и высоты
+ * (0 - левый/верхний край, 1 - правый/нижний).
+ *
+ * Зависит только от ручки и модификаторов, поэтому считается один раз
+ * на шаг ресайза, а не для каждой фигуры.
+ */
+static QPointF anchorFactors(const ResizeParams& params) {
+    if (params.fromCenter) return QPointF(0.5, 0.5);
+    if (params.primaryIsLine) {
+        // Тянем конец линии: якорь - другой конец (у рамок - угол напротив)
+        return (params.handle == HandlePosition::Start) ? QPointF(1, 1) : QPointF(0, 0);
+    }
+    switch (params.handle) {
+    case HandlePosition::TopLeft:       return QPointF(1, 1);
+    case HandlePosition::Top:           return QPointF(0.5, 1);
+    case HandlePosition::TopRight:      return QPointF(0, 1);
+    case HandlePosition::Left:          return QPointF(1, 0.5);
+    case HandlePosition::Right:         return QPointF(0, 0.5);
+    case HandlePosition::BottomLeft:    return QPointF(1, 0);
+    case HandlePosition::Bottom:        return QPointF(0.5, 0);
+    case HandlePosition::BottomRight:   return QPointF(0, 0);
+    default:                            return QPointF(0.5, 0.5);
+    }
+}
+
+/**
+ * @brief Применяет шаг ресайза к исходной геометрии многих фигур сразу.
+ *
+ * Каждая фигура масштабируется относительно своего якоря. Якорь лежит
+ * на границах фигуры (anchorFactors): у рамок это p1/p2, у линий -
+ * нормализованные границы, а при ресайзе "от центра" и за конец линии -
+ * сами точки. Прямоугольник после масштаба нормализуется (отрицательный
+ * масштаб - отражение), линия - нет.
+ *
+ * Цикл без вызовов и ветвлений по фигурам: только арифметика, min/max
+ * и выбор по маске, которые компилятор векторизует.
+ */
+void resizeBatch(const PackedGeometry& orig, const ResizeParams& params,
+                 std::vector<QPoint>& p1s, std::vector<QPoint>& p2s) {
+    const int n = orig.size();
+    p1s.resize(n);
+    p2s.resize(n);
+
+    const QPointF f = anchorFactors(params);
+    const double fx = f.x(), fy = f.y();
+    const double sx = params.scaleX, sy = params.scaleY;
+    const bool lineBounds = !params.fromCenter && !params.primaryIsLine;
+
+    const double* x1 = orig.x1.data();
+    const double* y1 = orig.y1.data();
+    const double* x2 = orig.x2.data();
+    const double* y2 = orig.y2.data();
+    const quint8* isLine = orig.isLine.data();
+    QPoint* out1 = p1s.data();
+    QPoint* out2 = p2s.data();
+
+    for (int i = 0; i < n; ++i) {
+        const bool line = isLine[i] != 0;
+        const bool sorted = line && lineBounds;
+
+        // Якорь
+        const double lx = sorted ? std::min(x1[i], x2[i]) : x1[i];
+        const double hx = sorted ? std::max(x1[i], x2[i]) : x2[i];
+        const double ly = sorted ? std::min(y1[i], y2[i]) : y1[i];
+        const double hy = sorted ? std::max(y1[i], y2[i]) : y2[i];
+        const double ax = lx + (hx - lx) * fx;
+        const double ay = ly + (hy - ly) * fy;
+
+        // Масштаб относительно якоря
+        const double nx1 = ax + (x1[i] - ax) * sx;
+        const double ny1 = ay + (y1[i] - ay) * sy;
+        const double nx2 = ax + (x2[i] - ax) * sx;
+        const double ny2 = ay + (y2[i] - ay) * sy;
+
+        out1[i] = QPoint(qRound(line ? nx1 : std::min(nx1, nx2)), qRound(line ? ny1 : std::min(ny1, ny2)));
+        out2[i] = QPoint(qRound(line ? nx2 : std::max(nx1, nx2)), qRound(line ? ny2 : std::max(ny1, ny2)));
+    }
+}
+
+/**
+ * @brief Вычисляет шаг ресайза по перетаскиваемой ("главной") фигуре.
+ *
+ * Масштаб считается по исходной геометрии главной фигуры и позиции
+ * мыши; затем тот же шаг применяется ко всем выделенным фигурам.
+ */
+ResizeParams computeResize(const Shape& primary, HandlePosition handle, const QPointF& mousePos,
+                           bool keepProportions, bool fromCenter) {
+    qreal g_scaleX = 1.0, g_scaleY = 1.0; QPointF primaryAnchor; QPointF origHandlePos; QPointF origVector;
+    if (primary.type == ShapeType::Line) {
+        origHandlePos = (handle == HandlePosition::Start) ? QPointF(primary.start) : QPointF(primary.end);
+        if (fromCenter) primaryAnchor = QLineF(primary.start, primary.end).center();
+        else primaryAnchor = (handle == HandlePosition::Start) ? QPointF(primary.end) : QPointF(primary.start);
+        origVector = origHandlePos - primaryAnchor;
+    } else {
+        QRectF origRect = primary.bounds(); primaryAnchor = getAnchorPoint(origRect, handle, fromCenter);
+        switch(handle) {
+        case HandlePosition::TopLeft:       origHandlePos = origRect.topLeft(); break;
+        case HandlePosition::Top:           origHandlePos = QPointF(origRect.center().x(), origRect.top()); break;
+        case HandlePosition::TopRight:      origHandlePos = origRect.topRight(); break;
+        case HandlePosition::Left:          origHandlePos = QPointF(origRect.left(), origRect.center().y()); break;
+        case HandlePosition::Right:         origHandlePos = QPointF(origRect.right(), origRect.center().y()); break;
+        case HandlePosition::BottomLeft:    origHandlePos = origRect.bottomLeft(); break;
+        case HandlePosition::Bottom:        origHandlePos = QPointF(origRect.center().x(), origRect.bottom()); break;
+        case HandlePosition::BottomRight:   origHandlePos = origRect.bottomRight(); break;
+        default:                            origHandlePos = primaryAnchor;
+        }
+        origVector = origHandlePos - primaryAnchor;
+    }
+    QPointF newVector = mousePos - primaryAnchor;
+    if (qAbs(origVector.x()) > 1e-3) g_scaleX = newVector.x() / origVector.x();
+    if (qAbs(origVector.y()) > 1e-3) g_scaleY = newVector.y() / origVector.y();
+    if (keepProportions) {
+        qreal scale;
+        if (primary.type == ShapeType::Line) {
+            qreal origLen = QLineF(QPointF(0,0), origVector).length(); qreal newLen = QLineF(QPointF(0,0), newVector).length();
+            scale = (origLen == 0) ? 1.0 : (newLen / origLen);
+        } else {
+            if (handle == HandlePosition::Left || handle == HandlePosition::Right) scale = g_scaleX;
+            else if (handle == HandlePosition::Top || handle == HandlePosition::Bottom) scale = g_scaleY;
+            else scale = (qAbs(g_scaleX) > qAbs(g_scaleY)) ? g_scaleX : g_scaleY;
+        }
+        g_scaleX = scale; g_scaleY = scale;
+    }
+    if (primary.type != ShapeType::Line && !keepProportions) {
+        if (handle == HandlePosition::Top || handle == HandlePosition::Bottom) g_scaleX = 1.0;
+        if (handle == HandlePosition::Left || handle == HandlePosition::Right) g_scaleY = 1.0;
+    }
+    if (primary.type != ShapeType::Line && fromCenter && keepProportions) {
+        if (handle == HandlePosition::Top || handle == HandlePosition::Bottom) g_scaleX = g_scaleY;
+        if (handle == HandlePosition::Left || handle == HandlePosition::Right) g_scaleY = g_scaleX;
+    }
+    return ResizeParams{handle, fromCenter, primary.type == ShapeType::Line, g_scaleX, g_scaleY};
+}
+
+/**
+ * @brief Вычисляет геометрию QRect на основе двух точек и модификаторов.
+ *
+ * square (Shift) - квадрат, fromCenter (Ctrl) - рисование от центра.
+ *
+ * @param p1 Первая точка (обычно startPoint).
+ * @param p2 Вторая точка (обычно позиция мыши).
+ * @return QRect Вычисленный прямоугольник.
+ */
+QRect calculateRect(const QPoint& p1, const QPoint& p2, bool square, bool fromCenter) {
+    QRect r;
+
+    if (fromCenter) {
+        // Ctrl: Рисование от центра (p1 - центр)
+        int w = qAbs(p2.x() - p1.x()) * 2;
+        int h = qAbs(p2.y() - p1.y()) * 2;
+        if (square) {
+            w = h = qMax(w, h); // Ctrl + Shift = квадрат от центра
+        }
+        r = QRect(p1.x() - w/2, p1.y() - h/2, w, h);
+    } else if (square) {
+        // Shift: Квадрат (p1 - угол)
+        int w = p2.x() - p1.x();
+        int h = p2.y() - p1.y();
+        int size = qMax(qAbs(w), qAbs(h));
+
+        // Сохраняем направление (квадрант)
+        r = QRect(p1.x(), p1.y(),
+                  (w < 0) ? -size : size,
+                  (h < 0) ? -size : size);
+    } else {
+        // Свободное рисование
+        r = QRect(p1, p2);
+    }
+
+    return r.normalized(); // Всегда возвращаем L-T < R-B
+}
+
+/**
+ * @brief Проверяет попадание точки в фигуру.
+ */
+bool hitTest(const Shape& s, const QPoint& pos, qreal lineThreshold) {
+    if (hasEndpoints(s.type)) { // Связь без маршрута - как отрезок между портами
+        if (s.start == s.end) return false;
+        return segmentDistance(pos, s.start, s.end) < lineThreshold;
+    }
+
+    // Проверка для прямоугольника/круга: попадание в область
+    // Даем небольшой отступ (-2, 2) для удобства
+    return s.rect.adjusted(-2, -2, 2, 2).contains(pos);
+}
+
+/**
+ * @brief Расстояние от точки до отрезка a-b.
+ */
+qreal segmentDistance(const QPointF& p, const QPointF& a, const QPointF& b) {
+    // Ищем ближайшую точку на отрезке
+    QPointF ab = b - a;
+    qreal len2 = QPointF::dotProduct(ab, ab);
+    if (len2 == 0) return QLineF(p, a).length();
+
+    qreal t = QPointF::dotProduct(p - a, ab) / len2;
+    t = qBound(0.0, t, 1.0); // Ограничиваем t от 0 до 1 (точка должна быть на отрезке)
+    return QLineF(p, a + t * ab).length();
+}
+
+// --- Связи ---
+
+/**
+ * @brief Точка порта - середина соответствующей стороны блока.
+ */
+QPoint portPoint(const QRectF& block, Port port) {
+    QPointF c = block.center();
+    switch (port) {
+    case Port::Top:    return QPointF(c.x(), block.top()).toPoint();
+    case Port::Right:  return QPointF(block.right(), c.y()).toPoint();
+    case Port::Bottom: return QPointF(c.x(), block.bottom()).toPoint();
+    case Port::Left:   return QPointF(block.left(), c.y()).toPoint();
+    }
+    return c.toPoint();
+}
+
+/**
+ * @brief Единичный шаг наружу из блока через порт.
+ */
+QPoint portDirection(Port port) {
+    switch (port) {
+    case Port::Top:    return QPoint(0, -1);
+    case Port::Right:  return QPoint(1, 0);
+    case Port::Bottom: return QPoint(0, 1);
+    case Port::Left:   return QPoint(-1, 0);
+    }
+    return QPoint(1, 0);
+}
+
+/**
+ * @brief Ближайший к точке порт блока.
+ */
+Port nearestPort(const QRectF& block, const QPointF& pos) {
+    Port best = Port::Top;
+    qreal bestDist = std::numeric_limits<qreal>::max();
+    for (Port port : {Port::Top, Port::Right, Port::Bottom, Port::Left}) {
+        qreal d = QLineF(pos, QPointF(portPoint(block, port))).length();
+        if (d < bestDist) {
+            bestDist = d;
+            best = port;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Быстрый маршрут без обхода препятствий.
+ *
+ * Из каждого порта - отрезок длиной stub наружу, концы отрезков
+ * соединяются одним изломом (порты на разных осях) или двумя -
+ * через середину (порты на одной оси).
+ */
+void elbowRoute(const QPoint& a, Port aPort, const QPoint& b, Port bPort, int stub,
+                std::vector<QPoint>& route) {
+    QPoint da = portDirection(aPort);
+    QPoint db = portDirection(bPort);
+    QPoint s = a + da * stub;
+    QPoint e = b + db * stub;
+    bool aHorizontal = da.y() == 0;
+    bool bHorizontal = db.y() == 0;
+
+    route.clear();
+    route.push_back(a);
+    route.push_back(s);
+    if (aHorizontal && bHorizontal) {
+        int mx = (s.x() + e.x()) / 2;
+        route.emplace_back(mx, s.y());
+        route.emplace_back(mx, e.y());
+    } else if (!aHorizontal && !bHorizontal) {
+        int my = (s.y() + e.y()) / 2;
+        route.emplace_back(s.x(), my);
+        route.emplace_back(e.x(), my);
+    } else if (aHorizontal) {
+        route.emplace_back(e.x(), s.y());
+    } else {
+        route.emplace_back(s.x(), e.y());
+    }
+    route.push_back(e);
+    route.push_back(b);
+    simplifyRoute(route);
+}
+
+/**
+ * @brief Переносит концы маршрута в новые точки портов, сохраняя изломы.
+ *
+ * Первый и последний отрезки остаются на своих осях: у соседней с концом
+ * точки меняется только координата поперек отрезка, поэтому маршрут
+ * остается ортогональным. Не подходит, если отрезок у порта оказался бы
+ * не по направлению выхода из порта.
+ */
+bool stretchRoute(std::vector<QPoint>& route, const QPoint& a, Port aPort,
+                  const QPoint& b, Port bPort) {
+    int n = (int)route.size();
+    if (n < 3) return false;
+
+    // Ось отрезка: горизонтальный, вертикальный или вырожденный
+    auto horizontal = [](const QPoint& p, const QPoint& q) { return p.y() == q.y() && p.x() != q.x(); };
+    auto vertical = [](const QPoint& p, const QPoint& q) { return p.x() == q.x() && p.y() != q.y(); };
+    bool firstH = horizontal(route[0], route[1]);
+    bool lastH = horizontal(route[n - 2], route[n - 1]);
+    if (!firstH && !vertical(route[0], route[1])) return false;
+    if (!lastH && !vertical(route[n - 2], route[n - 1])) return false;
+    if (n == 3 && firstH == lastH) return false; // Один излом на двух осях сразу не сдвинуть
+
+    QPoint first = route[1];
+    if (firstH) first.setY(a.y()); else first.setX(a.x());
+    QPoint last = (n == 3) ? first : route[n - 2];
+    if (lastH) last.setY(b.y()); else last.setX(b.x());
+    if (n == 3) first = last;
+
+    // Выход из порта - строго наружу
+    auto leaves = [](const QPoint& from, const QPoint& to, Port port) {
+        QPoint d = portDirection(port);
+        QPoint v = to - from;
+        bool onAxis = d.y() == 0 ? v.y() == 0 : v.x() == 0;
+        return onAxis && v.x() * d.x() + v.y() * d.y() > 0;
+    };
+    if (!leaves(a, first, aPort) || !leaves(b, last, bPort)) return false;
+
+    route[0] = a;
+    route[1] = first;
+    route[n - 2] = last;
+    route[n - 1] = b;
+    simplifyRoute(route);
+    return true;
+}
+
+/**
+ * @brief Убирает повторы точек и промежуточные точки прямых участков.
+ */
+void simplifyRoute(std::vector<QPoint>& route) {
+    int out = 0;
+    for (int i = 0; i < (int)route.size(); ++i) {
+        const QPoint& p = route[i];
+        if (out > 0 && route[out - 1] == p) continue;
+        // Три точки на одной прямой - средняя лишняя
+        if (out > 1) {
+            const QPoint& a = route[out - 2];
+            const QPoint& m = route[out - 1];
+            if ((a.x() == m.x() && m.x() == p.x()) || (a.y() == m.y() && m.y() == p.y())) {
+                route[out - 1] = p;
+                continue;
+            }
+        }
+        route[out++] = p;
+    }
+    route.resize(out);
+}
+
+/**
+ * @brief Расстояние от точки до ломаной.
+ */
+qreal polylineDistance(const QPointF& p, const QPoint* points, int count) {
+    if (count == 1) return QLineF(p, QPointF(points[0])).length();
+    qreal best = std::numeric_limits<qreal>::max();
+    for (int i = 1; i < count; ++i) {
+        best = qMin(best, segmentDistance(p, points[i - 1], points[i]));
+    }
+    return best;
+}
+
+/**
+ * @brief Проходит ли ломаная через внутренность прямоугольника.
+ *
+ * QRectF::intersects не годится: у горизонтального или вертикального
+ * отрезка границы нулевой ширины, и Qt считает их пустыми.
+ */
+bool polylineCrosses(const QPoint* points, int count, const QRectF& rect) {
+    for (int i = 1; i < count; ++i) {
+        const QPoint& p = points[i - 1];
+        const QPoint& q = points[i];
+        if (qMax(p.x(), q.x()) > rect.left() && qMin(p.x(), q.x()) < rect.right() &&
+            qMax(p.y(), q.y()) > rect.top() && qMin(p.y(), q.y()) < rect.bottom()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
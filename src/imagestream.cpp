@@ -0,0 +1,338 @@
+#include "imagestream.h"
+#include <QFileInfo>
+#include <QtEndian>
+#include <cstring>
+#include <zlib.h>
+
+namespace {
+
+const int CHUNK_SIZE = 64 * 1024; // Порция сжатых данных на один IDAT
+
+//==================================================================
+// 1. PNG
+//==================================================================
+
+// Строки сжимаются одним потоком deflate, который нарезается на IDAT
+// по CHUNK_SIZE - в памяти только строка и буфер порции
+class PngWriter : public ImageStreamWriter {
+public:
+    ~PngWriter() override {
+        if (zInit) deflateEnd(&zs);
+    }
+
+protected:
+    bool writeHeader() override {
+        static const char signature[8] = {'\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n'};
+        if (file.write(signature, 8) != 8) return false;
+
+        uchar ihdr[13];
+        qToBigEndian<quint32>(quint32(size.width()), ihdr);
+        qToBigEndian<quint32>(quint32(size.height()), ihdr + 4);
+        ihdr[8] = 8;                 // Бит на канал
+        ihdr[9] = alpha ? 6 : 2;     // RGBA или RGB
+        ihdr[10] = 0;                // deflate
+        ihdr[11] = 0;                // Адаптивная фильтрация
+        ihdr[12] = 0;                // Без interlace
+        if (!writeChunk("IHDR", ihdr, sizeof(ihdr))) return false;
+
+        std::memset(&zs, 0, sizeof(zs));
+        if (deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+            failure = "zlib initialization failed";
+            return false;
+        }
+        zInit = true;
+        out.resize(CHUNK_SIZE);
+        line.resize(1 + getRowBytes());
+        zs.next_out = out.data();
+        zs.avail_out = CHUNK_SIZE;
+        return true;
+    }
+
+    bool writeBand(const QImage& band, int rows) override {
+        for (int y = 0; y < rows; ++y) {
+            line[0] = 0; // Фильтр None: схемы почти целиком из ровного фона
+            std::memcpy(line.data() + 1, convertRow(band, y), getRowBytes());
+            if (!compress(line.data(), (uInt)line.size(), Z_NO_FLUSH)) return false;
+        }
+        return true;
+    }
+
+    bool writeTrailer() override {
+        if (!compress(nullptr, 0, Z_FINISH)) return false;
+        if (zs.avail_out < CHUNK_SIZE && !writeChunk("IDAT", out.data(), CHUNK_SIZE - zs.avail_out)) {
+            return false;
+        }
+        return writeChunk("IEND", nullptr, 0);
+    }
+
+private:
+    bool compress(const uchar* data, uInt length, int flush) {
+        zs.next_in = const_cast<Bytef*>(data);
+        zs.avail_in = length;
+        while (true) {
+            int rc = deflate(&zs, flush);
+            if (rc == Z_STREAM_ERROR) {
+                failure = "zlib compression failed";
+                return false;
+            }
+            if (zs.avail_out == 0) {
+                if (!writeChunk("IDAT", out.data(), CHUNK_SIZE)) return false;
+                zs.next_out = out.data();
+                zs.avail_out = CHUNK_SIZE;
+                continue;
+            }
+            if (flush == Z_FINISH ? rc == Z_STREAM_END : zs.avail_in == 0) return true;
+        }
+    }
+
+    bool writeChunk(const char type[4], const uchar* data, quint32 length) {
+        uchar head[8];
+        qToBigEndian<quint32>(length, head);
+        std::memcpy(head + 4, type, 4);
+        uLong crc = crc32(0, head + 4, 4);
+        if (length > 0) crc = crc32(crc, data, length);
+        uchar tail[4];
+        qToBigEndian<quint32>(quint32(crc), tail);
+        return file.write(reinterpret_cast<const char*>(head), 8) == 8 &&
+               (length == 0 || file.write(reinterpret_cast<const char*>(data), length) == qint64(length)) &&
+               file.write(reinterpret_cast<const char*>(tail), 4) == 4;
+    }
+
+    z_stream zs;
+    bool zInit = false;
+    std::vector<uchar> out;    // Порция сжатых данных
+    std::vector<uchar> line;   // Байт фильтра + строка
+};
+
+//==================================================================
+// 2. TIFF
+//==================================================================
+
+// Baseline TIFF без сжатия, одна полоса (strip) на каждую порцию строк.
+// Смещения полос известны только в конце, поэтому каталог (IFD) пишется
+// последним, а ссылка на него в заголовке правится задним числом
+class TiffWriter : public ImageStreamWriter {
+protected:
+    bool writeHeader() override {
+        uchar header[8] = {'I', 'I', 42, 0, 0, 0, 0, 0}; // Смещение IFD - потом
+        return file.write(reinterpret_cast<const char*>(header), 8) == 8;
+    }
+
+    bool writeBand(const QImage& band, int rows) override {
+        qint64 offset = file.pos();
+        qint64 bytes = qint64(rows) * getRowBytes();
+        if (offset + bytes > qint64(0xffffffffu)) {
+            failure = "image is too large for TIFF (4 GB limit)";
+            return false;
+        }
+        for (int y = 0; y < rows; ++y) {
+            if (file.write(reinterpret_cast<const char*>(convertRow(band, y)), getRowBytes()) != getRowBytes())
+                return false;
+        }
+        stripOffsets.push_back(quint32(offset));
+        stripBytes.push_back(quint32(bytes));
+        stripRows = qMax(stripRows, rows);
+        return true;
+    }
+
+    bool writeTrailer() override {
+        const quint16 samples = alpha ? 4 : 3;
+        const quint32 strips = quint32(stripOffsets.size());
+
+        // Данные, не влезающие в 4 байта поля, идут перед каталогом
+        QByteArray extra;
+        auto appendLong = [&extra](quint32 v) {
+            uchar b[4];
+            qToLittleEndian<quint32>(v, b);
+            extra.append(reinterpret_cast<const char*>(b), 4);
+        };
+        qint64 base = file.pos();
+        if (base & 1) { // Смещения в TIFF должны быть четными
+            if (file.write("\0", 1) != 1) return false;
+            ++base;
+        }
+        quint32 bitsOffset = quint32(base + extra.size());
+        for (int i = 0; i < samples; ++i) {
+            uchar b[2];
+            qToLittleEndian<quint16>(8, b);
+            extra.append(reinterpret_cast<const char*>(b), 2);
+        }
+        quint32 offsetsOffset = quint32(base + extra.size());
+        for (quint32 v : stripOffsets) appendLong(v);
+        quint32 bytesOffset = quint32(base + extra.size());
+        for (quint32 v : stripBytes) appendLong(v);
+        if (base + extra.size() + 256 > qint64(0xffffffffu)) {
+            failure = "image is too large for TIFF (4 GB limit)";
+            return false;
+        }
+        quint32 ifdOffset = quint32(base + extra.size());
+
+        // Каталог: теги по возрастанию номера
+        struct Tag { quint16 id, type; quint32 count, value; };
+        const quint16 SHORT = 3, LONG = 4;
+        std::vector<Tag> tags = {
+            {256, LONG, 1, quint32(size.width())},             // ImageWidth
+            {257, LONG, 1, quint32(size.height())},            // ImageLength
+            {258, SHORT, samples, bitsOffset},                 // BitsPerSample
+            {259, SHORT, 1, 1},                                // Compression: нет
+            {262, SHORT, 1, 2},                                // Photometric: RGB
+            {273, LONG, strips, strips == 1 ? stripOffsets[0] : offsetsOffset}, // StripOffsets
+            {277, SHORT, 1, samples},                          // SamplesPerPixel
+            {278, LONG, 1, quint32(stripRows)},                // RowsPerStrip
+            {279, LONG, strips, strips == 1 ? stripBytes[0] : bytesOffset},     // StripByteCounts
+            {284, SHORT, 1, 1},                                // PlanarConfiguration: chunky
+        };
+        if (alpha) tags.push_back({338, SHORT, 1, 2});         // ExtraSamples: непредумноженная альфа
+
+        QByteArray ifd;
+        uchar b[12];
+        qToLittleEndian<quint16>(quint16(tags.size()), b);
+        ifd.append(reinterpret_cast<const char*>(b), 2);
+        for (const Tag& t : tags) {
+            qToLittleEndian<quint16>(t.id, b);
+            qToLittleEndian<quint16>(t.type, b + 2);
+            qToLittleEndian<quint32>(t.count, b + 4);
+            // SHORT с одним значением лежит в первых двух байтах поля
+            if (t.type == SHORT && t.count == 1) {
+                qToLittleEndian<quint16>(quint16(t.value), b + 8);
+                qToLittleEndian<quint16>(0, b + 10);
+            } else {
+                qToLittleEndian<quint32>(t.value, b + 8);
+            }
+            ifd.append(reinterpret_cast<const char*>(b), 12);
+        }
+        qToLittleEndian<quint32>(0, b); // Следующего каталога нет
+        ifd.append(reinterpret_cast<const char*>(b), 4);
+
+        if (file.write(extra) != extra.size() || file.write(ifd) != ifd.size()) return false;
+
+        qToLittleEndian<quint32>(ifdOffset, b);
+        return file.seek(4) && file.write(reinterpret_cast<const char*>(b), 4) == 4;
+    }
+
+private:
+    std::vector<quint32> stripOffsets;
+    std::vector<quint32> stripBytes;
+    int stripRows = 1;
+};
+
+//==================================================================
+// 3. Raw
+//==================================================================
+
+class RawWriter : public ImageStreamWriter {
+protected:
+    bool writeHeader() override { return true; }
+
+    bool writeBand(const QImage& band, int rows) override {
+        for (int y = 0; y < rows; ++y) {
+            if (file.write(reinterpret_cast<const char*>(convertRow(band, y)), getRowBytes()) != getRowBytes())
+                return false;
+        }
+        return true;
+    }
+
+    bool writeTrailer() override { return true; }
+};
+
+} // namespace
+
+//==================================================================
+// 4. ImageStreamWriter
+//==================================================================
+
+/**
+ * @brief Создает писатель для формата.
+ */
+std::unique_ptr<ImageStreamWriter> ImageStreamWriter::create(Format format) {
+    switch (format) {
+    case Format::Png: return std::make_unique<PngWriter>();
+    case Format::Tiff: return std::make_unique<TiffWriter>();
+    case Format::Raw: return std::make_unique<RawWriter>();
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Определяет формат по расширению файла.
+ */
+bool ImageStreamWriter::formatForPath(const QString& path, Format* format) {
+    QString suffix = QFileInfo(path).suffix().toLower();
+    if (suffix == "png") *format = Format::Png;
+    else if (suffix == "tif" || suffix == "tiff") *format = Format::Tiff;
+    else if (suffix == "raw" || suffix == "rgba") *format = Format::Raw;
+    else return false;
+    return true;
+}
+
+/**
+ * @brief Открывает файл и пишет заголовок.
+ */
+bool ImageStreamWriter::open(const QString& path, const QSize& imageSize, bool withAlpha, QString* error) {
+    size = imageSize;
+    alpha = withAlpha;
+    rowsWritten = 0;
+    failure.clear();
+    if (size.isEmpty()) {
+        failure = "empty image";
+        return fail(error);
+    }
+    rowBuffer.resize(getRowBytes());
+
+    file.setFileName(path);
+    if (!file.open(QIODevice::WriteOnly) || !writeHeader()) return fail(error);
+    return true;
+}
+
+/**
+ * @brief Дописывает следующие rows строк.
+ */
+bool ImageStreamWriter::writeRows(const QImage& band, int rows, QString* error) {
+    rows = qMin(rows, size.height() - rowsWritten);
+    if (band.width() != size.width() || band.format() != QImage::Format_ARGB32_Premultiplied) {
+        failure = "band does not match the image";
+        return fail(error);
+    }
+    if (rows <= 0) return true;
+    if (!writeBand(band, rows)) return fail(error);
+    rowsWritten += rows;
+    return true;
+}
+
+/**
+ * @brief Завершает файл. До этого вызова на диске ничего не меняется.
+ */
+bool ImageStreamWriter::finish(QString* error) {
+    if (rowsWritten != size.height()) {
+        failure = QString("only %1 of %2 rows written").arg(rowsWritten).arg(size.height());
+        return fail(error);
+    }
+    if (!writeTrailer() || !file.commit()) return fail(error);
+    return true;
+}
+
+/**
+ * @brief Переводит строку порции в байты RGB(A) без предумножения.
+ */
+const uchar* ImageStreamWriter::convertRow(const QImage& band, int y) {
+    const QRgb* src = reinterpret_cast<const QRgb*>(band.constScanLine(y));
+    uchar* dst = rowBuffer.data();
+    for (int x = 0; x < size.width(); ++x) {
+        QRgb c = qUnpremultiply(src[x]);
+        *dst++ = uchar(qRed(c));
+        *dst++ = uchar(qGreen(c));
+        *dst++ = uchar(qBlue(c));
+        if (alpha) *dst++ = uchar(qAlpha(c));
+    }
+    return rowBuffer.data();
+}
+
+/**
+ * @brief Формирует текст ошибки и отменяет запись файла.
+ */
+bool ImageStreamWriter::fail(QString* error) {
+    QString reason = failure.isEmpty() ? file.errorString() : failure;
+    if (error) *error = QString("Cannot write %1: %2").arg(file.fileName(), reason);
+    file.cancelWriting();
+    return false;
+}
@@ -0,0 +1,596 @@
+#include "layout.h"
+#include "geometry.h"
+#include "tracer.h"
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <unordered_map>
+
+const int MAX_TRIALS = 8;          // Больше прогонов почти ничего не дает
+const int MAX_EDGE_SPAN = 16;      // Ребро длиннее (в слоях) не упорядочивается
+const int COORD_PASSES = 4;        // Проходов (вниз + вверх) выравнивания координат
+const double IDLE_WEIGHT = 0.01;   // Узел без соседей почти не держится за место
+const double DUMMY_WEIGHT = 2.0;   // Длинные ребра стараемся держать прямыми
+
+// Состояния узла при поиске в глубину
+const quint8 WHITE = 0;
+const quint8 GRAY = 1;             // На стеке
+const quint8 BLACK = 2;
+
+/**
+ * @brief Округление к ближайшему узлу сетки (и для отрицательных).
+ */
+static int roundToGrid(double v, int g) {
+    return int(std::lround(v / g)) * g;
+}
+
+/**
+ * @brief Округление вверх до узла сетки.
+ */
+static int ceilToGrid(double v, int g) {
+    return int(std::ceil(v / g)) * g;
+}
+
+//==================================================================
+// 1. Конструктор и запуск
+//==================================================================
+
+/**
+ * @brief Конструктор. Зазоры не меньше клетки сетки - иначе привязка
+ *        к сетке могла бы сдвинуть блоки друг на друга.
+ */
+LayeredLayout::LayeredLayout(const LayoutOptions& o) : options(o) {
+    options.gridSize = qMax(1, options.gridSize);
+    options.layerGap = qMax(options.gridSize, options.layerGap);
+    options.nodeGap = qMax(options.gridSize, options.nodeGap);
+    options.sweeps = qMax(1, options.sweeps);
+}
+
+/**
+ * @brief Раскладывает граф и записывает левые верхние углы узлов.
+ */
+void LayeredLayout::run(const std::vector<QSize>& sizes, const std::vector<std::pair<int, int>>& edges,
+                        std::vector<QPoint>& positions) {
+    BSG_TRACE_SCOPE("layout", "layout");
+    realCount = (int)sizes.size();
+    width.resize(realCount);
+    height.resize(realCount);
+    for (int i = 0; i < realCount; ++i) {
+        width[i] = qMax(0, sizes[i].width());
+        height[i] = qMax(0, sizes[i].height());
+    }
+
+    removeCycles(edges);
+    assignLayers();
+    splitLongEdges();
+    reduceCrossings();
+    assignCoordinates(positions);
+}
+
+//==================================================================
+// 2. Циклы и слои
+//==================================================================
+
+/**
+ * @brief Разворачивает обратные ребра поиска в глубину - граф без циклов.
+ *
+ * Петли и повторные ребра отбрасываются: на раскладку они не влияют.
+ */
+void LayeredLayout::removeCycles(const std::vector<std::pair<int, int>>& edges) {
+    const int n = realCount;
+    dag.clear();
+    for (const auto& e : edges) {
+        if (e.first == e.second || e.first < 0 || e.second < 0 || e.first >= n || e.second >= n) continue;
+        dag.push_back(e);
+    }
+    std::sort(dag.begin(), dag.end());
+    dag.erase(std::unique(dag.begin(), dag.end()), dag.end());
+
+    // Исходящие ребра (индексы в dag) - dag отсортирован по началу
+    downStart.assign(n + 1, 0);
+    for (const auto& e : dag) ++downStart[e.first + 1];
+    std::partial_sum(downStart.begin(), downStart.end(), downStart.begin());
+
+    state.assign(n, WHITE);
+    cursor.assign(n, 0);
+    backEdges.clear();
+    for (int root = 0; root < n; ++root) {
+        if (state[root] != WHITE) continue;
+        stack.clear();
+        stack.push_back(root);
+        state[root] = GRAY;
+        cursor[root] = downStart[root];
+        while (!stack.empty()) {
+            int u = stack.back();
+            if (cursor[u] == downStart[u + 1]) {
+                state[u] = BLACK;
+                stack.pop_back();
+                continue;
+            }
+            auto& e = dag[cursor[u]++];
+            int v = e.second;
+            if (state[v] == GRAY) {
+                std::swap(e.first, e.second); // Обратное ребро
+                backEdges.push_back(e);
+            } else if (state[v] == WHITE) {
+                state[v] = GRAY;
+                cursor[v] = downStart[v];
+                stack.push_back(v);
+            }
+        }
+    }
+
+    // Развернутые ребра могли совпасть с прямыми - такие уже не обратные
+    std::sort(dag.begin(), dag.end());
+    std::sort(backEdges.begin(), backEdges.end());
+    backEdges.erase(std::unique(backEdges.begin(), backEdges.end()), backEdges.end());
+    size_t kept = 0;
+    for (const auto& e : backEdges) {
+        auto range = std::equal_range(dag.begin(), dag.end(), e);
+        if (range.second - range.first == 1) backEdges[kept++] = e;
+    }
+    backEdges.resize(kept);
+    dag.erase(std::unique(dag.begin(), dag.end()), dag.end());
+}
+
+/**
+ * @brief Слои по самому длинному пути, затем укорачивание ребер.
+ *
+ * Самый длинный путь кладет узел как можно выше, и ребра от истоков
+ * тянутся через полсхемы, а каждый лишний слой ребра - фиктивный узел.
+ * Узел, у которого детей больше, чем родителей, выгодно опустить на
+ * слой над ближайшим ребенком: его ребра в сумме станут короче. Обход
+ * от листьев к корням опускает целые цепочки за один проход.
+ */
+void LayeredLayout::assignLayers() {
+    const int n = realCount;
+    downStart.assign(n + 1, 0);
+    for (const auto& e : dag) ++downStart[e.first + 1];
+    std::partial_sum(downStart.begin(), downStart.end(), downStart.begin());
+
+    indegree.assign(n, 0);
+    for (const auto& e : dag) ++indegree[e.second];
+    cursor.assign(indegree.begin(), indegree.end()); // Число родителей
+
+    // Топологический порядок (алгоритм Кана), stack - очередь
+    layer.assign(n, 0);
+    stack.clear();
+    for (int v = 0; v < n; ++v) {
+        if (indegree[v] == 0) stack.push_back(v);
+    }
+    for (size_t head = 0; head < stack.size(); ++head) {
+        int u = stack[head];
+        for (int k = downStart[u]; k < downStart[u + 1]; ++k) {
+            int v = dag[k].second;
+            layer[v] = qMax(layer[v], layer[u] + 1);
+            if (--indegree[v] == 0) stack.push_back(v);
+        }
+    }
+
+    for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+        int u = *it;
+        if (downStart[u + 1] - downStart[u] <= cursor[u]) continue;
+        int closest = INT_MAX;
+        for (int k = downStart[u]; k < downStart[u + 1]; ++k) closest = qMin(closest, layer[dag[k].second]);
+        layer[u] = closest - 1;
+    }
+
+    int lowest = n > 0 ? *std::min_element(layer.begin(), layer.end()) : 0;
+    for (int& l : layer) l -= lowest;
+}
+
+/**
+ * @brief Разбивает ребра длиннее одного слоя фиктивными узлами.
+ *
+ * После этого каждое ребро соединяет соседние слои; соседи узла
+ * хранятся сплошными списками (CSR) вверх и вниз. Обратные ребра (их
+ * связь идет сбоку блоков) и ребра длиннее MAX_EDGE_SPAN слоев в
+ * упорядочивании не участвуют: цепочки фиктивных узлов для них
+ * раздули бы граф в разы, а пересечения почти не уменьшили.
+ */
+void LayeredLayout::splitLongEdges() {
+    std::vector<std::pair<int, int>> segments;
+    segments.reserve(dag.size());
+    for (const auto& e : dag) {
+        if (layer[e.second] - layer[e.first] > MAX_EDGE_SPAN ||
+            std::binary_search(backEdges.begin(), backEdges.end(), e)) {
+            continue;
+        }
+        int prev = e.first;
+        for (int l = layer[e.first] + 1; l < layer[e.second]; ++l) {
+            int dummy = (int)layer.size();
+            layer.push_back(l);
+            width.push_back(0);
+            height.push_back(0);
+            segments.emplace_back(prev, dummy);
+            prev = dummy;
+        }
+        segments.emplace_back(prev, e.second);
+    }
+
+    const int total = (int)layer.size();
+    downStart.assign(total + 1, 0);
+    upStart.assign(total + 1, 0);
+    for (const auto& s : segments) {
+        ++downStart[s.first + 1];
+        ++upStart[s.second + 1];
+    }
+    std::partial_sum(downStart.begin(), downStart.end(), downStart.begin());
+    std::partial_sum(upStart.begin(), upStart.end(), upStart.begin());
+    downList.resize(segments.size());
+    upList.resize(segments.size());
+    cursor.assign(downStart.begin(), downStart.end() - 1);
+    for (const auto& s : segments) downList[cursor[s.first]++] = s.second;
+    cursor.assign(upStart.begin(), upStart.end() - 1);
+    for (const auto& s : segments) upList[cursor[s.second]++] = s.first;
+
+    int layerCount = total > 0 ? *std::max_element(layer.begin(), layer.end()) + 1 : 0;
+    layers.assign(layerCount, {});
+}
+
+//==================================================================
+// 3. Пересечения
+//==================================================================
+
+/**
+ * @brief Упорядочивает слои, уменьшая пересечения ребер.
+ *
+ * Начальный порядок - обход в глубину вниз от каждого узла: связанные
+ * узлы оказываются рядом. Прогоны (по одному на ядро) стартуют с
+ * разных порядков - исходного, зеркального и случайных - и идут
+ * параллельно; берется прогон с наименьшим числом пересечений.
+ */
+void LayeredLayout::reduceCrossings() {
+    const int total = (int)layer.size();
+    state.assign(total, WHITE);
+    for (int root = 0; root < realCount; ++root) {
+        if (state[root] != WHITE) continue;
+        stack.clear();
+        stack.push_back(root);
+        state[root] = BLACK;
+        while (!stack.empty()) {
+            int u = stack.back();
+            stack.pop_back();
+            layers[layer[u]].push_back(u);
+            for (int k = downStart[u + 1] - 1; k >= downStart[u]; --k) {
+                int v = downList[k];
+                if (state[v] == WHITE) {
+                    state[v] = BLACK;
+                    stack.push_back(v);
+                }
+            }
+        }
+    }
+
+    int trialCount = options.trials > 0 ? options.trials : QThreadPool::globalInstance()->maxThreadCount();
+    trialCount = qBound(1, trialCount, MAX_TRIALS);
+    std::vector<Trial> trials(trialCount);
+    for (int k = 0; k < trialCount; ++k) {
+        Trial& t = trials[k];
+        t.seed = k;
+        t.order = layers;
+        if (k == 1) {
+            for (auto& row : t.order) std::reverse(row.begin(), row.end());
+        } else if (k > 1) {
+            std::mt19937 rng(k);
+            for (auto& row : t.order) std::shuffle(row.begin(), row.end(), rng);
+        }
+    }
+
+    if (trialCount > 1) {
+        QtConcurrent::blockingMap(trials, [this](Trial& t) { sweep(t); });
+    } else {
+        sweep(trials[0]);
+    }
+
+    // При равенстве - прогон с меньшим номером, чтобы результат не зависел от потоков
+    const Trial* best = &trials[0];
+    for (const Trial& t : trials) {
+        if (t.crossings < best->crossings) best = &t;
+    }
+    layers = best->order;
+    crossings = best->crossings;
+}
+
+/**
+ * @brief Прогон: проходы барицентром вниз и вверх, пока есть улучшение.
+ */
+void LayeredLayout::sweep(Trial& t) const {
+    const int layerCount = (int)t.order.size();
+    t.pos.assign(layer.size(), 0);
+    for (const auto& row : t.order) {
+        for (int i = 0; i < (int)row.size(); ++i) t.pos[row[i]] = i;
+    }
+
+    std::vector<std::vector<int>> best = t.order;
+    qint64 bestCrossings = countCrossings(t);
+    int stale = 0;
+    for (int pass = 0; pass < options.sweeps && bestCrossings > 0 && stale < 2; ++pass) {
+        for (int l = 1; l < layerCount; ++l) sortLayer(t, l, true);
+        for (int l = layerCount - 2; l >= 0; --l) sortLayer(t, l, false);
+        qint64 c = countCrossings(t);
+        if (c < bestCrossings) {
+            bestCrossings = c;
+            best = t.order;
+            stale = 0;
+        } else {
+            ++stale;
+        }
+    }
+    t.order = std::move(best);
+    t.crossings = bestCrossings;
+}
+
+/**
+ * @brief Сортирует слой по барицентрам соседей из слоя выше (down) или ниже.
+ *
+ * Узел без соседей там остается на своем месте. Сортировка устойчивая:
+ * при равных барицентрах порядок не меняется, и проходы сходятся.
+ */
+void LayeredLayout::sortLayer(Trial& t, int l, bool down) const {
+    std::vector<int>& row = t.order[l];
+    const std::vector<int>& start = down ? upStart : downStart;
+    const std::vector<int>& list = down ? upList : downList;
+
+    t.keys.clear();
+    for (int i = 0; i < (int)row.size(); ++i) {
+        int v = row[i];
+        int count = start[v + 1] - start[v];
+        double key = i;
+        if (count > 0) {
+            double sum = 0;
+            for (int k = start[v]; k < start[v + 1]; ++k) sum += t.pos[list[k]];
+            key = sum / count;
+        }
+        t.keys.emplace_back(key, v);
+    }
+    std::stable_sort(t.keys.begin(), t.keys.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+    for (int i = 0; i < (int)row.size(); ++i) {
+        row[i] = t.keys[i].second;
+        t.pos[row[i]] = i;
+    }
+}
+
+/**
+ * @brief Число пересечений ребер между всеми соседними слоями.
+ *
+ * Ребра слоя выписываются по порядку верхних концов (а у одного верхнего
+ * конца - по нижним); пересечения - это инверсии в последовательности
+ * нижних концов, их считает дерево Фенвика за E log V.
+ */
+qint64 LayeredLayout::countCrossings(Trial& t) const {
+    qint64 total = 0;
+    for (int l = 0; l + 1 < (int)t.order.size(); ++l) {
+        const int southSize = (int)t.order[l + 1].size();
+        t.fenwick.assign(southSize + 1, 0);
+        qint64 inserted = 0;
+        for (int u : t.order[l]) {
+            t.south.clear();
+            for (int k = downStart[u]; k < downStart[u + 1]; ++k) t.south.push_back(t.pos[downList[k]]);
+            std::sort(t.south.begin(), t.south.end());
+            for (int p : t.south) {
+                qint64 notGreater = 0;
+                for (int i = p + 1; i > 0; i -= i & -i) notGreater += t.fenwick[i];
+                total += inserted - notGreater;
+                for (int i = p + 1; i <= southSize; i += i & -i) ++t.fenwick[i];
+                ++inserted;
+            }
+        }
+    }
+    return total;
+}
+
+//==================================================================
+// 4. Координаты
+//==================================================================
+
+/**
+ * @brief Ряды по слоям, в ряду - выравнивание по соседям, затем сетка.
+ */
+void LayeredLayout::assignCoordinates(std::vector<QPoint>& positions) {
+    const int g = options.gridSize;
+    const int layerCount = (int)layers.size();
+
+    // Начальная укладка - плотно слева направо
+    x.assign(layer.size(), 0.0);
+    for (const auto& row : layers) {
+        double cursorX = 0;
+        for (int i = 0; i < (int)row.size(); ++i) {
+            if (i > 0) cursorX += (width[row[i - 1]] + width[row[i]]) / 2.0 + gapBetween(row[i - 1], row[i]);
+            x[row[i]] = cursorX;
+        }
+    }
+    for (int pass = 0; pass < COORD_PASSES; ++pass) {
+        for (int l = 1; l < layerCount; ++l) placeLayer(l, true, false);
+        for (int l = layerCount - 2; l >= 0; --l) placeLayer(l, false, true);
+    }
+    for (int l = 0; l < layerCount; ++l) placeLayer(l, true, true);
+
+    // Ряды: высота - самый высокий блок слоя
+    positions.assign(realCount, QPoint());
+    int rowTop = 0;
+    int minLeft = INT_MAX;
+    for (const auto& row : layers) {
+        int rowHeight = 0;
+        for (int v : row) rowHeight = qMax(rowHeight, height[v]);
+
+        int prevRight = INT_MIN;
+        for (int v : row) {
+            if (v >= realCount) continue;
+            int left = roundToGrid(x[v] - width[v] / 2.0, g);
+            if (prevRight != INT_MIN) left = qMax(left, ceilToGrid(prevRight + options.nodeGap, g));
+            int top = rowTop + (rowHeight - height[v]) / 2 / g * g;
+            positions[v] = QPoint(left, top);
+            prevRight = left + width[v];
+            minLeft = qMin(minLeft, left);
+        }
+        rowTop = ceilToGrid(rowTop + rowHeight + options.layerGap, g);
+    }
+
+    // Левый край - в нуле (minLeft уже на сетке)
+    if (minLeft != INT_MAX) {
+        for (QPoint& p : positions) p.rx() -= minLeft;
+    }
+}
+
+/**
+ * @brief Сдвигает узлы ряда к среднему их соседей выше и/или ниже.
+ *
+ * Минимизируется сумма весов * (x - цель)^2 при зазорах между соседями
+ * по ряду. Заменой y_i = x_i - s_i (s_i - накопленные зазоры) это
+ * изотоническая регрессия: y не убывают. Ее точно решает объединение
+ * нарушающих соседних групп (pool adjacent violators) за O(n).
+ */
+void LayeredLayout::placeLayer(int l, bool useUp, bool useDown) {
+    const std::vector<int>& row = layers[l];
+    const int n = (int)row.size();
+    if (n == 0) return;
+
+    target.resize(n);
+    weight.resize(n);
+    offset.resize(n);
+    for (int i = 0; i < n; ++i) {
+        int v = row[i];
+        double sum = 0;
+        int count = 0;
+        if (useUp) {
+            for (int k = upStart[v]; k < upStart[v + 1]; ++k) sum += x[upList[k]];
+            count += upStart[v + 1] - upStart[v];
+        }
+        if (useDown) {
+            for (int k = downStart[v]; k < downStart[v + 1]; ++k) sum += x[downList[k]];
+            count += downStart[v + 1] - downStart[v];
+        }
+        target[i] = count > 0 ? sum / count : x[v];
+        weight[i] = count > 0 ? count * (v >= realCount ? DUMMY_WEIGHT : 1.0) : IDLE_WEIGHT;
+        offset[i] = i == 0 ? 0.0
+                           : offset[i - 1] + (width[row[i - 1]] + width[v]) / 2.0 + gapBetween(row[i - 1], v);
+    }
+
+    // Пулы: среднее, вес, сколько узлов
+    poolMean.clear();
+    poolWeight.clear();
+    poolSize.clear();
+    for (int i = 0; i < n; ++i) {
+        double mean = target[i] - offset[i];
+        double w = weight[i];
+        int size = 1;
+        while (!poolMean.empty() && poolMean.back() >= mean) {
+            mean = (mean * w + poolMean.back() * poolWeight.back()) / (w + poolWeight.back());
+            w += poolWeight.back();
+            size += poolSize.back();
+            poolMean.pop_back();
+            poolWeight.pop_back();
+            poolSize.pop_back();
+        }
+        poolMean.push_back(mean);
+        poolWeight.push_back(w);
+        poolSize.push_back(size);
+    }
+    int i = 0;
+    for (size_t p = 0; p < poolMean.size(); ++p) {
+        for (int k = 0; k < poolSize[p]; ++k, ++i) x[row[i]] = poolMean[p] + offset[i];
+    }
+}
+
+/**
+ * @brief Зазор между соседями ряда: между блоками - nodeGap, рядом с
+ *        фиктивным узлом - клетка (место для линии связи).
+ */
+int LayeredLayout::gapBetween(int a, int b) const {
+    return (a < realCount && b < realCount) ? options.nodeGap : options.gridSize;
+}
+
+//==================================================================
+// 5. Раскладка документа
+//==================================================================
+
+namespace Layout {
+
+/**
+ * @brief Раскладывает блоки документа; ребра - связи между ними.
+ */
+bool layered(const Document& doc, const std::vector<ShapeId>& blocks, const LayoutOptions& options,
+             LayoutResult& result) {
+    result = LayoutResult();
+
+    // Блоки - в порядке слоев документа, чтобы результат не зависел от
+    // порядка выделения
+    std::vector<int> blockSlots;
+    for (ShapeId id : blocks) {
+        int slot = doc.slotOf(id);
+        if (slot >= 0 && isBlock(doc.typeAt(slot))) blockSlots.push_back(slot);
+    }
+    std::sort(blockSlots.begin(), blockSlots.end());
+    blockSlots.erase(std::unique(blockSlots.begin(), blockSlots.end()), blockSlots.end());
+    if (blockSlots.empty()) return false;
+
+    std::unordered_map<ShapeId, int> node;
+    std::vector<QSize> sizes;
+    QPoint origin(INT_MAX, INT_MAX);
+    node.reserve(blockSlots.size());
+    sizes.reserve(blockSlots.size());
+    for (int slot : blockSlots) {
+        QRect r = doc.boundsAt(slot).toRect();
+        node.emplace(doc.idAt(slot), (int)result.blocks.size());
+        result.blocks.push_back(doc.idAt(slot));
+        sizes.push_back(r.size());
+        origin = QPoint(qMin(origin.x(), r.x()), qMin(origin.y(), r.y()));
+    }
+
+    // Каждая связь присоединена к обоим блокам - берем ее у начального
+    std::vector<std::pair<int, int>> edges;
+    for (ShapeId block : result.blocks) {
+        for (ShapeId c : doc.getConnectors(block)) {
+            const ConnectorLink& link = doc.getLink(c);
+            if (link.from != block || link.to == block) continue;
+            auto to = node.find(link.to);
+            if (to == node.end()) continue;
+            edges.emplace_back(node[block], to->second);
+            result.connectors.push_back(c);
+        }
+    }
+
+    LayeredLayout layout(options);
+    layout.run(sizes, edges, result.positions);
+    result.crossings = layout.getCrossings();
+    result.layers = layout.getLayerCount();
+
+    const int g = qMax(1, options.gridSize);
+    origin = QPoint(ceilToGrid(origin.x(), g), ceilToGrid(origin.y(), g));
+    for (QPoint& p : result.positions) p += origin;
+
+    for (size_t i = 0; i < result.connectors.size(); ++i) {
+        ConnectorLink link = doc.getLink(result.connectors[i]);
+        if (layout.getLayer(edges[i].first) < layout.getLayer(edges[i].second)) {
+            link.fromPort = Port::Bottom;
+            link.toPort = Port::Top;
+        } else {
+            link.fromPort = Port::Right;
+            link.toPort = Port::Right;
+        }
+        result.links.push_back(link);
+    }
+    return true;
+}
+
+/**
+ * @brief Переносит блоки и порты связей из результата в документ.
+ */
+void apply(Document& doc, const LayoutResult& result) {
+    for (size_t i = 0; i < result.blocks.size(); ++i) {
+        QPoint topLeft = doc.getBounds(result.blocks[i]).toRect().topLeft();
+        doc.translateShape(result.blocks[i], result.positions[i] - topLeft);
+    }
+    for (size_t i = 0; i < result.connectors.size(); ++i) {
+        doc.setLink(result.connectors[i], result.links[i]);
+        doc.followPorts(result.connectors[i]);
+    }
+}
+
+}
@@ -3,6 +3,16 @@
 #include <QVBoxLayout>
 #include <QPushButton>
 #include <QCheckBox> // (ДОБАВЛЕНО)
+#include <QStatusBar>
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QShortcut>
+#include "tracer.h"
+
+// Фильтр диалогов открытия/сохранения
+static const char* SCHEME_FILTER = "Схема (*.bsg);;JSON (*.json)";
+static const char* SOURCE_FILTER =
+    "Исходный код (*.c *.h *.cpp *.hpp *.cc *.java *.js *.cs);;Псевдокод (*.txt *.pseudo *.alg);;Все файлы (*)";
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -19,13 +29,35 @@ MainWindow::MainWindow(QWidget *parent)
     btnLine   = new QPushButton("Линия", sidePanel);
     btnRect   = new QPushButton("Квадрат", sidePanel);
     btnCircle = new QPushButton("Круг", sidePanel);
+    btnDiamond = new QPushButton("Ромб", sidePanel);
+    btnConnect = new QPushButton("Связь", sidePanel);
 
     // --- (НОВОЕ) Галочки Настроек ---
     chkGrid = new QCheckBox("Сетка", sidePanel);
     chkSnap = new QCheckBox("Привязка", sidePanel);
+    chkGuides = new QCheckBox("Направляющие", sidePanel);
+    chkGuides->setToolTip("Выравнивать по краям и центрам соседних фигур");
+    chkTouch = new QCheckBox("Рамка: касание", sidePanel);
+    chkTouch->setToolTip("Рамка выделяет все фигуры, которых касается, а не только целиком попавшие в нее");
+    btnFit = new QPushButton("Вписать", sidePanel);
+    btnLayout = new QPushButton("Раскладка", sidePanel);
+    btnLayout->setToolTip("Разложить схему по слоям (при выделении - только выделенные блоки)");
+    btnGroup = new QPushButton("Группа", sidePanel);
+    btnGroup->setToolTip("Объединить выделенное в свернутую группу (Ctrl+G)");
+    btnUngroup = new QPushButton("Разгруппировать", sidePanel);
+    btnUngroup->setToolTip("Расформировать выделенные группы (Ctrl+Shift+G)");
+    btnCollapse = new QPushButton("Свернуть/раскрыть", sidePanel);
+    btnCollapse->setToolTip("Раскрыть выделенные группы или свернуть группы выделенных фигур (Ctrl+E)");
+
+    // --- Файл ---
+    btnOpen = new QPushButton("Открыть...", sidePanel);
+    btnSave = new QPushButton("Сохранить...", sidePanel);
+    btnImport = new QPushButton("Из кода...", sidePanel);
+    btnImport->setToolTip("Построить блок-схему по исходному коду (C-подобному или псевдокоду)");
 
     chkGrid->setChecked(true); // Включаем по умолчанию
     chkSnap->setChecked(true); // Включаем по умолчанию
+    chkGuides->setChecked(true);
 
 
     // --- Добавляем виджеты на панель ---
@@ -35,10 +67,22 @@ MainWindow::MainWindow(QWidget *parent)
     sideLayout->addWidget(btnLine);
     sideLayout->addWidget(btnRect);
     sideLayout->addWidget(btnCircle);
+    sideLayout->addWidget(btnDiamond);
+    sideLayout->addWidget(btnConnect);
     sideLayout->addSpacing(20); // (ДОБАВЛЕН Отступ)
     sideLayout->addWidget(chkGrid); // (ДОБАВЛЕНО)
     sideLayout->addWidget(chkSnap); // (ДОБАВЛЕНО)
+    sideLayout->addWidget(chkGuides);
+    sideLayout->addWidget(chkTouch);
+    sideLayout->addWidget(btnFit);
+    sideLayout->addWidget(btnLayout);
+    sideLayout->addWidget(btnGroup);
+    sideLayout->addWidget(btnUngroup);
+    sideLayout->addWidget(btnCollapse);
     sideLayout->addStretch();
+    sideLayout->addWidget(btnOpen);
+    sideLayout->addWidget(btnSave);
+    sideLayout->addWidget(btnImport);
 
     // --- Холст ---
     canvas = new Canvas(central);
@@ -65,6 +109,11 @@ MainWindow::MainWindow(QWidget *parent)
         canvas->setTool(Tool::Draw);
         canvas->setShapeType(ShapeType::Circle);
     });
+    connect(btnDiamond, &QPushButton::clicked, this, [this]() {
+        canvas->setTool(Tool::Draw);
+        canvas->setShapeType(ShapeType::Diamond);
+    });
+    connect(btnConnect, &QPushButton::clicked, this, [this]() { canvas->setTool(Tool::Connect); });
 
     // (НОВЫЕ) Соединения для галочек
     // (Используем QCheckBox::toggled, а не ::clicked)
@@ -73,4 +122,102 @@ MainWindow::MainWindow(QWidget *parent)
 
     connect(chkSnap, &QCheckBox::toggled,
             canvas, &Canvas::setSnapEnabled);
+
+    connect(chkGuides, &QCheckBox::toggled,
+            canvas, &Canvas::setGuidesEnabled);
+
+    connect(chkTouch, &QCheckBox::toggled, this, [this](bool touch) {
+        canvas->setMarqueeMode(touch ? MarqueeMode::Intersect : MarqueeMode::Contain);
+    });
+
+    // Файл
+    connect(btnFit, &QPushButton::clicked, canvas, &Canvas::zoomToFit);
+    connect(btnLayout, &QPushButton::clicked, this, [this]() {
+        canvas->autoLayout(canvas->getSelectedCount() > 0);
+    });
+    connect(btnGroup, &QPushButton::clicked, canvas, &Canvas::groupSelection);
+    connect(btnUngroup, &QPushButton::clicked, canvas, &Canvas::ungroupSelection);
+    connect(btnCollapse, &QPushButton::clicked, canvas, &Canvas::toggleGroupsCollapsed);
+    connect(btnOpen, &QPushButton::clicked, this, &MainWindow::openScheme);
+    connect(btnSave, &QPushButton::clicked, this, &MainWindow::saveScheme);
+    connect(btnImport, &QPushButton::clicked, this, &MainWindow::importSource);
+
+    // Диагностика: HUD (F3), запись трассы и её экспорт
+    connect(new QShortcut(QKeySequence(Qt::Key_F3), this), &QShortcut::activated,
+            this, [this]() { canvas->setHudEnabled(!canvas->isHudEnabled()); });
+    connect(new QShortcut(QKeySequence("Ctrl+Shift+T"), this), &QShortcut::activated,
+            this, &MainWindow::toggleTracing);
+    connect(new QShortcut(QKeySequence("Ctrl+Shift+E"), this), &QShortcut::activated,
+            this, &MainWindow::exportTrace);
+
+    // Количество выделенных фигур в строке состояния
+    connect(canvas, &Canvas::selectionChanged, this, [this]() {
+        int n = canvas->getSelectedCount();
+        if (n > 0) statusBar()->showMessage(QString("Выделено: %1").arg(n));
+        else statusBar()->clearMessage();
+    });
+}
+
+/**
+ * @brief Открывает схему из файла (.bsg или .json).
+ */
+void MainWindow::openScheme() {
+    QString path = QFileDialog::getOpenFileName(this, "Открыть схему", QString(), SCHEME_FILTER);
+    if (path.isEmpty()) return;
+
+    QString error;
+    if (!canvas->loadDocument(path, &error)) {
+        QMessageBox::warning(this, "Ошибка", error);
+        return;
+    }
+    canvas->zoomToFit(); // Сразу показываем всю схему
+}
+
+/**
+ * @brief Сохраняет схему в файл. Формат выбирается по расширению.
+ */
+void MainWindow::saveScheme() {
+    QString path = QFileDialog::getSaveFileName(this, "Сохранить схему", QString(), SCHEME_FILTER);
+    if (path.isEmpty()) return;
+
+    QString error;
+    if (!canvas->saveDocument(path, &error)) {
+        QMessageBox::warning(this, "Ошибка", error);
+    }
+}
+
+/**
+ * @brief Строит блок-схему по файлу исходного кода и добавляет ее в схему.
+ */
+void MainWindow::importSource() {
+    QString path = QFileDialog::getOpenFileName(this, "Блок-схема из кода", QString(), SOURCE_FILTER);
+    if (path.isEmpty()) return;
+
+    QString error;
+    if (!canvas->importSource(path, &error)) {
+        QMessageBox::warning(this, "Ошибка", error);
+        return;
+    }
+    canvas->zoomToFit();
+}
+
+/**
+ * @brief Включает или выключает запись трассы событий.
+ */
+void MainWindow::toggleTracing() {
+    Trace::setEnabled(!Trace::isEnabled());
+    statusBar()->showMessage(Trace::isEnabled() ? "Трассировка включена" : "Трассировка выключена", 3000);
+}
+
+/**
+ * @brief Сохраняет накопленную трассу в формате Chrome trace (chrome://tracing, Perfetto).
+ */
+void MainWindow::exportTrace() {
+    QString path = QFileDialog::getSaveFileName(this, "Экспорт трассы", QString(), "Chrome trace (*.json)");
+    if (path.isEmpty()) return;
+
+    QString error;
+    if (!Trace::exportChromeTrace(path, &error)) {
+        QMessageBox::warning(this, "Ошибка", error);
+    }
 }
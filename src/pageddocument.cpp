@@ -0,0 +1,609 @@
+#include "pageddocument.h"
+#include "documentio.h"
+#include "tracer.h"
+#include <QFileInfo>
+#include <QtEndian>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Файл страниц
+const char PAGE_MAGIC[4] = {'B', 'S', 'G', 'P'};
+const quint32 PAGE_VERSION = 1;
+const quint32 PAGE_HEADER_SIZE = 64;
+const int RECORD_SIZE = 40;
+const int DIR_ENTRY_SIZE = 40;
+const quint32 NO_LABEL = 0xffffffffu;
+const quint32 MAX_LABEL_BYTES = 1 << 20;     // Как в DocumentIO
+const int CONNECTOR_RECORD_SIZE = 16;        // Запись связи бинарной схемы
+const int CELL_SHAPES = 256;                 // Фигур в ячейке сетки построения (в среднем)
+const int MAX_GRID_ORDER = 10;               // Сетка не больше 1024 x 1024 ячеек
+
+const qint64 DEFAULT_MEMORY_LIMIT = qint64(256) << 20;
+const qint64 LABEL_OVERHEAD = 32; // Заголовок данных QString
+
+void setError(QString* error, const QString& text) {
+    if (error) *error = text;
+}
+
+qint64 align8(qint64 v) {
+    return (v + 7) & ~qint64(7);
+}
+
+/**
+ * @brief Объединение границ; пустые (BoundsTree::voidBounds) пропускаются.
+ */
+QRectF unite(const QRectF& a, const QRectF& b) {
+    if (BoundsTree::isVoid(a)) return b;
+    if (BoundsTree::isVoid(b)) return a;
+    return QRectF(QPointF(qMin(a.left(), b.left()), qMin(a.top(), b.top())),
+                  QPointF(qMax(a.right(), b.right()), qMax(a.bottom(), b.bottom())));
+}
+
+/**
+ * @brief Ячейка сетки side x side (side - степень двойки), d-я по кривой Гильберта.
+ *
+ * Соседние на кривой ячейки соседствуют и на плоскости, поэтому любой
+ * отрезок кривой - компактная область, а не полоса.
+ */
+int hilbertCell(int side, qint64 d) {
+    int x = 0, y = 0;
+    for (int s = 1; s < side; s *= 2) {
+        int rx = 1 & int(d / 2);
+        int ry = 1 & int(d ^ rx);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+    return y * side + x;
+}
+
+/**
+ * @brief Запись фигуры (40 байт): id, тип, порты, стиль, точки,
+ *        блоки связи, надпись (смещение в блоке надписей страницы, длина).
+ */
+void encodeRecord(const PagedShape& s, uchar* rec, quint32 labelOffset, quint32 labelBytes) {
+    qToLittleEndian<quint32>(s.id, rec);
+    rec[4] = quint8(s.type);
+    rec[5] = quint8(quint8(s.fromPort) | (quint8(s.toPort) << 4));
+    qToLittleEndian<quint16>(s.style, rec + 6);
+    qToLittleEndian<qint32>(s.p1.x(), rec + 8);
+    qToLittleEndian<qint32>(s.p1.y(), rec + 12);
+    qToLittleEndian<qint32>(s.p2.x(), rec + 16);
+    qToLittleEndian<qint32>(s.p2.y(), rec + 20);
+    qToLittleEndian<quint32>(s.from, rec + 24);
+    qToLittleEndian<quint32>(s.to, rec + 28);
+    qToLittleEndian<quint32>(labelOffset, rec + 32);
+    qToLittleEndian<quint32>(labelBytes, rec + 36);
+}
+
+/**
+ * @brief Читает запись фигуры; false - испорченный тип или порт.
+ */
+bool decodeRecord(const uchar* rec, PagedShape& s, quint32& labelOffset, quint32& labelBytes) {
+    quint8 type = rec[4];
+    quint8 fromPort = rec[5] & 0x0f;
+    quint8 toPort = rec[5] >> 4;
+    if (type > quint8(ShapeType::Diamond) || fromPort > quint8(Port::Left) || toPort > quint8(Port::Left)) {
+        return false;
+    }
+    s.id = qFromLittleEndian<quint32>(rec);
+    s.type = ShapeType(type);
+    s.fromPort = Port(fromPort);
+    s.toPort = Port(toPort);
+    s.style = qFromLittleEndian<quint16>(rec + 6);
+    s.p1 = QPoint(qFromLittleEndian<qint32>(rec + 8), qFromLittleEndian<qint32>(rec + 12));
+    s.p2 = QPoint(qFromLittleEndian<qint32>(rec + 16), qFromLittleEndian<qint32>(rec + 20));
+    s.from = qFromLittleEndian<quint32>(rec + 24);
+    s.to = qFromLittleEndian<quint32>(rec + 28);
+    labelOffset = qFromLittleEndian<quint32>(rec + 32);
+    labelBytes = qFromLittleEndian<quint32>(rec + 36);
+    return true;
+}
+
+/**
+ * @brief Память страницы с фигурами и надписями (для лимита кэша).
+ */
+qint64 labelCost(const QString& label) {
+    return label.isEmpty() ? 0 : LABEL_OVERHEAD + qint64(label.size()) * 2;
+}
+
+/**
+ * @brief Запись каталога (40 байт): целые границы (пустые - справа
+ *        от левого края), смещения записей и надписей, число записей
+ *        и байт надписей.
+ */
+void encodeEntry(const QRectF& bounds, qint64 recordOffset, qint64 labelOffset, quint32 count,
+                 quint32 labelBytes, uchar* rec) {
+    std::memset(rec, 0, DIR_ENTRY_SIZE);
+    bool none = BoundsTree::isVoid(bounds);
+    qToLittleEndian<qint32>(none ? 0 : qint32(std::floor(bounds.left())), rec);
+    qToLittleEndian<qint32>(none ? 0 : qint32(std::floor(bounds.top())), rec + 4);
+    qToLittleEndian<qint32>(none ? -1 : qint32(std::ceil(bounds.right())), rec + 8);
+    qToLittleEndian<qint32>(none ? -1 : qint32(std::ceil(bounds.bottom())), rec + 12);
+    qToLittleEndian<quint64>(quint64(recordOffset), rec + 16);
+    qToLittleEndian<quint64>(quint64(labelOffset), rec + 24);
+    qToLittleEndian<quint32>(count, rec + 32);
+    qToLittleEndian<quint32>(labelBytes, rec + 36);
+}
+
+} // namespace
+
+//==================================================================
+// 1. Построение файла страниц
+//==================================================================
+
+/**
+ * @brief Строит файл страниц по бинарной схеме.
+ *
+ * Схема отображается в память и читается дважды. Первый проход - общие
+ * границы и число фигур в каждой ячейке мелкой сетки (в среднем
+ * CELL_SHAPES фигур на ячейку). Ячейки выстраиваются вдоль кривой
+ * Гильберта, и страница - это следующие PAGE_SHAPES фигур этого
+ * порядка: несколько соседних ячеек, компактная область даже при
+ * неравномерной схеме. Место каждой фигуры в файле известно заранее,
+ * и второй проход пишет ее сразу туда (сортировка подсчетом) в
+ * отображение файла страниц. Затем по страницам переносятся надписи.
+ * В памяти - только сетка и каталог.
+ */
+bool PagedDocument::build(const QString& schemePath, const QString& pagePath, QString* error) {
+    BSG_TRACE_SCOPE("pagedBuild", "io");
+    QFile source(schemePath);
+    if (!source.open(QIODevice::ReadOnly)) {
+        setError(error, QString("Cannot open %1: %2").arg(schemePath, source.errorString()));
+        return false;
+    }
+    DocumentIO::BinaryScheme scheme;
+    if (!DocumentIO::mapBinary(source, scheme, error)) return false;
+    auto invalid = [&](const QString& what) {
+        setError(error, QString("%1: %2").arg(schemePath, what));
+        return false;
+    };
+
+    // Стили - через таблицу, как при загрузке: в файле страниц индекс
+    // фигуры сразу указывает в таблицу, которую восстановит open()
+    StyleTable table;
+    std::vector<StyleIndex> remap(scheme.styles.size());
+    for (size_t i = 0; i < remap.size(); ++i) remap[i] = table.intern(scheme.styles[i]);
+
+    // 1. Границы схемы по центрам фигур и заполнение сетки
+    const qint64 n = scheme.shapeCount;
+    QRectF centers = BoundsTree::voidBounds();
+    for (qint64 i = 0; i < n; ++i) {
+        if (quint8(scheme.typeAt(i)) > quint8(ShapeType::Diamond)) return invalid("unknown shape type");
+        QPointF c = QRectF(QPointF(scheme.p1At(i)), QPointF(scheme.p2At(i))).center();
+        centers = unite(centers, QRectF(c, c));
+    }
+    int order = 0;
+    while (order < MAX_GRID_ORDER && (qint64(CELL_SHAPES) << (2 * order)) < n) ++order;
+    const int grid = 1 << order;
+    qreal cellW = qMax<qreal>(1, centers.width() / grid);
+    qreal cellH = qMax<qreal>(1, centers.height() / grid);
+    auto cellOf = [&](qint64 i) {
+        QPointF c = QRectF(QPointF(scheme.p1At(i)), QPointF(scheme.p2At(i))).center();
+        int cx = qBound(0, int((c.x() - centers.left()) / cellW), grid - 1);
+        int cy = qBound(0, int((c.y() - centers.top()) / cellH), grid - 1);
+        return cy * grid + cx;
+    };
+    std::vector<quint32> cellCount(size_t(grid) * grid, 0);
+    for (qint64 i = 0; i < n; ++i) cellCount[cellOf(i)]++;
+
+    // Порядок фигур: ячейки вдоль кривой Гильберта, в ячейке - по слотам;
+    // cellNext - место следующей фигуры ячейки в этом порядке
+    std::vector<qint64> cellNext(cellCount.size());
+    qint64 position = 0;
+    for (qint64 d = 0; d < qint64(cellCount.size()); ++d) {
+        int cell = hilbertCell(grid, d);
+        cellNext[cell] = position;
+        position += cellCount[cell];
+    }
+    std::vector<quint32>().swap(cellCount);
+
+    // Страницы - подряд по PAGE_SHAPES фигур этого порядка
+    struct BuildPage {
+        QRectF bounds = BoundsTree::voidBounds();
+        qint64 recordOffset = 0;
+        qint64 labelOffset = 0;
+        quint32 count = 0;
+        quint32 labelBytes = 0;
+    };
+    std::vector<BuildPage> built;
+    qint64 offset = PAGE_HEADER_SIZE;
+    for (qint64 done = 0; done < n; done += PAGE_SHAPES) {
+        BuildPage page;
+        page.count = quint32(qMin<qint64>(PAGE_SHAPES, n - done));
+        page.recordOffset = offset;
+        offset += qint64(page.count) * RECORD_SIZE;
+        built.push_back(page);
+    }
+    const qint64 recordsEnd = align8(offset);
+
+    QString tempPath = pagePath + ".tmp";
+    QFile out(tempPath);
+    if (!out.open(QIODevice::ReadWrite | QIODevice::Truncate) || !out.resize(recordsEnd)) {
+        setError(error, QString("Cannot write %1: %2").arg(tempPath, out.errorString()));
+        return false;
+    }
+    auto outFail = [&]() {
+        setError(error, QString("Cannot write %1: %2").arg(tempPath, out.errorString()));
+        out.close();
+        QFile::remove(tempPath);
+        return false;
+    };
+    uchar* records = out.map(0, recordsEnd);
+    if (!records) return outFail();
+
+    // 2. Фигуры - сразу на свои места. Связи и надписи в схеме идут по
+    // слотам, их читаем попутно; смещение надписи в схеме временно
+    // лежит в полях надписи записи
+    quint32 connector = 0;
+    quint32 labelIndex = 0;
+    const uchar* label = scheme.labels;
+    qint64 labelSlot = -1;
+    auto readLabelSlot = [&]() {
+        labelSlot = (labelIndex < scheme.labelCount && label + 8 <= scheme.end)
+                        ? qint64(qFromLittleEndian<quint32>(label)) : -1;
+    };
+    readLabelSlot();
+    for (qint64 slot = 0; slot < n; ++slot) {
+        qint64 at = cellNext[cellOf(slot)]++;
+        int page = int(at / PAGE_SHAPES);
+        uchar* rec = records + built[page].recordOffset + (at % PAGE_SHAPES) * RECORD_SIZE;
+
+        PagedShape s;
+        s.id = quint32(slot);
+        s.type = scheme.typeAt(slot);
+        StyleIndex st = scheme.styleAt(slot);
+        s.style = st < remap.size() ? remap[st] : 0;
+        s.p1 = scheme.p1At(slot);
+        s.p2 = scheme.p2At(slot);
+        while (connector < scheme.connectorCount &&
+               qFromLittleEndian<quint32>(scheme.connectors + qint64(connector) * CONNECTOR_RECORD_SIZE) < slot) {
+            connector++;
+        }
+        if (connector < scheme.connectorCount && s.type == ShapeType::Connector) {
+            const uchar* link = scheme.connectors + qint64(connector) * CONNECTOR_RECORD_SIZE;
+            if (qFromLittleEndian<quint32>(link) == slot) {
+                if (link[12] > quint8(Port::Left) || link[13] > quint8(Port::Left)) {
+                    out.close();
+                    QFile::remove(tempPath);
+                    return invalid("invalid port");
+                }
+                qint32 from = qFromLittleEndian<qint32>(link + 4);
+                qint32 to = qFromLittleEndian<qint32>(link + 8);
+                s.from = from >= 0 && from < n ? quint32(from) : PagedShape::NoLink;
+                s.to = to >= 0 && to < n ? quint32(to) : PagedShape::NoLink;
+                s.fromPort = Port(link[12]);
+                s.toPort = Port(link[13]);
+            }
+        }
+        encodeRecord(s, rec, 0, 0);
+        while (labelSlot >= 0 && labelSlot < slot) { // Надписи без фигуры пропускаем
+            quint32 bytes = qFromLittleEndian<quint32>(label + 4);
+            label += 8 + ((bytes + 3) & ~quint32(3));
+            labelIndex++;
+            readLabelSlot();
+        }
+        if (labelSlot == slot) qToLittleEndian<quint64>(quint64(label - scheme.types) + 1, rec + 32);
+
+        BuildPage& bp = built[page];
+        bp.bounds = unite(bp.bounds, s.bounds());
+    }
+
+    // 3. Надписи - блоком за записями каждой страницы, в конце файла
+    qint64 end = recordsEnd;
+    for (BuildPage& bp : built) {
+        QByteArray blob;
+        for (quint32 i = 0; i < bp.count; ++i) {
+            uchar* rec = records + bp.recordOffset + qint64(i) * RECORD_SIZE;
+            quint64 at = qFromLittleEndian<quint64>(rec + 32);
+            quint32 offsetInBlob = NO_LABEL;
+            quint32 bytes = 0;
+            if (at > 0) {
+                const uchar* src = scheme.types + (at - 1);
+                bytes = qFromLittleEndian<quint32>(src + 4);
+                if (bytes > MAX_LABEL_BYTES || src + 8 + bytes > scheme.end) {
+                    out.close();
+                    QFile::remove(tempPath);
+                    return invalid("invalid label");
+                }
+                offsetInBlob = quint32(blob.size());
+                blob.append(reinterpret_cast<const char*>(src + 8), bytes);
+            }
+            qToLittleEndian<quint32>(offsetInBlob, rec + 32);
+            qToLittleEndian<quint32>(bytes, rec + 36);
+        }
+        bp.labelOffset = end;
+        bp.labelBytes = quint32(blob.size());
+        if (!blob.isEmpty()) {
+            blob.append(QByteArray(int(align8(blob.size()) - blob.size()), '\0'));
+            if (!out.seek(end) || out.write(blob) != blob.size()) return outFail();
+            end += blob.size();
+        }
+    }
+    out.unmap(records);
+
+    // Каталог: стили, затем записи страниц; заголовок - последним
+    QByteArray dir(int(align8(qint64(table.size()) * DocumentIO::STYLE_RECORD_BYTES) +
+                       qint64(built.size()) * DIR_ENTRY_SIZE), '\0');
+    uchar* d = reinterpret_cast<uchar*>(dir.data());
+    for (int i = 0; i < table.size(); ++i) {
+        DocumentIO::writeStyleRecord(table.getStyle(StyleIndex(i)), d + i * DocumentIO::STYLE_RECORD_BYTES);
+    }
+    uchar* entry = d + align8(qint64(table.size()) * DocumentIO::STYLE_RECORD_BYTES);
+    for (const BuildPage& bp : built) {
+        encodeEntry(bp.bounds, bp.recordOffset, bp.labelOffset, bp.count, bp.labelBytes, entry);
+        entry += DIR_ENTRY_SIZE;
+    }
+    uchar header[PAGE_HEADER_SIZE] = {};
+    std::memcpy(header, PAGE_MAGIC, 4);
+    qToLittleEndian<quint32>(PAGE_VERSION, header + 4);
+    qToLittleEndian<quint32>(PAGE_HEADER_SIZE, header + 8);
+    qToLittleEndian<quint32>(quint32(table.size()), header + 12);
+    qToLittleEndian<quint32>(quint32(built.size()), header + 16);
+    qToLittleEndian<quint64>(quint64(end), header + 24);    // Каталог
+    qToLittleEndian<quint64>(quint64(n), header + 32);      // Фигур
+    bool ok = out.seek(end) && out.write(dir) == dir.size() && out.seek(0) &&
+              out.write(reinterpret_cast<const char*>(header), PAGE_HEADER_SIZE) == PAGE_HEADER_SIZE &&
+              out.flush();
+    if (!ok) return outFail();
+    out.close();
+
+    QFile::remove(pagePath);
+    if (!QFile::rename(tempPath, pagePath)) {
+        QFile::remove(tempPath);
+        setError(error, QString("Cannot write %1").arg(pagePath));
+        return false;
+    }
+    return true;
+}
+
+//==================================================================
+// 2. Открытие и закрытие
+//==================================================================
+
+/**
+ * @brief Конструктор. Лимит памяти - BSG_PAGE_MEMORY_MB или 256 МБ.
+ */
+PagedDocument::PagedDocument() {
+    int mb = qEnvironmentVariableIntValue("BSG_PAGE_MEMORY_MB");
+    memoryLimit = mb > 0 ? qint64(mb) << 20 : DEFAULT_MEMORY_LIMIT;
+}
+
+PagedDocument::~PagedDocument() {
+    close();
+}
+
+/**
+ * @brief Открывает файл страниц: в память читаются только стили и каталог.
+ */
+bool PagedDocument::open(const QString& pagePath, QString* error) {
+    close();
+    lastError.clear();
+    auto done = [&](bool ok) {
+        if (!ok) {
+            setError(error, lastError);
+            file.close();
+            pages.clear();
+        }
+        return ok;
+    };
+
+    file.setFileName(pagePath);
+    if (!file.open(QIODevice::ReadOnly)) return done(fail(file.errorString()));
+    uchar header[PAGE_HEADER_SIZE];
+    if (file.read(reinterpret_cast<char*>(header), PAGE_HEADER_SIZE) != PAGE_HEADER_SIZE ||
+        std::memcmp(header, PAGE_MAGIC, 4) != 0) {
+        return done(fail("not a page file"));
+    }
+    quint32 version = qFromLittleEndian<quint32>(header + 4);
+    if (version == 0 || version > PAGE_VERSION) return done(fail(QString("unsupported page file version %1").arg(version)));
+    quint32 styleCount = qFromLittleEndian<quint32>(header + 12);
+    quint32 pageCount = qFromLittleEndian<quint32>(header + 16);
+    qint64 dirOffset = qint64(qFromLittleEndian<quint64>(header + 24));
+    qint64 size = file.size();
+    qint64 stylesBytes = align8(qint64(styleCount) * DocumentIO::STYLE_RECORD_BYTES);
+    if (styleCount == 0 || styleCount > 65536 || dirOffset < PAGE_HEADER_SIZE ||
+        dirOffset + stylesBytes + qint64(pageCount) * DIR_ENTRY_SIZE > size) {
+        return done(fail("corrupted header"));
+    }
+
+    QByteArray dir(int(stylesBytes + qint64(pageCount) * DIR_ENTRY_SIZE), '\0');
+    if (!file.seek(dirOffset) || file.read(dir.data(), dir.size()) != dir.size()) {
+        return done(fail("file is truncated"));
+    }
+    const uchar* d = reinterpret_cast<const uchar*>(dir.constData());
+    styles.clear();
+    for (quint32 i = 0; i < styleCount; ++i) {
+        ShapeStyle st = DocumentIO::readStyleRecord(d + qint64(i) * DocumentIO::STYLE_RECORD_BYTES);
+        if (styles.intern(st) != StyleIndex(i)) return done(fail("corrupted style table"));
+    }
+
+    pages.clear();
+    pages.resize(pageCount);
+    shapeCount = 0;
+    std::vector<QRectF> bounds(pageCount);
+    for (quint32 p = 0; p < pageCount; ++p) {
+        const uchar* e = d + stylesBytes + qint64(p) * DIR_ENTRY_SIZE;
+        PageInfo& info = pages[p];
+        qint32 l = qFromLittleEndian<qint32>(e), t = qFromLittleEndian<qint32>(e + 4);
+        qint32 r = qFromLittleEndian<qint32>(e + 8), b = qFromLittleEndian<qint32>(e + 12);
+        info.bounds = r < l ? BoundsTree::voidBounds() : QRectF(QPointF(l, t), QPointF(r, b));
+        info.recordOffset = qint64(qFromLittleEndian<quint64>(e + 16));
+        info.labelOffset = qint64(qFromLittleEndian<quint64>(e + 24));
+        info.count = qFromLittleEndian<quint32>(e + 32);
+        info.labelBytes = qFromLittleEndian<quint32>(e + 36);
+        if (info.count > quint32(PAGE_SHAPES) || info.recordOffset < PAGE_HEADER_SIZE ||
+            info.recordOffset + qint64(info.count) * RECORD_SIZE > size ||
+            info.labelOffset + qint64(info.labelBytes) > size) {
+            return done(fail("corrupted page directory"));
+        }
+        bounds[p] = info.bounds;
+        shapeCount += info.count;
+    }
+    pageTree.build(bounds);
+    cacheBytes = 0;
+    residentCount = 0;
+    lruNewest = lruOldest = -1;
+    loadCount = 0;
+    return done(true);
+}
+
+/**
+ * @brief Освобождает кэш и файл.
+ */
+void PagedDocument::close() {
+    pages.clear();
+    pageTree.clear();
+    cacheBytes = 0;
+    residentCount = 0;
+    lruNewest = lruOldest = -1;
+    file.close();
+}
+
+//==================================================================
+// 3. Память и доступ
+//==================================================================
+
+/**
+ * @brief Лимит рабочей памяти: кэш страниц плюс каталог.
+ */
+void PagedDocument::setMemoryLimit(qint64 bytes) {
+    memoryLimit = qMax<qint64>(0, bytes);
+    trimCache(-1);
+}
+
+/**
+ * @brief Память каталога: записи страниц и дерево их границ.
+ */
+qint64 PagedDocument::directoryBytes() const {
+    return qint64(pages.capacity()) * qint64(sizeof(PageInfo) + 2 * sizeof(QRectF) + 3 * sizeof(int));
+}
+
+/**
+ * @brief Границы всех фигур.
+ */
+QRectF PagedDocument::getExtent() const {
+    return pageTree.isEmpty() ? QRectF() : pageTree.getBounds();
+}
+
+//==================================================================
+// 4. Private-функции
+//==================================================================
+
+/**
+ * @brief Запоминает ошибку; всегда false.
+ */
+bool PagedDocument::fail(const QString& what) {
+    lastError = QString("%1: %2").arg(file.fileName(), what);
+    return false;
+}
+
+/**
+ * @brief Страница в памяти: читает ее при необходимости и делает самой свежей.
+ */
+PagedDocument::Page* PagedDocument::acquire(int p) {
+    PageInfo& info = pages[p];
+    if (info.page) {
+        if (lruNewest != p) {
+            unlinkLru(p);
+            pushLru(p);
+        }
+        return info.page.get();
+    }
+    if (!loadPage(p)) return nullptr;
+    pushLru(p);
+    trimCache(p);
+    return pages[p].page.get();
+}
+
+/**
+ * @brief Читает страницу: записи одним чтением, надписи - вторым.
+ */
+bool PagedDocument::loadPage(int p) {
+    BSG_TRACE_SCOPE("pageLoad", "io");
+    PageInfo& info = pages[p];
+    qint64 bytes = qint64(info.count) * RECORD_SIZE;
+    ioBuffer.resize(size_t(bytes));
+    labelBuffer.resize(int(info.labelBytes));
+    if (!file.seek(info.recordOffset) ||
+        file.read(reinterpret_cast<char*>(ioBuffer.data()), bytes) != bytes ||
+        (info.labelBytes > 0 &&
+         (!file.seek(info.labelOffset) || file.read(labelBuffer.data(), info.labelBytes) != info.labelBytes))) {
+        return fail(QString("cannot read page %1").arg(p));
+    }
+
+    auto page = std::make_unique<Page>();
+    page->shapes.resize(info.count);
+    qint64 cost = qint64(info.count) * qint64(sizeof(PagedShape));
+    for (quint32 i = 0; i < info.count; ++i) {
+        PagedShape& s = page->shapes[i];
+        quint32 labelOffset, labelBytes;
+        if (!decodeRecord(ioBuffer.data() + qint64(i) * RECORD_SIZE, s, labelOffset, labelBytes)) {
+            return fail(QString("corrupted page %1").arg(p));
+        }
+        if (labelOffset != NO_LABEL) {
+            if (qint64(labelOffset) + labelBytes > info.labelBytes) return fail(QString("corrupted page %1").arg(p));
+            s.label = QString::fromUtf8(labelBuffer.constData() + labelOffset, int(labelBytes));
+            cost += labelCost(s.label);
+        }
+    }
+    page->bytes = cost;
+    info.page = std::move(page);
+    cacheBytes += cost;
+    residentCount++;
+    loadCount++;
+    return true;
+}
+
+/**
+ * @brief Вытесняет страницу из кэша.
+ */
+void PagedDocument::evict(int p) {
+    PageInfo& info = pages[p];
+    unlinkLru(p);
+    cacheBytes -= info.page->bytes;
+    residentCount--;
+    info.page.reset();
+}
+
+/**
+ * @brief Вытесняет самые старые страницы, пока кэш не уложится в лимит.
+ *
+ * Страница keep (только что прочитанная) не трогается.
+ */
+void PagedDocument::trimCache(int keep) {
+    qint64 budget = memoryLimit - directoryBytes();
+    int p = lruOldest;
+    while (cacheBytes > budget && p >= 0) {
+        int next = pages[p].newer;
+        if (p != keep) evict(p);
+        p = next;
+    }
+}
+
+void PagedDocument::unlinkLru(int p) {
+    PageInfo& info = pages[p];
+    if (info.newer >= 0) pages[info.newer].older = info.older;
+    else lruNewest = info.older;
+    if (info.older >= 0) pages[info.older].newer = info.newer;
+    else lruOldest = info.newer;
+    info.newer = info.older = -1;
+}
+
+void PagedDocument::pushLru(int p) {
+    PageInfo& info = pages[p];
+    info.older = lruNewest;
+    info.newer = -1;
+    if (lruNewest >= 0) pages[lruNewest].newer = p;
+    lruNewest = p;
+    if (lruOldest < 0) lruOldest = p;
+}
@@ -0,0 +1,131 @@
+#include "renderthread.h"
+#include "tracer.h"
+#include <QMutexLocker>
+#include <utility>
+
+//==================================================================
+// 1. Public-функции
+//==================================================================
+
+/**
+ * @brief Конструктор. Поток запускается при первом запросе кадра.
+ */
+RenderThread::RenderThread(QObject* parent) : QThread(parent) {
+    selectionPen = QPen(Qt::blue, 1, Qt::DashLine);
+    selectionPen.setCosmetic(true);
+    handleBrush = QBrush(Qt::blue);
+}
+
+/**
+ * @brief Деструктор. Останавливает поток и дожидается его завершения.
+ */
+RenderThread::~RenderThread() {
+    {
+        QMutexLocker lock(&mutex);
+        abort = true;
+        wake.wakeOne();
+    }
+    wait();
+}
+
+/**
+ * @brief Ставит кадр в очередь, заменяя еще не начатый запрос.
+ *
+ * Содержимое снимков обменивается, так что вызывающий получает назад
+ * буферы старого запроса и может заполнять их без новых выделений памяти.
+ */
+void RenderThread::render(FrameSnapshot& snapshot) {
+    QMutexLocker lock(&mutex);
+    std::swap(request, snapshot);
+    hasRequest = true;
+
+    if (!isRunning()) {
+        start(QThread::LowPriority);
+    } else {
+        wake.wakeOne();
+    }
+}
+
+/**
+ * @brief Рисует последний готовый кадр в текущем виде.
+ *
+ * Если вид с тех пор изменился (панорамирование, масштаб), кадр
+ * сдвигается и масштабируется - до прихода нового кадра.
+ */
+bool RenderThread::drawFrame(QPainter* p, const QTransform& view) {
+    QMutexLocker lock(&mutex);
+    if (front.isNull()) return false;
+
+    p->save();
+    p->setTransform(frontView.inverted() * view); // Старый виджет -> мир -> новый виджет
+    p->drawImage(QPointF(0, 0), front);
+    p->restore();
+    return true;
+}
+
+//==================================================================
+// 2. Protected-функции
+//==================================================================
+
+/**
+ * @brief Цикл потока: ждет запрос, рисует его, меняет буферы местами.
+ */
+void RenderThread::run() {
+    while (true) {
+        {
+            QMutexLocker lock(&mutex);
+            while (!hasRequest && !abort) {
+                wake.wait(&mutex);
+            }
+            if (abort) return;
+            std::swap(work, request);
+            hasRequest = false;
+        }
+
+        paintFrame(work);
+
+        {
+            QMutexLocker lock(&mutex);
+            std::swap(front, back);
+            frontView = work.view;
+        }
+        emit frameReady();
+    }
+}
+
+//==================================================================
+// 3. Private-функции
+//==================================================================
+
+/**
+ * @brief Рисует снимок в задний буфер.
+ */
+void RenderThread::paintFrame(const FrameSnapshot& frame) {
+    BSG_TRACE_SCOPE("renderFrame", "render");
+    QSize devSize = (QSizeF(frame.size) * frame.dpr).toSize();
+    if (back.size() != devSize) {
+        back = QImage(devSize, QImage::Format_ARGB32_Premultiplied);
+    }
+    back.setDevicePixelRatio(frame.dpr);
+    back.fill(Qt::transparent);
+    if (back.isNull()) return;
+
+    QPainter p(&back);
+    p.setRenderHint(QPainter::Antialiasing);
+    p.setTransform(frame.view);
+
+    renderer.setDetailLimits(frame.splatSize, frame.boxSize, frame.textSize);
+    renderer.drawShapes(&p, frame.styles, frame.shapes);
+
+    // Рамки и ручки выделения - постоянного экранного размера
+    if (!frame.selectionFrames.empty()) {
+        p.setPen(selectionPen);
+        p.setBrush(Qt::NoBrush);
+        p.drawRects(frame.selectionFrames.data(), (int)frame.selectionFrames.size());
+    }
+    if (!frame.selectionHandles.empty()) {
+        p.setPen(Qt::NoPen);
+        p.setBrush(handleBrush);
+        p.drawRects(frame.selectionHandles.data(), (int)frame.selectionHandles.size());
+    }
+}
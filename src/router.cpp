@@ -0,0 +1,412 @@
+#include "router.h"
+#include "geometry.h"
+#include "tracer.h"
+#include <QMutexLocker>
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <iterator>
+
+const int MAX_NODES = 160000;     // Больше узлов - решетка вдвое крупнее
+const int MAX_COARSEN = 6;        // Сколько раз можно укрупнить решетку
+const int AREA_MARGIN_CELLS = 8;  // Запас области поиска вокруг портов (в клетках)
+const int BEND_CELLS = 2;         // Цена излома (в клетках)
+const size_t RESULTS_BATCH = 32;  // Столько готовых маршрутов - и отдаем владельцу
+
+// Флаги узла решетки
+const quint8 NODE_CLOSED = 1;     // Узел внутри препятствия
+const quint8 RIGHT_CLOSED = 2;    // Ребро к соседу справа проходит через препятствие
+const quint8 DOWN_CLOSED = 4;     // Ребро к соседу снизу проходит через препятствие
+
+/**
+ * @brief Деление с округлением вниз (и для отрицательных).
+ */
+static int floorDiv(int v, int d) {
+    return v >= 0 ? v / d : -((-v + d - 1) / d);
+}
+
+/**
+ * @brief Направление шага: 0 - вправо, 1 - вниз, 2 - влево, 3 - вверх.
+ */
+static int directionOf(const QPoint& d) {
+    if (d.x() > 0) return 0;
+    if (d.y() > 0) return 1;
+    if (d.x() < 0) return 2;
+    return 3;
+}
+
+namespace Routing {
+
+//==================================================================
+// 1. Задания
+//==================================================================
+
+/**
+ * @brief Задание для связи: область поиска вокруг портов и блоки в ней.
+ */
+RouteJob makeJob(const Document& doc, ShapeId id, int gridSize) {
+    RouteJob job;
+    int slot = doc.slotOf(id);
+    if (slot < 0 || doc.typeAt(slot) != ShapeType::Connector) return job;
+
+    const ConnectorLink& link = doc.getLink(id);
+    job.id = id;
+    job.start = doc.p1At(slot);
+    job.end = doc.p2At(slot);
+    job.startPort = link.fromPort;
+    job.endPort = link.toPort;
+    job.gridSize = qMax(1, gridSize);
+
+    int margin = AREA_MARGIN_CELLS * job.gridSize;
+    job.area = QRect(job.start, job.end).normalized().adjusted(-margin, -margin, margin, margin);
+    doc.query(QRectF(job.area), [&](ShapeId other) {
+        int s = doc.slotOf(other);
+        if (isBlock(doc.typeAt(s))) job.obstacles.push_back(doc.boundsAt(s).toRect());
+    });
+    return job;
+}
+
+/**
+ * @brief Прокладывает маршруты всех связей документа в текущем потоке.
+ */
+void routeAll(Document& doc, int gridSize) {
+    std::vector<ShapeId> ids;
+    for (int slot = 0; slot < doc.size(); ++slot) {
+        if (doc.typeAt(slot) == ShapeType::Connector) ids.push_back(doc.idAt(slot));
+    }
+
+    OrthogonalRouter router;
+    std::vector<QPoint> route;
+    for (ShapeId id : ids) {
+        router.route(makeJob(doc, id, gridSize), route);
+        doc.setRoute(id, route);
+    }
+}
+
+}
+
+//==================================================================
+// 2. OrthogonalRouter
+//==================================================================
+
+/**
+ * @brief Ищет ортогональный маршрут в обход препятствий (A*).
+ *
+ * Состояние поиска - узел решетки и направление, в котором в него
+ * пришли, поэтому цена излома учитывается точно. Поиск идет от выхода
+ * из начального порта (отступ на clearance наружу) до выхода из
+ * конечного; последний излом - в сторону порта - тоже оплачивается.
+ * Эвристика - манхэттенское расстояние плюс излом, если узел не на одной
+ * прямой с целью; она не завышает цену, и первый найденный маршрут,
+ * дешевле которого ничего не осталось, - лучший.
+ */
+bool OrthogonalRouter::route(const RouteJob& job, std::vector<QPoint>& route) {
+    BSG_TRACE_SCOPE("routeConnector", "route");
+    const int g = qMax(1, job.gridSize);
+    clearance = qMax(1, g / 2);
+    const QPoint sDir = Geometry::portDirection(job.startPort);
+    const QPoint eDir = Geometry::portDirection(job.endPort);
+    const QPoint s = job.start + sDir * clearance;
+    const QPoint e = job.end + eDir * clearance;
+
+    bool built = false;
+    int step = g;
+    for (int k = 0; k <= MAX_COARSEN && !built; ++k, step *= 2) {
+        built = buildLattice(job, step, s, e);
+    }
+    if (!built) {
+        Geometry::elbowRoute(job.start, job.startPort, job.end, job.endPort, clearance, route);
+        return false;
+    }
+
+    const int nx = (int)xs.size();
+    const int n = nx * (int)ys.size();
+    const int sNode = nodeAt(s.x(), s.y());
+    const int eNode = nodeAt(e.x(), e.y());
+    flags[sNode] &= ~NODE_CLOSED; // Выходы портов лежат на границе своего блока
+    flags[eNode] &= ~NODE_CLOSED;
+
+    cost.assign(size_t(n) * 4, INT_MAX);
+    parent.assign(size_t(n) * 4, -1);
+    heap.clear();
+    const int bend = BEND_CELLS * g;
+    const int goalDir = directionOf(-eDir); // Последний шаг - внутрь конечного порта
+    auto estimate = [&](int state) {
+        int node = state / 4;
+        int dx = e.x() - xs[node % nx], dy = e.y() - ys[node / nx];
+        // Не на одной прямой с целью - впереди хотя бы один излом
+        return qAbs(dx) + qAbs(dy) + (dx != 0 && dy != 0 ? bend : 0);
+    };
+    auto push = [&](int f, int state) {
+        heap.emplace_back(f, state);
+        std::push_heap(heap.begin(), heap.end(), std::greater<>());
+    };
+
+    int startState = sNode * 4 + directionOf(sDir);
+    cost[startState] = 0;
+    push(estimate(startState), startState);
+
+    int best = INT_MAX;
+    int bestState = -1;
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), std::greater<>());
+        auto [f, state] = heap.back();
+        heap.pop_back();
+        if (f >= best) break;
+        const int node = state / 4;
+        const int d = state % 4;
+        const int here = cost[state];
+        if (f != here + estimate(state)) continue; // Устаревшая запись кучи
+
+        if (node == eNode) {
+            int turn = d == goalDir ? 0 : (d == (goalDir + 2) % 4 ? 2 * bend : bend);
+            if (here + turn < best) {
+                best = here + turn;
+                bestState = state;
+            }
+            continue;
+        }
+
+        const int i = node % nx;
+        const int j = node / nx;
+        for (int nd = 0; nd < 4; ++nd) {
+            if (nd == (d + 2) % 4) continue; // Разворот на месте
+            int next = -1, len = 0;
+            switch (nd) {
+            case 0:
+                if (i + 1 < nx && !(flags[node] & RIGHT_CLOSED)) { next = node + 1; len = xs[i + 1] - xs[i]; }
+                break;
+            case 1:
+                if (j + 1 < (int)ys.size() && !(flags[node] & DOWN_CLOSED)) { next = node + nx; len = ys[j + 1] - ys[j]; }
+                break;
+            case 2:
+                if (i > 0 && !(flags[node - 1] & RIGHT_CLOSED)) { next = node - 1; len = xs[i] - xs[i - 1]; }
+                break;
+            case 3:
+                if (j > 0 && !(flags[node - nx] & DOWN_CLOSED)) { next = node - nx; len = ys[j] - ys[j - 1]; }
+                break;
+            }
+            if (next < 0 || (flags[next] & NODE_CLOSED)) continue;
+
+            int c = here + len + (nd != d ? bend : 0);
+            int nextState = next * 4 + nd;
+            if (c < cost[nextState]) {
+                cost[nextState] = c;
+                parent[nextState] = state;
+                push(c + estimate(nextState), nextState);
+            }
+        }
+    }
+
+    if (bestState < 0) {
+        Geometry::elbowRoute(job.start, job.startPort, job.end, job.endPort, clearance, route);
+        return false;
+    }
+
+    // Путь восстанавливается с конца
+    route.clear();
+    route.push_back(job.end);
+    for (int state = bestState; state >= 0; state = parent[state]) {
+        int node = state / 4;
+        route.emplace_back(xs[node % nx], ys[node / nx]);
+    }
+    route.push_back(job.start);
+    std::reverse(route.begin(), route.end());
+    Geometry::simplifyRoute(route);
+    return true;
+}
+
+/**
+ * @brief Строит решетку с шагом step; false, если узлов больше MAX_NODES.
+ *
+ * Линии решетки - линии сетки внутри области плюс края всех препятствий
+ * (с отступом) и выходы портов. Поскольку края препятствий - тоже линии,
+ * ребро решетки целиком лежит либо внутри препятствия, либо снаружи.
+ */
+bool OrthogonalRouter::buildLattice(const RouteJob& job, int step, const QPoint& s, const QPoint& e) {
+    QRect area = job.area.united(QRect(s, e).normalized());
+    int left = area.x(), right = area.x() + area.width();
+    int top = area.y(), bottom = area.y() + area.height();
+    if (qint64(right - left) / step * (qint64(bottom - top) / step) > MAX_NODES) return false;
+
+    xs.clear();
+    ys.clear();
+    for (int x = floorDiv(left, step) * step; x <= right; x += step) xs.push_back(x);
+    for (int y = floorDiv(top, step) * step; y <= bottom; y += step) ys.push_back(y);
+    xs.push_back(s.x());
+    xs.push_back(e.x());
+    ys.push_back(s.y());
+    ys.push_back(e.y());
+    for (const QRect& r : job.obstacles) {
+        int l = r.x() - clearance, rr = r.x() + r.width() + clearance;
+        int t = r.y() - clearance, b = r.y() + r.height() + clearance;
+        if (l >= left) xs.push_back(l);
+        if (rr <= right) xs.push_back(rr);
+        if (t >= top) ys.push_back(t);
+        if (b <= bottom) ys.push_back(b);
+    }
+    std::sort(xs.begin(), xs.end());
+    xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
+    std::sort(ys.begin(), ys.end());
+    ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+    if (qint64(xs.size()) * qint64(ys.size()) > MAX_NODES) return false;
+
+    flags.assign(xs.size() * ys.size(), 0);
+    for (const QRect& r : job.obstacles) {
+        closeObstacle(r);
+    }
+    return true;
+}
+
+/**
+ * @brief Закрывает узлы и ребра внутри препятствия (с отступом).
+ *
+ * Граница препятствия остается открытой - вдоль нее маршрут может идти.
+ */
+void OrthogonalRouter::closeObstacle(const QRect& r) {
+    int l = r.x() - clearance, rr = r.x() + r.width() + clearance;
+    int t = r.y() - clearance, b = r.y() + r.height() + clearance;
+    const int nx = (int)xs.size();
+    const int ny = (int)ys.size();
+
+    // Линии строго внутри: (l, rr) и (t, b)
+    int i0 = int(std::upper_bound(xs.begin(), xs.end(), l) - xs.begin());
+    int i1 = int(std::lower_bound(xs.begin(), xs.end(), rr) - xs.begin());
+    int j0 = int(std::upper_bound(ys.begin(), ys.end(), t) - ys.begin());
+    int j1 = int(std::lower_bound(ys.begin(), ys.end(), b) - ys.begin());
+
+    // Горизонтальные ребра на строках внутри, задевающие (l, rr)
+    for (int j = j0; j < j1; ++j) {
+        for (int i = qMax(i0 - 1, 0); i < qMin(i1, nx - 1); ++i) {
+            flags[j * nx + i] |= RIGHT_CLOSED;
+        }
+    }
+    // Вертикальные ребра на столбцах внутри, задевающие (t, b)
+    for (int j = qMax(j0 - 1, 0); j < qMin(j1, ny - 1); ++j) {
+        for (int i = i0; i < i1; ++i) {
+            flags[j * nx + i] |= DOWN_CLOSED;
+        }
+    }
+    for (int j = j0; j < j1; ++j) {
+        for (int i = i0; i < i1; ++i) {
+            flags[j * nx + i] |= NODE_CLOSED;
+        }
+    }
+}
+
+/**
+ * @brief Узел решетки в точке (x, y) - точка обязана быть на решетке.
+ */
+int OrthogonalRouter::nodeAt(int x, int y) const {
+    int i = int(std::lower_bound(xs.begin(), xs.end(), x) - xs.begin());
+    int j = int(std::lower_bound(ys.begin(), ys.end(), y) - ys.begin());
+    return j * (int)xs.size() + i;
+}
+
+//==================================================================
+// 3. ConnectorRouter
+//==================================================================
+
+/**
+ * @brief Конструктор. Поток запускается при первом задании.
+ */
+ConnectorRouter::ConnectorRouter(QObject* parent) : QThread(parent) {
+}
+
+/**
+ * @brief Деструктор. Останавливает поток и дожидается его завершения.
+ */
+ConnectorRouter::~ConnectorRouter() {
+    {
+        QMutexLocker lock(&mutex);
+        abort = true;
+        wake.wakeOne();
+    }
+    wait();
+}
+
+/**
+ * @brief Ставит задания в очередь.
+ *
+ * Задание для связи, которое еще ждет своей очереди, заменяется новым -
+ * старые положения блоков прокладывать уже незачем.
+ */
+void ConnectorRouter::submit(std::vector<RouteJob>& jobs) {
+    if (jobs.empty()) return;
+    QMutexLocker lock(&mutex);
+    for (RouteJob& job : jobs) {
+        auto it = queued.find(job.id);
+        if (it != queued.end()) {
+            queue[it->second] = std::move(job);
+        } else {
+            queued.emplace(job.id, queue.size());
+            queue.push_back(std::move(job));
+        }
+    }
+    jobs.clear();
+
+    if (!isRunning()) {
+        start();
+    } else {
+        wake.wakeOne();
+    }
+}
+
+/**
+ * @brief Забирает готовые маршруты (дописывает их в out).
+ */
+void ConnectorRouter::takeResults(std::vector<RouteResult>& out) {
+    QMutexLocker lock(&mutex);
+    out.insert(out.end(), std::make_move_iterator(results.begin()), std::make_move_iterator(results.end()));
+    results.clear();
+}
+
+/**
+ * @brief Цикл потока: забирает очередь целиком и прокладывает маршруты.
+ *
+ * Готовые маршруты отдаются порциями, чтобы при большой очереди
+ * (загрузка схемы) связи появлялись постепенно. Задание, для которого
+ * уже пришло более новое, пропускается.
+ */
+void ConnectorRouter::run() {
+    std::vector<RouteResult> finished;
+    while (true) {
+        {
+            QMutexLocker lock(&mutex);
+            while (queue.empty() && !abort) {
+                wake.wait(&mutex);
+            }
+            if (abort) return;
+            std::swap(work, queue);
+            queue.clear();
+            queued.clear();
+        }
+
+        for (size_t i = 0; i < work.size(); ++i) {
+            bool superseded;
+            {
+                QMutexLocker lock(&mutex);
+                if (abort) return;
+                superseded = queued.count(work[i].id) != 0;
+            }
+            if (!superseded) {
+                RouteResult result;
+                result.id = work[i].id;
+                result.serial = work[i].serial;
+                router.route(work[i], result.route);
+                finished.push_back(std::move(result));
+            }
+
+            if (!finished.empty() && (finished.size() >= RESULTS_BATCH || i + 1 == work.size())) {
+                {
+                    QMutexLocker lock(&mutex);
+                    results.insert(results.end(), std::make_move_iterator(finished.begin()),
+                                   std::make_move_iterator(finished.end()));
+                }
+                finished.clear();
+                emit routesReady();
+            }
+        }
+        work.clear();
+    }
+}
@@ -0,0 +1,380 @@
+#include "sceneexport.h"
+#include "shaperenderer.h"
+#include "pageddocument.h"
+#include "geometry.h"
+#include "imagestream.h"
+#include "tracer.h"
+#include <QSvgGenerator>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <QtMath>
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+const int MIN_TILE_SIZE = 16;
+const int CONNECTOR_STUB = 10; // Как в Document: маршрут-"локоть" связи
+const int PAGED_BAND_SHARE = 8;  // Страничный экспорт: полосам - 1/8 лимита памяти,
+const int PAGED_LIST_SHARE = 8;  // фигурам тайла - 1/8, остальное - кэшу страниц
+const qint64 PAGED_SHAPE_BYTES = sizeof(PagedShape) + 96; // Копия фигуры и ее место в ShapeList
+
+// Полоса тайлового экспорта: строки изображения [top, top + rows)
+struct Band {
+    QImage image;               // Во всю ширину изображения
+    int top = 0;
+    int rows = 0;
+    std::vector<QRect> tiles;   // В пикселях изображения
+};
+
+/**
+ * @brief Рисует один тайл прямо в его место в буфере полосы.
+ *
+ * Тайлы пишут в непересекающиеся части буфера, поэтому их можно
+ * рисовать параллельно. draw(painter, world) получает область
+ * документа тайла с запасом margin на перо и сглаживание на краю.
+ */
+template <typename Draw>
+void renderTile(uchar* bandBits, qsizetype bytesPerLine, int bandTop, const QRect& r,
+                const QRectF& area, qreal scale, const QColor& background, qreal margin, Draw&& draw) {
+    BSG_TRACE_SCOPE("exportTile", "export");
+    uchar* origin = bandBits + qsizetype(r.top() - bandTop) * bytesPerLine + qsizetype(r.left()) * 4;
+    QImage tile(origin, r.width(), r.height(), bytesPerLine, QImage::Format_ARGB32_Premultiplied);
+    tile.fill(background);
+
+    qreal m = margin + 1 / scale;
+    QRectF world(area.left() + r.left() / scale, area.top() + r.top() / scale,
+                 r.width() / scale, r.height() / scale);
+    QPainter p(&tile);
+    p.setRenderHint(QPainter::Antialiasing);
+    p.translate(-r.topLeft());
+    p.scale(scale, scale);
+    p.translate(-area.topLeft());
+    draw(p, world.adjusted(-m, -m, m, m));
+}
+
+/**
+ * @brief Тайловый экспорт области area с потоковой записью.
+ *
+ * Пока одна полоса пишется в файл, следующая уже рисуется на пуле
+ * потоков (parallel) или рисуется целиком до записи (!parallel - для
+ * источников, которые нельзя читать из нескольких потоков). Высота
+ * полосы подбирается так, чтобы в ней было не больше
+ * (число потоков x tileSize^2) пикселей, а обе полосы вместе - не
+ * больше maxBandBytes (0 - без предела; но не меньше строки).
+ * renderBandTile(bits, bytesPerLine, bandTop, tile) рисует один тайл.
+ */
+template <typename RenderTile>
+bool streamTiles(const QRectF& area, const QString& path, const ExportOptions& opt, bool parallel,
+                 qint64 maxBandBytes, RenderTile&& renderBandTile, QString* error) {
+    ImageStreamWriter::Format format;
+    if (!ImageStreamWriter::formatForPath(path, &format)) {
+        if (error) *error = QString("%1: unknown image format (expected png, tiff or raw)").arg(path);
+        return false;
+    }
+
+    qreal scale = opt.scale > 0 ? opt.scale : 1.0;
+    qreal width = qCeil(area.width() * scale);
+    qreal height = qCeil(area.height() * scale);
+    if (width > std::numeric_limits<int>::max() / 4 || height > std::numeric_limits<int>::max()) {
+        if (error) *error = QString("%1: image is too large").arg(path);
+        return false;
+    }
+    QSize size(qMax(1, int(width)), qMax(1, int(height)));
+
+    int tile = qMax(MIN_TILE_SIZE, opt.tileSize);
+    int workers = parallel ? qMax(1, QThreadPool::globalInstance()->maxThreadCount()) : 1;
+    qint64 budget = qint64(workers) * tile * tile; // Пикселей на полосу
+    int bandRows = int(qBound<qint64>(1, budget / size.width(), size.height()));
+    if (bandRows > tile) bandRows -= bandRows % tile; // Целое число рядов тайлов
+    if (maxBandBytes > 0) {
+        bandRows = int(qBound<qint64>(1, maxBandBytes / (2 * 4 * qint64(size.width())), bandRows));
+    }
+
+    Band bands[2];
+    for (Band& b : bands) {
+        b.image = QImage(size.width(), bandRows, QImage::Format_ARGB32_Premultiplied);
+        if (b.image.isNull()) {
+            if (error) *error = QString("%1: out of memory").arg(path);
+            return false;
+        }
+    }
+
+    std::unique_ptr<ImageStreamWriter> writer = ImageStreamWriter::create(format);
+    if (!writer->open(path, size, opt.background.alpha() < 255, error)) return false;
+
+    // Запускает рисование полосы, начинающейся со строки top
+    auto startBand = [&](Band& b, int top) {
+        b.top = top;
+        b.rows = qMin(bandRows, size.height() - top);
+        b.tiles.clear();
+        for (int y = 0; y < b.rows; y += tile) {
+            for (int x = 0; x < size.width(); x += tile) {
+                b.tiles.emplace_back(x, top + y, qMin(tile, size.width() - x), qMin(tile, b.rows - y));
+            }
+        }
+        uchar* bits = b.image.bits(); // Один раз и в этом потоке: bits() может делать detach
+        qsizetype bpl = b.image.bytesPerLine();
+        if (!parallel) {
+            for (const QRect& r : b.tiles) renderBandTile(bits, bpl, top, r);
+            return QFuture<void>();
+        }
+        return QtConcurrent::map(b.tiles, [&renderBandTile, bits, bpl, top](QRect& r) {
+            renderBandTile(bits, bpl, top, r);
+        });
+    };
+
+    int current = 0;
+    QFuture<void> rendering = startBand(bands[current], 0);
+    for (int top = 0; top < size.height(); top += bandRows) {
+        rendering.waitForFinished();
+        const Band& done = bands[current];
+        current ^= 1;
+        if (top + bandRows < size.height()) {
+            rendering = startBand(bands[current], top + bandRows);
+        }
+        bool written;
+        {
+            BSG_TRACE_SCOPE("exportWrite", "export");
+            written = writer->writeRows(done.image, done.rows, error);
+        }
+        if (!written) {
+            rendering.waitForFinished(); // Полоса рисуется в наш буфер
+            return false;
+        }
+    }
+    return writer->finish(error);
+}
+
+} // namespace
+
+namespace SceneExport {
+
+/**
+ * @brief Рисует все фигуры документа в порядке наложения.
+ */
+void drawDocument(QPainter* p, const Document& doc) {
+    std::vector<int> order(doc.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    ShapeRenderer renderer; // Свой на каждый вызов - можно рисовать из разных потоков
+    renderer.drawShapes(p, doc, order);
+}
+
+/**
+ * @brief Экспортируемая область: границы фигур плюс поля.
+ */
+QRectF exportArea(const Document& doc, const ExportOptions& opt) {
+    return exportArea(doc.getExtent(), opt);
+}
+
+/**
+ * @brief Экспортируемая область по границам фигур (пустые - точка в нуле).
+ */
+QRectF exportArea(const QRectF& extent, const ExportOptions& opt) {
+    QRectF area = extent.isNull() ? QRectF(0, 0, 1, 1) : extent;
+    return area.adjusted(-opt.margin, -opt.margin, opt.margin, opt.margin);
+}
+
+/**
+ * @brief Рисует документ в QImage (без окна и без виджетов).
+ *
+ * Если сцена не влезает в maxSize, масштаб уменьшается.
+ */
+QImage renderImage(const Document& doc, const ExportOptions& opt) {
+    QRectF area = exportArea(doc, opt);
+    qreal scale = opt.scale > 0 ? opt.scale : 1.0;
+    qreal side = qMax(area.width(), area.height()) * scale;
+    if (opt.maxSize > 0 && side > opt.maxSize) {
+        scale *= opt.maxSize / side;
+    }
+
+    QSize size(qMax(1, qCeil(area.width() * scale)), qMax(1, qCeil(area.height() * scale)));
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    if (image.isNull()) return image; // Не хватило памяти
+    image.fill(opt.background);
+
+    QPainter p(&image);
+    p.setRenderHint(QPainter::Antialiasing);
+    p.scale(scale, scale);
+    p.translate(-area.topLeft());
+    drawDocument(&p, doc);
+    return image;
+}
+
+/**
+ * @brief Сохраняет документ в PNG.
+ */
+bool savePng(const Document& doc, const QString& path, const ExportOptions& opt, QString* error) {
+    QImage image = renderImage(doc, opt);
+    if (image.isNull()) {
+        if (error) *error = QString("%1: image is too large").arg(path);
+        return false;
+    }
+    if (!image.save(path, "PNG")) {
+        if (error) *error = QString("Cannot write %1").arg(path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Сохраняет документ в SVG (векторно, в координатах документа).
+ */
+bool saveSvg(const Document& doc, const QString& path, const ExportOptions& opt, QString* error) {
+    QRectF area = exportArea(doc, opt);
+    qreal scale = opt.scale > 0 ? opt.scale : 1.0;
+
+    QSvgGenerator gen;
+    gen.setFileName(path);
+    gen.setSize(QSize(qCeil(area.width() * scale), qCeil(area.height() * scale)));
+    gen.setViewBox(area);
+
+    QPainter p;
+    if (!p.begin(&gen)) {
+        if (error) *error = QString("Cannot write %1").arg(path);
+        return false;
+    }
+    if (opt.background.alpha() > 0) {
+        p.fillRect(area, opt.background);
+    }
+    p.setRenderHint(QPainter::Antialiasing);
+    drawDocument(&p, doc);
+    if (!p.end()) {
+        if (error) *error = QString("Cannot write %1").arg(path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Тайловый экспорт с потоковой записью (PNG, TIFF, raw).
+ *
+ * Тайлы рисуются параллельно; каждый берет из пространственного
+ * индекса только свои фигуры.
+ */
+bool saveTiled(const Document& doc, const QString& path, const ExportOptions& opt, QString* error) {
+    QRectF area = exportArea(doc, opt);
+    qreal scale = opt.scale > 0 ? opt.scale : 1.0;
+    const QColor background = opt.background;
+    qreal margin = doc.getStyles().getMaxStrokeWidth() / 2;
+    auto draw = [&doc](QPainter& p, const QRectF& world) {
+        std::vector<int> order;
+        doc.query(world, [&](ShapeId id) { order.push_back(doc.slotOf(id)); });
+        if (order.empty()) return;
+        std::sort(order.begin(), order.end());
+        ShapeRenderer renderer;
+        renderer.drawShapes(&p, doc, order);
+    };
+    return streamTiles(area, path, opt, true, 0, [&](uchar* bits, qsizetype bpl, int top, const QRect& r) {
+        renderTile(bits, bpl, top, r, area, scale, background, margin, draw);
+    }, error);
+}
+
+/**
+ * @brief Тайловый экспорт страничного документа.
+ *
+ * Тайлы рисуются по очереди: запрос к PagedDocument читает и вытесняет
+ * страницы. Полосы идут сверху вниз, поэтому страницы соседних тайлов
+ * обычно еще в кэше. Фигуры тайла копируются (страница может уйти из
+ * памяти до конца запроса) и сортируются по id - это порядок наложения.
+ *
+ * Все укладывается в лимит памяти документа: на время экспорта кэш
+ * страниц уступает по 1/8 лимита полосам и копиям фигур. Тайл, фигур
+ * которого больше своей доли, делится на сетку частей по числу
+ * найденных фигур (обычно хватает одного деления, то есть одного
+ * повторного запроса); каждая часть рисуется в свой прямоугольник, так
+ * что картинка та же. Пиксель делить некуда: в нем рисуются верхние
+ * maxShapes фигур (с наибольшими id); нижние под таким числом фигур
+ * в одном пикселе почти не видны.
+ */
+bool saveTiled(PagedDocument& doc, const QString& path, const ExportOptions& opt, QString* error) {
+    BSG_TRACE_SCOPE("pagedExport", "export");
+    QRectF area = exportArea(doc.getExtent(), opt);
+    qreal scale = opt.scale > 0 ? opt.scale : 1.0;
+    const QColor background = opt.background;
+    qreal margin = doc.getStyles().getMaxStrokeWidth() / 2;
+
+    doc.clearLastError(); // Ошибка прошлой работы с документом - не ошибка экспорта
+    const qint64 limit = doc.getMemoryLimit();
+    const qint64 bandBytes = limit / PAGED_BAND_SHARE;
+    const size_t maxShapes = size_t(qMax<qint64>(1, limit / PAGED_LIST_SHARE / PAGED_SHAPE_BYTES));
+    doc.setMemoryLimit(limit - bandBytes - limit / PAGED_LIST_SHARE);
+
+    // Буферы общие для всех тайлов: рисование последовательное
+    std::vector<PagedShape> found;
+    std::vector<QPoint> route;
+    ShapeList list;
+    ShapeRenderer renderer;
+    bool pixel = false;    // Тайл в пиксель: делить дальше некуда
+    bool overflow = false; // Фигур тайла больше maxShapes - нарисован не целиком
+    size_t hits = 0;       // Сколько фигур нашел запрос (и при переполнении)
+    auto byId = [](const PagedShape& a, const PagedShape& b) { return a.id < b.id; };
+    auto upperFirst = [](const PagedShape& a, const PagedShape& b) { return a.id > b.id; };
+    auto draw = [&](QPainter& p, const QRectF& world) {
+        found.clear();
+        overflow = false;
+        hits = 0;
+        doc.query(world, [&](const PagedShape& s) {
+            ++hits;
+            if (found.size() < maxShapes) {
+                found.push_back(s);
+                if (pixel) std::push_heap(found.begin(), found.end(), upperFirst);
+            } else if (!pixel) {
+                overflow = true;
+            } else if (s.id > found.front().id) {
+                // Куча с самой нижней фигурой сверху: она уступает место
+                std::pop_heap(found.begin(), found.end(), upperFirst);
+                found.back() = s;
+                std::push_heap(found.begin(), found.end(), upperFirst);
+            }
+        });
+        if (found.empty() || overflow) return;
+        std::sort(found.begin(), found.end(), byId);
+        list.clear();
+        for (const PagedShape& s : found) {
+            if (s.type == ShapeType::Connector) {
+                Geometry::elbowRoute(s.p1, s.fromPort, s.p2, s.toPort, CONNECTOR_STUB, route);
+                list.append(s.type, s.p1, s.p2, s.style, route.data(), (int)route.size(), s.label);
+            } else {
+                list.append(s.type, s.p1, s.p2, s.style, nullptr, 0, s.label);
+            }
+        }
+        renderer.drawShapes(&p, doc.getStyles(), list);
+    };
+    // Переполненный тайл - сеткой примерно по hits / maxShapes частей;
+    // части рисуются заново
+    std::vector<QRect> pieces;
+    auto renderPieces = [&](uchar* bits, qsizetype bpl, int top, const QRect& r) {
+        pieces.assign(1, r);
+        while (!pieces.empty()) {
+            QRect piece = pieces.back();
+            pieces.pop_back();
+            pixel = piece.width() == 1 && piece.height() == 1;
+            renderTile(bits, bpl, top, piece, area, scale, background, margin, draw);
+            if (!overflow) continue;
+            int side = qCeil(qSqrt(double(hits) / double(maxShapes))); // Не меньше 2: hits > maxShapes
+            int cols = qBound(1, side, piece.width());
+            int rows = qBound(1, side, piece.height());
+            for (int row = 0; row < rows; ++row) {
+                int y0 = piece.top() + piece.height() * row / rows;
+                int y1 = piece.top() + piece.height() * (row + 1) / rows;
+                for (int col = 0; col < cols; ++col) {
+                    int x0 = piece.left() + piece.width() * col / cols;
+                    int x1 = piece.left() + piece.width() * (col + 1) / cols;
+                    pieces.emplace_back(x0, y0, x1 - x0, y1 - y0);
+                }
+            }
+        }
+    };
+    bool ok = streamTiles(area, path, opt, false, bandBytes, renderPieces, error);
+    doc.setMemoryLimit(limit);
+    if (ok && !doc.getLastError().isEmpty()) { // Страница не прочиталась - картинка неполная
+        if (error) *error = doc.getLastError();
+        return false;
+    }
+    return ok;
+}
+
+}
@@ -0,0 +1,49 @@
+#include "selectionset.h"
+
+/**
+ * @brief Добавляет фигуру в выделение.
+ */
+bool SelectionSet::insert(ShapeId id) {
+    if (id < 0 || contains(id)) return false;
+    if (id >= (int)position.size()) {
+        position.resize(id + 1, -1);
+    }
+    position[id] = (int)members.size();
+    members.push_back(id);
+    ++version;
+    return true;
+}
+
+/**
+ * @brief Убирает фигуру из выделения (O(1): последний элемент встает на ее место).
+ */
+bool SelectionSet::remove(ShapeId id) {
+    if (!contains(id)) return false;
+    int pos = position[id];
+    ShapeId last = members.back();
+    members[pos] = last;
+    position[last] = pos;
+    members.pop_back();
+    position[id] = -1;
+    ++version;
+    return true;
+}
+
+/**
+ * @brief Переключает выделение фигуры.
+ */
+bool SelectionSet::toggle(ShapeId id) {
+    if (remove(id)) return false;
+    return insert(id);
+}
+
+/**
+ * @brief Снимает выделение. Трогает только выделенные элементы.
+ */
+void SelectionSet::clear() {
+    if (!members.empty()) ++version;
+    for (ShapeId id : members) {
+        position[id] = -1;
+    }
+    members.clear();
+}
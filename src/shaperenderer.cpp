@@ -0,0 +1,297 @@
+#include "shaperenderer.h"
+#include <QtMath>
+
+const int LABEL_PADDING = 4;        // Текст блока отступает от рамки
+const int LABEL_CONNECTOR_WIDTH = 160; // Поле надписи у начала связи
+const int ELLIPSE_MAX_SEGMENTS = 32;   // Отрезков в самом крупном пакетном эллипсе
+
+//==================================================================
+// 1. Public-функции
+//==================================================================
+
+/**
+ * @brief Рисует фигуры пакетами, сгруппированными по стилю и типу.
+ */
+void ShapeRenderer::drawShapes(QPainter* p, const Document& doc, const int* order, int count) {
+    const StyleTable& styles = doc.getStyles();
+    begin(p, styles);
+    bool labels = doc.getLabelCount() > 0;
+    for (int i = 0; i < count; ++i) {
+        int slot = order[i];
+        ShapeType type = doc.typeAt(slot);
+        const QString* label = nullptr;
+        if (labels) {
+            const QString& text = doc.getLabel(doc.idAt(slot));
+            if (!text.isEmpty()) label = &text;
+        }
+        if (type == ShapeType::Connector) {
+            const std::vector<QPoint>& route = doc.getRoute(doc.idAt(slot));
+            add(p, styles, type, doc.p1At(slot), doc.p2At(slot), doc.styleAt(slot),
+                route.data(), (int)route.size(), label);
+        } else {
+            add(p, styles, type, doc.p1At(slot), doc.p2At(slot), doc.styleAt(slot), nullptr, 0, label);
+        }
+    }
+    flush(p, styles);
+}
+
+/**
+ * @brief Рисует снимок фигур (тоже пакетами), например в потоке рендера.
+ */
+void ShapeRenderer::drawShapes(QPainter* p, const StyleTable& styles, const ShapeList& shapes) {
+    begin(p, styles);
+    size_t nextLabel = 0;
+    for (int i = 0; i < shapes.size(); ++i) {
+        int routeBegin = i ? shapes.routeEnds[i - 1] : 0;
+        const QString* label = nullptr;
+        if (nextLabel < shapes.labels.size() && shapes.labels[nextLabel].first == i) {
+            label = &shapes.labels[nextLabel++].second;
+        }
+        add(p, styles, shapes.types[i], shapes.p1s[i], shapes.p2s[i], shapes.styles[i],
+            shapes.routePoints.data() + routeBegin, shapes.routeEnds[i] - routeBegin, label);
+    }
+    flush(p, styles);
+}
+
+/**
+ * @brief Задает пороги упрощения (в единицах документа, 0 - без упрощения).
+ */
+void ShapeRenderer::setDetailLimits(qreal splat, qreal box, qreal text) {
+    splatSize = splat;
+    boxSize = box;
+    textSize = text;
+}
+
+//==================================================================
+// 2. Private-функции
+//==================================================================
+
+/**
+ * @brief Готовит группы к новому проходу.
+ */
+void ShapeRenderer::begin(QPainter* p, const StyleTable& styles) {
+    if ((int)buckets.size() < styles.size()) {
+        buckets.resize(styles.size());
+    }
+    pixelScale = qSqrt(qAbs(p->worldTransform().determinant()));
+    if (font.pixelSize() != LABEL_FONT_SIZE) font.setPixelSize(LABEL_FONT_SIZE);
+    haveLast = false;
+}
+
+/**
+ * @brief Кладет фигуру в группу ее стиля.
+ *
+ * Маршрут связи (route) идет в группу отрезками, как линии. Надпись
+ * блока центрируется в нем (у ромба - во вписанном прямоугольнике),
+ * надпись связи ставится у ее начала.
+ */
+void ShapeRenderer::add(QPainter* p, const StyleTable& styles, ShapeType type,
+                        const QPoint& p1, const QPoint& p2, StyleIndex st,
+                        const QPoint* route, int routeSize, const QString* label) {
+    if (st >= buckets.size()) st = 0;
+
+    // Чем фигура будет нарисована: упрощение мелких фигур - точка вместо
+    // фигуры, рамка вместо эллипса и ромба
+    Primitive primitive;
+    int size = qMax(qAbs(p2.x() - p1.x()), qAbs(p2.y() - p1.y()));
+    if (boxSize > 0 && size < splatSize) {
+        primitive = Primitive::Splat;
+    } else if (boxSize > 0 && size < boxSize && (type == ShapeType::Circle || type == ShapeType::Diamond)) {
+        primitive = Primitive::Rect;
+    } else {
+        switch (type) {
+        case ShapeType::Rectangle: primitive = Primitive::Rect; break;
+        case ShapeType::Circle: primitive = Primitive::Ellipse; break;
+        case ShapeType::Diamond: primitive = Primitive::Diamond; break;
+        default: primitive = Primitive::Line; break;
+        }
+    }
+    bool simplified = primitive == Primitive::Splat || (primitive == Primitive::Rect && type != ShapeType::Rectangle);
+    bool labeled = !simplified && label && textSize <= LABEL_FONT_SIZE && type != ShapeType::Line;
+
+    // Рядом заливка: группа рисуется по видам примитивов и надписи в
+    // конце, поэтому при смене стиля, вида или после фигуры с надписью
+    // сначала рисуем все накопленное, иначе нарушится порядок наложения
+    if (haveLast && (styles.isFilled(st) || styles.isFilled(last)) &&
+        (st != last || primitive != lastPrimitive || lastLabeled)) {
+        flush(p, styles);
+    }
+    haveLast = true;
+    last = st;
+    lastPrimitive = primitive;
+    lastLabeled = labeled;
+
+    Bucket& b = buckets[st];
+    if (!b.pending) {
+        b.pending = true;
+        pending.push_back(st);
+    }
+
+    QRect rect(p1, QSize(p2.x() - p1.x(), p2.y() - p1.y()));
+
+    if (primitive == Primitive::Splat) {
+        b.splats.emplace_back((p1.x() + p2.x()) / 2.0, (p1.y() + p2.y()) / 2.0);
+        return;
+    }
+    if (simplified) {
+        b.rects.push_back(rect);
+        return;
+    }
+
+    if (labeled) {
+        if (type == ShapeType::Connector) {
+            QPoint at = routeSize > 0 ? route[0] : p1;
+            b.texts.push_back(Text{QRect(at.x() + LABEL_PADDING, at.y() + LABEL_PADDING / 2,
+                                         LABEL_CONNECTOR_WIDTH, LABEL_FONT_SIZE + LABEL_PADDING),
+                                   Qt::AlignLeft | Qt::AlignTop, label});
+        } else {
+            QRect r = rect.normalized();
+            int dx = type == ShapeType::Diamond ? r.width() / 4 : LABEL_PADDING;
+            int dy = type == ShapeType::Diamond ? r.height() / 4 : LABEL_PADDING;
+            b.texts.push_back(Text{r.adjusted(dx, dy, -dx, -dy), Qt::AlignCenter | Qt::TextWordWrap, label});
+        }
+    }
+
+    switch (type) {
+    case ShapeType::Line: b.lines.emplace_back(p1, p2); break;
+    case ShapeType::Rectangle: b.rects.push_back(rect); break;
+    case ShapeType::Circle: addEllipse(b, styles.getPen(st), styles.isFilled(st), rect); break;
+    case ShapeType::Diamond: b.diamonds.push_back(rect); break;
+    case ShapeType::Connector:
+        if (routeSize < 2) {
+            b.lines.emplace_back(p1, p2);
+            break;
+        }
+        for (int k = 1; k < routeSize; ++k) b.lines.emplace_back(route[k - 1], route[k]);
+        break;
+    }
+}
+
+/**
+ * @brief Кладет эллипс в группу: мелкий контурный - отрезками, иначе целиком.
+ *
+ * Число отрезков растет с экранным радиусом (8, 16 или 32), так что
+ * отклонение от настоящей кривой меньше пятой доли пикселя. Пунктир
+ * на отрезках начинался бы заново, поэтому такие стили не дробятся.
+ */
+void ShapeRenderer::addEllipse(Bucket& b, const QPen& pen, bool filled, const QRect& rect) {
+    qreal radius = qMax(qAbs(rect.width()), qAbs(rect.height())) * pixelScale / 2;
+    if (filled || pen.style() != Qt::SolidLine || radius * 2 > ELLIPSE_BATCH_PIXELS) {
+        b.ellipses.push_back(rect);
+        return;
+    }
+
+    // Единичная окружность считается один раз
+    struct UnitCircle {
+        QPointF points[ELLIPSE_MAX_SEGMENTS];
+        UnitCircle() {
+            for (int i = 0; i < ELLIPSE_MAX_SEGMENTS; ++i) {
+                qreal a = 2 * M_PI * i / ELLIPSE_MAX_SEGMENTS;
+                points[i] = QPointF(qCos(a), qSin(a));
+            }
+        }
+    };
+    static const UnitCircle unit;
+
+    int step = radius < 4 ? 4 : radius < 16 ? 2 : 1;
+    QRectF r(rect);
+    QPointF c = r.center();
+    qreal rx = r.width() / 2, ry = r.height() / 2;
+    QPointF prev(c.x() + rx, c.y());
+    for (int i = step; i <= ELLIPSE_MAX_SEGMENTS; i += step) {
+        const QPointF& u = unit.points[i % ELLIPSE_MAX_SEGMENTS];
+        QPointF next(c.x() + u.x() * rx, c.y() + u.y() * ry);
+        b.curves.emplace_back(prev, next);
+        prev = next;
+    }
+}
+
+/**
+ * @brief Рисует все накопленные группы и очищает их (память сохраняется).
+ */
+void ShapeRenderer::flush(QPainter* p, const StyleTable& styles) {
+    for (StyleIndex st : pending) {
+        Bucket& b = buckets[st];
+        p->setPen(styles.getPen(st));
+        p->setBrush(styles.getBrush(st));
+
+        if (!b.lines.empty()) p->drawLines(b.lines.data(), (int)b.lines.size());
+        if (!b.rects.empty()) p->drawRects(b.rects.data(), (int)b.rects.size());
+        if (!b.curves.empty()) p->drawLines(b.curves.data(), (int)b.curves.size());
+        for (const QRect& r : b.ellipses) p->drawEllipse(r);
+        for (const QRect& r : b.diamonds) {
+            QPoint c = r.center();
+            const QPoint corners[4] = {QPoint(c.x(), r.top()), QPoint(r.right(), c.y()),
+                                       QPoint(c.x(), r.bottom()), QPoint(r.left(), c.y())};
+            p->drawConvexPolygon(corners, 4);
+        }
+        if (!b.texts.empty()) {
+            p->setFont(font);
+            for (const Text& t : b.texts) p->drawText(t.rect, t.flags, *t.text);
+        }
+        if (!b.splats.empty()) {
+            p->setPen(styles.getPointPen(st));
+            p->drawPoints(b.splats.data(), (int)b.splats.size());
+        }
+
+        b.lines.clear();
+        b.rects.clear();
+        b.ellipses.clear();
+        b.curves.clear();
+        b.diamonds.clear();
+        b.texts.clear();
+        b.splats.clear();
+        b.pending = false;
+    }
+    pending.clear();
+}
+
+//==================================================================
+// 3. ShapeList
+//==================================================================
+
+/**
+ * @brief Очищает список (память сохраняется для следующего снимка).
+ */
+void ShapeList::clear() {
+    types.clear();
+    p1s.clear();
+    p2s.clear();
+    styles.clear();
+    routePoints.clear();
+    routeEnds.clear();
+    labels.clear();
+}
+
+/**
+ * @brief Копирует в конец списка фигуру из слота документа.
+ */
+void ShapeList::append(const Document& doc, int slot) {
+    types.push_back(doc.typeAt(slot));
+    p1s.push_back(doc.p1At(slot));
+    p2s.push_back(doc.p2At(slot));
+    styles.push_back(doc.styleAt(slot));
+    if (types.back() == ShapeType::Connector) {
+        const std::vector<QPoint>& route = doc.getRoute(doc.idAt(slot));
+        routePoints.insert(routePoints.end(), route.begin(), route.end());
+    }
+    routeEnds.push_back((int)routePoints.size());
+    if (doc.getLabelCount() > 0) {
+        const QString& label = doc.getLabel(doc.idAt(slot));
+        if (!label.isEmpty()) labels.emplace_back(size() - 1, label);
+    }
+}
+
+/**
+ * @brief Копирует в конец списка фигуру, заданную полями.
+ */
+void ShapeList::append(ShapeType type, const QPoint& p1, const QPoint& p2, StyleIndex style,
+                       const QPoint* route, int routeSize, const QString& label) {
+    types.push_back(type);
+    p1s.push_back(p1);
+    p2s.push_back(p2);
+    styles.push_back(style);
+    if (route) routePoints.insert(routePoints.end(), route, route + routeSize);
+    routeEnds.push_back((int)routePoints.size());
+    if (!label.isEmpty()) labels.emplace_back(size() - 1, label);
+}
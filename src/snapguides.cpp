@@ -0,0 +1,166 @@
+#include "snapguides.h"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+namespace {
+
+/**
+ * @brief Линии выравнивания прямоугольника по одной оси: начало, центр, конец.
+ */
+void alignLines(qreal from, qreal to, int out[3]) {
+    out[0] = qRound(from);
+    out[2] = qRound(to);
+    out[1] = (out[0] + out[2]) >> 1; // Сдвиг - округление вниз и для отрицательных
+}
+
+} // namespace
+
+//==================================================================
+// 1. Построение
+//==================================================================
+
+/**
+ * @brief Строит индекс по фигурам области.
+ *
+ * Три линии на фигуру по каждой оси, сортировка и слияние одинаковых
+ * координат: O(n log n) на перетаскивание вместо полного прохода на
+ * каждое движение мыши. Если фигур больше maxShapes, берутся ближайшие
+ * к focus (nth_element, линейно) - сортируются только они.
+ */
+void SnapIndex::build(const Document& doc, const QRectF& buildArea, const SelectionSet* excluded,
+                      const QPointF& focus, int maxShapes) {
+    clear();
+    area = buildArea;
+    doc.query(area, [&](ShapeId id) {
+        if (excluded && excluded->contains(id)) return;
+        int slot = doc.slotOf(id);
+        if (doc.typeAt(slot) == ShapeType::Connector) return;
+        QRectF b = doc.boundsAt(slot);
+        QPointF d = b.center() - focus;
+        candidates.push_back(Candidate{d.x() * d.x() + d.y() * d.y(), b});
+    });
+    if (maxShapes >= 0 && (int)candidates.size() > maxShapes) {
+        std::nth_element(candidates.begin(), candidates.begin() + maxShapes, candidates.end(),
+                         [](const Candidate& a, const Candidate& b) { return a.distance < b.distance; });
+        candidates.resize(maxShapes);
+    }
+
+    for (const Candidate& c : candidates) {
+        const QRectF& b = c.bounds;
+        int xs[3], ys[3];
+        alignLines(b.left(), b.right(), xs);
+        alignLines(b.top(), b.bottom(), ys);
+        for (int i = 0; i < 3; ++i) {
+            xLines.push_back(Line{xs[i], ys[0], ys[2]});
+            yLines.push_back(Line{ys[i], xs[0], xs[2]});
+        }
+    }
+    sortAndMerge(xLines);
+    sortAndMerge(yLines);
+}
+
+/**
+ * @brief Очищает индекс, сохраняя память буферов.
+ */
+void SnapIndex::clear() {
+    area = QRectF();
+    candidates.clear();
+    xLines.clear();
+    yLines.clear();
+}
+
+/**
+ * @brief Сортирует линии и сливает совпадающие, объединяя их протяженность.
+ */
+void SnapIndex::sortAndMerge(std::vector<Line>& lines) {
+    std::sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) { return a.coord < b.coord; });
+    size_t out = 0;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (out > 0 && lines[out - 1].coord == lines[i].coord) {
+            lines[out - 1].from = qMin(lines[out - 1].from, lines[i].from);
+            lines[out - 1].to = qMax(lines[out - 1].to, lines[i].to);
+        } else {
+            lines[out++] = lines[i];
+        }
+    }
+    lines.resize(out);
+}
+
+//==================================================================
+// 2. Поиск
+//==================================================================
+
+/**
+ * @brief Ближайшая к любому из values линия в пределах tolerance.
+ *
+ * На каждое значение - один двоичный поиск и проход по линиям окна
+ * [v - tolerance, v + tolerance]. offset - сдвиг значения на линию.
+ */
+const SnapIndex::Line* SnapIndex::nearest(const std::vector<Line>& lines, const int* values, int count,
+                                          int tolerance, int& offset) {
+    const Line* best = nullptr;
+    int bestDistance = INT_MAX;
+    for (int i = 0; i < count; ++i) {
+        int v = values[i];
+        auto it = std::lower_bound(lines.begin(), lines.end(), v - tolerance,
+                                   [](const Line& l, int c) { return l.coord < c; });
+        for (; it != lines.end() && it->coord <= v + tolerance; ++it) {
+            int d = std::abs(it->coord - v);
+            if (d < bestDistance) {
+                bestDistance = d;
+                best = &*it;
+                offset = it->coord - v;
+            }
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Привязывает края и центр прямоугольника к линиям других фигур.
+ *
+ * Направляющая тянется от фигур линии до самого прямоугольника (уже
+ * после привязки по обеим осям).
+ */
+SnapResult SnapIndex::snapRect(const QRectF& rect, int tolerance) const {
+    SnapResult r;
+    int xs[3], ys[3];
+    alignLines(rect.left(), rect.right(), xs);
+    alignLines(rect.top(), rect.bottom(), ys);
+
+    int dx = 0, dy = 0;
+    const Line* lx = nearest(xLines, xs, 3, tolerance, dx);
+    const Line* ly = nearest(yLines, ys, 3, tolerance, dy);
+    r.offset = QPoint(dx, dy);
+    if (lx) {
+        r.snappedX = true;
+        r.guideX = QLine(lx->coord, qMin(lx->from, ys[0] + dy), lx->coord, qMax(lx->to, ys[2] + dy));
+    }
+    if (ly) {
+        r.snappedY = true;
+        r.guideY = QLine(qMin(ly->from, xs[0] + dx), ly->coord, qMax(ly->to, xs[2] + dx), ly->coord);
+    }
+    return r;
+}
+
+/**
+ * @brief Привязывает точку к линиям других фигур по выбранным осям.
+ */
+SnapResult SnapIndex::snapPoint(const QPoint& p, int tolerance, bool alongX, bool alongY) const {
+    SnapResult r;
+    int x = p.x(), y = p.y();
+    int dx = 0, dy = 0;
+    const Line* lx = alongX ? nearest(xLines, &x, 1, tolerance, dx) : nullptr;
+    const Line* ly = alongY ? nearest(yLines, &y, 1, tolerance, dy) : nullptr;
+    r.offset = QPoint(dx, dy);
+    if (lx) {
+        r.snappedX = true;
+        r.guideX = QLine(lx->coord, qMin(lx->from, y + dy), lx->coord, qMax(lx->to, y + dy));
+    }
+    if (ly) {
+        r.snappedY = true;
+        r.guideY = QLine(qMin(ly->from, x + dx), ly->coord, qMax(ly->to, x + dx), ly->coord);
+    }
+    return r;
+}
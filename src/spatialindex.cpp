@@ -0,0 +1,169 @@
+#include "spatialindex.h"
+#include <QtMath> // Для qFloor
+#include <algorithm>
+
+// Фигура, покрывающая больше ячеек, считается "крупной" и
+// хранится в отдельном списке (чтобы не раздувать сетку)
+const int MAX_CELLS_PER_ITEM = 64;
+
+//==================================================================
+// 1. Public-функции
+//==================================================================
+
+/**
+ * @brief Конструктор. cellSize - размер ячейки сетки в пикселях.
+ */
+SpatialIndex::SpatialIndex(int cellSize) : cellSize(qMax(1, cellSize)) {
+}
+
+/**
+ * @brief Полностью очищает индекс.
+ */
+void SpatialIndex::clear() {
+    entries.clear();
+    cells.clear();
+    oversized.clear();
+    count = 0;
+}
+
+/**
+ * @brief Добавляет элемент с указанными границами.
+ */
+void SpatialIndex::insert(int id, const QRectF& bounds) {
+    if (id < 0) return;
+    if (id >= (int)entries.size()) {
+        entries.resize(id + 1);
+    }
+    if (entries[id].used) {
+        unlink(id);
+        --count;
+    }
+
+    Entry& e = entries[id];
+    e.used = true;
+    e.bounds = bounds.normalized();
+    e.cells = cellRange(e.bounds);
+    e.oversized = qint64(e.cells.width()) * e.cells.height() > MAX_CELLS_PER_ITEM;
+    link(id);
+    ++count;
+}
+
+/**
+ * @brief Обновляет границы элемента (после перемещения или ресайза).
+ */
+void SpatialIndex::update(int id, const QRectF& bounds) {
+    if (!contains(id)) {
+        insert(id, bounds);
+        return;
+    }
+
+    Entry& e = entries[id];
+    QRectF b = bounds.normalized();
+    QRect newCells = cellRange(b);
+    bool newOversized = qint64(newCells.width()) * newCells.height() > MAX_CELLS_PER_ITEM;
+
+    // Частый случай: фигура сдвинулась в пределах тех же ячеек
+    if (newCells == e.cells && newOversized == e.oversized) {
+        e.bounds = b;
+        return;
+    }
+
+    unlink(id);
+    e.bounds = b;
+    e.cells = newCells;
+    e.oversized = newOversized;
+    link(id);
+}
+
+/**
+ * @brief Удаляет элемент из индекса.
+ */
+void SpatialIndex::remove(int id) {
+    if (!contains(id)) return;
+    unlink(id);
+    entries[id] = Entry();
+    --count;
+}
+
+/**
+ * @brief Проверяет, зарегистрирован ли элемент в индексе.
+ */
+bool SpatialIndex::contains(int id) const {
+    return id >= 0 && id < (int)entries.size() && entries[id].used;
+}
+
+//==================================================================
+// 2. Private-функции
+//==================================================================
+
+/**
+ * @brief Упаковывает координаты ячейки в ключ хеш-таблицы.
+ */
+quint64 SpatialIndex::cellKey(int cx, int cy) {
+    return (quint64(quint32(cx)) << 32) | quint64(quint32(cy));
+}
+
+/**
+ * @brief Вычисляет диапазон ячеек (включительно), которые покрывает прямоугольник.
+ */
+QRect SpatialIndex::cellRange(const QRectF& r) const {
+    int x0 = qFloor(r.left() / cellSize);
+    int y0 = qFloor(r.top() / cellSize);
+    int x1 = qFloor(r.right() / cellSize);
+    int y1 = qFloor(r.bottom() / cellSize);
+    return QRect(QPoint(x0, y0), QPoint(x1, y1));
+}
+
+/**
+ * @brief Проверка пересечения с учетом границ.
+ *
+ * В отличие от QRectF::intersects, работает и для вырожденных
+ * прямоугольников (горизонтальная или вертикальная линия).
+ */
+bool SpatialIndex::touches(const QRectF& a, const QRectF& b) {
+    return a.left() <= b.right() && b.left() <= a.right() &&
+           a.top() <= b.bottom() && b.top() <= a.bottom();
+}
+
+/**
+ * @brief Регистрирует элемент в ячейках сетки (или в списке крупных).
+ */
+void SpatialIndex::link(int id) {
+    const Entry& e = entries[id];
+    if (e.oversized) {
+        oversized.push_back(id);
+        return;
+    }
+    for (int cy = e.cells.top(); cy <= e.cells.bottom(); ++cy) {
+        for (int cx = e.cells.left(); cx <= e.cells.right(); ++cx) {
+            cells[cellKey(cx, cy)].push_back(id);
+        }
+    }
+}
+
+/**
+ * @brief Убирает элемент из ячеек сетки (или из списка крупных).
+ */
+void SpatialIndex::unlink(int id) {
+    auto eraseFrom = [id](std::vector<int>& ids) {
+        auto it = std::find(ids.begin(), ids.end(), id);
+        if (it != ids.end()) {
+            *it = ids.back(); // Порядок не важен - удаляем за O(1)
+            ids.pop_back();
+        }
+    };
+
+    const Entry& e = entries[id];
+    if (e.oversized) {
+        eraseFrom(oversized);
+        return;
+    }
+    for (int cy = e.cells.top(); cy <= e.cells.bottom(); ++cy) {
+        for (int cx = e.cells.left(); cx <= e.cells.right(); ++cx) {
+            auto it = cells.find(cellKey(cx, cy));
+            if (it == cells.end()) continue;
+            eraseFrom(it->second);
+            if (it->second.empty()) cells.erase(it);
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#include "styletable.h"
+#include <QDebug>
+#include <limits>
+
+/**
+ * @brief Конструктор. Регистрирует стиль по умолчанию (индекс 0).
+ */
+StyleTable::StyleTable() {
+    clear();
+}
+
+/**
+ * @brief Возвращает индекс стиля, добавляя его в таблицу при необходимости.
+ *
+ * Стилей на схеме обычно единицы, поэтому хватает линейного поиска.
+ */
+StyleIndex StyleTable::intern(const ShapeStyle& style) {
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].style == style) return StyleIndex(i);
+    }
+
+    if (entries.size() > std::numeric_limits<StyleIndex>::max()) {
+        qWarning() << "StyleTable: too many styles, falling back to default";
+        return 0;
+    }
+
+    Entry e;
+    e.style = style;
+    e.pen = QPen(style.stroke, style.strokeWidth, style.strokeStyle);
+    e.brush = (style.fill.alpha() == 0) ? QBrush(Qt::NoBrush) : QBrush(style.fill);
+    e.pointPen = QPen(style.stroke, 0); // 0 = косметическое перо в 1 пиксель
+    entries.push_back(e);
+    maxStrokeWidth = qMax(maxStrokeWidth, style.strokeWidth);
+    return StyleIndex(entries.size() - 1);
+}
+
+/**
+ * @brief Очищает таблицу, оставляя только стиль по умолчанию.
+ */
+void StyleTable::clear() {
+    entries.clear();
+    maxStrokeWidth = 0;
+    intern(ShapeStyle());
+}
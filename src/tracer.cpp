@@ -0,0 +1,143 @@
+#include "tracer.h"
+#include <QSaveFile>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+const quint64 RING_CAPACITY = 1 << 16; // Событий в буфере (степень двойки)
+
+// Ячейка кольцевого буфера. seq: 2i+1 - пишется событие i, 2i+2 - готово.
+// Поля атомарны (relaxed), чтобы чтение во время записи не было гонкой
+struct Slot {
+    std::atomic<quint64> seq{0};
+    std::atomic<const char*> name{nullptr};
+    std::atomic<const char*> category{nullptr};
+    std::atomic<qint64> start{0};
+    std::atomic<qint64> duration{0};
+    std::atomic<quint32> thread{0};
+};
+
+std::unique_ptr<Slot[]> ringStorage;
+std::atomic<Slot*> ring{nullptr};  // Создается при первом включении
+std::once_flag ringOnce;
+qint64 origin = 0;                 // Время первого включения - ноль шкалы
+std::atomic<quint64> head{0};      // Номер следующего события
+std::atomic<quint32> nextThread{1};
+
+quint32 threadNumber() {
+    thread_local quint32 number = nextThread.fetch_add(1, std::memory_order_relaxed);
+    return number;
+}
+
+} // namespace
+
+namespace Trace {
+
+std::atomic<bool> active{false};
+
+/**
+ * @brief Включает или выключает запись событий.
+ */
+void setEnabled(bool enabled) {
+    if (enabled) {
+        std::call_once(ringOnce, [] {
+            ringStorage.reset(new Slot[RING_CAPACITY]);
+            origin = now();
+            ring.store(ringStorage.get(), std::memory_order_release);
+        });
+    }
+    active.store(enabled, std::memory_order_release);
+}
+
+/**
+ * @brief Забывает все записанные события.
+ */
+void clear() {
+    head.store(0, std::memory_order_relaxed);
+    Slot* buffer = ring.load(std::memory_order_acquire);
+    if (!buffer) return;
+    for (quint64 i = 0; i < RING_CAPACITY; ++i) {
+        buffer[i].seq.store(0, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Монотонное время в наносекундах.
+ */
+qint64 now() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Записывает событие в кольцевой буфер (без блокировок).
+ *
+ * При переполнении затираются самые старые события.
+ */
+void record(const char* name, const char* category, qint64 startNs, qint64 endNs) {
+    Slot* buffer = ring.load(std::memory_order_acquire);
+    if (!buffer) return;
+    quint64 i = head.fetch_add(1, std::memory_order_relaxed);
+    Slot& s = buffer[i & (RING_CAPACITY - 1)];
+    s.seq.store(2 * i + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.name.store(name, std::memory_order_relaxed);
+    s.category.store(category, std::memory_order_relaxed);
+    s.start.store(startNs, std::memory_order_relaxed);
+    s.duration.store(endNs - startNs, std::memory_order_relaxed);
+    s.thread.store(threadNumber(), std::memory_order_relaxed);
+    s.seq.store(2 * i + 2, std::memory_order_release);
+}
+
+/**
+ * @brief Сохраняет события буфера в формате Chrome trace-event JSON.
+ *
+ * Можно вызывать при включенной записи: недописанные и затертые во
+ * время чтения ячейки пропускаются.
+ */
+bool exportChromeTrace(const QString& path, QString* error) {
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (error) *error = QString("Cannot write %1: %2").arg(path, file.errorString());
+        return false;
+    }
+
+    QByteArray out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    Slot* buffer = ring.load(std::memory_order_acquire);
+    quint64 end = head.load(std::memory_order_acquire);
+    quint64 begin = end > RING_CAPACITY ? end - RING_CAPACITY : 0;
+    bool first = true;
+    for (quint64 i = begin; buffer && i < end; ++i) {
+        const Slot& s = buffer[i & (RING_CAPACITY - 1)];
+        quint64 seq = s.seq.load(std::memory_order_acquire);
+        if (seq != 2 * i + 2) continue;
+        const char* name = s.name.load(std::memory_order_relaxed);
+        const char* category = s.category.load(std::memory_order_relaxed);
+        qint64 start = s.start.load(std::memory_order_relaxed);
+        qint64 duration = s.duration.load(std::memory_order_relaxed);
+        quint32 thread = s.thread.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.seq.load(std::memory_order_relaxed) != seq) continue; // Затерто во время чтения
+
+        if (!first) out += ",\n";
+        first = false;
+        // Имена - строковые литералы из кода, экранирование не нужно
+        out += QString("{\"name\":\"%1\",\"cat\":\"%2\",\"ph\":\"X\",\"ts\":%3,\"dur\":%4,\"pid\":1,\"tid\":%5}")
+                   .arg(QString::fromLatin1(name), QString::fromLatin1(category))
+                   .arg((start - origin) / 1000.0, 0, 'f', 3)
+                   .arg(duration / 1000.0, 0, 'f', 3)
+                   .arg(thread)
+                   .toLatin1();
+    }
+    out += "\n]}\n";
+
+    if (file.write(out) != out.size() || !file.commit()) {
+        if (error) *error = QString("Cannot write %1: %2").arg(path, file.errorString());
+        return false;
+    }
+    return true;
+}
+
+}
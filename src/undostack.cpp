@@ -0,0 +1,289 @@
+#include "undostack.h"
+#include <algorithm>
+
+//==================================================================
+// 1. Команды
+//==================================================================
+
+/**
+ * @brief Память под текст подписей сохраненных фигур (QString хранит его в куче).
+ */
+static size_t labelBytes(const std::vector<RestoredShape>& shapes) {
+    size_t size = 0;
+    for (const RestoredShape& rs : shapes) size += rs.shape.label.capacity() * sizeof(QChar);
+    return size;
+}
+
+// --- Создание ---
+
+CreateShapeCommand::CreateShapeCommand(ShapeId id, int slot, const Shape& shape)
+    : created{slot, id, shape} {
+    ids.push_back(id);
+}
+
+void CreateShapeCommand::undo(Document& doc) const {
+    doc.removeShapes(ids);
+}
+
+void CreateShapeCommand::redo(Document& doc) const {
+    doc.restoreShapes({created});
+}
+
+size_t CreateShapeCommand::getByteSize() const {
+    return sizeof(*this) + ids.capacity() * sizeof(ShapeId) +
+           created.shape.label.capacity() * sizeof(QChar);
+}
+
+CreateShapesCommand::CreateShapesCommand(std::vector<RestoredShape> createdShapes)
+    : created(std::move(createdShapes)) {
+    ids.reserve(created.size());
+    for (const RestoredShape& rs : created) ids.push_back(rs.id);
+}
+
+void CreateShapesCommand::undo(Document& doc) const {
+    doc.removeShapes(ids);
+}
+
+void CreateShapesCommand::redo(Document& doc) const {
+    doc.restoreShapes(created);
+}
+
+size_t CreateShapesCommand::getByteSize() const {
+    return sizeof(*this) + ids.capacity() * sizeof(ShapeId) +
+           created.capacity() * sizeof(RestoredShape) + labelBytes(created);
+}
+
+// --- Удаление ---
+
+DeleteShapesCommand::DeleteShapesCommand(std::vector<RestoredShape> removedShapes)
+    : removed(std::move(removedShapes)) {
+    ids.reserve(removed.size());
+    for (const RestoredShape& rs : removed) ids.push_back(rs.id);
+}
+
+void DeleteShapesCommand::undo(Document& doc) const {
+    doc.restoreShapes(removed);
+}
+
+void DeleteShapesCommand::redo(Document& doc) const {
+    doc.removeShapes(ids);
+}
+
+size_t DeleteShapesCommand::getByteSize() const {
+    return sizeof(*this) + ids.capacity() * sizeof(ShapeId) +
+           removed.capacity() * sizeof(RestoredShape) + labelBytes(removed);
+}
+
+// --- Перемещение ---
+
+TranslateCommand::TranslateCommand(std::vector<ShapeId> moved, const QPoint& d)
+    : delta(d) {
+    ids = std::move(moved);
+}
+
+void TranslateCommand::undo(Document& doc) const {
+    doc.translateShapes(ids, -delta);
+}
+
+void TranslateCommand::redo(Document& doc) const {
+    doc.translateShapes(ids, delta);
+}
+
+size_t TranslateCommand::getByteSize() const {
+    return sizeof(*this) + ids.capacity() * sizeof(ShapeId);
+}
+
+// --- Ресайз ---
+
+ResizeCommand::ResizeCommand(std::vector<ShapeId> resized, std::vector<QPoint> p1s,
+                             std::vector<QPoint> p2s, const ResizeParams& p)
+    : origP1(std::move(p1s)), origP2(std::move(p2s)), params(p) {
+    ids = std::move(resized);
+}
+
+void ResizeCommand::undo(Document& doc) const {
+    doc.setPoints(ids, origP1, origP2);
+}
+
+void ResizeCommand::redo(Document& doc) const {
+    // Тот же пакетный шаг, что и при перетаскивании - результат совпадает
+    std::vector<ShapeId> live;
+    PackedGeometry orig;
+    live.reserve(ids.size());
+    orig.reserve(ids.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (!doc.contains(ids[i])) continue;
+        live.push_back(ids[i]);
+        orig.append(doc.getType(ids[i]), origP1[i], origP2[i]);
+    }
+
+    std::vector<QPoint> p1s, p2s;
+    Geometry::resizeBatch(orig, params, p1s, p2s);
+    doc.setPoints(live, p1s, p2s);
+}
+
+size_t ResizeCommand::getByteSize() const {
+    return sizeof(*this) + ids.capacity() * sizeof(ShapeId) +
+           (origP1.capacity() + origP2.capacity()) * sizeof(QPoint);
+}
+
+// --- Раскладка ---
+
+LayoutCommand::LayoutCommand(std::vector<ShapeId> blocks, std::vector<QPoint> d,
+                             std::vector<ShapeId> connectors, std::vector<ConnectorLink> before,
+                             std::vector<ConnectorLink> after)
+    : blockCount(blocks.size()), deltas(std::move(d)), oldLinks(std::move(before)),
+      newLinks(std::move(after)) {
+    ids = std::move(blocks);
+    ids.insert(ids.end(), connectors.begin(), connectors.end());
+}
+
+void LayoutCommand::undo(Document& doc) const {
+    apply(doc, -1, oldLinks);
+}
+
+void LayoutCommand::redo(Document& doc) const {
+    apply(doc, 1, newLinks);
+}
+
+/**
+ * @brief Сдвигает блоки на sign * delta и ставит связям порты links.
+ */
+void LayoutCommand::apply(Document& doc, int sign, const std::vector<ConnectorLink>& links) const {
+    for (size_t i = 0; i < blockCount; ++i) doc.translateShape(ids[i], deltas[i] * sign);
+    for (size_t i = blockCount; i < ids.size(); ++i) {
+        doc.setLink(ids[i], links[i - blockCount]);
+        doc.followPorts(ids[i]);
+    }
+}
+
+size_t LayoutCommand::getByteSize() const {
+    return sizeof(*this) + ids.capacity() * sizeof(ShapeId) + deltas.capacity() * sizeof(QPoint) +
+           (oldLinks.capacity() + newLinks.capacity()) * sizeof(ConnectorLink);
+}
+
+// --- Группы ---
+
+/**
+ * @brief Конструктор. ids - все фигуры затронутых групп (для выделения после undo).
+ */
+GroupCommand::GroupCommand(const Document& doc, std::vector<GroupRecord> groups, bool c)
+    : records(std::move(groups)), created(c) {
+    for (const GroupRecord& rec : records) {
+        ids.insert(ids.end(), rec.shapes.begin(), rec.shapes.end());
+        for (GroupId s : rec.subgroups) doc.collectGroupShapes(s, ids);
+    }
+}
+
+void GroupCommand::undo(Document& doc) const {
+    apply(doc, !created, true);
+}
+
+void GroupCommand::redo(Document& doc) const {
+    apply(doc, created, false);
+}
+
+/**
+ * @brief Создает группы заново с прежними id или расформировывает их.
+ *
+ * Отмена идет в обратном порядке: вложенная группа, созданная после
+ * внешней, и расформировывается раньше нее.
+ */
+void GroupCommand::apply(Document& doc, bool add, bool reverse) const {
+    if (add) {
+        std::vector<GroupRecord> ordered(records.begin(), records.end());
+        if (reverse) std::reverse(ordered.begin(), ordered.end());
+        doc.addGroups(ordered);
+    } else {
+        std::vector<GroupId> ordered;
+        ordered.reserve(records.size());
+        for (const GroupRecord& rec : records) ordered.push_back(rec.id);
+        if (reverse) std::reverse(ordered.begin(), ordered.end());
+        doc.removeGroups(ordered);
+    }
+}
+
+size_t GroupCommand::getByteSize() const {
+    size_t size = sizeof(*this) + ids.capacity() * sizeof(ShapeId) +
+                  records.capacity() * sizeof(GroupRecord);
+    for (const GroupRecord& rec : records) {
+        size += rec.shapes.capacity() * sizeof(ShapeId) + rec.subgroups.capacity() * sizeof(GroupId);
+    }
+    return size;
+}
+
+//==================================================================
+// 2. Стек
+//==================================================================
+
+/**
+ * @brief Конструктор. byteLimit - бюджет памяти на всю историю.
+ */
+UndoStack::UndoStack(size_t limit) : byteLimit(limit) {
+}
+
+/**
+ * @brief Добавляет уже примененную команду. Ветка redo отбрасывается.
+ */
+void UndoStack::push(std::unique_ptr<UndoCommand> cmd) {
+    if (!cmd) return;
+    while (commands.size() > done) {
+        bytes -= commands.back()->getByteSize();
+        commands.pop_back();
+    }
+    bytes += cmd->getByteSize();
+    commands.push_back(std::move(cmd));
+    done = commands.size();
+    trim();
+}
+
+/**
+ * @brief Отменяет последнюю команду.
+ */
+bool UndoStack::undo(Document& doc) {
+    if (!canUndo()) return false;
+    commands[--done]->undo(doc);
+    return true;
+}
+
+/**
+ * @brief Повторяет отмененную команду.
+ */
+bool UndoStack::redo(Document& doc) {
+    if (!canRedo()) return false;
+    commands[done++]->redo(doc);
+    return true;
+}
+
+/**
+ * @brief Очищает историю.
+ */
+void UndoStack::clear() {
+    commands.clear();
+    done = 0;
+    bytes = 0;
+}
+
+/**
+ * @brief Меняет бюджет памяти (лишние старые команды сразу выбрасываются).
+ */
+void UndoStack::setByteLimit(size_t limit) {
+    byteLimit = limit;
+    trim();
+}
+
+/**
+ * @brief Выбрасывает самые старые команды, пока история не влезет в бюджет.
+ */
+void UndoStack::trim() {
+    while (bytes > byteLimit && !commands.empty()) {
+        if (done > 0) {
+            bytes -= commands.front()->getByteSize();
+            commands.pop_front();
+            --done;
+        } else {
+            bytes -= commands.back()->getByteSize();
+            commands.pop_back();
+        }
+    }
+}